@@ -20,6 +20,8 @@ namespace patch
 /**
     Allows the caller to supply a custom class which stores copies of pre-compiled
     binaries, so that the compiler can re-use previously compiled chunks of object code.
+    The same cache is also used to store the compiled form of each program, so that
+    reloading a patch whose sources haven't changed doesn't need to re-run the compiler.
 
     An implementation of this class just needs to store key-value chunks of data in
     some kind of files or database, and retrieve them when asked.
@@ -31,6 +31,10 @@ namespace patch
     function using the askHostToReinitialise parameter - the object will
     use its own background thread to recompile the SOUL code, and will use
     this callback to tell the host when its configuration has changed.
+
+    If enableHotSwapping() has been called, then rebuilds which don't change the
+    buses or parameters are swapped in while the processor keeps running, without
+    involving the host at all.
 */
 struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
                                     private juce::Thread,
@@ -70,6 +74,10 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
     ~SOULPatchAudioProcessor() override
     {
         stopThread (100000);
+        newlyBuiltPlayer.take();
+        latestBuild = {};
+        retiringPlayer = {};
+        replacementPlayer = {};
         player = {};
         patch = {};
     }
@@ -107,6 +115,8 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
         description = desc->description;
         showMIDIKeyboard = desc->isInstrument;
 
+        collectNewlyBuiltPlayer();
+
         if (replacementPlayer != nullptr)
         {
             updateLastState();
@@ -114,6 +124,32 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
             player = std::move (replacementPlayer);
             refreshParameterList();
         }
+
+        // The host has stopped the processor, so any hot-swap that's in progress can be abandoned
+        const juce::ScopedLock sl (hotSwapLock);
+        pendingHotSwap = nullptr;
+        fadingOutPlayer = nullptr;
+        retiringPlayer = {};
+        activePlayer = player.get();
+    }
+
+    //==============================================================================
+    /** Enables or disables hot-swapping of rebuilt patches.
+
+        When enabled, a rebuilt player whose buses and parameters match the current one
+        doesn't cause a call to askHostToReinitialise. Instead, its parameters are given
+        the current values, and the audio thread switches over to it at the start of its
+        next block, with a crossfade of the given length from the old player (or a hard
+        switch if the length is zero). The old player is then released by the background
+        thread, so the audio thread never has to delete it.
+
+        Any rebuild that changes the buses or parameters (or that fails to compile) still
+        goes through askHostToReinitialise.
+    */
+    void enableHotSwapping (bool shouldEnable, double crossfadeLengthSeconds = 0.02)
+    {
+        hotSwapCrossfadeSeconds = juce::jmax (0.0, crossfadeLengthSeconds);
+        hotSwapEnabled = shouldEnable;
     }
 
     /** Returns a string containing all the compile messages and warnings, or an empty string if
@@ -244,6 +280,13 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
         setRateAndBufferSizeDetails (sampleRate, maxBlockSize);
         midiKeyboardState.reset();
 
+        // Any hot-swap that was in progress is completed straight away
+        if (pendingHotSwap.exchange (nullptr) != nullptr || fadingOutPlayer != nullptr)
+            hotSwapFinished = true;
+
+        fadingOutPlayer = nullptr;
+        activePlayer = player.get();
+
         if (player != nullptr)
         {
             numPatchInputChannels  = countTotalBusChannels (player->getInputBuses());
@@ -269,6 +312,8 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
             if (numPatchOutputChannels == 2 && pluginBuses.getMainOutputChannels() == 1)
                 postprocessOutputData = stereoToMono;
         }
+
+        crossfadeBuffer.setSize (juce::jmax (1, numPatchOutputChannels, getTotalNumOutputChannels()), maxBlockSize);
     }
 
     void releaseResources() override
@@ -281,6 +326,8 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
 
     void processBlock (juce::AudioBuffer<float>& audio, juce::MidiBuffer& midi) override
     {
+        startPendingHotSwap();
+
         auto numFrames = audio.getNumSamples();
 
         outputBuffer.setSize (juce::jmax (numPatchOutputChannels, getTotalNumOutputChannels()), numFrames, false, false, true);
@@ -289,7 +336,7 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
         inputBuffer.setSize (juce::jmax (numPatchInputChannels, getTotalNumInputChannels()), numFrames, false, false, true);
         inputBuffer.clear();
 
-        if (player != nullptr && player->isPlayable() && (! isSuspended()))
+        if (activePlayer != nullptr && activePlayer->isPlayable() && (! isSuspended()))
         {
             soul::patch::PatchPlayer::RenderContext rc;
 
@@ -342,10 +389,13 @@ struct SOULPatchAudioProcessor    : public juce::AudioPluginInstance,
                 midi.clear();
             }
 
-            auto result = player->render (rc);
+            auto result = activePlayer->render (rc);
             juce::ignoreUnused (result);
             jassert (result == PatchPlayer::RenderResult::ok);
 
+            if (fadingOutPlayer != nullptr)
+                renderHotSwapCrossfade (rc);
+
             if (rc.numMIDIMessagesOut != 0)
             {
                 // The numMIDIMessagesOut value could be greater than the buffer size we provided,
@@ -471,7 +521,49 @@ private:
 
     juce::String name, description;
 
+    //==============================================================================
+    /** Passes a reference to a player from one thread to another through an atomic slot.
+        If a new player is sent before the last one has been taken, the sender releases
+        the old one, so only one thread ever touches each reference.
+    */
+    struct PlayerHandoff
+    {
+        ~PlayerHandoff()    { take(); }
+
+        void send (const soul::patch::PatchPlayer::Ptr& p) noexcept
+        {
+            if (auto old = slot.exchange (p.incrementAndGetPointer()))
+                old->release();
+        }
+
+        soul::patch::PatchPlayer::Ptr take() noexcept
+        {
+            return soul::patch::PatchPlayer::Ptr (slot.exchange (nullptr));
+        }
+
+        std::atomic<soul::patch::PatchPlayer*> slot { nullptr };
+    };
+
+    // player and replacementPlayer are only used on the message thread. The background
+    // thread compares against its own reference to the last player it built, and sends
+    // each new build across through newlyBuiltPlayer.
     soul::patch::PatchPlayer::Ptr player, replacementPlayer;
+    soul::patch::PatchPlayer::Ptr latestBuild;
+    PlayerHandoff newlyBuiltPlayer;
+
+    // The audio thread only renders activePlayer (and fadingOutPlayer during a crossfade).
+    // A hot-swap keeps the old player alive in retiringPlayer until the audio thread has
+    // finished with it, and then the background thread releases it.
+    soul::patch::PatchPlayer* activePlayer = nullptr;
+    soul::patch::PatchPlayer* fadingOutPlayer = nullptr;
+    soul::patch::PatchPlayer::Ptr retiringPlayer;
+    std::atomic<soul::patch::PatchPlayer*> pendingHotSwap { nullptr };
+    std::atomic<bool> hotSwapEnabled { false }, hotSwapFinished { false };
+    std::atomic<double> hotSwapCrossfadeSeconds { 0 };
+    std::atomic<int> pendingCrossfadeLength { 0 };
+    int crossfadeLength = 0, crossfadePosition = 0;
+    juce::AudioBuffer<float> crossfadeBuffer;
+    juce::CriticalSection hotSwapLock;
 
     juce::CriticalSection configLock;
     soul::patch::PatchPlayerConfiguration currentConfig;
@@ -535,37 +627,201 @@ private:
     {
         while (! threadShouldExit())
         {
-            if (replacementPlayer == nullptr)
-            {
-                auto config = getConfigCopy();
+            releaseFinishedHotSwap();
+
+            auto config = getConfigCopy();
 
-                if (config.sampleRate != 0 && config.maxFramesPerBlock != 0)
+            if (config.sampleRate != 0 && config.maxFramesPerBlock != 0)
+            {
+                if (latestBuild == nullptr || latestBuild->needsRebuilding (config))
                 {
-                    if (player == nullptr || player->needsRebuilding (currentConfig))
-                    {
-                        auto newPlayer = soul::patch::PatchPlayer::Ptr (patch->compileNewPlayer (currentConfig, cache.get(),
-                                                                                                 preprocessor.get(), externalData.get(),
-                                                                                                 consoleHandler.get()));
-
-                        if (threadShouldExit())
-                            return;
-
-                        replacementPlayer = newPlayer;
-                        triggerAsyncUpdate();
-                    }
+                    auto newPlayer = soul::patch::PatchPlayer::Ptr (patch->compileNewPlayer (config, cache.get(),
+                                                                                             preprocessor.get(), externalData.get(),
+                                                                                             consoleHandler.get()));
+
+                    if (threadShouldExit())
+                        return;
+
+                    latestBuild = newPlayer;
+                    newlyBuiltPlayer.send (newPlayer);
+                    triggerAsyncUpdate();
                 }
             }
 
-            wait (millisecsBetweenFileChecks);
+            // (while a hot-swap is in progress, this needs to keep checking whether it's finished)
+            wait (isHotSwapInProgress() ? 20 : millisecsBetweenFileChecks);
         }
     }
 
     void handleAsyncUpdate() override
     {
+        collectNewlyBuiltPlayer();
+
+        if (replacementPlayer == nullptr)
+            return;
+
+        if (tryToHotSwap())
+            return;
+
         if (askHostToReinitialise != nullptr)
             askHostToReinitialise();
     }
 
+    void collectNewlyBuiltPlayer()
+    {
+        if (auto newPlayer = newlyBuiltPlayer.take())
+            replacementPlayer = std::move (newPlayer);
+    }
+
+    //==============================================================================
+    bool tryToHotSwap()
+    {
+        auto newPlayer = replacementPlayer;
+
+        if (! hotSwapEnabled || player == nullptr || newPlayer == nullptr
+             || ! player->isPlayable() || ! newPlayer->isPlayable()
+             || ! haveSameBusesAndParameters (*player, *newPlayer))
+            return false;
+
+        const juce::ScopedLock sl (hotSwapLock);
+
+        // If the last swap hasn't finished yet, the background thread will
+        // trigger another attempt once it has
+        if (retiringPlayer != nullptr)
+            return true;
+
+        for (auto& p : newPlayer->getParameters())
+            for (auto& old : player->getParameters())
+                if (p->ID.toString<juce::String>() == old->ID.toString<juce::String>())
+                    p->setValue (old->getValue());
+
+        for (auto* p : getParameters())
+            if (auto patchParam = dynamic_cast<PatchParameter*> (p))
+                for (auto& newParam : newPlayer->getParameters())
+                    if (patchParam->paramID == newParam->ID.toString<juce::String>())
+                        patchParam->retarget (*newParam);
+
+        retiringPlayer = std::move (player);
+        player = std::move (newPlayer);
+        replacementPlayer = {};
+
+        pendingCrossfadeLength = juce::roundToInt (hotSwapCrossfadeSeconds * getConfigCopy().sampleRate);
+        pendingHotSwap = player.get();
+        return true;
+    }
+
+    void startPendingHotSwap()
+    {
+        if (auto newPlayer = pendingHotSwap.exchange (nullptr))
+        {
+            fadingOutPlayer = activePlayer;
+            activePlayer = newPlayer;
+            crossfadeLength = pendingCrossfadeLength;
+            crossfadePosition = 0;
+
+            if (crossfadeLength <= 0 || fadingOutPlayer == nullptr)
+            {
+                fadingOutPlayer = nullptr;
+                hotSwapFinished = true;
+            }
+        }
+    }
+
+    void renderHotSwapCrossfade (soul::patch::PatchPlayer::RenderContext rc)
+    {
+        // The old player keeps running on the same input, but without any MIDI
+        crossfadeBuffer.clear();
+        rc.outputChannels = crossfadeBuffer.getArrayOfWritePointers();
+        rc.numMIDIMessagesIn = 0;
+        rc.maximumMIDIMessagesOut = 0;
+        rc.numMIDIMessagesOut = 0;
+        fadingOutPlayer->render (rc);
+
+        auto numToFade = juce::jmin ((int) rc.numFrames, crossfadeLength - crossfadePosition);
+        auto startGain = (float) crossfadePosition / (float) crossfadeLength;
+        auto endGain   = (float) (crossfadePosition + numToFade) / (float) crossfadeLength;
+
+        for (int i = 0; i < (int) rc.numOutputChannels; ++i)
+        {
+            outputBuffer.applyGainRamp (i, 0, numToFade, startGain, endGain);
+            outputBuffer.addFromWithRamp (i, 0, crossfadeBuffer.getReadPointer (i), numToFade, 1.0f - startGain, 1.0f - endGain);
+        }
+
+        crossfadePosition += numToFade;
+
+        if (crossfadePosition >= crossfadeLength)
+        {
+            fadingOutPlayer = nullptr;
+            hotSwapFinished = true;
+        }
+    }
+
+    bool isHotSwapInProgress() const
+    {
+        const juce::ScopedLock sl (hotSwapLock);
+        return retiringPlayer != nullptr;
+    }
+
+    void releaseFinishedHotSwap()
+    {
+        if (hotSwapFinished.exchange (false))
+        {
+            soul::patch::PatchPlayer::Ptr oldPlayer;
+
+            {
+                const juce::ScopedLock sl (hotSwapLock);
+                oldPlayer = std::move (retiringPlayer);
+            }
+
+            oldPlayer = {};
+
+            // A rebuild may have been waiting for this swap to finish
+            triggerAsyncUpdate();
+        }
+    }
+
+    static bool haveSameBusesAndParameters (soul::patch::PatchPlayer& p1, soul::patch::PatchPlayer& p2)
+    {
+        auto busesMatch = [] (Span<soul::patch::Bus> buses1, Span<soul::patch::Bus> buses2)
+        {
+            if (buses1.size() != buses2.size())
+                return false;
+
+            for (uint32_t i = 0; i < buses1.size(); ++i)
+                if (buses1[i].numChannels != buses2[i].numChannels)
+                    return false;
+
+            return true;
+        };
+
+        auto params1 = p1.getParameters();
+        auto params2 = p2.getParameters();
+
+        if (! (busesMatch (p1.getInputBuses(), p2.getInputBuses())
+                && busesMatch (p1.getOutputBuses(), p2.getOutputBuses())
+                && params1.size() == params2.size()))
+            return false;
+
+        for (uint32_t i = 0; i < params1.size(); ++i)
+            if (getParameterSignature (*params1[i]) != getParameterSignature (*params2[i]))
+                return false;
+
+        return true;
+    }
+
+    static juce::String getParameterSignature (const soul::patch::Parameter& p)
+    {
+        juce::String s;
+
+        s << p.ID.toString<juce::String>() << "|" << p.name.toString<juce::String>() << "|" << p.unit.toString<juce::String>()
+          << "|" << p.minValue << "|" << p.maxValue << "|" << p.step << "|" << p.initialValue;
+
+        for (auto propertyName : p.getPropertyNames())
+            s << "|" << propertyName << "=" << String::Ptr (p.getProperty (propertyName)).toString<juce::String>();
+
+        return s;
+    }
+
     bool isMatchingStateType (const juce::ValueTree& state) const
     {
         return state.hasType (ids.SOULPatch)
@@ -630,6 +886,7 @@ private:
         }
 
         const soul::patch::Parameter::Ptr param;
+        std::atomic<soul::patch::Parameter*> target { param.get() };
         const juce::String unit;
         const juce::StringArray textValues;
         const juce::NormalisableRange<float> range;
@@ -647,19 +904,23 @@ private:
         juce::StringArray getAllValueStrings() const override            { return textValues; }
 
         float getDefaultValue() const override                           { return convertTo0to1 (initialValue); }
-        float getValue() const override                                  { return convertTo0to1 (param->getValue()); }
+        float getValue() const override                                  { return convertTo0to1 (target.load()->getValue()); }
 
         void setValue (float newValue) override
         {
             auto fullRange = convertFrom0to1 (newValue);
+            auto& p = *target.load();
 
-            if (fullRange != param->getValue())
+            if (fullRange != p.getValue())
             {
-                param->setValue (fullRange);
+                p.setValue (fullRange);
                 sendValueChangedMessageToListeners (newValue);
             }
         }
 
+        /** Makes this parameter control a matching parameter in a player that has been hot-swapped in. */
+        void retarget (soul::patch::Parameter& newTarget)                { target = std::addressof (newTarget); }
+
         juce::String getText (float v, int length) const override
         {
             juce::String result;
@@ -14,6 +14,9 @@
 #endif
 
 #include "../API/soul_patch.h"
+#include <list>
+#include <sstream>
+#include <unordered_map>
 
 #if __clang__
  #pragma clang diagnostic push
@@ -29,97 +32,367 @@ namespace patch
 /**
     Implements a simple CompilerCache that stores the cached object code chunks
     as files in a folder.
+
+    The sizes and recency of the entries are tracked in memory, and are kept in a set of
+    append-only index files in the same folder, so the folder only has to be scanned when
+    the cache is first opened. When the number of files or their total size goes over
+    its limit, the least recently used entries are deleted until it's back below about
+    90% of the limit.
+
+    Entries are spread across several shards by key, each with its own lock and index
+    file, so that threads using different keys don't have to wait for each other.
 */
 struct CompilerCacheFolder final  : public CompilerCache
 {
-    /** Creates a cache in the given folder (which must exist!) */
-    CompilerCacheFolder (juce::File cacheFolder, uint32_t maxNumFilesToCache)
-       : folder (std::move (cacheFolder)), maxNumFiles (maxNumFilesToCache)
+    /** Creates a cache in the given folder (which must exist!)
+        If maxTotalSizeInBytes is zero, then only the number of files is limited.
+    */
+    CompilerCacheFolder (juce::File cacheFolder, uint32_t maxNumFilesToCache, uint64_t maxTotalSizeInBytes = 0)
+       : folder (std::move (cacheFolder)), maxNumFiles (maxNumFilesToCache), maxTotalSize (maxTotalSizeInBytes)
     {
-        purgeOldestFiles (maxNumFiles);
+        loadIndex();
+        purgeLeastRecentlyUsed (maxNumFiles, maxTotalSize);
     }
 
-    ~CompilerCacheFolder() = default;
+    ~CompilerCacheFolder()
+    {
+        for (auto& shard : shards)
+        {
+            juce::ScopedLock sl (shard.lock);
+            writePendingRecords (shard);
+        }
+    }
 
     void storeItemInCache (const char* key, const void* sourceData, uint64_t size) override
     {
-        juce::ScopedLock sl (lock);
-        auto file = getFileForKey (key);
-        file.replaceWithData (sourceData, (size_t) size);
-        purgeOldestFiles (maxNumFiles);
+        auto& shard = getShard (key);
+
+        {
+            juce::ScopedLock sl (shard.lock);
+
+            if (auto existing = shard.entries.find (key); existing != shard.entries.end())
+                removeEntry (shard, existing->second, false);
+
+            if (getFileForKey (key).replaceWithData (sourceData, (size_t) size))
+            {
+                auto lastUse = ++lastUseCounter;
+                addEntry (shard, key, size, lastUse);
+                shard.pendingRecords += "S " + std::string (key) + " " + std::to_string (size) + " " + std::to_string (lastUse) + "\n";
+            }
+
+            writePendingRecords (shard);
+        }
+
+        if (isOverLimit (maxNumFiles, maxTotalSize))
+            purgeLeastRecentlyUsed (getLowWaterMark (maxNumFiles), getLowWaterMark (maxTotalSize));
     }
 
     uint64_t readItemFromCache (const char* key, void* destAddress, uint64_t destSize) override
     {
-        juce::ScopedLock sl (lock);
-        auto file = getFileForKey (key);
-        auto fileSize = (uint64_t) file.getSize();
+        auto& shard = getShard (key);
+        juce::ScopedLock sl (shard.lock);
 
-        if (fileSize == 0)
+        auto found = shard.entries.find (key);
+
+        if (found == shard.entries.end())
             return 0;
 
-        if (destAddress == nullptr || destSize < fileSize)
-            return fileSize;
+        auto entry = found->second;
+        auto size = entry->size;
 
-        auto readEntireFile = [&]() -> bool
-        {
-            juce::FileInputStream fin (file);
-            return fin.openedOk() && fin.read (destAddress, (int) fileSize) == (int) fileSize;
-        };
+        if (destAddress == nullptr || destSize < size)
+            return size;
 
-        if (! readEntireFile())
+        if (! readFile (getFileForKey (key), destAddress, size))
+        {
+            removeEntry (shard, entry, true);
             return 0;
+        }
+
+        // Rather than touching the file, each read just adds a record to the index,
+        // and these get written out in batches
+        entry->lastUse = ++lastUseCounter;
+        shard.lruOrder.splice (shard.lruOrder.end(), shard.lruOrder, entry);
+        shard.pendingRecords += "R " + std::string (key) + " " + std::to_string (entry->lastUse) + "\n";
 
-        file.setLastModificationTime (juce::Time::getCurrentTime());
-        return fileSize;
+        if (shard.pendingRecords.length() > maxPendingRecordBytes)
+            writePendingRecords (shard);
+
+        return size;
     }
 
-    bool purgeOldestFiles (uint32_t maxNumFilesToRetain) const
+    /** Deletes the least recently used files until there are no more than the given number left. */
+    bool purgeOldestFiles (uint32_t maxNumFilesToRetain)
     {
-        juce::ScopedLock sl (lock);
+        return purgeLeastRecentlyUsed (maxNumFilesToRetain, 0);
+    }
+
+    /** Returns the total size of all the files in the cache. */
+    uint64_t getTotalSize() const                            { return totalSize; }
+
+    /** Returns the number of files in the cache. */
+    uint32_t getNumFiles() const                             { return numFiles; }
+
+    static std::string getFilePrefix()                       { return "soul_patch_cache_"; }
+    static std::string getFileName (const char* cacheKey)    { return getFilePrefix() + cacheKey; }
+    juce::File getFileForKey (const char* cacheKey) const    { return folder.getChildFile (getFileName (cacheKey)); }
+
+    static std::string getIndexFileName (size_t shardIndex)  { return "soul_patch_index_" + std::to_string (shardIndex); }
+
+    int addRef() noexcept override   { return ++refCount; }
+    int release() noexcept override  { auto newCount = --refCount; if (newCount == 0) delete this; return newCount; }
 
-        struct FileAndDate
+private:
+    //==============================================================================
+    struct Entry
+    {
+        std::string key;
+        uint64_t size, lastUse;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    struct Shard
+    {
+        juce::CriticalSection lock;
+        EntryList lruOrder; // least recently used first
+        std::unordered_map<std::string, EntryList::iterator> entries;
+        juce::File indexFile;
+        std::string pendingRecords;
+        size_t numRecordsInIndex = 0;
+    };
+
+    static constexpr size_t numShards = 8;
+    static constexpr size_t maxPendingRecordBytes = 4096;
+
+    std::atomic<int> refCount { 1 };
+    juce::File folder;
+    const uint32_t maxNumFiles;
+    const uint64_t maxTotalSize;
+    std::array<Shard, numShards> shards;
+    std::atomic<uint32_t> numFiles { 0 };
+    std::atomic<uint64_t> totalSize { 0 }, lastUseCounter { 0 };
+    juce::CriticalSection purgeLock;
+
+    //==============================================================================
+    Shard& getShard (const std::string& key)
+    {
+        // (FNV-1a, because the shard that a key lives in must be the same every time the cache is opened)
+        uint32_t hash = 2166136261u;
+
+        for (auto c : key)
+            hash = (hash ^ (uint8_t) c) * 16777619u;
+
+        return shards[hash % numShards];
+    }
+
+    void addEntry (Shard& shard, const std::string& key, uint64_t size, uint64_t lastUse)
+    {
+        shard.entries[key] = shard.lruOrder.insert (shard.lruOrder.end(), Entry { key, size, lastUse });
+        ++numFiles;
+        totalSize += size;
+    }
+
+    void removeEntry (Shard& shard, EntryList::iterator entry, bool deleteFile)
+    {
+        if (deleteFile)
+            getFileForKey (entry->key.c_str()).deleteFile();
+
+        shard.pendingRecords += "D " + entry->key + "\n";
+        --numFiles;
+        totalSize -= entry->size;
+        shard.entries.erase (entry->key);
+        shard.lruOrder.erase (entry);
+    }
+
+    static bool readFile (const juce::File& file, void* destAddress, uint64_t size)
+    {
+        juce::MemoryMappedFile mappedFile (file, juce::MemoryMappedFile::readOnly);
+
+        if (mappedFile.getData() != nullptr)
         {
-            juce::File file;
-            juce::Time modificationTime;
+            if ((uint64_t) mappedFile.getSize() != size)
+                return false;
 
-            bool operator< (const FileAndDate& other) const noexcept     { return modificationTime < other.modificationTime; }
-        };
+            memcpy (destAddress, mappedFile.getData(), (size_t) size);
+            return true;
+        }
+
+        juce::FileInputStream fin (file);
+        return fin.openedOk() && (uint64_t) fin.getTotalLength() == size
+                && fin.read (destAddress, (int) size) == (int) size;
+    }
+
+    bool isOverLimit (uint32_t fileLimit, uint64_t sizeLimit) const
+    {
+        return numFiles > fileLimit || (sizeLimit != 0 && totalSize > sizeLimit);
+    }
+
+    template <typename IntType>
+    static IntType getLowWaterMark (IntType limit)
+    {
+        return limit - limit / 10;
+    }
+
+    bool purgeLeastRecentlyUsed (uint32_t fileLimit, uint64_t sizeLimit)
+    {
+        juce::ScopedLock sl (purgeLock);
+
+        for (auto& shard : shards)
+            shard.lock.enter();
 
-        std::vector<FileAndDate> files;
-        juce::Time modificationTime;
         bool anyFailed = false;
 
-        for (juce::DirectoryIterator i (folder, false, getFilePrefix() + "*", juce::File::findFiles);
-             i.next ({}, {}, {}, &modificationTime, {}, {});)
+        while (isOverLimit (fileLimit, sizeLimit))
         {
-            files.push_back ({ i.getFile(), modificationTime });
+            Shard* oldest = nullptr;
+
+            for (auto& shard : shards)
+                if (! shard.lruOrder.empty())
+                    if (oldest == nullptr || shard.lruOrder.front().lastUse < oldest->lruOrder.front().lastUse)
+                        oldest = std::addressof (shard);
+
+            if (oldest == nullptr)
+                break;
+
+            auto entry = oldest->lruOrder.begin();
+            auto file = getFileForKey (entry->key.c_str());
+
+            if (! file.deleteFile())
+                anyFailed = true;
+
+            removeEntry (*oldest, entry, false);
         }
 
-        if (files.size() > maxNumFilesToRetain)
+        for (auto& shard : shards)
         {
-            std::sort (files.begin(), files.end());
-
-            for (size_t i = 0; i < files.size() - maxNumFilesToRetain; ++i)
-                if (! files[i].file.deleteFile())
-                    anyFailed = true;
+            writePendingRecords (shard);
+            shard.lock.exit();
         }
 
         return ! anyFailed;
     }
 
-    static std::string getFilePrefix()                       { return "soul_patch_cache_"; }
-    static std::string getFileName (const char* cacheKey)    { return getFilePrefix() + cacheKey; }
-    juce::File getFileForKey (const char* cacheKey) const    { return folder.getChildFile (getFileName (cacheKey)); }
+    //==============================================================================
+    void writePendingRecords (Shard& shard)
+    {
+        if (shard.pendingRecords.empty())
+            return;
 
-    int addRef() noexcept override   { return ++refCount; }
-    int release() noexcept override  { auto newCount = --refCount; if (newCount == 0) delete this; return newCount; }
+        auto numNewRecords = (size_t) std::count (shard.pendingRecords.begin(), shard.pendingRecords.end(), '\n');
 
-private:
-    std::atomic<int> refCount { 1 };
-    juce::File folder;
-    uint32_t maxNumFiles;
-    juce::CriticalSection lock;
+        // When the index has collected a lot of stale records, it gets rewritten from scratch
+        if (shard.numRecordsInIndex + numNewRecords > 2 * shard.entries.size() + 64)
+            return rewriteIndex (shard);
+
+        juce::FileOutputStream out (shard.indexFile);
+
+        if (out.openedOk() && out.write (shard.pendingRecords.data(), shard.pendingRecords.length()))
+        {
+            shard.numRecordsInIndex += numNewRecords;
+            shard.pendingRecords.clear();
+        }
+    }
+
+    void rewriteIndex (Shard& shard)
+    {
+        std::string records;
+
+        for (auto& e : shard.lruOrder)
+            records += "S " + e.key + " " + std::to_string (e.size) + " " + std::to_string (e.lastUse) + "\n";
+
+        if (shard.indexFile.replaceWithData (records.data(), records.length()))
+        {
+            shard.numRecordsInIndex = shard.lruOrder.size();
+            shard.pendingRecords.clear();
+        }
+    }
+
+    void loadIndex()
+    {
+        struct LoadedEntry
+        {
+            uint64_t size = 0, lastUse = 0;
+            bool fileExists = false;
+        };
+
+        std::unordered_map<std::string, LoadedEntry> loaded;
+
+        for (size_t i = 0; i < numShards; ++i)
+        {
+            shards[i].indexFile = folder.getChildFile (getIndexFileName (i));
+
+            juce::StringArray lines;
+            shards[i].indexFile.readLines (lines);
+
+            for (auto& line : lines)
+            {
+                std::istringstream record (line.toStdString());
+                std::string type, key;
+                uint64_t size = 0, lastUse = 0;
+                record >> type >> key;
+
+                if (type == "S" && record >> size >> lastUse)  loaded[key] = { size, lastUse };
+                else if (type == "R" && record >> lastUse)     { if (auto e = loaded.find (key); e != loaded.end()) e->second.lastUse = lastUse; }
+                else if (type == "D")                          loaded.erase (key);
+            }
+        }
+
+        // Any files that the index doesn't know about (e.g. from an older version of this
+        // class) are treated as being older than everything else, in order of modification time
+        struct UnindexedFile
+        {
+            std::string key;
+            uint64_t size;
+            juce::Time modificationTime;
+
+            bool operator< (const UnindexedFile& other) const noexcept     { return modificationTime < other.modificationTime; }
+        };
+
+        std::vector<UnindexedFile> unindexedFiles;
+        auto prefixLength = (int) getFilePrefix().length();
+        juce::Time modificationTime;
+        juce::int64 fileSize = 0;
+
+        for (juce::DirectoryIterator i (folder, false, getFilePrefix() + "*", juce::File::findFiles);
+             i.next ({}, {}, &fileSize, &modificationTime, {}, {});)
+        {
+            auto key = i.getFile().getFileName().substring (prefixLength).toStdString();
+
+            if (auto e = loaded.find (key); e != loaded.end())
+            {
+                e->second.size = (uint64_t) fileSize;
+                e->second.fileExists = true;
+            }
+            else
+            {
+                unindexedFiles.push_back ({ key, (uint64_t) fileSize, modificationTime });
+            }
+        }
+
+        std::sort (unindexedFiles.begin(), unindexedFiles.end());
+        uint64_t nextLastUse = 0;
+
+        for (auto& f : unindexedFiles)
+            addEntry (getShard (f.key), f.key, f.size, ++nextLastUse);
+
+        std::vector<std::pair<std::string, LoadedEntry>> indexedFiles;
+
+        for (auto& e : loaded)
+            if (e.second.fileExists)
+                indexedFiles.push_back (e);
+
+        std::sort (indexedFiles.begin(), indexedFiles.end(),
+                   [] (auto& a, auto& b) { return a.second.lastUse < b.second.lastUse; });
+
+        for (auto& f : indexedFiles)
+            addEntry (getShard (f.first), f.first, f.second.size, ++nextLastUse);
+
+        lastUseCounter = nextLastUse;
+
+        for (auto& shard : shards)
+            rewriteIndex (shard);
+    }
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CompilerCacheFolder)
 };
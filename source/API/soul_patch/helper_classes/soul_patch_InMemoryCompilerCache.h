@@ -0,0 +1,293 @@
+/*
+     _____ _____ _____ __
+    |   __|     |  |  |  |
+    |__   |  |  |  |  |  |__
+    |_____|_____|_____|_____|
+
+    Copyright (c) 2018 - ROLI Ltd.
+*/
+
+#pragma once
+
+#include "soul_patch_Utilities.h"
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <condition_variable>
+
+#if __clang__
+ #pragma clang diagnostic push
+ #pragma clang diagnostic ignored "-Wnon-virtual-dtor"
+#endif
+
+namespace soul
+{
+namespace patch
+{
+
+//==============================================================================
+/**
+    A CompilerCache which keeps recently used items in memory, in front of another
+    (usually slower) CompilerCache such as a CompilerCacheFolder.
+
+    Reads are served from memory when possible, and anything that has to be fetched from
+    the backing cache is kept in memory for next time. When the total size of the items
+    in memory goes over the budget, the least recently used ones are dropped.
+
+    Stores go into memory straight away. If write-behind is enabled, they're passed on to
+    the backing cache by a background thread, so the caller doesn't have to wait for any
+    disk access. Any writes that are still pending are completed by flush() or by the
+    destructor.
+*/
+struct InMemoryCompilerCache final  : public RefCountHelper<CompilerCache, InMemoryCompilerCache>
+{
+    /** Creates a cache which holds up to maxBytesInMemory bytes of items.
+        The backing cache may be null, in which case this is just an in-memory cache.
+    */
+    InMemoryCompilerCache (CompilerCache::Ptr backingCache, uint64_t maxBytesInMemory, bool useWriteBehind = true)
+        : backing (std::move (backingCache)), maxBytes (maxBytesInMemory)
+    {
+        if (backing != nullptr && useWriteBehind)
+            writerThread = std::thread ([this] { runWriterThread(); });
+    }
+
+    ~InMemoryCompilerCache()
+    {
+        if (writerThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> l (lock);
+                shouldStop = true;
+            }
+
+            writesPending.notify_all();
+            writerThread.join();
+        }
+    }
+
+    void storeItemInCache (const char* key, const void* sourceData, uint64_t size) override
+    {
+        auto data = std::make_shared<const Data> (static_cast<const uint8_t*> (sourceData),
+                                                  static_cast<const uint8_t*> (sourceData) + size);
+
+        {
+            std::lock_guard<std::mutex> l (lock);
+            stats.bytesStored += size;
+            addToMemory (key, data);
+
+            if (writerThread.joinable())
+            {
+                pendingWrites[key] = data;
+                writesPending.notify_all();
+                return;
+            }
+        }
+
+        if (backing != nullptr)
+        {
+            backing->storeItemInCache (key, sourceData, size);
+
+            std::lock_guard<std::mutex> l (lock);
+            stats.bytesWrittenToBacking += size;
+        }
+    }
+
+    uint64_t readItemFromCache (const char* key, void* destAddress, uint64_t destSize) override
+    {
+        auto data = findInMemory (key);
+
+        if (data == nullptr)
+        {
+            data = readFromBacking (key);
+
+            if (data == nullptr)
+            {
+                std::lock_guard<std::mutex> l (lock);
+                ++stats.numMisses;
+                return 0;
+            }
+        }
+
+        auto size = (uint64_t) data->size();
+
+        if (destAddress == nullptr || destSize < size)
+            return size;
+
+        memcpy (destAddress, data->data(), (size_t) size);
+
+        std::lock_guard<std::mutex> l (lock);
+        ++stats.numHits;
+        stats.bytesRead += size;
+        return size;
+    }
+
+    /** Blocks until all the pending writes have been passed on to the backing cache. */
+    void flush()
+    {
+        std::unique_lock<std::mutex> l (lock);
+        writesFinished.wait (l, [this] { return pendingWrites.empty() && writesInProgress.empty(); });
+    }
+
+    /** Discards all the items held in memory (but not any pending writes). */
+    void clearMemory()
+    {
+        std::lock_guard<std::mutex> l (lock);
+        lruOrder.clear();
+        items.clear();
+        stats.numItemsInMemory = 0;
+        stats.bytesInMemory = 0;
+    }
+
+    //==============================================================================
+    struct Statistics
+    {
+        uint64_t numHits = 0;               /**< Reads that were copied out of memory */
+        uint64_t numBackingReads = 0;       /**< Items that had to be fetched from the backing cache */
+        uint64_t numMisses = 0;             /**< Lookups that weren't found in either place */
+        uint64_t numEvictions = 0;          /**< Items dropped from memory to stay within the budget */
+        uint64_t bytesRead = 0;             /**< Total size of all the reads that were served */
+        uint64_t bytesStored = 0;           /**< Total size of all the items that were stored */
+        uint64_t bytesWrittenToBacking = 0; /**< Total size of the items passed on to the backing cache */
+        uint64_t numItemsInMemory = 0, bytesInMemory = 0;
+        uint64_t numPendingWrites = 0;
+    };
+
+    Statistics getStatistics() const
+    {
+        std::lock_guard<std::mutex> l (lock);
+        auto s = stats;
+        s.numPendingWrites = pendingWrites.size();
+        return s;
+    }
+
+private:
+    //==============================================================================
+    using Data = std::vector<uint8_t>;
+    using DataPtr = std::shared_ptr<const Data>;
+
+    struct Item
+    {
+        std::string key;
+        DataPtr data;
+    };
+
+    using ItemList = std::list<Item>;
+
+    const CompilerCache::Ptr backing;
+    const uint64_t maxBytes;
+
+    mutable std::mutex lock;
+    ItemList lruOrder; // least recently used first
+    std::unordered_map<std::string, ItemList::iterator> items;
+    std::unordered_map<std::string, DataPtr> pendingWrites, writesInProgress;
+    Statistics stats;
+
+    std::thread writerThread;
+    std::condition_variable writesPending, writesFinished;
+    bool shouldStop = false;
+
+    //==============================================================================
+    DataPtr findInMemory (const std::string& key)
+    {
+        std::lock_guard<std::mutex> l (lock);
+
+        if (auto found = items.find (key); found != items.end())
+        {
+            lruOrder.splice (lruOrder.end(), lruOrder, found->second);
+            return found->second->data;
+        }
+
+        // (an item may have been dropped from memory before its write-behind has finished)
+        for (auto* writes : { &pendingWrites, &writesInProgress })
+            if (auto pending = writes->find (key); pending != writes->end())
+                return pending->second;
+
+        return {};
+    }
+
+    DataPtr readFromBacking (const char* key)
+    {
+        if (backing == nullptr)
+            return {};
+
+        auto size = backing->readItemFromCache (key, nullptr, 0);
+
+        if (size == 0)
+            return {};
+
+        auto data = std::make_shared<Data> ((size_t) size);
+
+        if (backing->readItemFromCache (key, data->data(), size) != size)
+            return {};
+
+        std::lock_guard<std::mutex> l (lock);
+        ++stats.numBackingReads;
+        addToMemory (key, data);
+        return data;
+    }
+
+    void addToMemory (const std::string& key, DataPtr data)
+    {
+        if (auto existing = items.find (key); existing != items.end())
+            removeFromMemory (existing->second);
+
+        if (data->size() > maxBytes)
+            return;
+
+        items[key] = lruOrder.insert (lruOrder.end(), Item { key, std::move (data) });
+        ++stats.numItemsInMemory;
+        stats.bytesInMemory += lruOrder.back().data->size();
+
+        while (stats.bytesInMemory > maxBytes && ! lruOrder.empty())
+        {
+            removeFromMemory (lruOrder.begin());
+            ++stats.numEvictions;
+        }
+    }
+
+    void removeFromMemory (ItemList::iterator item)
+    {
+        --stats.numItemsInMemory;
+        stats.bytesInMemory -= item->data->size();
+        items.erase (item->key);
+        lruOrder.erase (item);
+    }
+
+    void runWriterThread()
+    {
+        std::unique_lock<std::mutex> l (lock);
+
+        for (;;)
+        {
+            writesPending.wait (l, [this] { return shouldStop || ! pendingWrites.empty(); });
+
+            if (pendingWrites.empty())
+                return;
+
+            writesInProgress = std::move (pendingWrites);
+            pendingWrites.clear();
+            l.unlock();
+
+            uint64_t bytesWritten = 0;
+
+            for (auto& w : writesInProgress)
+            {
+                backing->storeItemInCache (w.first.c_str(), w.second->data(), w.second->size());
+                bytesWritten += w.second->size();
+            }
+
+            l.lock();
+            writesInProgress.clear();
+            stats.bytesWrittenToBacking += bytesWritten;
+            writesFinished.notify_all();
+        }
+    }
+};
+
+
+} // namespace patch
+} // namespace soul
+
+#if __clang__
+ #pragma clang diagnostic pop
+#endif
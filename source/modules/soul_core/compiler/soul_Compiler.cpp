@@ -39,6 +39,13 @@ void Compiler::reset()
     addDefaultBuiltInLibrary();
 }
 
+void Compiler::resetIfNeeded()
+{
+    // After a link, the built-in library is only re-added if the compiler gets used again
+    if (topLevelNamespace == nullptr)
+        reset();
+}
+
 bool Compiler::addCode (CompileMessageList& messageList, CodeLocation code)
 {
     if (messageList.hasErrors())
@@ -51,6 +58,7 @@ bool Compiler::addCode (CompileMessageList& messageList, CodeLocation code)
 
         SOUL_LOG_TIME_OF_SCOPE ("initial resolution pass: " + code.getFilename());
         soul::CompileMessageHandler handler (messageList);
+        resetIfNeeded();
         compile (std::move (code));
         return true;
     }
@@ -98,18 +106,339 @@ static void sanityCheckBuildSettings (const BuildSettings& settings,
 }
 
 //==============================================================================
-Program Compiler::build (CompileMessageList& messageList, const BuildBundle& bundle)
+/** The layout of an entry in the LinkerCache for a built program: a header, the messages
+    that the build produced, and then the program in heart::BinaryFormat.
+
+    The header holds a hash of everything after it, so that an entry which has been
+    truncated or corrupted is rejected, rather than relying on the binary reader to spot
+    the damage.
+
+    A message's location is stored as the index of a file in the BuildBundle and a byte
+    offset into it. The cache key includes the content of all the files, so when the entry
+    is loaded, the locations can be re-attached to the same text. Locations that aren't in
+    one of the bundle's files (e.g. in the built-in library) are dropped.
+*/
+struct CachedProgram
+{
+    static constexpr uint32_t magicNumber = 0x32505348; // "HSP2"
+    static constexpr uint32_t noFile = 0xffffffffu;
+
+    /** A one-byte entry which is stored over an entry that couldn't be loaded (the
+        LinkerCache has no way to remove one), so that it isn't read again on every build.
+    */
+    static constexpr uint8_t evictedEntry = 0;
+
+    static std::vector<uint8_t> write (const Program& program, ArrayView<const CompileMessage> messages, const BuildBundle& bundle)
+    {
+        std::vector<uint8_t> data;
+        writeInt (data, (uint32_t) messages.size());
+
+        for (auto& m : messages)
+        {
+            auto fileIndex = noFile;
+            uint32_t offset = 0;
+
+            if (m.location.sourceCode != nullptr)
+            {
+                for (size_t i = 0; i < bundle.sourceFiles.size(); ++i)
+                {
+                    auto& text = m.location.sourceCode->content;
+                    auto address = m.location.location.getAddress();
+
+                    if (bundle.sourceFiles[i].filename == m.location.sourceCode->filename
+                         && address >= text.data() && address <= text.data() + text.length())
+                    {
+                        fileIndex = (uint32_t) i;
+                        offset = (uint32_t) (address - text.data());
+                        break;
+                    }
+                }
+            }
+
+            writeInt (data, (uint32_t) m.type);
+            writeInt (data, (uint32_t) m.category);
+            writeInt (data, fileIndex);
+            writeInt (data, offset);
+            writeInt (data, (uint32_t) m.description.length());
+            data.insert (data.end(), m.description.begin(), m.description.end());
+        }
+
+        auto programData = program.toBinary();
+        data.insert (data.end(), programData.begin(), programData.end());
+
+        auto checksum = getChecksum (data.data(), data.size());
+
+        std::vector<uint8_t> header;
+        writeInt (header, magicNumber);
+        writeInt64 (header, checksum.part1);
+        writeInt64 (header, checksum.part2);
+
+        data.insert (data.begin(), header.begin(), header.end());
+        return data;
+    }
+
+    /** Returns an error description if the data can't be parsed. */
+    static std::string read (const std::vector<uint8_t>& data, const BuildBundle& bundle,
+                             std::vector<CompileMessage>& messages, Program& program)
+    {
+        size_t pos = 0;
+        uint32_t magic = 0, numMessages = 0;
+        FastHashBuilder::Hash checksum;
+
+        if (! (readInt (data, pos, magic) && magic == magicNumber
+                && readInt64 (data, pos, checksum.part1) && readInt64 (data, pos, checksum.part2)))
+            return "unknown format";
+
+        if (checksum != getChecksum (data.data() + pos, data.size() - pos))
+            return "checksum mismatch";
+
+        if (! readInt (data, pos, numMessages))
+            return "truncated messages";
+
+        std::vector<SourceCodeText::Ptr> sourceTexts (bundle.sourceFiles.size());
+
+        for (uint32_t i = 0; i < numMessages; ++i)
+        {
+            uint32_t type, category, fileIndex, offset, length;
+
+            if (! (readInt (data, pos, type) && readInt (data, pos, category) && readInt (data, pos, fileIndex)
+                    && readInt (data, pos, offset) && readInt (data, pos, length) && length <= data.size() - pos))
+                return "truncated messages";
+
+            CompileMessage m;
+            m.type = (CompileMessage::Type) type;
+            m.category = (CompileMessage::Category) category;
+            m.description = std::string (reinterpret_cast<const char*> (data.data() + pos), length);
+            pos += length;
+
+            if (fileIndex != noFile)
+            {
+                if (fileIndex >= bundle.sourceFiles.size() || offset > bundle.sourceFiles[fileIndex].content.length())
+                    return "bad message location";
+
+                auto& text = sourceTexts[fileIndex];
+
+                if (text == nullptr)
+                    text = SourceCodeText::createForFile (bundle.sourceFiles[fileIndex].filename, bundle.sourceFiles[fileIndex].content);
+
+                m.location.sourceCode = text;
+                m.location.location = UTF8Reader (text->content.data() + offset);
+            }
+
+            messages.push_back (std::move (m));
+        }
+
+        CompileMessageList errors;
+        program = Program::createFromBinary (errors, data.data() + pos, data.size() - pos);
+
+        if (program.isEmpty())
+            return errors.hasErrors() ? errors.toString() : "bad program data";
+
+        return {};
+    }
+
+private:
+    static FastHashBuilder::Hash getChecksum (const uint8_t* data, size_t size)
+    {
+        return FastHashBuilder().addBytes (data, size).getHash();
+    }
+
+    static void writeInt (std::vector<uint8_t>& data, uint32_t n)
+    {
+        for (int i = 0; i < 4; ++i)
+            data.push_back (static_cast<uint8_t> (n >> (8 * i)));
+    }
+
+    static void writeInt64 (std::vector<uint8_t>& data, uint64_t n)
+    {
+        writeInt (data, static_cast<uint32_t> (n));
+        writeInt (data, static_cast<uint32_t> (n >> 32));
+    }
+
+    static bool readInt (const std::vector<uint8_t>& data, size_t& pos, uint32_t& result)
+    {
+        if (pos + 4 > data.size())
+            return false;
+
+        result = 0;
+
+        for (int i = 0; i < 4; ++i)
+            result |= static_cast<uint32_t> (data[pos++]) << (8 * i);
+
+        return true;
+    }
+
+    static bool readInt64 (const std::vector<uint8_t>& data, size_t& pos, uint64_t& result)
+    {
+        uint32_t low, high;
+
+        if (! (readInt (data, pos, low) && readInt (data, pos, high)))
+            return false;
+
+        result = low | (static_cast<uint64_t> (high) << 32);
+        return true;
+    }
+};
+
+//==============================================================================
+Program Compiler::build (CompileMessageList& messageList, const BuildBundle& bundle,
+                         LinkedProgramCache* linkedProgramCache, LinkerCache* programCache)
 {
     sanityCheckBuildSettings (bundle.settings);
+
+    if (programCache == nullptr)
+        return compileAndLink (messageList, bundle, linkedProgramCache);
+
+    auto key = getProgramCacheKey (bundle);
+
+    if (auto cached = loadProgramFromCache (messageList, *programCache, key, bundle))
+        return cached;
+
+    auto firstNewMessage = messageList.messages.size();
+    auto program = compileAndLink (messageList, bundle, linkedProgramCache);
+
+    // (a build that succeeds can only have produced warnings, which get stored with it)
+    if (program)
+    {
+        auto data = CachedProgram::write (program, ArrayView<const CompileMessage> (messageList.messages.data() + firstNewMessage,
+                                                                                    messageList.messages.size() - firstNewMessage),
+                                          bundle);
+        programCache->storeItem (key.c_str(), data.data(), data.size());
+    }
+
+    return program;
+}
+
+std::string Compiler::getProgramCacheKey (const BuildBundle& bundle)
+{
+    FastHashBuilder hash;
+
+    hash << getLibraryVersion().toString()
+         << getHEARTFormatVersion()
+         << heart::BinaryFormat::formatVersion
+         << OptimisationPipeline::getEffectiveLevel (bundle.settings.optimisationLevel)
+         << LinkedProgramCache::createKey (bundle);
+
+    return "program" + hash.toString();
+}
+
+Program Compiler::loadProgramFromCache (CompileMessageList& messageList, LinkerCache& cache,
+                                        const std::string& key, const BuildBundle& bundle)
+{
+    auto size = cache.readItem (key.c_str(), nullptr, 0);
+
+    if (size <= sizeof (CachedProgram::evictedEntry))
+        return {};
+
+    std::vector<uint8_t> data (static_cast<size_t> (size));
+    std::string error;
+    std::vector<CompileMessage> messages;
+    Program program;
+
+    if (cache.readItem (key.c_str(), data.data(), size) != size)
+        error = "failed to read the cached data";
+    else
+        error = CachedProgram::read (data, bundle, messages, program);
+
+    if (! error.empty())
+    {
+        SOUL_LOG ("Discarding cached program " + key, error);
+        cache.storeItem (key.c_str(), std::addressof (CachedProgram::evictedEntry), sizeof (CachedProgram::evictedEntry));
+        return {};
+    }
+
+    for (auto& m : messages)
+        messageList.add (m);
+
+    return program;
+}
+
+Program Compiler::compileAndLink (CompileMessageList& messageList, const BuildBundle& bundle,
+                                  LinkedProgramCache* linkedProgramCache)
+{
+    auto cacheKey = linkedProgramCache != nullptr ? LinkedProgramCache::createKey (bundle) : FastHashBuilder::Hash();
+
+    if (linkedProgramCache != nullptr)
+        if (auto cached = linkedProgramCache->find (cacheKey, messageList))
+            return optimise (messageList, std::move (cached), bundle.settings);
+
+    auto firstNewMessage = messageList.messages.size();
     Compiler c;
 
     for (auto& file : bundle.sourceFiles)
         if (! c.addCode (messageList, CodeLocation::createFromSourceFile (file)))
             return {};
 
-    return c.link (messageList, bundle.settings);
+    auto program = c.linkWithoutOptimising (messageList, bundle.settings);
+
+    if (program.isEmpty())
+        return {};
+
+    if (linkedProgramCache != nullptr)
+        linkedProgramCache->add (cacheKey, program, { messageList.messages.begin() + (std::ptrdiff_t) firstNewMessage,
+                                                      messageList.messages.end() });
+
+    return optimise (messageList, std::move (program), bundle.settings);
+}
+
+//==============================================================================
+Compiler::LinkedProgramCache::LinkedProgramCache (size_t maxNumEntries)  : maxEntries (maxNumEntries)
+{
+    SOUL_ASSERT (maxEntries > 0);
+}
+
+void Compiler::LinkedProgramCache::clear()
+{
+    std::lock_guard<std::mutex> l (lock);
+    entries.clear();
+}
+
+FastHashBuilder::Hash Compiler::LinkedProgramCache::createKey (const BuildBundle& bundle)
+{
+    FastHashBuilder hash;
+    hash << bundle.settings.mainProcessor << bundle.sourceFiles.size();
+
+    for (auto& file : bundle.sourceFiles)
+        hash << file.filename << file.content;
+
+    return hash.getHash();
+}
+
+Program Compiler::LinkedProgramCache::find (FastHashBuilder::Hash key, CompileMessageList& messageList)
+{
+    std::lock_guard<std::mutex> l (lock);
+
+    for (auto e = entries.begin(); e != entries.end(); ++e)
+    {
+        if (e->key == key)
+        {
+            std::rotate (entries.begin(), e, e + 1);
+
+            for (auto& m : entries.front().messages)
+                messageList.add (m);
+
+            // The optimiser modifies the program it's given, so the cached one must be cloned
+            return entries.front().program.clone();
+        }
+    }
+
+    return {};
+}
+
+void Compiler::LinkedProgramCache::add (FastHashBuilder::Hash key, const Program& program,
+                                        std::vector<CompileMessage> messages)
+{
+    auto newEntry = Entry { key, program.clone(), std::move (messages) };
+
+    std::lock_guard<std::mutex> l (lock);
+
+    if (entries.size() >= maxEntries)
+        entries.pop_back();
+
+    entries.insert (entries.begin(), std::move (newEntry));
 }
 
+//==============================================================================
 std::vector<pool_ref<AST::ModuleBase>> Compiler::parseTopLevelDeclarations (AST::Allocator& allocator, CodeLocation code,
                                                                             AST::Namespace& parentNamespace)
 {
@@ -170,6 +499,11 @@ AST::ProcessorBase& Compiler::findMainProcessor (const BuildSettings& settings)
 }
 
 Program Compiler::link (CompileMessageList& messageList, const BuildSettings& settings)
+{
+    return optimise (messageList, linkWithoutOptimising (messageList, settings), settings);
+}
+
+Program Compiler::linkWithoutOptimising (CompileMessageList& messageList, const BuildSettings& settings)
 {
     if (messageList.hasErrors())
         return {};
@@ -178,14 +512,15 @@ Program Compiler::link (CompileMessageList& messageList, const BuildSettings& se
     {
         CompileMessageHandler handler (messageList);
         sanityCheckBuildSettings (settings);
-        return link (messageList, findMainProcessor (settings));
+        resetIfNeeded();
+        return linkWithoutOptimising (messageList, findMainProcessor (settings));
     }
     catch (AbortCompilationException) {}
 
     return {};
 }
 
-Program Compiler::link (CompileMessageList& messageList, AST::ProcessorBase& processorToRun)
+Program Compiler::linkWithoutOptimising (CompileMessageList& messageList, AST::ProcessorBase& processorToRun)
 {
     try
     {
@@ -205,13 +540,13 @@ Program Compiler::link (CompileMessageList& messageList, AST::ProcessorBase& pro
         compileAllModules (*topLevelNamespace, program, processorToRun);
         heart::Utilities::inlineFunctionsThatUseAdvanceOrStreams<Optimisations> (program);
         heart::Checker::sanityCheck (program);
-        reset();
+        topLevelNamespace.reset();
+        allocator.clear();
 
         SOUL_LOG (program.getMainProcessorOrThrowError().originalFullName + ": linked HEART",
                   [&] { return program.toHEART(); });
 
         heart::Checker::testHEARTRoundTrip (program);
-        optimise (program);
         return program;
     }
     catch (AbortCompilationException) {}
@@ -219,10 +554,36 @@ Program Compiler::link (CompileMessageList& messageList, AST::ProcessorBase& pro
     return {};
 }
 
-void Compiler::optimise (Program& program)
+Program Compiler::optimise (CompileMessageList& messageList, Program program, const BuildSettings& settings)
+{
+    if (program.isEmpty())
+        return {};
+
+    try
+    {
+        CompileMessageHandler handler (messageList);
+        optimise (program, settings);
+        return program;
+    }
+    catch (AbortCompilationException) {}
+
+    return {};
+}
+
+void Compiler::optimise (Program& program, const BuildSettings& settings)
 {
-    Optimisations::optimiseFunctionBlocks (program);
-    Optimisations::removeUnusedVariables (program);
+    auto stats = OptimisationPipeline::run (program, settings.optimisationLevel);
+
+    SOUL_LOG (program.getMainProcessorOrThrowError().originalFullName + ": optimisation passes",
+              [&] { return stats.getDescription(); });
+
+    if (OptimisationPipeline::getEffectiveLevel (settings.optimisationLevel) >= OptimisationPipeline::fullOptimisationLevel)
+    {
+        auto layout = StateLayoutPlanner::planLayout (program);
+
+        SOUL_LOG (program.getMainProcessorOrThrowError().originalFullName + ": state layout",
+                  [&] { return layout.getDescription(); });
+    }
 }
 
 void Compiler::resolveProcessorInstances (AST::ProcessorBase& processor)
@@ -21,6 +21,8 @@
 namespace soul
 {
 
+class LinkerCache;
+
 //==============================================================================
 /**
     Compiles and links some source code to create a Program that can be
@@ -35,11 +37,67 @@ class Compiler  final
 public:
     Compiler();
 
+    //==============================================================================
+    /** Holds on to the linked (but not yet optimised) programs from recent builds, so
+        that rebuilding a set of sources which hasn't changed can skip the parse,
+        resolution and HEART generation stages, and go straight to the optimiser.
+
+        Entries are keyed by a hash of the content of every source file and the name of
+        the main processor. The other build settings don't affect the linked program, so a
+        rebuild that was only triggered by a change of sample rate, block size or optimisation
+        level will always find a match.
+
+        Note that this isn't an incremental compiler: a change to any one of the files misses
+        the cache, and the whole front-end runs again for all of them. That's because all the
+        files in a build are parsed and resolved into a single namespace, where one file's
+        declarations can change how another's are resolved, and the AST can't be copied out
+        of that namespace to be re-used in a later build.
+    */
+    struct LinkedProgramCache
+    {
+        LinkedProgramCache (size_t maxNumEntries = 4);
+
+        /** Discards all the cached programs. */
+        void clear();
+
+    private:
+        friend class Compiler;
+
+        struct Entry
+        {
+            FastHashBuilder::Hash key;
+            Program program;
+            std::vector<CompileMessage> messages;
+        };
+
+        std::mutex lock;
+        std::vector<Entry> entries;
+        const size_t maxEntries;
+
+        static FastHashBuilder::Hash createKey (const BuildBundle&);
+        Program find (FastHashBuilder::Hash key, CompileMessageList&);
+        void add (FastHashBuilder::Hash key, const Program&, std::vector<CompileMessage>);
+    };
+
     /** This static method runs a complete build and link for a BuildBundle, and returns
         the resulting program.
+
+        If a LinkedProgramCache is supplied, then it will be used to avoid re-compiling
+        sources that it has seen before.
+
+        If a LinkerCache is supplied, then the finished program is stored in it in binary
+        form, and a later build of the same sources and settings will simply be loaded from
+        there without running the compiler at all. This is keyed by a hash of the sources,
+        the main processor name, the optimisation level and the compiler version.
+        Any warnings from the build are stored along with it and reported again when it's
+        loaded, but a program that's loaded from the cache won't contain any source code
+        locations. Each entry carries a checksum, and an entry which fails it or can't be
+        loaded is logged and discarded, and the program is rebuilt.
     */
     static Program build (CompileMessageList& messageList,
-                          const BuildBundle& buildBundle);
+                          const BuildBundle& buildBundle,
+                          LinkedProgramCache* linkedProgramCache = nullptr,
+                          LinkerCache* programCache = nullptr);
 
     /** Compiles a chunk of code which is expected to contain a list of top-level
         processor/graph/namespace decls, and these are added to the program.
@@ -62,10 +120,16 @@ private:
     AST::Allocator allocator;
     pool_ptr<AST::Namespace> topLevelNamespace;
 
+    static Program compileAndLink (CompileMessageList&, const BuildBundle&, LinkedProgramCache*);
+    static std::string getProgramCacheKey (const BuildBundle&);
+    static Program loadProgramFromCache (CompileMessageList&, LinkerCache&, const std::string& key, const BuildBundle&);
+
     void reset();
+    void resetIfNeeded();
     void addDefaultBuiltInLibrary();
     void compile (CodeLocation);
-    Program link (CompileMessageList&, AST::ProcessorBase& processorToRun);
+    Program linkWithoutOptimising (CompileMessageList&, const BuildSettings&);
+    Program linkWithoutOptimising (CompileMessageList&, AST::ProcessorBase& processorToRun);
     void resolveProcessorInstances (AST::ProcessorBase&);
     AST::ProcessorBase& findMainProcessor (const BuildSettings&);
 
@@ -76,7 +140,8 @@ private:
 
     pool_ref<AST::ProcessorBase> addClone (const AST::ProcessorBase&, const std::string& nameRoot);
     void compileAllModules (const AST::Namespace& parentNamespace, Program&, AST::ProcessorBase& processorToRun);
-    void optimise (Program&);
+    static Program optimise (CompileMessageList&, Program, const BuildSettings&);
+    static void optimise (Program&, const BuildSettings&);
 };
 
 } // namespace soul
@@ -282,6 +282,7 @@ namespace soul
 #define SOUL_ERRORS_RUNTIME(X) \
     X(customRuntimeError,                   "$0$") \
     X(failedToLoadProgram,                  "Failed to load program") \
+    X(invalidProgramData,                   "The program data is corrupt or incomplete") \
     X(cannotOverwriteFile,                  "Cannot overwrite existing file $Q0$") \
     X(cannotCreateOutputFile,               "Cannot create output file $Q0$") \
     X(cannotCreateFolder,                   "Cannot create folder $Q0$") \
@@ -36,6 +36,9 @@ Module::Module (Program& p, const Module& toClone)
       originalFullName (toClone.originalFullName),
       annotation (toClone.annotation),
       allocator (p.getAllocator()),
+      modificationCount (toClone.modificationCount),
+      hashedModificationCount (toClone.hashedModificationCount),
+      cachedHash (toClone.cachedHash),
       moduleType (toClone.moduleType)
 {
 }
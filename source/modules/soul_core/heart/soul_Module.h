@@ -90,11 +90,24 @@ public:
     void rebuildBlockPredecessors();
     void rebuildVariableUseCounts();
 
+    /** Anything which changes a module after it has been built must call this, so that
+        Program::getHash() knows that the hash it may have cached for it is out of date.
+    */
+    void markAsModified() noexcept          { ++modificationCount; }
+
 private:
     friend class Program;
+    friend struct heart::Hasher;
 
     uint32_t moduleID = 0;
 
+    // heart::Hasher keeps the last hash it calculated for this module, along with the
+    // modificationCount at that time, so it can be re-used until the module changes.
+    // A clone starts with the same count and hash as its original.
+    uint32_t modificationCount = 1;
+    mutable uint32_t hashedModificationCount = 0;
+    mutable FastHashBuilder::Hash cachedHash;
+
     enum class ModuleType
     {
         processorModule,
@@ -21,7 +21,13 @@
 namespace soul
 {
 
-/** Performs a deep-clone of a Module object, which is trickier than it sounds.. */
+/** Performs a deep-clone of a Module object, which is trickier than it sounds..
+
+    Identifiers are copied across as they are, so the destination module's identifier
+    pool must contain all the strings of the source's. That's always true when both
+    modules are in the same program, and Program::clone() makes the new program's pool
+    share the old one's strings.
+*/
 struct ModuleCloner
 {
     using FunctionMappings = std::unordered_map<pool_ref<const heart::Function>, pool_ptr<heart::Function>>;
@@ -82,23 +88,69 @@ struct ModuleCloner
     FunctionMappings& functionMappings;
     StructMappings& structMappings;
     VariableMappings& variableMappings;
-    std::unordered_map<pool_ref<const heart::InputDeclaration>, pool_ptr<heart::InputDeclaration>> inputMappings;
-    std::unordered_map<pool_ref<const heart::OutputDeclaration>, pool_ptr<heart::OutputDeclaration>> outputMappings;
-    std::unordered_map<pool_ref<const heart::Block>, pool_ptr<heart::Block>> blockMappings;
-    std::unordered_map<pool_ref<const heart::ProcessorInstance>, pool_ptr<heart::ProcessorInstance>> processorInstanceMappings;
+
+    /** Maps objects to their clones with a flat array that's sorted by address, which is
+        quicker to build and search than a hash map for the numbers of items involved.
+    */
+    template <typename ObjectType>
+    struct ObjectMap
+    {
+        void add (const ObjectType& old, ObjectType& clone)
+        {
+            items.push_back ({ std::addressof (old), std::addressof (clone) });
+            isSorted = false;
+        }
+
+        ObjectType& get (const ObjectType& old)
+        {
+            if (! isSorted)
+            {
+                std::sort (items.begin(), items.end(), [] (const Item& a, const Item& b) { return std::less<const ObjectType*>() (a.first, b.first); });
+                isSorted = true;
+            }
+
+            auto found = std::lower_bound (items.begin(), items.end(), std::addressof (old),
+                                           [] (const Item& item, const ObjectType* o) { return std::less<const ObjectType*>() (item.first, o); });
+
+            SOUL_ASSERT (found != items.end() && found->first == std::addressof (old));
+            return *found->second;
+        }
+
+        void clear()
+        {
+            items.clear();
+            isSorted = true;
+        }
+
+    private:
+        using Item = std::pair<const ObjectType*, ObjectType*>;
+        std::vector<Item> items;
+        bool isSorted = true;
+    };
+
+    ObjectMap<heart::InputDeclaration> inputMappings;
+    ObjectMap<heart::OutputDeclaration> outputMappings;
+    ObjectMap<heart::Block> blockMappings;
+    ObjectMap<heart::ProcessorInstance> processorInstanceMappings;
 
     heart::Block& getRemappedBlock (heart::Block& old)
     {
-        auto& b = blockMappings[old];
-        SOUL_ASSERT (b != nullptr);
-        return *b;
+        return blockMappings.get (old);
     }
 
-    Value getRemappedValue (Value v)
+    Value getRemappedValue (const Value& v)
     {
+        if (! containsStructs (v.getType()))
+            return v;
+
         return v.cloneWithEquivalentType (cloneType (v.getType()));
     }
 
+    static bool containsStructs (const Type& t)
+    {
+        return t.isStruct() || (t.isArray() && containsStructs (t.getArrayElementType()));
+    }
+
     heart::Expression& cloneExpression (heart::Expression& old)
     {
         if (auto c = cast<heart::Constant> (old))
@@ -156,16 +208,12 @@ struct ModuleCloner
 
     heart::InputDeclaration& getRemappedInput (heart::InputDeclaration& old)
     {
-        auto io = inputMappings[old];
-        SOUL_ASSERT (io != nullptr);
-        return *io;
+        return inputMappings.get (old);
     }
 
     heart::OutputDeclaration& getRemappedOutput (heart::OutputDeclaration& old)
     {
-        auto io = outputMappings[old];
-        SOUL_ASSERT (io != nullptr);
-        return *io;
+        return outputMappings.get (old);
     }
 
     static Type cloneType (StructMappings& structMappings, const Type& t)
@@ -202,10 +250,8 @@ struct ModuleCloner
     heart::InputDeclaration& clone (const heart::InputDeclaration& old)
     {
         auto& io = newModule.allocate<heart::InputDeclaration> (old.location);
-        auto& mapping = inputMappings[old];
-        SOUL_ASSERT (mapping == nullptr);
-        mapping = io;
-        io.name = newModule.allocator.get (old.name);
+        inputMappings.add (old, io);
+        io.name = old.name;
         io.index = old.index;
         io.endpointType = old.endpointType;
         io.dataTypes = cloneTypes (old.dataTypes);
@@ -217,10 +263,8 @@ struct ModuleCloner
     heart::OutputDeclaration& clone (const heart::OutputDeclaration& old)
     {
         auto& io = newModule.allocate<heart::OutputDeclaration> (old.location);
-        auto& mapping = outputMappings[old];
-        SOUL_ASSERT (mapping == nullptr);
-        mapping = io;
-        io.name = newModule.allocator.get (old.name);
+        outputMappings.add (old, io);
+        io.name = old.name;
         io.index = old.index;
         io.endpointType = old.endpointType;
         io.dataTypes = cloneTypes (old.dataTypes);
@@ -248,15 +292,13 @@ struct ModuleCloner
         if (old == nullptr)
             return {};
 
-        return processorInstanceMappings[*old];
+        return processorInstanceMappings.get (*old);
     }
 
     heart::ProcessorInstance& clone (const heart::ProcessorInstance& old)
     {
         auto& p = newModule.allocate<heart::ProcessorInstance>();
-        auto& mapping = processorInstanceMappings[old];
-        SOUL_ASSERT (mapping == nullptr);
-        mapping = p;
+        processorInstanceMappings.add (old, p);
         p.instanceName = old.instanceName;
         p.sourceName = old.sourceName;
         p.clockMultiplier = old.clockMultiplier;
@@ -270,7 +312,7 @@ struct ModuleCloner
         auto& mapping = variableMappings[old];
         SOUL_ASSERT (mapping == nullptr);
         auto& v = newModule.allocate<heart::Variable> (old.location, cloneType (old.type),
-                                                       newModule.allocator.get (old.name),
+                                                       old.name,
                                                        old.role);
         v.externalHandle = old.externalHandle;
         v.annotation = old.annotation;
@@ -309,8 +351,8 @@ struct ModuleCloner
 
     heart::Block& createNewBlock (const heart::Block& old)
     {
-        auto& b = newModule.allocate<heart::Block> (newModule.allocator.get (old.name));
-        blockMappings[old] = b;
+        auto& b = newModule.allocate<heart::Block> (old.name);
+        blockMappings.add (old, b);
         return b;
     }
 
@@ -444,7 +486,7 @@ struct ModuleCloner
 
         f.location = old.location;
         f.returnType = cloneType (old.returnType);
-        f.name = newModule.allocator.get (old.name);
+        f.name = old.name;
         f.functionType = old.functionType;
         f.intrinsicType = old.intrinsicType;
         f.isExported = old.isExported;
@@ -454,6 +496,8 @@ struct ModuleCloner
         for (auto& p : old.parameters)
             f.parameters.push_back (cloneVariable (p));
 
+        f.blocks.reserve (old.blocks.size());
+
         for (auto& b : old.blocks)
             f.blocks.push_back (createNewBlock (b));
 
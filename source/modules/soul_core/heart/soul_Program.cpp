@@ -38,6 +38,8 @@ struct Program::ProgramImpl  : public RefCountedObject
 
     uint32_t nextModuleID = 1;
 
+    std::mutex hashLock;
+
     pool_ptr<Module> getModuleWithName (const std::string& name) const
     {
         for (auto& m : modules)
@@ -61,6 +63,12 @@ struct Program::ProgramImpl  : public RefCountedObject
         removeIf (modules, [&] (pool_ref<Module> m) { return m == module; });
     }
 
+    std::string getHash()
+    {
+        std::lock_guard<decltype (hashLock)> lock (hashLock);
+        return heart::Hasher::getHash (Program (*this, false));
+    }
+
     Module& getOrCreateNamespace (const std::string& name)
     {
         if (auto m = getModuleWithName (name))
@@ -141,6 +149,7 @@ struct Program::ProgramImpl  : public RefCountedObject
     {
         Program newProgram;
         newProgram.pimpl->stringDictionary = stringDictionary;
+        newProgram.pimpl->allocator.identifiers.shareStringsFrom (allocator.identifiers);
 
         ModuleCloner::FunctionMappings functionMappings;
         ModuleCloner::StructMappings structMappings;
@@ -163,8 +172,14 @@ struct Program::ProgramImpl  : public RefCountedObject
         for (auto& c : cloners)
             c.clone();
 
+        // (constants which don't refer to any structs can be shared rather than copied)
         for (auto& c : constantTable)
-            newProgram.pimpl->constantTable.addItem ({ c.handle, std::make_unique<Value> (cloneValue (structMappings, *c.value)) });
+        {
+            if (ModuleCloner::containsStructs (c.value->getType()))
+                newProgram.pimpl->constantTable.addItem ({ c.handle, std::make_shared<const Value> (cloneValue (structMappings, *c.value)) });
+            else
+                newProgram.pimpl->constantTable.addItem (c);
+        }
 
         return newProgram;
     }
@@ -287,6 +302,27 @@ Program Program::createFromHEART (CompileMessageList& messageList, CodeLocation
     return {};
 }
 
+std::vector<uint8_t> Program::toBinary() const
+{
+    return heart::BinaryFormat::write (*this);
+}
+
+Program Program::createFromBinary (CompileMessageList& messageList, const void* data, size_t size)
+{
+    try
+    {
+        CompileMessageHandler handler (messageList);
+        auto program = heart::BinaryFormat::read (data, size);
+
+        heart::Checker::sanityCheck (program);
+
+        return program;
+    }
+    catch (AbortCompilationException) {}
+
+    return {};
+}
+
 Program Program::clone() const                                                          { return pimpl->clone(); }
 bool Program::isEmpty() const                                                           { return getModules().empty(); }
 Program::operator bool() const                                                          { return ! isEmpty(); }
@@ -314,14 +350,7 @@ uint32_t Program::getModuleID (Module& m, uint32_t arraySize)
 const char* Program::getRootNamespaceName()                                             { return "_root"; }
 std::string Program::stripRootNamespaceFromQualifiedPath (std::string path)             { return TokenisedPathString::removeTopLevelNameIfPresent (path, getRootNamespaceName()); }
 
-std::string Program::getHash() const
-{
-    IndentedStream dump;
-    heart::Printer::print (*this, dump);
-    HashBuilder hash;
-    hash << dump.getContent();
-    return hash.toString();
-}
+std::string Program::getHash() const                                                    { return pimpl->getHash(); }
 
 Module& Program::getMainProcessorOrThrowError() const
 {
@@ -41,7 +41,12 @@ public:
     Program& operator= (const Program&);
     Program& operator= (Program&&);
 
-    /** Returns a deep copy of this program. */
+    /** Returns a deep copy of this program.
+        The new program shares the original's identifier strings and its immutable constant
+        values, but every module is still copied, so the cost grows with the size of the program.
+        Modules can't be shared copy-on-write, because the optimisation passes modify them in
+        place through getModules(), and nothing would tell the program to make its own copy first.
+    */
     Program clone() const;
 
     //==============================================================================
@@ -55,6 +60,19 @@ public:
     */
     static Program createFromHEART (CompileMessageList&, CodeLocation heartCode);
 
+    /** Creates a compact binary representation of this program, which can be loaded
+        much more quickly than HEART code.
+        @see createFromBinary()
+    */
+    std::vector<uint8_t> toBinary() const;
+
+    /** Recreates a Program from some data that was created by toBinary().
+        If the data is invalid, this adds an error to the message list and returns an
+        empty program.
+        @see toBinary()
+    */
+    static Program createFromBinary (CompileMessageList&, const void* data, size_t size);
+
     //==============================================================================
     /** Return true if the program contains no modules. */
     bool isEmpty() const;
@@ -91,7 +109,10 @@ public:
     /** Looks for a variable with a (fully-qualified) name. */
     pool_ptr<heart::Variable> getVariableWithName (const std::string& name) const;
 
-    /** Generates a repeatable hash code for the complete state of this program. */
+    /** Generates a repeatable hash code for the complete state of this program.
+        The hash of each module is kept and re-used until Module::markAsModified() is called,
+        so anything which changes a module must call that.
+    */
     std::string getHash() const;
 
     /** Provides access to the program's string dictionary */
@@ -72,6 +72,8 @@ struct heart
 
     struct Parser;
     struct Printer;
+    struct BinaryFormat;
+    struct Hasher;
     struct Checker;
     struct Utilities;
 
@@ -0,0 +1,1312 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Reads and writes a compact binary form of a Program, which is much quicker to
+    load than HEART code because nothing needs tokenising or looking up by name.
+
+    The data starts with a magic number and a format version, followed by the string
+    dictionary, the modules and their structs, the constant table, the module contents
+    and finally the function bodies. Everything that refers to another object (a struct,
+    function, variable, endpoint, block or node) does so with an index, and strings are
+    written once and then referred to by index. Large constant values are stored as raw
+    blobs which are aligned relative to the start of the data, so when it's loaded from a
+    memory-mapped file, each one is read with a single aligned copy, and large values
+    which are all zero aren't stored at all.
+
+    Source code locations aren't stored.
+*/
+struct heart::BinaryFormat
+{
+    static constexpr uint32_t magicNumber = 0x4e425553; // "SUBN"
+    static constexpr uint32_t formatVersion = 1;
+
+    static constexpr size_t blobAlignment = 16;
+    static constexpr size_t minBlobSize = 64;
+
+    //==============================================================================
+    static std::vector<uint8_t> write (const Program& program)
+    {
+        Writer w (program);
+        w.writeProgram();
+        return std::move (w.data);
+    }
+
+    /** Recreates a program from some data produced by write(), throwing a compile error
+        if the data is invalid.
+    */
+    static Program read (const void* data, size_t size)
+    {
+        Reader r (static_cast<const uint8_t*> (data), size);
+        return r.readProgram();
+    }
+
+private:
+    //==============================================================================
+    enum class TypeTag  : uint8_t
+    {
+        invalid, primitive, vector, fixedArray, unsizedArray, wrapped, clamped, structure, stringLiteral
+    };
+
+    enum class ExpressionTag  : uint8_t
+    {
+        null, constant, variable, newVariable, arrayElement, structElement,
+        typeCast, unaryOperator, binaryOperator, pureFunctionCall, processorProperty
+    };
+
+    enum class StatementTag  : uint8_t
+    {
+        assignFromValue, functionCall, readStream, writeStream, advanceClock, endOfBlock
+    };
+
+    enum class TerminatorTag  : uint8_t
+    {
+        branch, branchIf, returnVoid, returnValue
+    };
+
+    enum ArrayElementFlags  : uint8_t
+    {
+        isDynamicFlag           = 1,
+        isRangeTrustedFlag      = 2,
+        suppressWrapWarningFlag = 4
+    };
+
+    //==============================================================================
+    struct Writer
+    {
+        Writer (const Program& p) : program (p) {}
+
+        const Program& program;
+        std::vector<uint8_t> data;
+
+        std::unordered_map<std::string, uint32_t> stringIndexes;
+        std::unordered_map<const std::string*, uint32_t> identifierIndexes;
+        uint32_t numStrings = 0;
+        std::unordered_map<const Structure*, uint32_t> structIndexes;
+        std::unordered_map<const heart::Function*, uint32_t> functionIndexes;
+        std::unordered_map<const heart::Variable*, uint32_t> variableIndexes;
+        std::unordered_map<const heart::IODeclaration*, uint32_t> inputIndexes, outputIndexes;
+        std::unordered_map<const heart::ProcessorInstance*, uint32_t> nodeIndexes;
+        std::unordered_map<const heart::Block*, uint32_t> blockIndexes;
+
+        void writeProgram()
+        {
+            data.reserve (16384);
+            variableIndexes.reserve (1024);
+            identifierIndexes.reserve (1024);
+
+            writeRaw (magicNumber);
+            writeInt (formatVersion);
+
+            auto& dictionary = program.getStringDictionary();
+            writeInt (dictionary.strings.size());
+
+            for (auto& s : dictionary.strings)
+            {
+                writeInt (s.handle.handle);
+                writeString (s.text);
+            }
+
+            auto& modules = program.getModules();
+            writeInt (modules.size());
+
+            for (auto& m : modules)
+            {
+                writeInt (m->isProcessor() ? 0 : (m->isGraph() ? 1 : 2));
+                writeString (m->shortName);
+                writeString (m->fullName);
+                writeString (m->originalFullName);
+                writeRaw (m->sampleRate);
+                writeInt (m->structs.size());
+
+                for (auto& s : m->structs)
+                {
+                    structIndexes[s.get()] = static_cast<uint32_t> (structIndexes.size());
+                    writeString (s->getName());
+                }
+
+                for (auto& f : m->functions)
+                    functionIndexes[f.getPointer()] = static_cast<uint32_t> (functionIndexes.size());
+            }
+
+            for (auto& m : modules)
+            {
+                for (auto& s : m->structs)
+                {
+                    writeInt (s->getNumMembers());
+
+                    for (auto& member : s->getMembers())
+                    {
+                        writeType (member.type);
+                        writeString (member.name);
+                    }
+                }
+            }
+
+            auto& constants = program.getConstantTable();
+            writeInt (constants.size());
+
+            for (auto& c : constants)
+            {
+                writeSignedInt (c.handle);
+                writeValue (*c.value);
+            }
+
+            for (auto& m : modules)
+                writeModuleContents (m);
+
+            for (auto& m : modules)
+                for (auto& f : m->functions)
+                    if (! f->hasNoBody)
+                        writeFunctionBody (f);
+        }
+
+        void writeModuleContents (const Module& m)
+        {
+            writeAnnotation (m.annotation);
+            writeEndpoints (m.inputs, inputIndexes);
+            writeEndpoints (m.outputs, outputIndexes);
+
+            nodeIndexes.clear();
+            writeInt (m.processorInstances.size());
+
+            for (auto& p : m.processorInstances)
+            {
+                nodeIndexes[p.getPointer()] = static_cast<uint32_t> (nodeIndexes.size());
+                writeString (p->instanceName);
+                writeString (p->sourceName);
+                writeSignedInt (p->clockMultiplier);
+                writeSignedInt (p->clockDivider);
+                writeInt (p->arraySize);
+            }
+
+            writeInt (m.connections.size());
+
+            for (auto& c : m.connections)
+            {
+                writeInt (static_cast<uint32_t> (c->interpolationType));
+                writeNode (c->sourceProcessor);
+                writeString (c->sourceEndpoint);
+                writeOptionalIndex (c->sourceEndpointIndex);
+                writeNode (c->destProcessor);
+                writeString (c->destEndpoint);
+                writeOptionalIndex (c->destEndpointIndex);
+                writeSignedInt (c->delayLength);
+            }
+
+            writeInt (m.stateVariables.size());
+
+            for (auto& v : m.stateVariables)
+                writeNewVariable (v);
+
+            writeInt (m.functions.size());
+
+            for (auto& f : m.functions)
+            {
+                writeIdentifier (f->name);
+                writeInt (static_cast<uint32_t> (f->functionType.type));
+                writeInt (static_cast<uint32_t> (f->intrinsicType));
+                writeInt ((f->isExported ? 1u : 0u) | (f->hasNoBody ? 2u : 0u));
+                writeType (f->returnType);
+                writeAnnotation (f->annotation);
+                writeInt (f->parameters.size());
+
+                for (auto& p : f->parameters)
+                    writeNewVariable (p);
+            }
+        }
+
+        template <typename EndpointList>
+        void writeEndpoints (const EndpointList& endpoints, std::unordered_map<const heart::IODeclaration*, uint32_t>& indexes)
+        {
+            writeInt (endpoints.size());
+
+            for (auto& e : endpoints)
+            {
+                indexes[e.getPointer()] = static_cast<uint32_t> (indexes.size());
+                writeIdentifier (e->name);
+                writeInt (e->index);
+                writeInt (static_cast<uint32_t> (e->endpointType));
+                writeInt (e->dataTypes.size());
+
+                for (auto& t : e->dataTypes)
+                    writeType (t);
+
+                writeOptionalIndex (e->arraySize);
+                writeAnnotation (e->annotation);
+            }
+        }
+
+        void writeFunctionBody (const heart::Function& f)
+        {
+            blockIndexes.clear();
+            writeInt (f.blocks.size());
+
+            for (auto& b : f.blocks)
+            {
+                blockIndexes[b.getPointer()] = static_cast<uint32_t> (blockIndexes.size());
+                writeIdentifier (b->name);
+            }
+
+            for (auto& b : f.blocks)
+            {
+                writeInt (b->parameters.size());
+
+                for (auto& p : b->parameters)
+                    writeNewVariable (p);
+
+                for (auto s : b->statements)
+                    writeStatement (*s);
+
+                writeTag (StatementTag::endOfBlock);
+                SOUL_ASSERT (b->isTerminated());
+                writeTerminator (*b->terminator);
+            }
+        }
+
+        void writeStatement (heart::Statement& s)
+        {
+            if (auto a = cast<heart::AssignFromValue> (s))
+            {
+                writeTag (StatementTag::assignFromValue);
+                writeExpression (*a->target);
+                writeExpression (a->source);
+            }
+            else if (auto fc = cast<heart::FunctionCall> (s))
+            {
+                writeTag (StatementTag::functionCall);
+                writeOptionalExpression (fc->target);
+                writeInt (functionIndexes.at (std::addressof (fc->getFunction())));
+                writeExpressionList (fc->arguments);
+            }
+            else if (auto r = cast<heart::ReadStream> (s))
+            {
+                writeTag (StatementTag::readStream);
+                writeExpression (*r->target);
+                writeInt (inputIndexes.at (r->source.getPointer()));
+            }
+            else if (auto w = cast<heart::WriteStream> (s))
+            {
+                writeTag (StatementTag::writeStream);
+                writeInt (outputIndexes.at (w->target.getPointer()));
+                writeOptionalExpression (w->element);
+                writeExpression (w->value);
+            }
+            else
+            {
+                SOUL_ASSERT (is_type<heart::AdvanceClock> (s));
+                writeTag (StatementTag::advanceClock);
+            }
+        }
+
+        void writeTerminator (heart::Terminator& t)
+        {
+            if (auto b = cast<heart::Branch> (t))
+            {
+                writeTag (TerminatorTag::branch);
+                writeInt (blockIndexes.at (b->target.getPointer()));
+                writeExpressionList (b->targetArgs);
+            }
+            else if (auto bi = cast<heart::BranchIf> (t))
+            {
+                writeTag (TerminatorTag::branchIf);
+                writeExpression (bi->condition);
+                writeInt (blockIndexes.at (bi->targets[0].getPointer()));
+                writeInt (blockIndexes.at (bi->targets[1].getPointer()));
+                writeExpressionList (bi->targetArgs[0]);
+                writeExpressionList (bi->targetArgs[1]);
+            }
+            else if (auto r = cast<heart::ReturnValue> (t))
+            {
+                writeTag (TerminatorTag::returnValue);
+                writeExpression (r->returnValue);
+            }
+            else
+            {
+                SOUL_ASSERT (is_type<heart::ReturnVoid> (t));
+                writeTag (TerminatorTag::returnVoid);
+            }
+        }
+
+        template <typename ListType>
+        void writeExpressionList (const ListType& list)
+        {
+            writeInt (list.size());
+
+            for (auto& e : list)
+                writeExpression (e);
+        }
+
+        void writeOptionalExpression (pool_ptr<heart::Expression> e)
+        {
+            if (e == nullptr)
+                writeTag (ExpressionTag::null);
+            else
+                writeExpression (*e);
+        }
+
+        void writeExpression (heart::Expression& e)
+        {
+            // (variables are by far the most common expressions, so get checked first)
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto found = variableIndexes.find (v.get());
+
+                if (found != variableIndexes.end())
+                {
+                    writeTag (ExpressionTag::variable);
+                    writeInt (found->second);
+                }
+                else
+                {
+                    writeTag (ExpressionTag::newVariable);
+                    writeNewVariable (*v);
+                }
+            }
+            else if (auto c = cast<heart::Constant> (e))
+            {
+                writeTag (ExpressionTag::constant);
+                writeValue (c->value);
+            }
+            else if (auto a = cast<heart::ArrayElement> (e))
+            {
+                writeTag (ExpressionTag::arrayElement);
+                writeExpression (a->parent);
+                writeInt ((a->isDynamic() ? isDynamicFlag : 0)
+                            | (a->isRangeTrusted ? isRangeTrustedFlag : 0)
+                            | (a->suppressWrapWarning ? suppressWrapWarningFlag : 0));
+
+                if (a->isDynamic())
+                {
+                    writeExpression (*a->dynamicIndex);
+                }
+                else
+                {
+                    writeInt (a->fixedStartIndex);
+                    writeInt (a->fixedEndIndex);
+                }
+            }
+            else if (auto s = cast<heart::StructElement> (e))
+            {
+                writeTag (ExpressionTag::structElement);
+                writeExpression (s->parent);
+                writeString (s->memberName);
+            }
+            else if (auto t = cast<heart::TypeCast> (e))
+            {
+                writeTag (ExpressionTag::typeCast);
+                writeExpression (t->source);
+                writeType (t->destType);
+            }
+            else if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                writeTag (ExpressionTag::unaryOperator);
+                writeExpression (u->source);
+                writeInt (static_cast<uint32_t> (u->operation));
+            }
+            else if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                writeTag (ExpressionTag::binaryOperator);
+                writeExpression (b->lhs);
+                writeExpression (b->rhs);
+                writeInt (static_cast<uint32_t> (b->operation));
+            }
+            else if (auto f = cast<heart::PureFunctionCall> (e))
+            {
+                writeTag (ExpressionTag::pureFunctionCall);
+                writeInt (functionIndexes.at (std::addressof (f->function)));
+                writeExpressionList (f->arguments);
+            }
+            else
+            {
+                auto pp = cast<heart::ProcessorProperty> (e);
+                SOUL_ASSERT (pp != nullptr);
+                writeTag (ExpressionTag::processorProperty);
+                writeInt (static_cast<uint32_t> (pp->property));
+            }
+        }
+
+        void writeNewVariable (const heart::Variable& v)
+        {
+            SOUL_ASSERT (variableIndexes.find (std::addressof (v)) == variableIndexes.end());
+            variableIndexes[std::addressof (v)] = static_cast<uint32_t> (variableIndexes.size());
+
+            writeIdentifier (v.name);
+            writeType (v.type);
+            writeInt (static_cast<uint32_t> (v.role));
+            writeSignedInt (v.externalHandle);
+            writeAnnotation (v.annotation);
+        }
+
+        void writeNode (pool_ptr<heart::ProcessorInstance> node)
+        {
+            writeInt (node == nullptr ? 0 : nodeIndexes.at (node.get()) + 1);
+        }
+
+        template <typename IntType>
+        void writeOptionalIndex (const std::optional<IntType>& index)
+        {
+            writeInt (index.has_value() ? static_cast<uint64_t> (*index) + 1 : 0);
+        }
+
+        //==============================================================================
+        void writeType (const Type& type)
+        {
+            if (! type.isValid())
+            {
+                writeTag (TypeTag::invalid);
+                return;
+            }
+
+            if (type.isStringLiteral())
+            {
+                writeTag (TypeTag::stringLiteral);
+            }
+            else if (type.isBoundedInt())
+            {
+                writeTag (type.isWrapped() ? TypeTag::wrapped : TypeTag::clamped);
+                writeInt (static_cast<uint64_t> (type.getBoundedIntLimit()));
+            }
+            else if (type.isVector())
+            {
+                writeTag (TypeTag::vector);
+                writeInt (static_cast<uint32_t> (type.getVectorElementType().type));
+                writeInt (type.getVectorSize());
+            }
+            else if (type.isUnsizedArray())
+            {
+                writeTag (TypeTag::unsizedArray);
+                writeType (type.getArrayElementType());
+            }
+            else if (type.isArray())
+            {
+                writeTag (TypeTag::fixedArray);
+                writeType (type.getArrayElementType());
+                writeInt (type.getArraySize());
+            }
+            else if (type.isStruct())
+            {
+                writeTag (TypeTag::structure);
+                writeInt (structIndexes.at (type.getStruct().get()));
+            }
+            else
+            {
+                SOUL_ASSERT (type.isPrimitive());
+                writeTag (TypeTag::primitive);
+                writeInt (static_cast<uint32_t> (type.getPrimitiveType().type));
+            }
+
+            writeInt ((type.isConst() ? 1u : 0u) | (type.isReference() ? 2u : 0u));
+        }
+
+        void writeValue (const Value& value)
+        {
+            writeType (value.getType());
+
+            auto size = value.getPackedDataSize();
+
+            if (size >= minBlobSize && isZero (value.getPackedData(), size))
+            {
+                writeInt (0);
+                return;
+            }
+
+            writeInt (size);
+
+            if (size >= minBlobSize)
+                data.resize (getAlignedSize<blobAlignment> (data.size()));
+
+            writeBytes (value.getPackedData(), size);
+        }
+
+        static bool isZero (const void* source, size_t size)
+        {
+            auto bytes = static_cast<const uint8_t*> (source);
+            return size == 0 || (bytes[0] == 0 && memcmp (bytes, bytes + 1, size - 1) == 0);
+        }
+
+        void writeAnnotation (const Annotation& annotation)
+        {
+            auto names = annotation.getNames();
+            writeInt (names.size());
+
+            if (names.empty())
+                return;
+
+            auto& strings = annotation.getDictionary().strings;
+            writeInt (strings.size());
+
+            for (auto& s : strings)
+            {
+                writeInt (s.handle.handle);
+                writeString (s.text);
+            }
+
+            for (auto& name : names)
+            {
+                writeString (name);
+                writeValue (annotation.getValue (name));
+            }
+        }
+
+        //==============================================================================
+        template <typename TagType>
+        void writeTag (TagType tag)
+        {
+            data.push_back (static_cast<uint8_t> (tag));
+        }
+
+        void writeInt (uint64_t n)
+        {
+            while (n >= 0x80)
+            {
+                data.push_back (static_cast<uint8_t> (n | 0x80));
+                n >>= 7;
+            }
+
+            data.push_back (static_cast<uint8_t> (n));
+        }
+
+        void writeSignedInt (int64_t n)
+        {
+            writeInt ((static_cast<uint64_t> (n) << 1) ^ static_cast<uint64_t> (n >> 63));
+        }
+
+        template <typename Primitive>
+        void writeRaw (Primitive value)
+        {
+            writeBytes (std::addressof (value), sizeof (value));
+        }
+
+        void writeBytes (const void* source, size_t size)
+        {
+            auto start = static_cast<const uint8_t*> (source);
+            data.insert (data.end(), start, start + size);
+        }
+
+        void writeString (const std::string& s)
+        {
+            auto found = stringIndexes.find (s);
+
+            if (found != stringIndexes.end())
+            {
+                writeInt (found->second + 1);
+                return;
+            }
+
+            stringIndexes[s] = numStrings;
+            writeNewString (s);
+        }
+
+        void writeNewString (const std::string& s)
+        {
+            ++numStrings;
+            writeInt (0);
+            writeInt (s.length());
+            writeBytes (s.data(), s.length());
+        }
+
+        // Identifiers are pooled, so they can be looked up by address rather than hashing the text
+        void writeIdentifier (Identifier name)
+        {
+            if (! name.isValid())
+                return writeString ({});
+
+            auto& text = name.toString();
+            auto found = identifierIndexes.find (std::addressof (text));
+
+            if (found != identifierIndexes.end())
+                return writeInt (found->second + 1);
+
+            identifierIndexes[std::addressof (text)] = numStrings;
+            writeNewString (text);
+        }
+    };
+
+    //==============================================================================
+    struct Reader
+    {
+        Reader (const uint8_t* d, size_t size) : start (d), data (d), end (d + size) {}
+
+        const uint8_t* const start;
+        const uint8_t* data;
+        const uint8_t* const end;
+
+        Program program;
+
+        std::vector<std::string> strings;
+        std::vector<Identifier> identifiers;
+        std::vector<pool_ref<Module>> modules;
+        std::vector<StructurePtr> structs;
+        std::vector<pool_ref<heart::Function>> functions;
+        std::vector<pool_ref<heart::Variable>> variables;
+        std::vector<pool_ref<heart::InputDeclaration>> inputs;
+        std::vector<pool_ref<heart::OutputDeclaration>> outputs;
+        std::vector<pool_ref<heart::ProcessorInstance>> nodes;
+        std::vector<pool_ref<heart::Block>> blocks;
+        pool_ptr<Module> module;
+
+        Program readProgram()
+        {
+            if (readRaw<uint32_t>() != magicNumber)
+                throwError();
+
+            strings.reserve (1024);
+            identifiers.reserve (1024);
+            variables.reserve (1024);
+
+            if (readInt() > formatVersion)
+                CodeLocation().throwError (Errors::wrongAPIVersion());
+
+            auto& dictionary = program.getStringDictionary();
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto handle = static_cast<uint32_t> (readInt());
+                dictionary.addItem ({ { handle }, readString() });
+            }
+
+            auto numModules = readInt();
+            std::vector<size_t> numStructs;
+
+            for (uint64_t i = 0; i < numModules; ++i)
+            {
+                auto moduleType = readInt();
+                auto& m = moduleType == 0 ? program.addProcessor()
+                                          : (moduleType == 1 ? program.addGraph() : program.addNamespace());
+                modules.push_back (m);
+                m.shortName = readString();
+                m.fullName = readString();
+                m.originalFullName = readString();
+                m.sampleRate = readRaw<double>();
+
+                for (auto j = readInt(); j > 0; --j)
+                    structs.push_back (m.addStruct (readString()));
+            }
+
+            for (auto& s : structs)
+            {
+                for (auto i = readInt(); i > 0; --i)
+                {
+                    auto type = readType();
+                    s->addMember (std::move (type), readString());
+                }
+            }
+
+            auto& constants = program.getConstantTable();
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto handle = static_cast<ConstantTable::Handle> (readSignedInt());
+                constants.addItem ({ handle, std::make_shared<const Value> (readValue()) });
+            }
+
+            for (auto& m : modules)
+                readModuleContents (m);
+
+            for (auto& f : functions)
+                if (! f->hasNoBody)
+                    readFunctionBody (f);
+
+            if (data != end)
+                throwError();
+
+            return std::move (program);
+        }
+
+        void readModuleContents (Module& m)
+        {
+            module = m;
+            m.annotation = readAnnotation();
+            readEndpoints (m.inputs, inputs);
+            readEndpoints (m.outputs, outputs);
+
+            nodes.clear();
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto& p = m.allocate<heart::ProcessorInstance>();
+                p.instanceName = readString();
+                p.sourceName = readString();
+                p.clockMultiplier = readSignedInt();
+                p.clockDivider = readSignedInt();
+                p.arraySize = static_cast<uint32_t> (readInt());
+                m.processorInstances.push_back (p);
+                nodes.push_back (p);
+            }
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto& c = m.allocate<heart::Connection> (CodeLocation());
+                c.interpolationType = static_cast<InterpolationType> (readInt());
+                c.sourceProcessor = readNode();
+                c.sourceEndpoint = readString();
+                c.sourceEndpointIndex = readOptionalIndex<size_t>();
+                c.destProcessor = readNode();
+                c.destEndpoint = readString();
+                c.destEndpointIndex = readOptionalIndex<size_t>();
+                c.delayLength = readSignedInt();
+                m.connections.push_back (c);
+            }
+
+            for (auto i = readInt(); i > 0; --i)
+                m.stateVariables.push_back (readNewVariable());
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto& f = m.allocate<heart::Function>();
+                f.name = readIdentifier();
+                f.functionType.type = static_cast<heart::FunctionType::Type> (readInt());
+                f.intrinsicType = static_cast<IntrinsicType> (readInt());
+
+                auto flags = readInt();
+                f.isExported = (flags & 1) != 0;
+                f.hasNoBody  = (flags & 2) != 0;
+
+                f.returnType = readType();
+                f.annotation = readAnnotation();
+
+                for (auto j = readInt(); j > 0; --j)
+                    f.parameters.push_back (readNewVariable());
+
+                m.functions.push_back (f);
+                functions.push_back (f);
+            }
+        }
+
+        template <typename DeclarationType>
+        void readEndpoints (std::vector<pool_ref<DeclarationType>>& list, std::vector<pool_ref<DeclarationType>>& allEndpoints)
+        {
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto& e = module->allocate<DeclarationType> (CodeLocation());
+                e.name = readIdentifier();
+                e.index = static_cast<uint32_t> (readInt());
+                e.endpointType = static_cast<EndpointType> (readInt());
+
+                for (auto j = readInt(); j > 0; --j)
+                    e.dataTypes.push_back (readType());
+
+                e.arraySize = readOptionalIndex<uint32_t>();
+                e.annotation = readAnnotation();
+                list.push_back (e);
+                allEndpoints.push_back (e);
+            }
+        }
+
+        void readFunctionBody (heart::Function& f)
+        {
+            module = program.getModuleContainingFunction (f);
+            blocks.clear();
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto& b = module->allocate<heart::Block> (readIdentifier());
+                f.blocks.push_back (b);
+                blocks.push_back (b);
+            }
+
+            for (auto& b : blocks)
+            {
+                for (auto i = readInt(); i > 0; --i)
+                    b->parameters.push_back (readNewVariable());
+
+                LinkedList<heart::Statement>::Iterator last;
+
+                for (;;)
+                {
+                    auto tag = static_cast<StatementTag> (readByte());
+
+                    if (tag == StatementTag::endOfBlock)
+                        break;
+
+                    last = b->statements.insertAfter (last, readStatement (tag));
+                }
+
+                b->terminator = readTerminator();
+            }
+        }
+
+        heart::Statement& readStatement (StatementTag tag)
+        {
+            switch (tag)
+            {
+                case StatementTag::assignFromValue:
+                {
+                    auto& target = readExpression();
+                    auto& source = readExpression();
+                    return module->allocate<heart::AssignFromValue> (CodeLocation(), target, source);
+                }
+
+                case StatementTag::functionCall:
+                {
+                    auto target = readOptionalExpression();
+                    auto& fc = module->allocate<heart::FunctionCall> (CodeLocation(), target, readFunction());
+                    readExpressionList (fc.arguments);
+                    return fc;
+                }
+
+                case StatementTag::readStream:
+                {
+                    auto& target = readExpression();
+                    return module->allocate<heart::ReadStream> (CodeLocation(), target, getItem (inputs, readInt()));
+                }
+
+                case StatementTag::writeStream:
+                {
+                    auto& output = getItem (outputs, readInt()).get();
+                    auto element = readOptionalExpression();
+                    auto& value = readExpression();
+                    return module->allocate<heart::WriteStream> (CodeLocation(), output, element, value);
+                }
+
+                case StatementTag::advanceClock:
+                    return module->allocate<heart::AdvanceClock> (CodeLocation());
+
+                default:
+                    throwError();
+                    return module->allocate<heart::AdvanceClock> (CodeLocation());
+            }
+        }
+
+        heart::Terminator& readTerminator()
+        {
+            switch (static_cast<TerminatorTag> (readByte()))
+            {
+                case TerminatorTag::branch:
+                {
+                    auto& b = module->allocate<heart::Branch> (getItem (blocks, readInt()));
+                    readExpressionList (b.targetArgs);
+                    return b;
+                }
+
+                case TerminatorTag::branchIf:
+                {
+                    auto& condition = readExpression();
+                    auto& trueBlock = getItem (blocks, readInt()).get();
+                    auto& falseBlock = getItem (blocks, readInt()).get();
+
+                    if (std::addressof (trueBlock) == std::addressof (falseBlock))
+                        throwError();
+
+                    auto& b = module->allocate<heart::BranchIf> (condition, trueBlock, falseBlock);
+                    readExpressionList (b.targetArgs[0]);
+                    readExpressionList (b.targetArgs[1]);
+                    return b;
+                }
+
+                case TerminatorTag::returnVoid:
+                    return module->allocate<heart::ReturnVoid>();
+
+                case TerminatorTag::returnValue:
+                    return module->allocate<heart::ReturnValue> (readExpression());
+
+                default:
+                    throwError();
+                    return module->allocate<heart::ReturnVoid>();
+            }
+        }
+
+        template <typename ListType>
+        void readExpressionList (ListType& list)
+        {
+            for (auto i = readInt(); i > 0; --i)
+                list.push_back (readExpression());
+        }
+
+        pool_ptr<heart::Expression> readOptionalExpression()
+        {
+            auto tag = static_cast<ExpressionTag> (readByte());
+
+            if (tag == ExpressionTag::null)
+                return {};
+
+            return readExpression (tag);
+        }
+
+        heart::Expression& readExpression()
+        {
+            auto e = readOptionalExpression();
+
+            if (e == nullptr)
+                throwError();
+
+            return *e;
+        }
+
+        heart::Expression& readExpression (ExpressionTag tag)
+        {
+            switch (tag)
+            {
+                case ExpressionTag::constant:
+                    return module->allocator.allocateConstant (readValue());
+
+                case ExpressionTag::variable:
+                    return getItem (variables, readInt());
+
+                case ExpressionTag::newVariable:
+                    return readNewVariable();
+
+                case ExpressionTag::arrayElement:
+                {
+                    auto& parent = readExpression();
+                    auto flags = readInt();
+
+                    if (! parent.getType().isArrayOrVector())
+                        throwError();
+
+                    if ((flags & isDynamicFlag) != 0)
+                    {
+                        auto& index = readExpression();
+                        auto& a = module->allocate<heart::ArrayElement> (CodeLocation(), parent, index);
+                        a.isRangeTrusted = (flags & isRangeTrustedFlag) != 0;
+                        a.suppressWrapWarning = (flags & suppressWrapWarningFlag) != 0;
+                        return a;
+                    }
+
+                    auto startIndex = static_cast<size_t> (readInt());
+                    auto endIndex = static_cast<size_t> (readInt());
+                    auto& a = module->allocate<heart::ArrayElement> (CodeLocation(), parent, startIndex, endIndex);
+                    a.isRangeTrusted = (flags & isRangeTrustedFlag) != 0;
+                    a.suppressWrapWarning = (flags & suppressWrapWarningFlag) != 0;
+                    return a;
+                }
+
+                case ExpressionTag::structElement:
+                {
+                    auto& parent = readExpression();
+                    auto member = readString();
+
+                    if (! (parent.getType().isStruct() && parent.getType().getStructRef().hasMemberWithName (member)))
+                        throwError();
+
+                    return module->allocate<heart::StructElement> (CodeLocation(), parent, std::move (member));
+                }
+
+                case ExpressionTag::typeCast:
+                {
+                    auto& source = readExpression();
+                    return module->allocate<heart::TypeCast> (CodeLocation(), source, readType());
+                }
+
+                case ExpressionTag::unaryOperator:
+                {
+                    auto& source = readExpression();
+                    return module->allocate<heart::UnaryOperator> (CodeLocation(), source, static_cast<UnaryOp::Op> (readInt()));
+                }
+
+                case ExpressionTag::binaryOperator:
+                {
+                    auto& lhs = readExpression();
+                    auto& rhs = readExpression();
+                    return module->allocate<heart::BinaryOperator> (CodeLocation(), lhs, rhs, static_cast<BinaryOp::Op> (readInt()));
+                }
+
+                case ExpressionTag::pureFunctionCall:
+                {
+                    auto& fc = module->allocate<heart::PureFunctionCall> (CodeLocation(), readFunction());
+                    readExpressionList (fc.arguments);
+                    return fc;
+                }
+
+                case ExpressionTag::processorProperty:
+                    return module->allocate<heart::ProcessorProperty> (CodeLocation(), static_cast<heart::ProcessorProperty::Property> (readInt()));
+
+                case ExpressionTag::null:
+                default:
+                    throwError();
+                    return module->allocator.allocateConstant (Value());
+            }
+        }
+
+        heart::Variable& readNewVariable()
+        {
+            auto name = readIdentifier();
+            auto type = readType();
+            auto role = static_cast<heart::Variable::Role> (readInt());
+            auto& v = module->allocate<heart::Variable> (CodeLocation(), std::move (type), name, role);
+
+            v.externalHandle = static_cast<ConstantTable::Handle> (readSignedInt());
+            v.annotation = readAnnotation();
+            variables.push_back (v);
+            return v;
+        }
+
+        heart::Function& readFunction()
+        {
+            return getItem (functions, readInt());
+        }
+
+        pool_ptr<heart::ProcessorInstance> readNode()
+        {
+            auto index = readInt();
+
+            if (index == 0)
+                return {};
+
+            return getItem (nodes, index - 1);
+        }
+
+        template <typename IntType>
+        std::optional<IntType> readOptionalIndex()
+        {
+            auto index = readInt();
+
+            if (index == 0)
+                return {};
+
+            return static_cast<IntType> (index - 1);
+        }
+
+        template <typename ItemType>
+        ItemType& getItem (std::vector<ItemType>& items, uint64_t index)
+        {
+            if (index >= items.size())
+                throwError();
+
+            return items[static_cast<size_t> (index)];
+        }
+
+        //==============================================================================
+        Type readType()
+        {
+            auto tag = static_cast<TypeTag> (readByte());
+
+            if (tag == TypeTag::invalid)
+                return {};
+
+            Type type;
+
+            switch (tag)
+            {
+                case TypeTag::primitive:      type = Type (readPrimitive()); break;
+                case TypeTag::stringLiteral:  type = Type::createStringLiteral(); break;
+                case TypeTag::wrapped:        type = Type::createWrappedInt (readBoundedIntLimit()); break;
+                case TypeTag::clamped:        type = Type::createClampedInt (readBoundedIntLimit()); break;
+                case TypeTag::unsizedArray:   type = readArrayElementType().createUnsizedArray(); break;
+                case TypeTag::structure:      type = Type::createStruct (*getItem (structs, readInt())); break;
+
+                case TypeTag::vector:
+                {
+                    auto elementType = readPrimitive();
+                    auto size = readInt();
+
+                    if (! (elementType.canBeVectorElementType() && Type::isLegalVectorSize (static_cast<int64_t> (size))))
+                        throwError();
+
+                    type = Type::createVector (elementType, static_cast<Type::ArraySize> (size));
+                    break;
+                }
+
+                case TypeTag::fixedArray:
+                {
+                    auto elementType = readArrayElementType();
+                    auto size = readInt();
+
+                    if (size == 0 || size > Type::maxArraySize)
+                        throwError();
+
+                    type = elementType.createArray (static_cast<Type::ArraySize> (size));
+                    break;
+                }
+
+                case TypeTag::invalid:
+                default:
+                    throwError();
+            }
+
+            auto flags = readInt();
+            return type.withConstAndRefFlags ((flags & 1) != 0, (flags & 2) != 0);
+        }
+
+        PrimitiveType readPrimitive()
+        {
+            auto primitive = readInt();
+
+            if (primitive == 0 || primitive > PrimitiveType::bool_)
+                throwError();
+
+            return PrimitiveType (static_cast<PrimitiveType::Primitive> (primitive));
+        }
+
+        Type::BoundedIntSize readBoundedIntLimit()
+        {
+            auto limit = readInt();
+
+            if (! Type::isLegalBoundedIntSize (static_cast<int64_t> (limit)))
+                throwError();
+
+            return static_cast<Type::BoundedIntSize> (limit);
+        }
+
+        Type readArrayElementType()
+        {
+            auto elementType = readType();
+
+            if (! elementType.canBeArrayElementType())
+                throwError();
+
+            return elementType;
+        }
+
+        Value readValue()
+        {
+            auto type = readType();
+            auto size = static_cast<size_t> (readInt());
+
+            if (! type.isValid())
+            {
+                if (size != 0)
+                    throwError();
+
+                return {};
+            }
+
+            if (size == 0)
+                return Value::zeroInitialiser (std::move (type));
+
+            if (size != type.getPackedSizeInBytes())
+                throwError();
+
+            if (size >= minBlobSize)
+                data = start + getAlignedSize<blobAlignment> (static_cast<size_t> (data - start));
+
+            return Value::createFromRawData (std::move (type), readBytes (size), size);
+        }
+
+        Annotation readAnnotation()
+        {
+            Annotation annotation;
+            auto numProperties = readInt();
+
+            if (numProperties == 0)
+                return annotation;
+
+            StringDictionary dictionary;
+
+            for (auto i = readInt(); i > 0; --i)
+            {
+                auto handle = static_cast<uint32_t> (readInt());
+                dictionary.addItem ({ { handle }, readString() });
+            }
+
+            for (uint64_t i = 0; i < numProperties; ++i)
+            {
+                auto name = readString();
+                annotation.set (name, readValue(), dictionary);
+            }
+
+            return annotation;
+        }
+
+        //==============================================================================
+        uint8_t readByte()
+        {
+            return *readBytes (1);
+        }
+
+        uint64_t readInt()
+        {
+            uint64_t n = 0;
+
+            for (uint32_t shift = 0; shift < 64; shift += 7)
+            {
+                auto byte = readByte();
+                n |= static_cast<uint64_t> (byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0)
+                    return n;
+            }
+
+            throwError();
+            return 0;
+        }
+
+        int64_t readSignedInt()
+        {
+            auto n = readInt();
+            return static_cast<int64_t> (n >> 1) ^ -static_cast<int64_t> (n & 1);
+        }
+
+        template <typename Primitive>
+        Primitive readRaw()
+        {
+            Primitive value;
+            memcpy (std::addressof (value), readBytes (sizeof (value)), sizeof (value));
+            return value;
+        }
+
+        const uint8_t* readBytes (size_t size)
+        {
+            if (data > end || static_cast<size_t> (end - data) < size)
+                throwError();
+
+            auto bytes = data;
+            data += size;
+            return bytes;
+        }
+
+        size_t readStringIndex()
+        {
+            auto index = readInt();
+
+            if (index != 0)
+            {
+                if (index > strings.size())
+                    throwError();
+
+                return static_cast<size_t> (index - 1);
+            }
+
+            auto length = static_cast<size_t> (readInt());
+            auto chars = reinterpret_cast<const char*> (readBytes (length));
+            strings.emplace_back (chars, length);
+            identifiers.emplace_back();
+            return strings.size() - 1;
+        }
+
+        std::string readString()
+        {
+            return strings[readStringIndex()];
+        }
+
+        Identifier readIdentifier()
+        {
+            auto index = readStringIndex();
+            auto& identifier = identifiers[index];
+
+            if (! identifier.isValid() && ! strings[index].empty())
+                identifier = program.getAllocator().get (strings[index]);
+
+            return identifier;
+        }
+
+        [[noreturn]] static void throwError()
+        {
+            CodeLocation().throwError (Errors::invalidProgramData());
+        }
+    };
+};
+
+} // namespace soul
@@ -88,6 +88,221 @@ struct CallFlowGraph
         return results;
     }
 
+    //==============================================================================
+    /** Works out which blocks of a function dominate which others.
+
+        The reachable blocks are held in reverse post-order, so every block comes after
+        its immediate dominator, and blocks which can't be reached from the entry block
+        are left out altogether. The function's block predecessor lists are rebuilt
+        when this is created.
+    */
+    struct DominatorTree
+    {
+        DominatorTree (heart::Function& f)
+        {
+            f.rebuildBlockPredecessors();
+
+            if (! f.blocks.empty())
+            {
+                findReversePostOrder (f.blocks.front());
+                findImmediateDominators();
+            }
+        }
+
+        static constexpr size_t notFound = std::numeric_limits<size_t>::max();
+
+        size_t getIndex (const heart::Block& b) const
+        {
+            auto i = indexes.find (std::addressof (b));
+            return i != indexes.end() ? i->second : notFound;
+        }
+
+        bool isReachable (const heart::Block& b) const                  { return getIndex (b) != notFound; }
+        size_t getImmediateDominator (size_t blockIndex) const          { return immediateDominators[blockIndex]; }
+        const std::vector<size_t>& getChildren (size_t blockIndex) const  { return children[blockIndex]; }
+
+        bool dominates (size_t dominator, size_t blockIndex) const
+        {
+            while (blockIndex > dominator)
+                blockIndex = immediateDominators[blockIndex];
+
+            return blockIndex == dominator;
+        }
+
+        bool dominates (const heart::Block& dominator, const heart::Block& b) const
+        {
+            auto dominatorIndex = getIndex (dominator);
+            auto blockIndex = getIndex (b);
+
+            return dominatorIndex != notFound && blockIndex != notFound
+                    && dominates (dominatorIndex, blockIndex);
+        }
+
+        std::vector<pool_ref<heart::Block>> blocks;
+
+    private:
+        std::unordered_map<const heart::Block*, size_t> indexes;
+        std::vector<size_t> immediateDominators;
+        std::vector<std::vector<size_t>> children;
+
+        void findReversePostOrder (heart::Block& entry)
+        {
+            struct StackItem
+            {
+                heart::Block& block;
+                size_t nextDestination;
+            };
+
+            std::vector<StackItem> stack;
+            std::unordered_set<const heart::Block*> visited;
+
+            stack.push_back ({ entry, 0 });
+            visited.insert (std::addressof (entry));
+
+            while (! stack.empty())
+            {
+                auto& top = stack.back();
+                auto destinations = top.block.terminator->getDestinationBlocks();
+
+                if (top.nextDestination < destinations.size())
+                {
+                    auto& next = destinations[top.nextDestination++].get();
+
+                    if (visited.insert (std::addressof (next)).second)
+                        stack.push_back ({ next, 0 });
+                }
+                else
+                {
+                    blocks.push_back (top.block);
+                    stack.pop_back();
+                }
+            }
+
+            std::reverse (blocks.begin(), blocks.end());
+
+            for (size_t i = 0; i < blocks.size(); ++i)
+                indexes[blocks[i].getPointer()] = i;
+        }
+
+        void findImmediateDominators()
+        {
+            immediateDominators.resize (blocks.size(), notFound);
+            immediateDominators[0] = 0;
+
+            auto findCommonDominator = [this] (size_t a, size_t b)
+            {
+                while (a != b)
+                {
+                    while (a > b)  a = immediateDominators[a];
+                    while (b > a)  b = immediateDominators[b];
+                }
+
+                return a;
+            };
+
+            for (bool anyChanged = true; anyChanged;)
+            {
+                anyChanged = false;
+
+                for (size_t i = 1; i < blocks.size(); ++i)
+                {
+                    auto newDominator = notFound;
+
+                    for (auto& pred : blocks[i]->predecessors)
+                    {
+                        auto predIndex = getIndex (pred);
+
+                        if (predIndex != notFound && immediateDominators[predIndex] != notFound)
+                            newDominator = newDominator == notFound ? predIndex
+                                                                    : findCommonDominator (predIndex, newDominator);
+                    }
+
+                    if (immediateDominators[i] != newDominator)
+                    {
+                        immediateDominators[i] = newDominator;
+                        anyChanged = true;
+                    }
+                }
+            }
+
+            children.resize (blocks.size());
+
+            for (size_t i = 1; i < blocks.size(); ++i)
+                children[immediateDominators[i]].push_back (i);
+        }
+    };
+
+    //==============================================================================
+    /** A loop whose header block dominates all the other blocks in it. The block numbers
+        are indexes into the DominatorTree that was used to find the loop.
+    */
+    struct NaturalLoop
+    {
+        size_t header;
+        std::vector<size_t> blocks;     // in reverse post-order, starting with the header
+        std::vector<size_t> latches;    // the blocks which branch back to the header
+
+        bool contains (size_t blockIndex) const     { return std::binary_search (blocks.begin(), blocks.end(), blockIndex); }
+    };
+
+    /** Finds the natural loops in a function, with any inner loops coming before the loops
+        that contain them. Back-edges which share a header are treated as a single loop.
+    */
+    static std::vector<NaturalLoop> findNaturalLoops (const DominatorTree& dominators)
+    {
+        std::vector<NaturalLoop> loops;
+
+        for (size_t header = 0; header < dominators.blocks.size(); ++header)
+        {
+            NaturalLoop loop { header, {}, {} };
+
+            for (auto& pred : dominators.blocks[header]->predecessors)
+            {
+                auto predIndex = dominators.getIndex (pred);
+
+                if (predIndex != DominatorTree::notFound && dominators.dominates (header, predIndex))
+                    loop.latches.push_back (predIndex);
+            }
+
+            if (loop.latches.empty())
+                continue;
+
+            std::vector<bool> isInLoop (dominators.blocks.size());
+            isInLoop[header] = true;
+            auto blocksToVisit = loop.latches;
+
+            while (! blocksToVisit.empty())
+            {
+                auto b = blocksToVisit.back();
+                blocksToVisit.pop_back();
+
+                if (isInLoop[b])
+                    continue;
+
+                isInLoop[b] = true;
+
+                for (auto& pred : dominators.blocks[b]->predecessors)
+                {
+                    auto predIndex = dominators.getIndex (pred);
+
+                    if (predIndex != DominatorTree::notFound && ! isInLoop[predIndex])
+                        blocksToVisit.push_back (predIndex);
+                }
+            }
+
+            for (size_t i = header; i < isInLoop.size(); ++i)
+                if (isInLoop[i])
+                    loop.blocks.push_back (i);
+
+            loops.push_back (std::move (loop));
+        }
+
+        std::stable_sort (loops.begin(), loops.end(),
+                          [] (const NaturalLoop& a, const NaturalLoop& b) { return a.blocks.size() < b.blocks.size(); });
+
+        return loops;
+    }
+
 private:
     //==============================================================================
     static void resetVisitedFlags (const heart::Function& f)
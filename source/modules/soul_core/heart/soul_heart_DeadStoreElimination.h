@@ -0,0 +1,664 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Removes the copies and stores which the HEART generator leaves behind when it builds
+    temporaries for assignments, function arguments and struct or array elements.
+
+    Unlike the SSA passes, these work on any function, including ones whose variables are
+    only ever written through elements, so they also tidy up the struct and array values
+    which promoteLocalVariables() has to leave alone.
+
+    propagateCopies() replaces reads of a variable that was copied from another one with
+    reads of the original, for as long as neither of them changes. removeDeadStores() uses
+    the liveness of each local variable to remove assignments to it (or to any of its
+    elements) which can never be read, and also removes writes to state which get
+    overwritten in the same block before anything could see them.
+    removeUnreadStateVariables() gets rid of any state variables which nothing ever reads.
+*/
+struct DeadStoreElimination
+{
+    static void propagateCopies (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                propagateCopies (f);
+    }
+
+    static void removeDeadStores (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                removeDeadStores (f);
+    }
+
+    //==============================================================================
+    static void propagateCopies (heart::Function& f)
+    {
+        if (! canBeAnalysed (f))
+            return;
+
+        for (int i = 0; i < maxNumIterations; ++i)
+            if (! CopyPropagator (f).perform())
+                break;
+    }
+
+    static void removeDeadStores (heart::Function& f)
+    {
+        if (! canBeAnalysed (f))
+            return;
+
+        for (int i = 0; i < maxNumIterations; ++i)
+            if (! DeadStoreRemover (f).perform())
+                break;
+    }
+
+    //==============================================================================
+    /** Removes any state variables which are never read by any function in the program,
+        along with all the statements that write to them.
+
+        A variable which is written by a function call or a stream read is kept, because
+        the statement that writes it has to stay.
+    */
+    static void removeUnreadStateVariables (Program& program)
+    {
+        std::unordered_set<const heart::Variable*> variablesToKeep;
+
+        for (auto& m : program.getModules())
+        {
+            for (auto& f : m->functions)
+            {
+                for (auto& b : f->blocks)
+                {
+                    for (auto s : b->statements)
+                    {
+                        auto target = getTargetVariable (*s);
+
+                        if (target != nullptr && ! is_type<heart::AssignFromValue> (*s))
+                            variablesToKeep.insert (target.get());
+
+                        // a variable which is only read in order to calculate a new value for
+                        // itself isn't being read by anything else
+                        s->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+                        {
+                            if (mode != AccessType::write)
+                                if (auto v = cast<heart::Variable> (value))
+                                    if (v != target || mode == AccessType::readWrite)
+                                        variablesToKeep.insert (v.get());
+                        });
+                    }
+
+                    if (b->terminator != nullptr)
+                        b->terminator->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                        {
+                            if (auto v = cast<heart::Variable> (value))
+                                variablesToKeep.insert (v.get());
+                        });
+                }
+            }
+        }
+
+        auto isUnread = [&] (heart::Variable& v)
+        {
+            return v.role == heart::Variable::Role::state
+                    && variablesToKeep.find (std::addressof (v)) == variablesToKeep.end();
+        };
+
+        for (auto& m : program.getModules())
+        {
+            for (auto& f : m->functions)
+            {
+                for (auto& b : f->blocks)
+                {
+                    b->statements.removeMatches ([&] (heart::Statement& s)
+                    {
+                        auto target = getTargetVariable (s);
+                        return target != nullptr && isUnread (*target);
+                    });
+                }
+            }
+
+            removeIf (m->stateVariables, isUnread);
+        }
+    }
+
+private:
+    //==============================================================================
+    static constexpr int maxNumIterations = 8;
+    using VariableSet = std::vector<bool>;
+
+    static bool canBeAnalysed (heart::Function& f)
+    {
+        if (f.hasNoBody || f.blocks.empty())
+            return false;
+
+        for (auto& b : f.blocks)
+            if (b->terminator == nullptr)
+                return false;
+
+        return true;
+    }
+
+    static pool_ptr<heart::Variable> getTargetVariable (heart::Statement& s)
+    {
+        if (auto a = cast<heart::Assignment> (s))
+            if (a->target != nullptr)
+                return a->target->getRootVariable();
+
+        return {};
+    }
+
+    /** The variables which belong to a single call of a function, so that nothing outside
+        the function can see their values.
+    */
+    static bool isPrivateToFunction (const heart::Variable& v)
+    {
+        return (v.isFunctionLocal() || v.isParameter()) && ! v.type.isReference();
+    }
+
+    static std::vector<heart::Statement*> getStatements (heart::Block& b)
+    {
+        std::vector<heart::Statement*> statements;
+
+        for (auto s : b.statements)
+            statements.push_back (s);
+
+        return statements;
+    }
+
+    //==============================================================================
+    /** Indexes the blocks, and the local variables of a function, and records where each
+        local first appears.
+
+        When HEART is parsed, a local is declared by the first statement that mentions it, so
+        that statement can't be removed, and a variable can only be substituted for another
+        one at a point after the other one has been declared.
+    */
+    struct FunctionVariables
+    {
+        FunctionVariables (heart::Function& fn)  : f (fn)
+        {
+            f.rebuildBlockPredecessors();
+            size_t position = 0;
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
+            {
+                blockIndexes[f.blocks[i].getPointer()] = i;
+
+                for (auto& p : f.blocks[i]->parameters)
+                    blockParameters.insert (p.getPointer());
+
+                auto addVariables = [&] (pool_ref<heart::Expression>& value, AccessType)
+                {
+                    if (auto v = cast<heart::Variable> (value))
+                    {
+                        if (isPrivateToFunction (*v) && variableIndexes.find (v.get()) == variableIndexes.end())
+                        {
+                            variableIndexes[v.get()] = variables.size();
+                            variables.push_back (*v);
+                            firstPositions.push_back (position);
+                        }
+                    }
+                };
+
+                for (auto s : f.blocks[i]->statements)
+                {
+                    ++position;
+                    statementPositions[s] = position;
+                    s->visitExpressions (addVariables);
+                }
+
+                ++position;
+                f.blocks[i]->terminator->visitExpressions (addVariables);
+            }
+        }
+
+        size_t getIndex (const heart::Variable& v) const
+        {
+            auto i = variableIndexes.find (std::addressof (v));
+            return i != variableIndexes.end() ? i->second : notFound;
+        }
+
+        size_t getBlockIndex (const heart::Block& b) const
+        {
+            return blockIndexes.find (std::addressof (b))->second;
+        }
+
+        bool isDeclaredBefore (size_t variableIndex, size_t position) const
+        {
+            return variables[variableIndex]->isParameter() || firstPositions[variableIndex] < position;
+        }
+
+        bool isDeclaration (size_t variableIndex, const heart::Statement& s) const
+        {
+            return ! variables[variableIndex]->isParameter()
+                    && firstPositions[variableIndex] == statementPositions.find (std::addressof (s))->second;
+        }
+
+        bool isBlockParameter (size_t variableIndex) const
+        {
+            return blockParameters.find (variables[variableIndex].getPointer()) != blockParameters.end();
+        }
+
+        size_t getPosition (const heart::Statement& s) const
+        {
+            return statementPositions.find (std::addressof (s))->second;
+        }
+
+        static constexpr size_t notFound = std::numeric_limits<size_t>::max();
+
+        heart::Function& f;
+        std::vector<pool_ref<heart::Variable>> variables;
+        std::unordered_map<const heart::Variable*, size_t> variableIndexes;
+        std::unordered_map<const heart::Block*, size_t> blockIndexes;
+        std::unordered_map<const heart::Statement*, size_t> statementPositions;
+        std::unordered_set<const heart::Variable*> blockParameters;
+        std::vector<size_t> firstPositions;
+    };
+
+    //==============================================================================
+    /** Finds the copies which are available at the start of each block, i.e. the ones which
+        are made on every path into the block and aren't followed by a write to either of
+        their variables, and replaces reads of the copies with reads of their sources.
+
+        Block parameters are never used as sources, as they can only be read in their own
+        block, and nothing is propagated past an advance call, for the same reason.
+    */
+    struct CopyPropagator
+    {
+        CopyPropagator (heart::Function& fn)  : f (fn), variables (fn)
+        {
+            for (auto& b : f.blocks)
+            {
+                for (auto s : b->statements)
+                {
+                    if (auto a = cast<heart::AssignFromValue> (*s))
+                    {
+                        auto target = cast<heart::Variable> (a->target);
+                        auto source = cast<heart::Variable> (a->source);
+
+                        if (target != nullptr && source != nullptr && target != source
+                             && isPrivateToFunction (*target) && isPrivateToFunction (*source)
+                             && target->type.isIdentical (source->type))
+                        {
+                            Copy copy { variables.getIndex (*target), variables.getIndex (*source) };
+
+                            if (variables.isBlockParameter (copy.source))
+                                continue;
+
+                            auto copyIndex = copies.size();
+                            copies.push_back (copy);
+                            copyStatements[s] = copyIndex;
+                            copiesOfVariable[copies.back().target].push_back (copyIndex);
+                            copiesOfVariable[copies.back().source].push_back (copyIndex);
+                        }
+                    }
+                }
+            }
+        }
+
+        bool perform()
+        {
+            if (copies.empty())
+                return false;
+
+            findAvailableCopies();
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
+            {
+                auto available = availableAtStart[i];
+                applyBlock (f.blocks[i], available, true);
+            }
+
+            return anyReplaced;
+        }
+
+    private:
+        struct Copy
+        {
+            size_t target, source;
+        };
+
+        heart::Function& f;
+        FunctionVariables variables;
+        std::vector<Copy> copies;
+        std::unordered_map<const heart::Statement*, size_t> copyStatements;
+        std::unordered_map<size_t, std::vector<size_t>> copiesOfVariable;
+        std::vector<VariableSet> availableAtStart;
+        bool anyReplaced = false;
+
+        void findAvailableCopies()
+        {
+            auto numBlocks = f.blocks.size();
+            std::vector<VariableSet> availableAtEnd (numBlocks, VariableSet (copies.size(), true));
+            availableAtStart.assign (numBlocks, VariableSet (copies.size()));
+
+            for (bool anyChanged = true; anyChanged;)
+            {
+                anyChanged = false;
+
+                for (size_t i = 0; i < numBlocks; ++i)
+                {
+                    auto& b = f.blocks[i].get();
+                    VariableSet available (copies.size(), ! b.predecessors.empty() && i != 0);
+
+                    for (auto& pred : b.predecessors)
+                    {
+                        auto& predAvailable = availableAtEnd[variables.getBlockIndex (pred)];
+
+                        for (size_t j = 0; j < available.size(); ++j)
+                            if (! predAvailable[j])
+                                available[j] = false;
+                    }
+
+                    availableAtStart[i] = available;
+                    applyBlock (b, available, false);
+
+                    if (available != availableAtEnd[i])
+                    {
+                        availableAtEnd[i] = std::move (available);
+                        anyChanged = true;
+                    }
+                }
+            }
+        }
+
+        void applyBlock (heart::Block& b, VariableSet& available, bool replaceReads)
+        {
+            for (auto s : b.statements)
+            {
+                if (is_type<heart::AdvanceClock> (*s))
+                {
+                    std::fill (available.begin(), available.end(), false);
+                    continue;
+                }
+
+                if (replaceReads)
+                {
+                    auto position = variables.getPosition (*s);
+
+                    s->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+                    {
+                        replaceRead (value, mode, available, position);
+                    });
+                }
+
+                s->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+                {
+                    if (mode != AccessType::read)
+                        if (auto v = cast<heart::Variable> (value))
+                            removeCopiesOf (*v, available);
+                });
+
+                auto copy = copyStatements.find (s);
+
+                if (copy != copyStatements.end())
+                    available[copy->second] = true;
+            }
+
+            if (replaceReads)
+            {
+                auto position = std::numeric_limits<size_t>::max();
+
+                b.terminator->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+                {
+                    replaceRead (value, mode, available, position);
+                });
+            }
+        }
+
+        void replaceRead (pool_ref<heart::Expression>& value, AccessType mode, const VariableSet& available, size_t position)
+        {
+            if (mode == AccessType::read)
+            {
+                if (auto v = cast<heart::Variable> (value))
+                {
+                    auto index = variables.getIndex (*v);
+
+                    if (index != FunctionVariables::notFound)
+                    {
+                        auto found = copiesOfVariable.find (index);
+
+                        if (found != copiesOfVariable.end())
+                        {
+                            for (auto copyIndex : found->second)
+                            {
+                                auto& copy = copies[copyIndex];
+
+                                if (available[copyIndex] && copy.target == index
+                                     && variables.isDeclaredBefore (copy.source, position))
+                                {
+                                    value = variables.variables[copy.source];
+                                    anyReplaced = true;
+                                    return;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        void removeCopiesOf (const heart::Variable& v, VariableSet& available) const
+        {
+            auto found = copiesOfVariable.find (variables.getIndex (v));
+
+            if (found != copiesOfVariable.end())
+                for (auto copyIndex : found->second)
+                    available[copyIndex] = false;
+        }
+    };
+
+    //==============================================================================
+    /** Works out which local variables are live at the start of each block, and removes any
+        assignments to a local (or to one of its elements) whose value can't be read before
+        the variable is next overwritten.
+
+        Writing to an element doesn't end the life of the variable's previous value, because
+        the other elements are still needed. Stores to state variables are only removed when
+        they're overwritten later in the same block, with nothing in between that could read
+        them.
+    */
+    struct DeadStoreRemover
+    {
+        DeadStoreRemover (heart::Function& fn)  : f (fn), variables (fn)
+        {
+            for (auto& b : f.blocks)
+            {
+                auto findReads = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+                {
+                    if (mode != AccessType::write)
+                        if (auto v = cast<heart::Variable> (value))
+                            variablesNeeded.insert (v.get());
+                };
+
+                for (auto s : b->statements)
+                {
+                    s->visitExpressions (findReads);
+
+                    if (! is_type<heart::AssignFromValue> (*s))
+                        if (auto target = getTargetVariable (*s))
+                            variablesNeeded.insert (target.get());
+                }
+
+                b->terminator->visitExpressions (findReads);
+            }
+        }
+
+        bool perform()
+        {
+            auto numBlocks = f.blocks.size();
+            liveAtStart.assign (numBlocks, VariableSet (variables.variables.size()));
+
+            for (bool anyChanged = true; anyChanged;)
+            {
+                anyChanged = false;
+
+                for (size_t i = numBlocks; i-- > 0;)
+                {
+                    auto live = findLiveVariablesAtStart (f.blocks[i], nullptr);
+
+                    if (live != liveAtStart[i])
+                    {
+                        liveAtStart[i] = std::move (live);
+                        anyChanged = true;
+                    }
+                }
+            }
+
+            std::unordered_set<const heart::Statement*> deadStores;
+
+            for (auto& b : f.blocks)
+                findLiveVariablesAtStart (b, std::addressof (deadStores));
+
+            if (deadStores.empty())
+                return false;
+
+            for (auto& b : f.blocks)
+                b->statements.removeMatches ([&] (heart::Statement& s) { return deadStores.find (std::addressof (s)) != deadStores.end(); });
+
+            return true;
+        }
+
+    private:
+        heart::Function& f;
+        FunctionVariables variables;
+        // the variables which will still be mentioned after any dead stores have gone
+        std::unordered_set<const heart::Variable*> variablesNeeded;
+        std::vector<VariableSet> liveAtStart;
+
+        VariableSet findLiveVariablesAtStart (heart::Block& b, std::unordered_set<const heart::Statement*>* deadStores)
+        {
+            VariableSet live (variables.variables.size());
+
+            auto addReads = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode != AccessType::write)
+                {
+                    if (auto v = cast<heart::Variable> (value))
+                    {
+                        auto index = variables.getIndex (*v);
+
+                        if (index != FunctionVariables::notFound)
+                            live[index] = true;
+                    }
+                }
+            };
+
+            for (auto dest : b.terminator->getDestinationBlocks())
+            {
+                auto& destLive = liveAtStart[variables.getBlockIndex (dest.get())];
+
+                for (size_t i = 0; i < live.size(); ++i)
+                    if (destLive[i])
+                        live[i] = true;
+            }
+
+            b.terminator->visitExpressions (addReads);
+
+            // state variables which are completely overwritten later in the block
+            std::unordered_set<const heart::Variable*> overwrittenState;
+
+            auto statements = getStatements (b);
+
+            for (auto s = statements.rbegin(); s != statements.rend(); ++s)
+            {
+                auto& statement = **s;
+                auto target = getTargetVariable (statement);
+                bool isWholeVariable = target != nullptr && is_type<heart::Variable> (cast<heart::Assignment> (statement)->target);
+                bool isRemovable = is_type<heart::AssignFromValue> (statement);
+
+                if (target != nullptr)
+                {
+                    auto index = variables.getIndex (*target);
+
+                    if (index != FunctionVariables::notFound)
+                    {
+                        if (isRemovable && ! live[index] && ! isNeededAsDeclaration (index, statement, *target))
+                        {
+                            if (deadStores != nullptr)
+                                deadStores->insert (std::addressof (statement));
+
+                            continue;
+                        }
+
+                        if (isWholeVariable)
+                            live[index] = false;
+                    }
+                    else if (target->isState())
+                    {
+                        if (isRemovable && overwrittenState.find (target.get()) != overwrittenState.end())
+                        {
+                            if (deadStores != nullptr)
+                                deadStores->insert (std::addressof (statement));
+
+                            continue;
+                        }
+                    }
+                }
+
+                if (isWholeVariable && target->isState())
+                    overwrittenState.insert (target.get());
+
+                if (mightReadAnyState (statement))
+                    overwrittenState.clear();
+
+                statement.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+                {
+                    if (mode != AccessType::write)
+                        if (auto v = cast<heart::Variable> (value))
+                            overwrittenState.erase (v.get());
+                });
+
+                statement.visitExpressions (addReads);
+            }
+
+            return live;
+        }
+
+        bool isNeededAsDeclaration (size_t index, const heart::Statement& s, const heart::Variable& target) const
+        {
+            return variables.isDeclaration (index, s)
+                    && variablesNeeded.find (std::addressof (target)) != variablesNeeded.end();
+        }
+
+        static bool mightReadAnyState (heart::Statement& s)
+        {
+            if (is_type<heart::FunctionCall> (s) || is_type<heart::AdvanceClock> (s))
+                return true;
+
+            bool callsFunction = false;
+
+            s.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+            {
+                if (is_type<heart::PureFunctionCall> (value))
+                    callsFunction = true;
+            });
+
+            return callsFunction;
+        }
+    };
+};
+
+} // namespace soul
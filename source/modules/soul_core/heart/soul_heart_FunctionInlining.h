@@ -0,0 +1,252 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Decides which function calls are worth inlining, using a simple model of how much
+    each one costs and how often it's likely to be called.
+
+    Functions are visited callees-first, so by the time a call is considered, the function
+    it calls has already had its own calls inlined. Small leaf functions, calls made from
+    inside a loop, and functions with only one caller are inlined, until the program has
+    grown by the amount that the optimisation level allows.
+*/
+struct FunctionInlining
+{
+    /** The limits used to decide whether to inline a call. Sizes are measured in HEART
+        statements, and the growth budget is a percentage of the program's original size.
+    */
+    struct CostModel
+    {
+        size_t maxLeafFunctionSize, maxSizeForCallInLoop, maxSizeForSingleCaller, growthBudgetPercent;
+
+        static CostModel forOptimisationLevel (int level)
+        {
+            if (level <= 0)  return { 0, 0, 0, 0 };
+            if (level == 1)  return { 6, 6, 30, 10 };
+            if (level == 2)  return { 12, 40, 100, 50 };
+
+            return { 20, 80, 200, 100 };
+        }
+    };
+
+    static void inlineFunctions (Program& program, int optimisationLevel)
+    {
+        inlineFunctions (program, CostModel::forOptimisationLevel (optimisationLevel));
+    }
+
+    static void inlineFunctions (Program& program, CostModel costModel)
+    {
+        if (costModel.maxLeafFunctionSize != 0)
+            CallInliner (program, costModel).perform();
+    }
+
+    static size_t getFunctionSize (heart::Function& f)
+    {
+        size_t size = 0;
+
+        for (auto& b : f.blocks)
+            size += 1 + static_cast<size_t> (std::distance (b->statements.begin(), b->statements.end()));
+
+        return size;
+    }
+
+private:
+    //==============================================================================
+    struct CallInliner
+    {
+        CallInliner (Program& p, CostModel c) : program (p), costModel (c) {}
+
+        void perform()
+        {
+            size_t programSize = 0;
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions)
+                {
+                    programSize += getFunctionSize (f);
+                    countCalls (f);
+                }
+            }
+
+            growthBudget = programSize * costModel.growthBudgetPercent / 100;
+
+            for (auto& m : program.getModules())
+                for (auto& f : m->functions)
+                    visitCalleesFirst (f);
+
+            for (auto& f : functionsToRemove)
+                if (numCallers[f.getPointer()] == 0)
+                    removeItem (program.getModuleContainingFunction (f)->functions, f);
+        }
+
+    private:
+        struct CallSite
+        {
+            heart::FunctionCall& call;
+            bool isInLoop;
+        };
+
+        Program& program;
+        CostModel costModel;
+        size_t growthBudget = 0;
+        std::unordered_map<const heart::Function*, size_t> numCallers;
+        std::unordered_set<const heart::Function*> visitedFunctions;
+        std::vector<pool_ref<heart::Function>> functionsToRemove;
+
+        void countCalls (heart::Function& f)
+        {
+            f.visitStatements<heart::FunctionCall> ([this] (heart::FunctionCall& fc)
+            {
+                ++numCallers[std::addressof (fc.getFunction())];
+            });
+
+            f.visitExpressions ([this] (pool_ref<heart::Expression>& value, AccessType)
+            {
+                if (auto fc = cast<heart::PureFunctionCall> (value))
+                    ++numCallers[std::addressof (fc->function)];
+            });
+        }
+
+        void visitCalleesFirst (heart::Function& f)
+        {
+            if (! visitedFunctions.insert (std::addressof (f)).second)
+                return;
+
+            f.visitStatements<heart::FunctionCall> ([this] (heart::FunctionCall& fc)
+            {
+                visitCalleesFirst (fc.getFunction());
+            });
+
+            bool anyInlined = false;
+
+            for (auto& site : findCallSites (f))
+            {
+                if (shouldInline (f, site))
+                {
+                    inlineCall (f, site.call);
+                    anyInlined = true;
+                }
+            }
+
+            if (anyInlined)
+                Optimisations::optimiseFunctionBlocks (f, program.getModuleContainingFunction (f)->allocator);
+        }
+
+        std::vector<CallSite> findCallSites (heart::Function& f)
+        {
+            CallFlowGraph::DominatorTree dominators (f);
+            std::unordered_set<const heart::Block*> blocksInLoops;
+
+            for (auto& loop : CallFlowGraph::findNaturalLoops (dominators))
+                for (auto blockIndex : loop.blocks)
+                    blocksInLoops.insert (dominators.blocks[blockIndex].getPointer());
+
+            std::vector<CallSite> sites;
+
+            for (auto& b : f.blocks)
+                for (auto s : b->statements)
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                        sites.push_back ({ *call, blocksInLoops.find (b.getPointer()) != blocksInLoops.end() });
+
+            return sites;
+        }
+
+        bool shouldInline (heart::Function& caller, const CallSite& site)
+        {
+            auto& callee = site.call.getFunction();
+
+            if (std::addressof (callee) == std::addressof (caller)
+                 || callee.intrinsicType != IntrinsicType::none   // (an intrinsic's body may just be a placeholder)
+                 || callee.annotation.getBool ("do_not_optimise")
+                 || ! heart::Utilities::canFunctionBeInlined (program, caller, site.call))
+                return false;
+
+            // (reference parameters can only be inlined if they refer to a variable)
+            for (size_t i = 0; i < callee.parameters.size(); ++i)
+                if (callee.parameters[i]->type.isReference() && ! is_type<heart::Variable> (site.call.arguments[i]))
+                    return false;
+
+            auto size = getFunctionSize (callee);
+
+            if (numCallers[std::addressof (callee)] == 1 && canBeRemoved (callee))
+                return size <= costModel.maxSizeForSingleCaller;
+
+            if (size > growthBudget)
+                return false;
+
+            if (site.isInLoop && size <= costModel.maxSizeForCallInLoop)
+                return true;
+
+            return size <= costModel.maxLeafFunctionSize && isLeafFunction (callee);
+        }
+
+        static bool canBeRemoved (heart::Function& f)
+        {
+            return f.functionType.isNormal() && ! f.isExported;
+        }
+
+        static bool isLeafFunction (heart::Function& f)
+        {
+            bool callsOtherFunctions = false;
+
+            f.visitStatements<heart::FunctionCall> ([&] (heart::FunctionCall& fc)
+            {
+                if (fc.getFunction().intrinsicType == IntrinsicType::none)
+                    callsOtherFunctions = true;
+            });
+
+            return ! callsOtherFunctions;
+        }
+
+        void inlineCall (heart::Function& caller, heart::FunctionCall& call)
+        {
+            auto& callee = call.getFunction();
+            auto size = getFunctionSize (callee);
+
+            for (size_t i = 0; i < caller.blocks.size(); ++i)
+            {
+                if (contains (caller.blocks[i]->statements, std::addressof (call)))
+                {
+                    Optimisations::makeFunctionCallInline (program, caller, i, call);
+
+                    if (--numCallers[std::addressof (callee)] == 0 && canBeRemoved (callee))
+                    {
+                        // the callee's code has just moved into the caller, so nothing has grown
+                        functionsToRemove.push_back (callee);
+                        return;
+                    }
+
+                    growthBudget -= std::min (growthBudget, size);
+                    countCalls (callee);
+                    return;
+                }
+            }
+
+            SOUL_ASSERT_FALSE;
+        }
+    };
+};
+
+} // namespace soul
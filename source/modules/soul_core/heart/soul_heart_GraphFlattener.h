@@ -0,0 +1,1230 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Replaces graphs of statically connected processor instances with a single processor,
+    so that the connections between the instances become local variables in one run
+    function, rather than buffers which the performer has to copy between them.
+
+    Each instance gets its own copy of its processor's functions and state, prefixed with
+    the instance name. Its run function becomes a "step" function which remembers where it
+    got to in a state variable, and returns wherever it used to call advance(). The new run
+    function calls each step once per frame, in the order that the connections require, and
+    then inlines them. Event connections become direct calls to the destination's handler,
+    and delayed stream connections become ring buffers.
+
+    Graphs which use anything that can't be expressed this way (arrays of instances or
+    endpoints, clock ratios, or delayed event and value connections) are left as they are.
+    Inner graphs are flattened first, so a graph of graphs can end up as a single processor.
+*/
+struct GraphFlattener
+{
+    struct Results
+    {
+        size_t numGraphsFlattened = 0, numProcessorInstancesFused = 0,
+               numConnectionBuffersRemoved = 0, numDelayLinesCreated = 0;
+
+        std::string getDescription() const
+        {
+            return "Flattened " + std::to_string (numGraphsFlattened) + " graphs containing "
+                     + std::to_string (numProcessorInstancesFused) + " processor instances: removed "
+                     + std::to_string (numConnectionBuffersRemoved) + " connection buffers, created "
+                     + std::to_string (numDelayLinesCreated) + " delay lines";
+        }
+    };
+
+    static Results flatten (Program& program)
+    {
+        Results results;
+        auto processorIDCounts = countProcessorIDs (program);
+        std::vector<pool_ref<Module>> graphsToSkip, fusedProcessors;
+
+        for (;;)
+        {
+            auto graph = findNextGraphToFlatten (program, graphsToSkip);
+
+            if (graph == nullptr)
+                break;
+
+            if (canBeFlattened (program, *graph))
+                GraphFuser (program, *graph, processorIDCounts, results, fusedProcessors).perform();
+            else
+                graphsToSkip.push_back (*graph);
+        }
+
+        removeUnusedProcessors (program, fusedProcessors);
+        return results;
+    }
+
+private:
+    //==============================================================================
+    // A processor's id is its position in a depth-first walk of the instances, so this
+    // holds the number of ids that each module uses, to let the fused instances keep theirs.
+    using ProcessorIDCounts = std::unordered_map<std::string, int32_t>;
+
+    static ProcessorIDCounts countProcessorIDs (Program& program)
+    {
+        ProcessorIDCounts counts;
+
+        for (auto& m : program.getModules())
+            countProcessorIDs (program, m, counts);
+
+        return counts;
+    }
+
+    static int32_t countProcessorIDs (Program& program, Module& module, ProcessorIDCounts& counts)
+    {
+        auto found = counts.find (module.fullName);
+
+        if (found != counts.end())
+            return found->second;
+
+        int32_t total = 1;
+
+        for (auto& i : module.processorInstances)
+            if (auto child = program.getModuleWithName (i->sourceName))
+                total += static_cast<int32_t> (i->arraySize) * countProcessorIDs (program, *child, counts);
+
+        counts[module.fullName] = total;
+        return total;
+    }
+
+    static pool_ptr<Module> findNextGraphToFlatten (Program& program, const std::vector<pool_ref<Module>>& graphsToSkip)
+    {
+        for (auto& m : program.getModules())
+            if (m->isGraph() && ! contains (graphsToSkip, m) && areAllInstancesProcessors (program, m))
+                return m;
+
+        return {};
+    }
+
+    static bool areAllInstancesProcessors (Program& program, Module& graph)
+    {
+        for (auto& i : graph.processorInstances)
+        {
+            auto m = program.getModuleWithName (i->sourceName);
+
+            if (m == nullptr || ! m->isProcessor())
+                return false;
+        }
+
+        return true;
+    }
+
+    static void removeUnusedProcessors (Program& program, const std::vector<pool_ref<Module>>& candidates)
+    {
+        auto mainProcessor = program.getMainProcessor();
+
+        for (auto& m : candidates)
+            if (m != mainProcessor && contains (program.getModules(), m) && ! isInstantiated (program, m))
+                program.removeModule (m);
+    }
+
+    static bool isInstantiated (Program& program, const Module& processor)
+    {
+        for (auto& m : program.getModules())
+            for (auto& i : m->processorInstances)
+                if (i->sourceName == processor.fullName)
+                    return true;
+
+        return false;
+    }
+
+    //==============================================================================
+    static bool canBeFlattened (Program& program, Module& graph)
+    {
+        if (graph.processorInstances.empty() || ! graph.functions.empty()
+             || ! graph.stateVariables.empty() || hasEndpointArrays (graph))
+            return false;
+
+        for (auto& i : graph.processorInstances)
+        {
+            auto& processor = *program.getModuleWithName (i->sourceName);
+
+            if (i->arraySize != 1 || i->hasClockMultiplier() || i->hasClockDivider()
+                 || ! canProcessorBeFused (processor) || doEndpointsUseStructsFrom (graph, processor))
+                return false;
+        }
+
+        std::vector<std::pair<const heart::ProcessorInstance*, std::string>> valueDestinations;
+
+        for (auto& c : graph.connections)
+        {
+            auto source = findSourceEndpoint (program, graph, c);
+            auto dest = findDestEndpoint (program, graph, c);
+
+            if (source == nullptr || dest == nullptr || c->sourceEndpointIndex || c->destEndpointIndex)
+                return false;
+
+            if (c->delayLength > 0 && ! source->isStreamEndpoint())
+                return false;
+
+            if (dest->isValueEndpoint())
+            {
+                std::pair<const heart::ProcessorInstance*, std::string> destination (c->destProcessor.get(), c->destEndpoint);
+
+                if (contains (valueDestinations, destination))
+                    return false;
+
+                valueDestinations.push_back (destination);
+            }
+        }
+
+        return getProcessingOrder (graph).size() == graph.processorInstances.size();
+    }
+
+    static bool canProcessorBeFused (Module& processor)
+    {
+        auto run = processor.findRunFunction();
+
+        if (run == nullptr || hasEndpointArrays (processor))
+            return false;
+
+        for (auto& v : processor.stateVariables)
+            if (v->isExternal())
+                return false;
+
+        for (auto& b : run->blocks)
+            if (! b->parameters.empty())
+                return false;
+
+        // streams and advance() can only be used by the run function, which is where they get replaced
+        for (auto& f : processor.functions)
+        {
+            if (f == run)
+                continue;
+
+            for (auto& b : f->blocks)
+            {
+                for (auto s : b->statements)
+                {
+                    if (is_type<heart::AdvanceClock> (*s))
+                        return false;
+
+                    if (auto r = cast<heart::ReadStream> (*s))
+                        if (r->source->isStreamEndpoint())
+                            return false;
+
+                    if (auto w = cast<heart::WriteStream> (*s))
+                        if (w->target->isStreamEndpoint())
+                            return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    static bool hasEndpointArrays (const Module& m)
+    {
+        for (auto& i : m.inputs)
+            if (i->arraySize.has_value())
+                return true;
+
+        for (auto& o : m.outputs)
+            if (o->arraySize.has_value())
+                return true;
+
+        return false;
+    }
+
+    static bool doEndpointsUseStructsFrom (const Module& graph, const Module& processor)
+    {
+        auto usesStruct = [&] (const heart::IODeclaration& io)
+        {
+            for (auto& type : io.dataTypes)
+                for (auto& s : processor.structs)
+                    if (type.usesStruct (*s))
+                        return true;
+
+            return false;
+        };
+
+        for (auto& i : graph.inputs)
+            if (usesStruct (i))
+                return true;
+
+        for (auto& o : graph.outputs)
+            if (usesStruct (o))
+                return true;
+
+        return false;
+    }
+
+    static pool_ptr<heart::IODeclaration> findSourceEndpoint (Program& program, Module& graph, const heart::Connection& c)
+    {
+        if (c.sourceProcessor == nullptr)
+            return graph.findInput (c.sourceEndpoint);
+
+        if (auto m = program.getModuleWithName (c.sourceProcessor->sourceName))
+            return m->findOutput (c.sourceEndpoint);
+
+        return {};
+    }
+
+    static pool_ptr<heart::IODeclaration> findDestEndpoint (Program& program, Module& graph, const heart::Connection& c)
+    {
+        if (c.destProcessor == nullptr)
+            return graph.findOutput (c.destEndpoint);
+
+        if (auto m = program.getModuleWithName (c.destProcessor->sourceName))
+            return m->findInput (c.destEndpoint);
+
+        return {};
+    }
+
+    /** Puts the instances in an order where each one comes after the instances that feed
+        its inputs (other than through a delay), or returns fewer instances if there's a cycle.
+    */
+    static std::vector<pool_ref<heart::ProcessorInstance>> getProcessingOrder (const Module& graph)
+    {
+        std::vector<pool_ref<heart::ProcessorInstance>> remaining (graph.processorInstances), ordered;
+
+        auto isReady = [&] (pool_ref<heart::ProcessorInstance> i)
+        {
+            for (auto& c : graph.connections)
+                if (c->delayLength == 0 && c->destProcessor == i && c->sourceProcessor != nullptr
+                     && ! contains (ordered, *c->sourceProcessor))
+                    return false;
+
+            return true;
+        };
+
+        while (! remaining.empty())
+        {
+            auto next = std::find_if (remaining.begin(), remaining.end(), isReady);
+
+            if (next == remaining.end())
+                break;
+
+            ordered.push_back (*next);
+            remaining.erase (next);
+        }
+
+        return ordered;
+    }
+
+    //==============================================================================
+    /** Finds the local variables whose values are needed again after an advance() call. */
+    static std::vector<pool_ref<heart::Variable>> findVariablesLiveAcrossAdvances (heart::Function& f)
+    {
+        using VariableSet = std::unordered_set<heart::Variable*>;
+
+        struct BlockLiveness
+        {
+            std::vector<heart::Statement*> statements;
+            VariableSet uses, defs, liveIn, liveOut;
+        };
+
+        std::unordered_map<const heart::Block*, BlockLiveness> liveness;
+
+        for (auto& b : f.blocks)
+        {
+            auto& info = liveness[b.getPointer()];
+
+            for (auto s : b->statements)
+            {
+                info.statements.push_back (s);
+
+                for (auto v : getLocalVariablesRead (*s))
+                    if (info.defs.find (v) == info.defs.end())
+                        info.uses.insert (v);
+
+                if (auto v = getLocalVariableWritten (*s))
+                    info.defs.insert (v);
+            }
+
+            for (auto v : getLocalVariablesRead (*b->terminator))
+                if (info.defs.find (v) == info.defs.end())
+                    info.uses.insert (v);
+        }
+
+        for (bool anyChanged = true; anyChanged;)
+        {
+            anyChanged = false;
+
+            for (auto i = f.blocks.size(); i > 0; --i)
+            {
+                auto& b = f.blocks[i - 1];
+                auto& info = liveness[b.getPointer()];
+
+                for (auto& dest : b->terminator->getDestinationBlocks())
+                    for (auto v : liveness[dest.getPointer()].liveIn)
+                        info.liveOut.insert (v);
+
+                auto liveIn = info.uses;
+
+                for (auto v : info.liveOut)
+                    if (info.defs.find (v) == info.defs.end())
+                        liveIn.insert (v);
+
+                // (the live sets only ever grow, so comparing sizes is enough)
+                if (liveIn.size() != info.liveIn.size())
+                {
+                    info.liveIn = std::move (liveIn);
+                    anyChanged = true;
+                }
+            }
+        }
+
+        VariableSet liveAcrossAdvances;
+
+        for (auto& b : f.blocks)
+        {
+            auto& info = liveness[b.getPointer()];
+            auto live = info.liveOut;
+
+            for (auto v : getLocalVariablesRead (*b->terminator))
+                live.insert (v);
+
+            for (auto i = info.statements.size(); i > 0; --i)
+            {
+                auto& s = *info.statements[i - 1];
+
+                if (is_type<heart::AdvanceClock> (s))
+                    liveAcrossAdvances.insert (live.begin(), live.end());
+
+                if (auto v = getLocalVariableWritten (s))
+                    live.erase (v);
+
+                for (auto v : getLocalVariablesRead (s))
+                    live.insert (v);
+            }
+        }
+
+        // (returned in the order they're first used, so that the result is repeatable)
+        std::vector<pool_ref<heart::Variable>> result;
+
+        f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+        {
+            if (auto v = cast<heart::Variable> (value))
+                if (liveAcrossAdvances.erase (v.get()) != 0)
+                    result.push_back (*v);
+        });
+
+        return result;
+    }
+
+    /** Only an assignment to a whole variable counts as a definition: writing to part of
+        one also needs the rest of its old value.
+    */
+    static heart::Variable* getLocalVariableWritten (heart::Statement& s)
+    {
+        if (auto a = cast<heart::Assignment> (s))
+            if (auto v = cast<heart::Variable> (a->target))
+                if (v->isFunctionLocal())
+                    return v.get();
+
+        return nullptr;
+    }
+
+    template <typename StatementOrTerminator>
+    static std::vector<heart::Variable*> getLocalVariablesRead (StatementOrTerminator& s)
+    {
+        std::vector<heart::Variable*> variables;
+
+        s.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+        {
+            if (auto v = cast<heart::Variable> (value))
+                if (v->isFunctionLocal())
+                    variables.push_back (v.get());
+        });
+
+        return variables;
+    }
+
+    static std::vector<heart::Variable*> getLocalVariablesRead (heart::Statement& s)
+    {
+        auto variables = getLocalVariablesRead<heart::Statement> (s);
+
+        // the target of a whole-variable assignment is the first thing that gets visited
+        if (auto written = getLocalVariableWritten (s))
+            variables.erase (std::find (variables.begin(), variables.end(), written));
+
+        return variables;
+    }
+
+    //==============================================================================
+    struct GraphFuser
+    {
+        GraphFuser (Program& p, Module& g, const ProcessorIDCounts& processorIDCounts,
+                    Results& r, std::vector<pool_ref<Module>>& processors)
+            : program (p), graph (g), fused (p.addProcessor (getModuleIndex (p, g))),
+              results (r), fusedProcessors (processors)
+        {
+            instances.reserve (graph.processorInstances.size());
+            int32_t nextProcessorID = 1;
+
+            for (auto& i : graph.processorInstances)
+            {
+                auto& processor = *program.getModuleWithName (i->sourceName);
+                instances.emplace_back (i, processor, makeSafeIdentifierName (i->instanceName), nextProcessorID);
+                nextProcessorID += processorIDCounts.at (processor.fullName);
+            }
+
+            for (auto& i : getProcessingOrder (graph))
+                processingOrder.push_back (std::addressof (getInstance (i.getPointer())));
+        }
+
+        void perform()
+        {
+            fused.shortName         = graph.shortName;
+            fused.fullName          = graph.fullName;
+            fused.originalFullName  = graph.originalFullName;
+            fused.annotation        = graph.annotation;
+            fused.sampleRate        = graph.sampleRate;
+            fused.inputs            = graph.inputs;
+            fused.outputs           = graph.outputs;
+            fused.structs           = graph.structs;
+
+            createStructCopies();
+
+            for (auto& i : instances)
+                cloneInstance (i);
+
+            createConnectionVariables();
+
+            for (auto& i : instances)
+            {
+                convertRunToStepFunction (i);
+                replaceEndpointAccess (i);
+                offsetProcessorIDs (i);
+
+                for (auto& f : i.functions)
+                    if (! (f->functionType.isNormal() || f->functionType.isIntrinsic()))
+                        f->functionType = heart::FunctionType::normal();
+            }
+
+            createEventHandlers();
+            createInitFunction();
+            createRunFunction();
+
+            for (auto& i : instances)
+                Optimisations::inlineAllCallsToFunction (program, *i.stepFunction);
+
+            removeUncalledFunctions();
+            program.removeModule (graph);
+
+            ++results.numGraphsFlattened;
+            results.numProcessorInstancesFused += instances.size();
+
+            for (auto& i : instances)
+                fusedProcessors.push_back (i.processor);
+        }
+
+    private:
+        //==============================================================================
+        struct FusedInstance
+        {
+            FusedInstance (heart::ProcessorInstance& i, Module& p, std::string prefixToUse, int32_t id)
+                : instance (i), processor (p), prefix (std::move (prefixToUse)), processorIDOffset (id)
+            {}
+
+            heart::ProcessorInstance& instance;
+            Module& processor;
+            std::string prefix;
+            int32_t processorIDOffset;
+
+            ModuleCloner::FunctionMappings functionMappings;
+            ModuleCloner::VariableMappings variableMappings;
+            std::vector<pool_ref<heart::Function>> functions;
+            pool_ptr<heart::Function> stepFunction, systemInitFunction;
+
+            // the stream accumulators that the step function needs, which are passed by reference
+            std::unordered_map<const heart::Variable*, pool_ptr<heart::Variable>> stepParameters;
+            heart::FunctionCall::ArgListType stepArguments;
+        };
+
+        struct EndpointVariable
+        {
+            const heart::ProcessorInstance* instance;
+            std::string endpoint;
+            pool_ref<heart::Variable> variable;
+        };
+
+        struct DelayLine
+        {
+            const heart::Connection* connection;
+            pool_ref<heart::Variable> buffer;
+            pool_ptr<heart::Variable> position;
+        };
+
+        Program& program;
+        Module& graph;
+        Module& fused;
+        Results& results;
+        std::vector<pool_ref<Module>>& fusedProcessors;
+
+        std::vector<FusedInstance> instances;
+        std::vector<FusedInstance*> processingOrder;
+        ModuleCloner::StructMappings structMappings;
+        std::vector<EndpointVariable> streamAccumulators, valueOutputs;
+        std::vector<DelayLine> delayLines;
+
+        static int getModuleIndex (Program& program, Module& m)
+        {
+            auto& modules = program.getModules();
+            return static_cast<int> (std::distance (modules.begin(), std::find (modules.begin(), modules.end(), m)));
+        }
+
+        FusedInstance& getInstance (const heart::ProcessorInstance* instance)
+        {
+            for (auto& i : instances)
+                if (std::addressof (i.instance) == instance)
+                    return i;
+
+            SOUL_ASSERT_FALSE;
+            return instances.front();
+        }
+
+        std::vector<pool_ref<heart::Connection>> getConnectionsFrom (const heart::ProcessorInstance* source, const std::string& endpoint) const
+        {
+            std::vector<pool_ref<heart::Connection>> result;
+
+            for (auto& c : graph.connections)
+                if (c->sourceProcessor == source && c->sourceEndpoint == endpoint)
+                    result.push_back (c);
+
+            return result;
+        }
+
+        std::vector<pool_ref<heart::Connection>> getConnectionsTo (const heart::ProcessorInstance* dest, const std::string& endpoint) const
+        {
+            std::vector<pool_ref<heart::Connection>> result;
+
+            for (auto& c : graph.connections)
+                if (c->destProcessor == dest && c->destEndpoint == endpoint)
+                    result.push_back (c);
+
+            return result;
+        }
+
+        static pool_ptr<heart::Variable> findEndpointVariable (const std::vector<EndpointVariable>& list,
+                                                               const heart::ProcessorInstance* instance,
+                                                               const std::string& endpoint)
+        {
+            for (auto& v : list)
+                if (v.instance == instance && v.endpoint == endpoint)
+                    return v.variable;
+
+            return {};
+        }
+
+        std::string getUniqueStateVariableName (const std::string& name) const
+        {
+            return addSuffixToMakeUnique (name, [this] (const std::string& nm) { return fused.findStateVariable (nm) != nullptr; });
+        }
+
+        std::string getUniqueFunctionName (const std::string& name) const
+        {
+            return addSuffixToMakeUnique (name, [this] (const std::string& nm) { return fused.findFunction (nm) != nullptr; });
+        }
+
+        static std::string getUniqueBlockName (const heart::Function& f, const std::string& name)
+        {
+            return addSuffixToMakeUnique (name, [&] (const std::string& nm) { return f.findBlockByName (nm) != nullptr; });
+        }
+
+        heart::Variable& addStateVariable (Type type, const std::string& name)
+        {
+            auto& v = fused.allocate<heart::Variable> (CodeLocation(), std::move (type),
+                                                       fused.allocator.get (getUniqueStateVariableName (name)),
+                                                       heart::Variable::Role::state);
+            fused.stateVariables.push_back (v);
+            return v;
+        }
+
+        //==============================================================================
+        void createStructCopies()
+        {
+            std::vector<pool_ref<Module>> processorsToCopy;
+
+            for (auto& i : instances)
+                if (! contains (processorsToCopy, i.processor))
+                    processorsToCopy.push_back (i.processor);
+
+            for (auto& m : program.getModules())
+                if (! contains (processorsToCopy, m))
+                    for (auto& s : m->structs)
+                        structMappings[s.get()] = s;
+
+            std::vector<std::pair<StructurePtr, StructurePtr>> copies;
+
+            for (auto& m : processorsToCopy)
+            {
+                for (auto& s : m->structs)
+                {
+                    auto& copy = fused.addStruct (addSuffixToMakeUnique (s->getName(),
+                                                                         [this] (const std::string& nm) { return fused.findStruct (nm) != nullptr; }));
+                    structMappings[s.get()] = copy;
+                    structMappings[std::addressof (copy)] = copy;
+                    copies.push_back ({ s, copy });
+                }
+            }
+
+            for (auto& c : copies)
+                for (auto& m : c.first->getMembers())
+                    c.second->addMember (ModuleCloner::cloneType (structMappings, m.type), m.name);
+        }
+
+        void cloneInstance (FusedInstance& i)
+        {
+            for (auto& m : program.getModules())
+            {
+                if (m != i.processor)
+                {
+                    for (auto& f : m->functions)
+                        i.functionMappings[f.get()] = f;
+
+                    for (auto& v : m->stateVariables)
+                        i.variableMappings[v.get()] = v;
+                }
+            }
+
+            ModuleCloner cloner (i.processor, fused, i.functionMappings, structMappings, i.variableMappings);
+
+            for (auto& v : i.processor.stateVariables)
+            {
+                auto& clone = cloner.getRemappedVariable (v);
+                clone.name = fused.allocator.get (getUniqueStateVariableName (i.prefix + "_" + v->name.toString()));
+                fused.stateVariables.push_back (clone);
+            }
+
+            // the copies of the endpoints are only used until the reads and writes have been replaced
+            for (auto& input : i.processor.inputs)
+                cloner.clone (input.get());
+
+            for (auto& output : i.processor.outputs)
+                cloner.clone (output.get());
+
+            for (auto& f : i.processor.functions)
+                i.functions.push_back (cloner.createNewFunctionObject (f));
+
+            for (size_t n = 0; n < i.functions.size(); ++n)
+            {
+                auto& f = i.functions[n].get();
+                cloner.clone (f, i.processor.functions[n].get());
+                f.name = fused.allocator.get (getUniqueFunctionName (i.prefix + "_" + f.name.toString()));
+                fused.functions.push_back (f);
+            }
+
+            i.stepFunction = i.functionMappings[i.processor.getRunFunction()];
+
+            if (auto initFunction = i.processor.findFunction (heart::getSystemInitFunctionName()))
+                i.systemInitFunction = i.functionMappings[*initFunction];
+        }
+
+        void createConnectionVariables()
+        {
+            for (auto& c : graph.connections)
+            {
+                auto& source = *findSourceEndpoint (program, graph, c);
+                auto sourceName = c->sourceProcessor == nullptr ? std::string ("in")
+                                                                : getInstance (c->sourceProcessor.get()).prefix;
+
+                if (c->delayLength > 0)
+                {
+                    createDelayLine (c, source.getFrameType(), sourceName + "_" + c->sourceEndpoint + "_delay");
+                    ++results.numDelayLinesCreated;
+                }
+                else
+                {
+                    ++results.numConnectionBuffersRemoved;
+                }
+
+                if (c->sourceProcessor == nullptr)
+                    continue;
+
+                if (source.isStreamEndpoint())
+                {
+                    if (findEndpointVariable (streamAccumulators, c->sourceProcessor.get(), c->sourceEndpoint) == nullptr)
+                    {
+                        auto& v = fused.allocate<heart::Variable> (CodeLocation(), source.getFrameType(),
+                                                                   fused.allocator.get (sourceName + "_" + c->sourceEndpoint),
+                                                                   heart::Variable::Role::mutableLocal);
+                        streamAccumulators.push_back ({ c->sourceProcessor.get(), c->sourceEndpoint, v });
+                    }
+                }
+                else if (source.isValueEndpoint() && c->destProcessor != nullptr)
+                {
+                    if (findEndpointVariable (valueOutputs, c->sourceProcessor.get(), c->sourceEndpoint) == nullptr)
+                    {
+                        auto& v = addStateVariable (ModuleCloner::cloneType (structMappings, source.getValueType()),
+                                                    sourceName + "_" + c->sourceEndpoint);
+                        valueOutputs.push_back ({ c->sourceProcessor.get(), c->sourceEndpoint, v });
+                    }
+                }
+            }
+        }
+
+        void createDelayLine (const heart::Connection& c, const Type& frameType, const std::string& name)
+        {
+            if (c.delayLength == 1)
+            {
+                delayLines.push_back ({ std::addressof (c), addStateVariable (frameType, name), {} });
+                return;
+            }
+
+            auto& buffer = addStateVariable (frameType.createArray (static_cast<Type::ArraySize> (c.delayLength)), name);
+            auto& position = addStateVariable (PrimitiveType::int32, name + "_pos");
+            delayLines.push_back ({ std::addressof (c), buffer, position });
+        }
+
+        const DelayLine& getDelayLine (const heart::Connection& c) const
+        {
+            for (auto& d : delayLines)
+                if (d.connection == std::addressof (c))
+                    return d;
+
+            SOUL_ASSERT_FALSE;
+            return delayLines.front();
+        }
+
+        //==============================================================================
+        void convertRunToStepFunction (FusedInstance& i)
+        {
+            auto& step = *i.stepFunction;
+
+            for (auto& v : findVariablesLiveAcrossAdvances (step))
+            {
+                v->role = heart::Variable::Role::state;
+                v->name = fused.allocator.get (getUniqueStateVariableName (i.prefix + "_"
+                                                                            + (v->name.isValid() ? v->name.toString() : std::string ("temp"))));
+                fused.stateVariables.push_back (v);
+            }
+
+            // 0 = not started, -1 = finished, otherwise the number of the advance() call to resume after
+            auto& resumePoint = addStateVariable (PrimitiveType::int32, i.prefix + "_resumePoint");
+
+            for (auto& b : step.blocks)
+            {
+                if (is_type<heart::ReturnVoid> (b->terminator))
+                {
+                    BlockBuilder builder (fused, b);
+                    builder.addAssignment (resumePoint, builder.createConstantInt32 (-1));
+                }
+            }
+
+            std::vector<pool_ref<heart::Block>> resumeBlocks;
+
+            for (size_t blockIndex = 0; blockIndex < step.blocks.size(); ++blockIndex)
+            {
+                LinkedList<heart::Statement>::Iterator last;
+
+                for (auto s : step.blocks[blockIndex]->statements)
+                {
+                    if (is_type<heart::AdvanceClock> (*s))
+                    {
+                        auto resumeIndex = static_cast<int32_t> (resumeBlocks.size() + 1);
+                        auto& resumeBlock = heart::Utilities::splitBlock (fused, step, blockIndex, last,
+                                                                          getUniqueBlockName (step, "@resume_" + std::to_string (resumeIndex)));
+                        resumeBlock.statements.removeFront();
+
+                        BlockBuilder builder (fused, step.blocks[blockIndex]);
+                        builder.addAssignment (resumePoint, builder.createConstantInt32 (resumeIndex));
+                        builder.setReturnTerminator();
+                        resumeBlocks.push_back (resumeBlock);
+                        break;
+                    }
+
+                    last = s;
+                }
+            }
+
+            pool_ptr<heart::Block> next = step.blocks.front();
+
+            auto& finishedBlock = heart::Utilities::insertBlock (fused, step, 0, getUniqueBlockName (step, "@finished"));
+            BlockBuilder (fused, finishedBlock).setReturnTerminator();
+
+            for (auto index = static_cast<int32_t> (resumeBlocks.size()); index > 0; --index)
+            {
+                auto& checkBlock = heart::Utilities::insertBlock (fused, step, 0, getUniqueBlockName (step, "@resume_check_" + std::to_string (index)));
+                BlockBuilder builder (fused, checkBlock);
+                builder.setBranchIfTerminator (builder.createEqualsOp (resumePoint, builder.createConstantInt32 (index)),
+                                               resumeBlocks[static_cast<size_t> (index - 1)], *next);
+                next = checkBlock;
+            }
+
+            auto& entryBlock = heart::Utilities::insertBlock (fused, step, 0, getUniqueBlockName (step, "@step"));
+            BlockBuilder builder (fused, entryBlock);
+            builder.setBranchIfTerminator (builder.createComparisonOp (resumePoint, builder.createConstantInt32 (0), BinaryOp::Op::lessThan),
+                                           finishedBlock, *next);
+        }
+
+        //==============================================================================
+        void replaceEndpointAccess (FusedInstance& i)
+        {
+            for (auto& f : i.functions)
+            {
+                for (auto& b : f->blocks)
+                {
+                    std::vector<heart::Statement*> statements;
+
+                    for (auto s : b->statements)
+                        statements.push_back (s);
+
+                    b->statements.clear();
+                    BlockBuilder builder (fused, b);
+
+                    for (auto s : statements)
+                    {
+                        s->nextObject = nullptr;
+
+                        if (auto r = cast<heart::ReadStream> (*s))
+                            replaceRead (builder, i, *r);
+                        else if (auto w = cast<heart::WriteStream> (*s))
+                            replaceWrite (builder, i, *w);
+                        else
+                            builder.addStatement (*s);
+                    }
+                }
+            }
+        }
+
+        void replaceRead (BlockBuilder& builder, FusedInstance& i, heart::ReadStream& r)
+        {
+            auto& input = r.source.get();
+            auto& target = *r.target;
+            auto connections = getConnectionsTo (std::addressof (i.instance), input.name.toString());
+
+            if (connections.empty())
+                return builder.addZeroAssignment (target);
+
+            if (input.isValueEndpoint())
+            {
+                auto& value = builder.createCastIfNeeded (getValueSource (builder, connections.front()), input.getValueType());
+                return builder.addAssignment (target, builder.createCastIfNeeded (value, target.getType()));
+            }
+
+            SOUL_ASSERT (input.isStreamEndpoint());
+            pool_ptr<heart::Expression> total;
+
+            for (auto& c : connections)
+            {
+                auto& value = builder.createCastIfNeeded (getStreamSource (builder, c, std::addressof (i)), input.getFrameType());
+                total = total == nullptr ? value : builder.createAdd (*total, value);
+            }
+
+            builder.addAssignment (target, builder.createCastIfNeeded (*total, target.getType()));
+        }
+
+        void replaceWrite (BlockBuilder& builder, FusedInstance& i, heart::WriteStream& w)
+        {
+            auto& output = w.target.get();
+            auto name = output.name.toString();
+
+            if (output.isEventEndpoint())
+                return emitEvent (builder, std::addressof (i.instance), name, w.value);
+
+            if (output.isStreamEndpoint())
+            {
+                if (auto accumulator = findEndpointVariable (streamAccumulators, std::addressof (i.instance), name))
+                {
+                    auto& total = getStepParameter (i, *accumulator);
+                    builder.addAssignment (total, builder.createAdd (total, builder.createCastIfNeeded (w.value, accumulator->type)));
+                }
+
+                return;
+            }
+
+            SOUL_ASSERT (output.isValueEndpoint());
+            std::vector<pool_ref<heart::OutputDeclaration>> graphOutputs;
+
+            for (auto& c : getConnectionsFrom (std::addressof (i.instance), name))
+                if (c->destProcessor == nullptr)
+                    graphOutputs.push_back (*graph.findOutput (c->destEndpoint));
+
+            auto stateVariable = findEndpointVariable (valueOutputs, std::addressof (i.instance), name);
+            pool_ref<heart::Expression> value = w.value;
+
+            if (graphOutputs.size() + (stateVariable != nullptr ? 1 : 0) > 1 && ! is_type<heart::Variable> (value))
+                value = builder.createRegisterVariable (value);
+
+            if (stateVariable != nullptr)
+                builder.addAssignment (*stateVariable, builder.createCastIfNeeded (value, stateVariable->type));
+
+            for (auto& graphOutput : graphOutputs)
+                builder.addWriteStream (w.location, graphOutput, nullptr, builder.createCastIfNeeded (value, graphOutput->getValueType()));
+        }
+
+        /** Sends an event to whatever the given endpoint is connected to. */
+        void emitEvent (BlockBuilder& builder, const heart::ProcessorInstance* source,
+                        const std::string& endpoint, heart::Expression& value)
+        {
+            auto connections = getConnectionsFrom (source, endpoint);
+
+            if (connections.empty())
+                return;
+
+            auto eventValue = cast<heart::Variable> (value);
+
+            if (eventValue == nullptr)
+                eventValue = builder.createRegisterVariable (value);
+
+            auto eventType = eventValue->type.removeReferenceIfPresent().removeConstIfPresent();
+
+            for (auto& c : connections)
+            {
+                if (c->destProcessor == nullptr)
+                {
+                    builder.addWriteStream (value.location, *graph.findOutput (c->destEndpoint), nullptr, *eventValue);
+                    continue;
+                }
+
+                if (auto handler = findEventHandler (getInstance (c->destProcessor.get()), c->destEndpoint, eventType))
+                {
+                    auto paramType = handler->parameters.front()->type.removeReferenceIfPresent().removeConstIfPresent();
+                    pool_ref<heart::Variable> arg = *eventValue;
+
+                    if (! paramType.isIdentical (eventType))
+                        arg = builder.createRegisterVariable (builder.createCast (value.location, *eventValue, paramType));
+
+                    builder.addFunctionCall (*handler, { arg });
+                }
+            }
+        }
+
+        /** Finds the copy of the handler that the instance's performer would have delivered this event to. */
+        static pool_ptr<heart::Function> findEventHandler (FusedInstance& dest, const std::string& endpoint, const Type& eventType)
+        {
+            for (auto& f : dest.processor.functions)
+            {
+                if (f->functionType.isEvent() && f->parameters.size() == 1
+                     && f->name == heart::getEventFunctionName (endpoint, f->parameters.front()->type))
+                {
+                    auto handler = dest.functionMappings[f.get()];
+
+                    if (handler->parameters.front()->type.removeReferenceIfPresent().removeConstIfPresent()
+                            .isEqual (eventType, Type::ignoreVectorSize1))
+                        return handler;
+                }
+            }
+
+            return {};
+        }
+
+        heart::Variable& getStepParameter (FusedInstance& i, heart::Variable& accumulator)
+        {
+            auto& param = i.stepParameters[std::addressof (accumulator)];
+
+            if (param == nullptr)
+            {
+                param = fused.allocate<heart::Variable> (CodeLocation(), accumulator.type.createReference(),
+                                                         accumulator.name, heart::Variable::Role::parameter);
+                i.stepFunction->parameters.push_back (*param);
+                i.stepArguments.push_back (accumulator);
+            }
+
+            return *param;
+        }
+
+        heart::Variable& readGraphInput (BlockBuilder& builder, const std::string& name)
+        {
+            auto& input = *graph.findInput (name);
+            auto& value = builder.createRegisterVariable (input.getSingleDataType());
+            builder.createStatement<heart::ReadStream> (CodeLocation(), value, input);
+            return value;
+        }
+
+        /** Returns the value arriving along a stream connection. The reader is the instance whose
+            step function the value is needed in, or nullptr for the fused run function.
+        */
+        heart::Expression& getStreamSource (BlockBuilder& builder, const heart::Connection& c,
+                                            FusedInstance* reader, bool applyDelay = true)
+        {
+            if (applyDelay && c.delayLength > 0)
+            {
+                auto& line = getDelayLine (c);
+
+                if (line.position == nullptr)
+                    return line.buffer;
+
+                return builder.createTrustedDynamicSubElement (line.buffer, *line.position);
+            }
+
+            if (c.sourceProcessor == nullptr)
+                return readGraphInput (builder, c.sourceEndpoint);
+
+            auto& accumulator = *findEndpointVariable (streamAccumulators, c.sourceProcessor.get(), c.sourceEndpoint);
+
+            if (reader != nullptr)
+                return getStepParameter (*reader, accumulator);
+
+            return accumulator;
+        }
+
+        heart::Expression& getValueSource (BlockBuilder& builder, const heart::Connection& c)
+        {
+            if (c.sourceProcessor == nullptr)
+                return readGraphInput (builder, c.sourceEndpoint);
+
+            return *findEndpointVariable (valueOutputs, c.sourceProcessor.get(), c.sourceEndpoint);
+        }
+
+        void offsetProcessorIDs (FusedInstance& i)
+        {
+            for (auto& f : i.functions)
+            {
+                f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                {
+                    if (auto pp = cast<heart::ProcessorProperty> (value))
+                        if (pp->property == heart::ProcessorProperty::Property::id)
+                            value = fused.allocate<heart::BinaryOperator> (pp->location, *pp,
+                                                                           fused.allocator.allocateConstant (Value::createInt32 (i.processorIDOffset)),
+                                                                           BinaryOp::Op::add);
+                });
+            }
+        }
+
+        //==============================================================================
+        void createEventHandlers()
+        {
+            for (auto& input : graph.inputs)
+            {
+                auto name = input->name.toString();
+
+                if (! input->isEventEndpoint() || getConnectionsFrom (nullptr, name).empty())
+                    continue;
+
+                for (auto& type : input->dataTypes)
+                {
+                    auto& handler = FunctionBuilder::createFunction (fused, heart::getEventFunctionName (name, type),
+                                                                     PrimitiveType::void_, [&] (FunctionBuilder& builder)
+                    {
+                        emitEvent (builder, nullptr, name, builder.addParameter ("value", type));
+                    });
+
+                    handler.functionType = heart::FunctionType::event();
+                }
+            }
+        }
+
+        void createInitFunction()
+        {
+            std::vector<pool_ref<heart::Function>> initFunctions;
+
+            for (auto& i : instances)
+                if (i.systemInitFunction != nullptr)
+                    initFunctions.push_back (*i.systemInitFunction);
+
+            if (initFunctions.empty())
+                return;
+
+            auto& init = FunctionBuilder::createFunction (fused, heart::getSystemInitFunctionName(),
+                                                          PrimitiveType::void_, [&] (FunctionBuilder& builder)
+            {
+                for (auto& f : initFunctions)
+                    builder.addFunctionCall (f, {});
+            });
+
+            init.functionType = heart::FunctionType::systemInit();
+        }
+
+        void createRunFunction()
+        {
+            auto& run = FunctionBuilder::createFunction (fused, heart::getRunFunctionName(),
+                                                         PrimitiveType::void_, [&] (FunctionBuilder& builder)
+            {
+                builder.beginBlock (builder.createNewBlock());
+                auto& frameBlock = builder.createNewBlock();
+                builder.addBranch (frameBlock, frameBlock);
+
+                for (auto& a : streamAccumulators)
+                    builder.addZeroAssignment (a.variable);
+
+                for (auto i : processingOrder)
+                    builder.addFunctionCall (nullptr, *i->stepFunction, std::move (i->stepArguments));
+
+                for (auto& c : graph.connections)
+                {
+                    if (c->destProcessor != nullptr)
+                        continue;
+
+                    auto& output = *graph.findOutput (c->destEndpoint);
+
+                    if (output.isStreamEndpoint())
+                        builder.addWriteStream ({}, output, nullptr,
+                                                builder.createCastIfNeeded (getStreamSource (builder, c, nullptr), output.getFrameType()));
+                    else if (output.isValueEndpoint() && c->sourceProcessor == nullptr)
+                        builder.addWriteStream ({}, output, nullptr,
+                                                builder.createCastIfNeeded (readGraphInput (builder, c->sourceEndpoint), output.getValueType()));
+                }
+
+                // the delay lines are written last, so that a length of 1 gives the previous frame's value
+                for (auto& line : delayLines)
+                {
+                    auto& value = getStreamSource (builder, *line.connection, nullptr, false);
+
+                    if (line.position == nullptr)
+                    {
+                        builder.addAssignment (line.buffer, value);
+                    }
+                    else
+                    {
+                        builder.addAssignment (builder.createTrustedDynamicSubElement (line.buffer, *line.position), value);
+                        builder.incrementAndWrap (*line.position, *line.position, static_cast<size_t> (line.connection->delayLength));
+                    }
+                }
+
+                builder.addAdvance ({});
+                builder.addBranch (frameBlock, nullptr);
+            });
+
+            run.functionType = heart::FunctionType::run();
+        }
+
+        /** Removes any copied functions that nothing calls any more, such as the handlers
+            for unconnected inputs.
+        */
+        void removeUncalledFunctions()
+        {
+            for (;;)
+            {
+                std::unordered_set<const heart::Function*> calledFunctions;
+
+                for (auto& f : fused.functions)
+                {
+                    f->visitStatements<heart::FunctionCall> ([&] (heart::FunctionCall& fc)
+                    {
+                        calledFunctions.insert (std::addressof (fc.getFunction()));
+                    });
+
+                    f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                    {
+                        if (auto fc = cast<heart::PureFunctionCall> (value))
+                            calledFunctions.insert (std::addressof (fc->function));
+                    });
+                }
+
+                if (! removeIf (fused.functions, [&] (heart::Function& f)
+                                {
+                                    return f.functionType.isNormal() && calledFunctions.find (std::addressof (f)) == calledFunctions.end();
+                                }))
+                    break;
+            }
+        }
+    };
+};
+
+} // namespace soul
@@ -0,0 +1,461 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Calculates a hash of the complete state of a program by walking its modules,
+    types, constants and statements, rather than printing it as HEART and hashing
+    the text.
+
+    Each module is hashed on its own, referring to things in other modules by name
+    and to things inside itself (local variables, blocks) by index, so the hash of
+    a module only depends on its own contents. That means each module's hash can be
+    kept and re-used until Module::markAsModified() is called.
+*/
+struct heart::Hasher
+{
+    using Hash = FastHashBuilder::Hash;
+
+    static std::string getHash (const Program& program)
+    {
+        Hasher hasher (program);
+        FastHashBuilder hash;
+
+        hash << getHEARTFormatVersion();
+
+        auto& constants = program.getConstantTable();
+        hash << static_cast<uint64_t> (constants.size());
+
+        for (auto& c : constants)
+        {
+            hash << c.handle;
+            addValue (hash, *c.value, program.getStringDictionary());
+        }
+
+        auto& modules = program.getModules();
+        hash << static_cast<uint64_t> (modules.size());
+
+        for (auto& m : modules)
+            hash << hasher.getCachedModuleHash (m);
+
+        return hash.toString();
+    }
+
+private:
+    //==============================================================================
+    Hasher (const Program& program)  : stringDictionary (program.getStringDictionary())
+    {
+        for (auto& m : program.getModules())
+        {
+            for (auto& f : m->functions)
+                functionModules[f.getPointer()] = m.getPointer();
+
+            for (auto& v : m->stateVariables)
+                stateVariableModules[v.getPointer()] = m.getPointer();
+        }
+    }
+
+    const StringDictionary& stringDictionary;
+    std::unordered_map<const heart::Function*, const Module*> functionModules;
+    std::unordered_map<const heart::Variable*, const Module*> stateVariableModules;
+    std::unordered_map<const heart::Variable*, uint32_t> localVariables;
+    std::unordered_map<const heart::Block*, uint32_t> blockIndexes;
+
+    enum class Tag  : uint8_t
+    {
+        invalid, primitive, vector, array, wrapped, clamped, structure, stringLiteral,
+        null, constant, variable, arrayElement, structElement, typeCast, unaryOperator,
+        binaryOperator, pureFunctionCall, processorProperty,
+        assignFromValue, functionCall, readStream, writeStream, advanceClock,
+        branch, branchIf, returnVoid, returnValue
+    };
+
+    //==============================================================================
+    Hash getCachedModuleHash (const Module& m)
+    {
+        if (m.hashedModificationCount != m.modificationCount)
+        {
+            m.cachedHash = getModuleHash (m);
+            m.hashedModificationCount = m.modificationCount;
+        }
+
+        return m.cachedHash;
+    }
+
+    Hash getModuleHash (const Module& m)
+    {
+        FastHashBuilder hash;
+
+        hash << m.isProcessor() << m.isGraph() << m.shortName << m.fullName << m.originalFullName << m.sampleRate;
+        addAnnotation (hash, m.annotation);
+
+        hash << static_cast<uint64_t> (m.structs.size());
+
+        for (auto& s : m.structs)
+        {
+            hash << s->getName() << static_cast<uint64_t> (s->getNumMembers());
+
+            for (auto& member : s->getMembers())
+            {
+                addType (hash, member.type);
+                hash << member.name;
+            }
+        }
+
+        addEndpoints (hash, m.inputs);
+        addEndpoints (hash, m.outputs);
+
+        hash << static_cast<uint64_t> (m.processorInstances.size());
+
+        for (auto& p : m.processorInstances)
+            hash << p->instanceName << p->sourceName << p->clockMultiplier << p->clockDivider << p->arraySize;
+
+        hash << static_cast<uint64_t> (m.connections.size());
+
+        for (auto& c : m.connections)
+        {
+            hash << c->interpolationType
+                 << (c->sourceProcessor != nullptr ? std::string_view (c->sourceProcessor->instanceName) : std::string_view())
+                 << c->sourceEndpoint << c->sourceEndpointIndex.value_or (std::numeric_limits<size_t>::max())
+                 << (c->destProcessor != nullptr ? std::string_view (c->destProcessor->instanceName) : std::string_view())
+                 << c->destEndpoint << c->destEndpointIndex.value_or (std::numeric_limits<size_t>::max())
+                 << c->delayLength;
+        }
+
+        hash << static_cast<uint64_t> (m.stateVariables.size());
+
+        for (auto& v : m.stateVariables)
+        {
+            hash << v->name.toString();
+            addVariableDefinition (hash, v);
+        }
+
+        hash << static_cast<uint64_t> (m.functions.size());
+
+        for (auto& f : m.functions)
+            addFunction (hash, f);
+
+        return hash.getHash();
+    }
+
+    template <typename EndpointList>
+    void addEndpoints (FastHashBuilder& hash, const EndpointList& endpoints)
+    {
+        hash << static_cast<uint64_t> (endpoints.size());
+
+        for (auto& e : endpoints)
+        {
+            hash << e->name.toString() << e->index << e->endpointType
+                 << e->arraySize.value_or (0) << static_cast<uint64_t> (e->dataTypes.size());
+
+            for (auto& t : e->dataTypes)
+                addType (hash, t);
+
+            addAnnotation (hash, e->annotation);
+        }
+    }
+
+    void addFunction (FastHashBuilder& hash, const heart::Function& f)
+    {
+        localVariables.clear();
+        blockIndexes.clear();
+
+        hash << f.name.toString() << f.functionType.type << f.intrinsicType << f.isExported << f.hasNoBody;
+        addType (hash, f.returnType);
+        addAnnotation (hash, f.annotation);
+
+        hash << static_cast<uint64_t> (f.parameters.size());
+
+        for (auto& p : f.parameters)
+            addLocalVariable (hash, p);
+
+        hash << static_cast<uint64_t> (f.blocks.size());
+
+        for (auto& b : f.blocks)
+            blockIndexes[b.getPointer()] = static_cast<uint32_t> (blockIndexes.size());
+
+        for (auto& b : f.blocks)
+        {
+            hash << b->name.toString() << static_cast<uint64_t> (b->parameters.size());
+
+            for (auto& p : b->parameters)
+                addLocalVariable (hash, p);
+
+            for (auto s : b->statements)
+                addStatement (hash, *s);
+
+            if (b->terminator != nullptr)
+                addTerminator (hash, *b->terminator);
+            else
+                hash << Tag::null;
+        }
+    }
+
+    void addStatement (FastHashBuilder& hash, heart::Statement& s)
+    {
+        if (auto a = cast<heart::AssignFromValue> (s))
+        {
+            hash << Tag::assignFromValue;
+            addOptionalExpression (hash, a->target);
+            addExpression (hash, a->source);
+        }
+        else if (auto fc = cast<heart::FunctionCall> (s))
+        {
+            hash << Tag::functionCall;
+            addOptionalExpression (hash, fc->target);
+            addFunctionReference (hash, fc->getFunction());
+            addExpressionList (hash, fc->arguments);
+        }
+        else if (auto r = cast<heart::ReadStream> (s))
+        {
+            hash << Tag::readStream << r->source->name.toString();
+            addOptionalExpression (hash, r->target);
+        }
+        else if (auto w = cast<heart::WriteStream> (s))
+        {
+            hash << Tag::writeStream << w->target->name.toString();
+            addOptionalExpression (hash, w->element);
+            addExpression (hash, w->value);
+        }
+        else
+        {
+            SOUL_ASSERT (is_type<heart::AdvanceClock> (s));
+            hash << Tag::advanceClock;
+        }
+    }
+
+    void addTerminator (FastHashBuilder& hash, heart::Terminator& t)
+    {
+        if (auto b = cast<heart::Branch> (t))
+        {
+            hash << Tag::branch << blockIndexes[b->target.getPointer()];
+            addExpressionList (hash, b->targetArgs);
+        }
+        else if (auto bi = cast<heart::BranchIf> (t))
+        {
+            hash << Tag::branchIf << blockIndexes[bi->targets[0].getPointer()] << blockIndexes[bi->targets[1].getPointer()];
+            addExpression (hash, bi->condition);
+            addExpressionList (hash, bi->targetArgs[0]);
+            addExpressionList (hash, bi->targetArgs[1]);
+        }
+        else if (auto r = cast<heart::ReturnValue> (t))
+        {
+            hash << Tag::returnValue;
+            addExpression (hash, r->returnValue);
+        }
+        else
+        {
+            SOUL_ASSERT (is_type<heart::ReturnVoid> (t));
+            hash << Tag::returnVoid;
+        }
+    }
+
+    template <typename ListType>
+    void addExpressionList (FastHashBuilder& hash, const ListType& list)
+    {
+        hash << static_cast<uint64_t> (list.size());
+
+        for (auto& e : list)
+            addExpression (hash, e);
+    }
+
+    void addOptionalExpression (FastHashBuilder& hash, pool_ptr<heart::Expression> e)
+    {
+        if (e == nullptr)
+            hash << Tag::null;
+        else
+            addExpression (hash, *e);
+    }
+
+    void addExpression (FastHashBuilder& hash, heart::Expression& e)
+    {
+        if (auto v = cast<heart::Variable> (e))
+        {
+            hash << Tag::variable;
+            addVariableReference (hash, *v);
+        }
+        else if (auto c = cast<heart::Constant> (e))
+        {
+            hash << Tag::constant;
+            addValue (hash, c->value, stringDictionary);
+        }
+        else if (auto a = cast<heart::ArrayElement> (e))
+        {
+            hash << Tag::arrayElement << a->isRangeTrusted << a->suppressWrapWarning;
+            addExpression (hash, a->parent);
+
+            if (a->isDynamic())
+                addExpression (hash, *a->dynamicIndex);
+            else
+                hash << Tag::null << a->fixedStartIndex << a->fixedEndIndex;
+        }
+        else if (auto s = cast<heart::StructElement> (e))
+        {
+            hash << Tag::structElement << s->memberName;
+            addExpression (hash, s->parent);
+        }
+        else if (auto t = cast<heart::TypeCast> (e))
+        {
+            hash << Tag::typeCast;
+            addType (hash, t->destType);
+            addExpression (hash, t->source);
+        }
+        else if (auto u = cast<heart::UnaryOperator> (e))
+        {
+            hash << Tag::unaryOperator << u->operation;
+            addExpression (hash, u->source);
+        }
+        else if (auto b = cast<heart::BinaryOperator> (e))
+        {
+            hash << Tag::binaryOperator << b->operation;
+            addExpression (hash, b->lhs);
+            addExpression (hash, b->rhs);
+        }
+        else if (auto f = cast<heart::PureFunctionCall> (e))
+        {
+            hash << Tag::pureFunctionCall;
+            addFunctionReference (hash, f->function);
+            addExpressionList (hash, f->arguments);
+        }
+        else
+        {
+            auto pp = cast<heart::ProcessorProperty> (e);
+            SOUL_ASSERT (pp != nullptr);
+            hash << Tag::processorProperty << pp->property;
+        }
+    }
+
+    // Local variables are identified by the order in which they first appear, and
+    // state variables by their name and the module that they belong to.
+    void addVariableReference (FastHashBuilder& hash, const heart::Variable& v)
+    {
+        auto local = localVariables.find (std::addressof (v));
+
+        if (local != localVariables.end())
+        {
+            hash << local->second;
+            return;
+        }
+
+        auto state = stateVariableModules.find (std::addressof (v));
+
+        if (state != stateVariableModules.end())
+        {
+            hash << std::numeric_limits<uint32_t>::max() << state->second->fullName << v.name.toString();
+            return;
+        }
+
+        addLocalVariable (hash, v);
+    }
+
+    void addLocalVariable (FastHashBuilder& hash, const heart::Variable& v)
+    {
+        localVariables[std::addressof (v)] = static_cast<uint32_t> (localVariables.size());
+        hash << static_cast<uint32_t> (localVariables.size());
+        addVariableDefinition (hash, v);
+    }
+
+    // (a local variable's name isn't included, because it's only referred to by its index)
+    void addVariableDefinition (FastHashBuilder& hash, const heart::Variable& v)
+    {
+        hash << v.role << v.externalHandle;
+        addType (hash, v.type);
+        addAnnotation (hash, v.annotation);
+    }
+
+    void addFunctionReference (FastHashBuilder& hash, const heart::Function& f)
+    {
+        auto module = functionModules.find (std::addressof (f));
+        hash << (module != functionModules.end() ? std::string_view (module->second->fullName) : std::string_view())
+             << f.name.toString();
+    }
+
+    //==============================================================================
+    static void addType (FastHashBuilder& hash, const Type& type)
+    {
+        if (! type.isValid())
+        {
+            hash << Tag::invalid;
+            return;
+        }
+
+        hash << type.isConst() << type.isReference();
+
+        if (type.isStringLiteral())
+        {
+            hash << Tag::stringLiteral;
+        }
+        else if (type.isBoundedInt())
+        {
+            hash << (type.isWrapped() ? Tag::wrapped : Tag::clamped) << type.getBoundedIntLimit();
+        }
+        else if (type.isVector())
+        {
+            hash << Tag::vector << type.getVectorElementType().type << type.getVectorSize();
+        }
+        else if (type.isArray())
+        {
+            hash << Tag::array << (type.isUnsizedArray() ? 0 : type.getArraySize());
+            addType (hash, type.getArrayElementType());
+        }
+        else if (type.isStruct())
+        {
+            // (the members are included in the hash of the module which declares the struct)
+            hash << Tag::structure << type.getStructRef().getName();
+        }
+        else
+        {
+            hash << Tag::primitive << type.getPrimitiveType().type;
+        }
+    }
+
+    // String literals are hashed by their text, because their handles depend on the
+    // order in which the strings were added to the dictionary
+    static void addValue (FastHashBuilder& hash, const Value& value, const StringDictionary& dictionary)
+    {
+        addType (hash, value.getType());
+
+        if (value.getType().isStringLiteral())
+        {
+            hash << dictionary.getStringForHandle (value.getStringLiteral());
+            return;
+        }
+
+        hash << static_cast<uint64_t> (value.getPackedDataSize());
+        hash.addBytes (value.getPackedData(), value.getPackedDataSize());
+    }
+
+    static void addAnnotation (FastHashBuilder& hash, const Annotation& annotation)
+    {
+        auto names = annotation.getNames();
+        hash << static_cast<uint64_t> (names.size());
+
+        for (auto& name : names)
+        {
+            hash << name;
+            addValue (hash, annotation.getValue (name), annotation.getDictionary());
+        }
+    }
+};
+
+} // namespace soul
@@ -0,0 +1,944 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Optimisations for the natural loops in a function. These need the loop variables to
+    have been turned into block parameters by SSAOptimisations::promoteLocalVariables().
+
+    hoistLoopInvariants() moves calculations whose operands can't change while a loop is
+    running into the block which enters the loop. reduceLoopStrength() replaces products
+    of induction variables with a running total, and uses what's known about the range of
+    loop counters and bounded ints to replace integer divisions and modulos with shifts
+    and masks.
+*/
+struct LoopOptimisations
+{
+    static void hoistLoopInvariants (Program& program)
+    {
+        PureFunctionList pureFunctions;
+
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                hoistLoopInvariants (m, f, pureFunctions);
+    }
+
+    static void reduceLoopStrength (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                reduceLoopStrength (m, f);
+    }
+
+    //==============================================================================
+    /** Keeps track of which functions can be called from anywhere without changing the
+        result, and which of those can also be called speculatively, because they can't
+        fail or get stuck in a loop.
+    */
+    struct PureFunctionList
+    {
+        bool isPure (heart::Function& f)             { return getProperties (f).isPure; }
+        bool canBeSpeculated (heart::Function& f)    { return getProperties (f).canBeSpeculated; }
+
+    private:
+        struct Properties
+        {
+            bool isPure, canBeSpeculated;
+        };
+
+        std::unordered_map<const heart::Function*, Properties> functions;
+
+        Properties getProperties (heart::Function& f)
+        {
+            auto found = functions.find (std::addressof (f));
+
+            if (found != functions.end())
+                return found->second;
+
+            // (a recursive call will see this and give up)
+            functions[std::addressof (f)] = { false, false };
+            auto result = checkFunction (f);
+            functions[std::addressof (f)] = result;
+            return result;
+        }
+
+        Properties checkFunction (heart::Function& f)
+        {
+            // An intrinsic's body may just be a placeholder for the back-end's own version
+            if (f.intrinsicType != IntrinsicType::none)
+                return { true, ! canIntrinsicFail (f.intrinsicType, f.returnType) };
+
+            if (f.hasNoBody || ! f.functionType.isNormal() || f.hasStateParameter() || f.hasIOParameter() || f.mayHaveSideEffects())
+                return { false, false };
+
+            for (auto& p : f.parameters)
+                if (p->type.isReference())
+                    return { false, false };
+
+            bool accessesState = false, mayFail = false;
+
+            f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+            {
+                if (auto v = cast<heart::Variable> (value))
+                    if (v->isExternalToFunction())
+                        accessesState = true;
+
+                if (auto fc = cast<heart::PureFunctionCall> (value))
+                    if (! canBeSpeculated (fc->function))
+                        mayFail = true;
+
+                if (canExpressionFail (value))
+                    mayFail = true;
+            });
+
+            if (accessesState)
+                return { false, false };
+
+            for (auto& b : f.blocks)
+            {
+                for (auto s : b->statements)
+                {
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                    {
+                        auto callee = getProperties (call->getFunction());
+
+                        if (! callee.isPure)
+                            return { false, false };
+
+                        if (! callee.canBeSpeculated)
+                            mayFail = true;
+                    }
+                }
+            }
+
+            return { true, ! (mayFail || containsLoop (f)) };
+        }
+
+        static bool containsLoop (heart::Function& f)
+        {
+            std::unordered_map<const heart::Block*, size_t> blockIndexes;
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
+                blockIndexes[f.blocks[i].getPointer()] = i;
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
+                for (auto dest : f.blocks[i]->terminator->getDestinationBlocks())
+                    if (blockIndexes[dest.getPointer()] <= i)
+                        return true;
+
+            return false;
+        }
+    };
+
+    static void hoistLoopInvariants (Module& module, heart::Function& f, PureFunctionList& pureFunctions)
+    {
+        SSAOptimisations::SSAValues values (f);
+
+        if (! values.isValid)
+            return;
+
+        bool anyHoisted = false;
+
+        for (auto& loop : CallFlowGraph::findNaturalLoops (values.dominators))
+            if (InvariantHoister (module, values, loop, pureFunctions).perform())
+                anyHoisted = true;
+
+        if (anyHoisted)
+        {
+            SSAOptimisations::keepBlockParametersLocal (module, f);
+            SSAOptimisations::tidyBlocks (module, f);
+        }
+    }
+
+    static void reduceLoopStrength (Module& module, heart::Function& f)
+    {
+        SSAOptimisations::SSAValues values (f);
+
+        if (values.isValid && StrengthReducer (module, f, values).perform())
+        {
+            SSAOptimisations::keepBlockParametersLocal (module, f);
+            SSAOptimisations::tidyBlocks (module, f);
+        }
+    }
+
+    static constexpr size_t notFound = CallFlowGraph::DominatorTree::notFound;
+
+    /** Returns the index of the block that enters a loop, if there's only one, and it doesn't
+        go anywhere else. This is also used by LoopUnrolling.
+    */
+    static size_t findPreheader (const CallFlowGraph::DominatorTree& dominators, const CallFlowGraph::NaturalLoop& loop)
+    {
+        auto preheader = notFound;
+
+        for (auto& pred : dominators.blocks[loop.header]->predecessors)
+        {
+            auto predIndex = dominators.getIndex (pred);
+
+            if (! loop.contains (predIndex))
+            {
+                if (preheader != notFound)
+                    return notFound;
+
+                preheader = predIndex;
+            }
+        }
+
+        if (preheader != notFound && is_type<heart::Branch> (dominators.blocks[preheader]->terminator))
+            return preheader;
+
+        return notFound;
+    }
+
+private:
+    /** Returns true if evaluating this expression on its own could fail at runtime. */
+    static bool canExpressionFail (heart::Expression& e)
+    {
+        if (auto b = cast<heart::BinaryOperator> (e))
+            return (b->operation == BinaryOp::Op::divide || b->operation == BinaryOp::Op::modulo)
+                     && b->getType().isInteger() && ! isSafeDivisor (b->rhs);
+
+        if (auto a = cast<heart::ArrayElement> (e))
+            return a->isDynamic();
+
+        if (auto fc = cast<heart::PureFunctionCall> (e))
+            return fc->function.intrinsicType == IntrinsicType::none
+                    || canIntrinsicFail (fc->function.intrinsicType, fc->getType());
+
+        return false;
+    }
+
+    static bool canIntrinsicFail (IntrinsicType intrinsic, const Type& resultType)
+    {
+        return intrinsic == IntrinsicType::read || intrinsic == IntrinsicType::readLinearInterpolated
+                || (resultType.isInteger() && (intrinsic == IntrinsicType::wrap || intrinsic == IntrinsicType::fmod
+                                                 || intrinsic == IntrinsicType::remainder));
+    }
+
+    static bool isSafeDivisor (heart::Expression& e)
+    {
+        if (auto c = cast<heart::Constant> (e))
+            return c->value.getType().isInteger() && ! c->value.isZero() && c->value.getAsInt64() != -1;
+
+        return false;
+    }
+
+    //==============================================================================
+    struct InvariantHoister
+    {
+        InvariantHoister (Module& m, SSAOptimisations::SSAValues& v, const CallFlowGraph::NaturalLoop& l, PureFunctionList& p)
+            : module (m), values (v), dominators (v.dominators), loop (l), pureFunctions (p)
+        {
+        }
+
+        bool perform()
+        {
+            preheaderIndex = findPreheader (dominators, loop);
+
+            if (preheaderIndex == notFound)
+                return false;
+
+            findExitingBlocks();
+
+            for (auto blockIndex : loop.blocks)
+                hoistFromBlock (blockIndex);
+
+            auto& preheader = dominators.blocks[preheaderIndex].get();
+
+            for (auto& s : newPreheaderStatements)
+            {
+                s->nextObject = nullptr;
+                preheader.statements.append (s);
+            }
+
+            return ! newPreheaderStatements.empty();
+        }
+
+    private:
+        Module& module;
+        SSAOptimisations::SSAValues& values;
+        CallFlowGraph::DominatorTree& dominators;
+        const CallFlowGraph::NaturalLoop& loop;
+        PureFunctionList& pureFunctions;
+        size_t preheaderIndex = notFound;
+        std::vector<size_t> exitingBlocks;
+        std::vector<pool_ref<heart::Statement>> newPreheaderStatements;
+
+        void findExitingBlocks()
+        {
+            for (auto blockIndex : loop.blocks)
+            {
+                for (auto dest : dominators.blocks[blockIndex]->terminator->getDestinationBlocks())
+                {
+                    if (! loop.contains (dominators.getIndex (dest)))
+                    {
+                        exitingBlocks.push_back (blockIndex);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Anything that could fail (e.g. an integer division) or which might be slow can only be
+        // hoisted if it would have been executed anyway whenever the loop is entered
+        bool isExecutedOnEveryIteration (size_t blockIndex) const
+        {
+            for (auto latch : loop.latches)
+                if (! dominators.dominates (blockIndex, latch))
+                    return false;
+
+            for (auto exitingBlock : exitingBlocks)
+                if (! dominators.dominates (blockIndex, exitingBlock))
+                    return false;
+
+            return true;
+        }
+
+        void hoistFromBlock (size_t blockIndex)
+        {
+            auto& block = dominators.blocks[blockIndex].get();
+            auto isAlwaysExecuted = isExecutedOnEveryIteration (blockIndex);
+            std::unordered_set<const heart::Statement*> statementsMoved;
+
+            for (auto s : block.statements)
+            {
+                if (canBeMoved (*s, isAlwaysExecuted))
+                {
+                    auto& assignment = *cast<heart::Assignment> (*s);
+                    values.setDefinitionAtEndOfBlock (*cast<heart::Variable> (assignment.target), preheaderIndex, assignment);
+                    newPreheaderStatements.push_back (*s);
+                    statementsMoved.insert (s);
+                }
+                else
+                {
+                    hoistInvariantSubexpressions (*s, isAlwaysExecuted);
+                }
+            }
+
+            hoistInvariantSubexpressions (*block.terminator, isAlwaysExecuted);
+
+            // (the statements must be removed from this block before they can be added to the new one)
+            block.statements.removeMatches ([&] (heart::Statement& st) { return statementsMoved.find (std::addressof (st)) != statementsMoved.end(); });
+        }
+
+        bool canBeMoved (heart::Statement& s, bool isAlwaysExecuted)
+        {
+            auto assignment = cast<heart::Assignment> (s);
+
+            if (assignment == nullptr)
+                return false;
+
+            auto target = cast<heart::Variable> (assignment->target);
+
+            if (target == nullptr || ! values.contains (*target))
+                return false;
+
+            if (auto a = cast<heart::AssignFromValue> (s))
+            {
+                bool mayFail = false;
+                return isInvariant (a->source, mayFail) && (isAlwaysExecuted || ! mayFail);
+            }
+
+            if (auto call = cast<heart::FunctionCall> (s))
+            {
+                auto& function = call->getFunction();
+
+                if (! (isAlwaysExecuted ? pureFunctions.isPure (function)
+                                        : pureFunctions.canBeSpeculated (function)))
+                    return false;
+
+                for (auto& arg : call->arguments)
+                {
+                    bool mayFail = false;
+
+                    if (! isInvariant (arg, mayFail))
+                        return false;
+                }
+
+                return true;
+            }
+
+            return false;
+        }
+
+        template <typename StatementType>
+        void hoistInvariantSubexpressions (StatementType& s, bool isAlwaysExecuted)
+        {
+            std::unordered_set<const heart::Expression*> invariantExpressions, nestedExpressions;
+
+            s.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode == AccessType::read && ! isTrivial (value))
+                {
+                    bool mayFail = false;
+
+                    if (isInvariant (value, mayFail) && (isAlwaysExecuted || ! mayFail))
+                    {
+                        invariantExpressions.insert (value.getPointer());
+
+                        value->visitExpressions ([&] (pool_ref<heart::Expression>& inner, AccessType)
+                        {
+                            nestedExpressions.insert (inner.getPointer());
+                        }, AccessType::read);
+                    }
+                }
+            });
+
+            if (invariantExpressions.empty())
+                return;
+
+            std::unordered_map<const heart::Expression*, pool_ref<heart::Variable>> newValues;
+
+            s.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode == AccessType::read
+                     && invariantExpressions.find (value.getPointer()) != invariantExpressions.end()
+                     && nestedExpressions.find (value.getPointer()) == nestedExpressions.end())
+                {
+                    auto existing = newValues.find (value.getPointer());
+
+                    if (existing != newValues.end())
+                    {
+                        value = existing->second;
+                        return;
+                    }
+
+                    auto& source = value.get();
+                    auto& newValue = module.allocate<heart::Variable> (source.location, source.getType(), heart::Variable::Role::constant);
+                    auto& assignment = module.allocate<heart::AssignFromValue> (source.location, newValue, source);
+                    values.setDefinitionAtEndOfBlock (newValue, preheaderIndex, assignment);
+                    newPreheaderStatements.push_back (assignment);
+                    newValues.emplace (std::addressof (source), newValue);
+                    value = newValue;
+                }
+            });
+        }
+
+        static bool isTrivial (heart::Expression& e)
+        {
+            return is_type<heart::Variable> (e) || is_type<heart::Constant> (e) || is_type<heart::ProcessorProperty> (e);
+        }
+
+        bool isInvariant (heart::Expression& e, bool& mayFail)
+        {
+            if (is_type<heart::Constant> (e) || is_type<heart::ProcessorProperty> (e))
+                return true;
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto d = values.getDefinition (*v);
+                return d != nullptr && ! loop.contains (d->blockIndex);
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                if (! (isInvariant (b->lhs, mayFail) && isInvariant (b->rhs, mayFail)))
+                    return false;
+
+                mayFail = mayFail || canExpressionFail (e);
+                return true;
+            }
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+                return isInvariant (u->source, mayFail);
+
+            if (auto t = cast<heart::TypeCast> (e))
+                return isInvariant (t->source, mayFail);
+
+            if (auto s = cast<heart::StructElement> (e))
+                return isInvariant (s->parent, mayFail);
+
+            if (auto a = cast<heart::ArrayElement> (e))
+            {
+                if (! isInvariant (a->parent, mayFail))
+                    return false;
+
+                if (a->isDynamic() && ! isInvariant (*a->dynamicIndex, mayFail))
+                    return false;
+
+                mayFail = mayFail || canExpressionFail (e);
+                return true;
+            }
+
+            if (auto fc = cast<heart::PureFunctionCall> (e))
+            {
+                for (auto& arg : fc->arguments)
+                    if (! isInvariant (arg, mayFail))
+                        return false;
+
+                mayFail = mayFail || canExpressionFail (e);
+                return true;
+            }
+
+            return false;
+        }
+    };
+
+    //==============================================================================
+    struct StrengthReducer
+    {
+        StrengthReducer (Module& m, heart::Function& f, SSAOptimisations::SSAValues& v)
+            : module (m), values (v), dominators (v.dominators), parameterNames (m, f)
+        {
+        }
+
+        bool perform()
+        {
+            loops = CallFlowGraph::findNaturalLoops (dominators);
+
+            for (auto& loop : loops)
+                findInductionVariables (loop);
+
+            for (auto& iv : inductionVariables)
+                findRange (iv);
+
+            for (auto& iv : inductionVariables)
+                replaceMultiplications (iv);
+
+            for (auto& b : dominators.blocks)
+            {
+                for (auto s : b->statements)
+                    s->visitExpressions ([this] (pool_ref<heart::Expression>& value, AccessType mode) { reduceDivision (value, mode); });
+
+                b->terminator->visitExpressions ([this] (pool_ref<heart::Expression>& value, AccessType mode) { reduceDivision (value, mode); });
+            }
+
+            return anyChanged;
+        }
+
+    private:
+        struct Range
+        {
+            int64_t min, max;
+        };
+
+        /** A block parameter of a loop header which goes up or down by a constant amount
+            each time around the loop.
+        */
+        struct InductionVariable
+        {
+            heart::Block& header;
+            heart::Variable& parameter;
+            size_t parameterIndex;
+            const CallFlowGraph::NaturalLoop& loop;
+            heart::Branch& entryBranch;
+            std::vector<pool_ref<heart::Branch>> latchBranches;
+            int64_t step;
+            bool hasRange = false;
+            Range range { 0, 0 };
+        };
+
+        Module& module;
+        SSAOptimisations::SSAValues& values;
+        CallFlowGraph::DominatorTree& dominators;
+        SSAOptimisations::ParameterNameGenerator parameterNames;
+        std::vector<CallFlowGraph::NaturalLoop> loops;
+        std::vector<InductionVariable> inductionVariables;
+        bool anyChanged = false;
+
+        static bool isPlainInteger (const Type& type)
+        {
+            return (type.isInteger32() || type.isInteger64()) && ! (type.isBoundedInt() || type.isReference());
+        }
+
+        // Looks through any constants to find the expression which produced a value
+        heart::Expression& getSource (heart::Expression& e) const
+        {
+            if (auto v = cast<heart::Variable> (e))
+                if (auto d = values.getDefinition (*v))
+                    if (auto a = cast<heart::AssignFromValue> (d->assignment))
+                        return getSource (a->source);
+
+            return e;
+        }
+
+        bool isValueOf (heart::Expression& e, const heart::Variable& v) const
+        {
+            return std::addressof (getSource (e)) == std::addressof (v);
+        }
+
+        static pool_ptr<heart::Constant> getIntegerConstant (heart::Expression& e)
+        {
+            if (auto c = cast<heart::Constant> (e))
+                if (c->value.getType().isPrimitiveInteger() && ! c->value.getType().isBoundedInt())
+                    return c;
+
+            return {};
+        }
+
+        //==============================================================================
+        void findInductionVariables (const CallFlowGraph::NaturalLoop& loop)
+        {
+            auto preheader = findPreheader (dominators, loop);
+
+            if (preheader == notFound)
+                return;
+
+            auto& header = dominators.blocks[loop.header].get();
+            auto& entryBranch = *cast<heart::Branch> (dominators.blocks[preheader]->terminator);
+            std::vector<pool_ref<heart::Branch>> latchBranches;
+
+            for (auto latch : loop.latches)
+            {
+                auto branch = cast<heart::Branch> (dominators.blocks[latch]->terminator);
+
+                if (branch == nullptr)
+                    return;
+
+                latchBranches.push_back (*branch);
+            }
+
+            for (size_t i = 0; i < header.parameters.size(); ++i)
+            {
+                auto& param = header.parameters[i].get();
+
+                if (! isPlainInteger (param.type))
+                    continue;
+
+                int64_t step = 0;
+                bool isInductionVariable = true;
+
+                for (auto& branch : latchBranches)
+                {
+                    auto latchStep = getStep (branch->targetArgs[i], param);
+
+                    if (latchStep == 0 || (step != 0 && latchStep != step))
+                    {
+                        isInductionVariable = false;
+                        break;
+                    }
+
+                    step = latchStep;
+                }
+
+                if (isInductionVariable)
+                    inductionVariables.push_back ({ header, param, i, loop, entryBranch, latchBranches, step });
+            }
+        }
+
+        // Returns the amount that a value adds to a parameter, or 0 if it isn't of that form
+        int64_t getStep (heart::Expression& value, const heart::Variable& param) const
+        {
+            if (auto b = cast<heart::BinaryOperator> (getSource (value)))
+            {
+                if (b->getType().isIdentical (param.type))
+                {
+                    if (b->operation == BinaryOp::Op::add)
+                    {
+                        if (isValueOf (b->lhs, param))
+                            if (auto c = getIntegerConstant (b->rhs))
+                                return c->value.getAsInt64();
+
+                        if (isValueOf (b->rhs, param))
+                            if (auto c = getIntegerConstant (b->lhs))
+                                return c->value.getAsInt64();
+                    }
+
+                    if (b->operation == BinaryOp::Op::subtract && isValueOf (b->lhs, param))
+                        if (auto c = getIntegerConstant (b->rhs))
+                            if (c->value.getAsInt64() != std::numeric_limits<int64_t>::min())
+                                return -c->value.getAsInt64();
+                }
+            }
+
+            return 0;
+        }
+
+        // Finds the range of a counter which starts at a constant and counts upwards
+        // until it fails a "lessThan" test in the loop header
+        void findRange (InductionVariable& iv)
+        {
+            auto initialValue = getIntegerConstant (iv.entryBranch.targetArgs[iv.parameterIndex]);
+            auto branchIf = cast<heart::BranchIf> (iv.header.terminator);
+
+            if (initialValue == nullptr || branchIf == nullptr || iv.step <= 0
+                 || ! iv.loop.contains (dominators.getIndex (branchIf->targets[0]))
+                 || iv.loop.contains (dominators.getIndex (branchIf->targets[1])))
+                return;
+
+            auto condition = cast<heart::BinaryOperator> (getSource (branchIf->condition));
+
+            if (condition == nullptr || ! isValueOf (condition->lhs, iv.parameter))
+                return;
+
+            auto limit = getIntegerConstant (condition->rhs);
+
+            if (limit == nullptr)
+                return;
+
+            auto start = initialValue->value.getAsInt64();
+            auto end = limit->value.getAsInt64();
+
+            if (condition->operation == BinaryOp::Op::lessThanOrEqual && end < std::numeric_limits<int32_t>::max())
+                ++end;
+            else if (condition->operation != BinaryOp::Op::lessThan)
+                return;
+
+            auto maxValue = std::max (start, end - 1 + iv.step);
+
+            if (maxValue > (iv.parameter.type.isInteger32() ? std::numeric_limits<int32_t>::max()
+                                                             : std::numeric_limits<int64_t>::max() / 2))
+                return;
+
+            iv.range = { start, maxValue };
+            iv.hasRange = true;
+        }
+
+        //==============================================================================
+        // Replaces "iv * constant" inside the loop with a new parameter which starts at
+        // "initial value * constant" and goes up by "step * constant" on each iteration
+        void replaceMultiplications (InductionVariable& iv)
+        {
+            std::unordered_map<int64_t, pool_ref<heart::Variable>> scaledVariables;
+
+            auto replaceMultiplication = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode != AccessType::read)
+                    return;
+
+                auto b = cast<heart::BinaryOperator> (value);
+
+                if (b == nullptr || b->operation != BinaryOp::Op::multiply || ! b->getType().isIdentical (iv.parameter.type))
+                    return;
+
+                pool_ptr<heart::Constant> factor;
+
+                if (isValueOf (b->lhs, iv.parameter))       factor = getIntegerConstant (b->rhs);
+                else if (isValueOf (b->rhs, iv.parameter))  factor = getIntegerConstant (b->lhs);
+
+                if (factor == nullptr)
+                    return;
+
+                auto scale = factor->value.getAsInt64();
+                auto existing = scaledVariables.find (scale);
+
+                if (existing != scaledVariables.end())
+                {
+                    value = existing->second;
+                    anyChanged = true;
+                    return;
+                }
+
+                if (auto scaled = createScaledVariable (iv, scale, b->location))
+                {
+                    scaledVariables.emplace (scale, *scaled);
+                    value = *scaled;
+                    anyChanged = true;
+                }
+            };
+
+            for (auto blockIndex : iv.loop.blocks)
+            {
+                auto& block = dominators.blocks[blockIndex].get();
+
+                for (auto s : block.statements)
+                    s->visitExpressions (replaceMultiplication);
+
+                block.terminator->visitExpressions (replaceMultiplication);
+            }
+        }
+
+        pool_ptr<heart::Variable> createScaledVariable (InductionVariable& iv, int64_t scale, const CodeLocation& location)
+        {
+            auto& type = iv.parameter.type;
+            auto& initialValue = iv.entryBranch.targetArgs[iv.parameterIndex].get();
+            pool_ptr<heart::Expression> scaledInitialValue;
+
+            if (auto c = getIntegerConstant (initialValue))
+                scaledInitialValue = module.allocator.allocateConstant (multiplyWrapped (c->value.getAsInt64(), scale, type));
+            else if (is_type<heart::Variable> (initialValue) && initialValue.getType().isIdentical (type))
+                scaledInitialValue = module.allocate<heart::BinaryOperator> (location, initialValue,
+                                                                            module.allocator.allocateConstant (multiplyWrapped (1, scale, type)),
+                                                                            BinaryOp::Op::multiply);
+            else
+                return {};
+
+            auto& scaled = module.allocate<heart::Variable> (location, type,
+                                                             module.allocator.get (parameterNames.createName (iv.parameter, "scaled")),
+                                                             heart::Variable::Role::parameter);
+            iv.header.addParameter (scaled);
+            iv.entryBranch.targetArgs.push_back (*scaledInitialValue);
+
+            auto& increment = module.allocator.allocateConstant (multiplyWrapped (iv.step, scale, type));
+
+            for (auto& latch : iv.latchBranches)
+                latch->targetArgs.push_back (module.allocate<heart::BinaryOperator> (location, scaled, increment, BinaryOp::Op::add));
+
+            return scaled;
+        }
+
+        static Value multiplyWrapped (int64_t a, int64_t b, const Type& type)
+        {
+            auto result = static_cast<uint64_t> (a) * static_cast<uint64_t> (b);
+
+            if (type.isInteger32())
+                return Value (static_cast<int32_t> (static_cast<uint32_t> (result)));
+
+            return Value (static_cast<int64_t> (result));
+        }
+
+        //==============================================================================
+        bool findRange (heart::Expression& e, Range& range, int depth = 0) const
+        {
+            if (depth > 16)
+                return false;
+
+            auto& type = e.getType();
+
+            if (type.isBoundedInt())
+            {
+                range = { 0, static_cast<int64_t> (type.getBoundedIntLimit()) - 1 };
+                return true;
+            }
+
+            if (! type.isInteger() || type.isReference())
+                return false;
+
+            if (auto c = getIntegerConstant (e))
+            {
+                range = { c->value.getAsInt64(), c->value.getAsInt64() };
+                return true;
+            }
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                for (auto& iv : inductionVariables)
+                {
+                    if (iv.hasRange && std::addressof (iv.parameter) == v.get())
+                    {
+                        range = iv.range;
+                        return true;
+                    }
+                }
+
+                if (auto d = values.getDefinition (*v))
+                    if (auto a = cast<heart::AssignFromValue> (d->assignment))
+                        return findRange (a->source, range, depth + 1);
+
+                return false;
+            }
+
+            if (auto t = cast<heart::TypeCast> (e))
+                return t->source->getType().isInteger() && findRange (t->source, range, depth + 1)
+                        && fitsInType (range, type);
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                Range lhs, rhs;
+
+                if (! (findRange (b->lhs, lhs, depth + 1) && findRange (b->rhs, rhs, depth + 1)))
+                    return false;
+
+                if (b->operation == BinaryOp::Op::add)
+                    range = { lhs.min + rhs.min, lhs.max + rhs.max };
+                else if (b->operation == BinaryOp::Op::multiply && lhs.min >= 0 && rhs.min >= 0
+                          && lhs.max <= std::numeric_limits<int32_t>::max() && rhs.max <= std::numeric_limits<int32_t>::max())
+                    range = { lhs.min * rhs.min, lhs.max * rhs.max };
+                else if (b->operation == BinaryOp::Op::bitwiseAnd && (lhs.min >= 0 || rhs.min >= 0))
+                    range = { 0, lhs.min >= 0 && rhs.min >= 0 ? std::min (lhs.max, rhs.max) : (lhs.min >= 0 ? lhs.max : rhs.max) };
+                else if (b->operation == BinaryOp::Op::modulo && lhs.min >= 0 && rhs.min > 0)
+                    range = { 0, std::min (lhs.max, rhs.max - 1) };
+                else if (b->operation == BinaryOp::Op::divide && lhs.min >= 0 && rhs.min > 0)
+                    range = { lhs.min / rhs.max, lhs.max / rhs.min };
+                else
+                    return false;
+
+                return fitsInType (range, type);
+            }
+
+            return false;
+        }
+
+        static bool fitsInType (Range range, const Type& type)
+        {
+            if (type.isInteger64())
+                return range.min > std::numeric_limits<int64_t>::min() / 4
+                        && range.max < std::numeric_limits<int64_t>::max() / 4;
+
+            return range.min >= std::numeric_limits<int32_t>::min()
+                    && range.max <= std::numeric_limits<int32_t>::max();
+        }
+
+        static int getPowerOfTwo (int64_t n)
+        {
+            if (n <= 0 || (n & (n - 1)) != 0)
+                return -1;
+
+            int power = 0;
+
+            while ((static_cast<int64_t> (1) << power) != n)
+                ++power;
+
+            return power;
+        }
+
+        // Replaces an integer division or modulo of a value that's known to be positive
+        void reduceDivision (pool_ref<heart::Expression>& value, AccessType mode)
+        {
+            if (mode != AccessType::read)
+                return;
+
+            auto b = cast<heart::BinaryOperator> (value);
+
+            if (b == nullptr || ! (b->operation == BinaryOp::Op::modulo || b->operation == BinaryOp::Op::divide))
+                return;
+
+            auto& type = b->getType();
+            auto divisor = getIntegerConstant (b->rhs);
+
+            if (divisor == nullptr || ! isPlainInteger (type) || ! b->lhs->getType().isIdentical (type)
+                 || ! divisor->value.getType().isIdentical (type))
+                return;
+
+            Range range { 0, 0 };
+
+            if (! findRange (b->lhs, range) || range.min < 0)
+                return;
+
+            auto divisorValue = divisor->value.getAsInt64();
+            auto power = getPowerOfTwo (divisorValue);
+
+            if (b->operation == BinaryOp::Op::modulo)
+            {
+                if (divisorValue > 0 && range.max < divisorValue)
+                {
+                    value = b->lhs;
+                    anyChanged = true;
+                }
+                else if (power > 0)
+                {
+                    b->operation = BinaryOp::Op::bitwiseAnd;
+                    b->rhs = module.allocator.allocateConstant (multiplyWrapped (divisorValue - 1, 1, type));
+                    anyChanged = true;
+                }
+            }
+            else if (power > 0)
+            {
+                b->operation = BinaryOp::Op::rightShift;
+                b->rhs = module.allocator.allocateConstant (multiplyWrapped (power, 1, type));
+                anyChanged = true;
+            }
+        }
+    };
+};
+
+} // namespace soul
@@ -0,0 +1,1146 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Rewrites loops whose trip count is a small constant, such as "loop (4)" or a for-loop
+    over the elements of a fixed-size array. Like LoopOptimisations, these need the loop
+    counters to have been turned into block parameters.
+
+    widenVectorLoops() replaces a loop which applies the same arithmetic to each element of
+    some arrays with a single vector operation, changing the arrays into vectors. It only
+    does this when each iteration touches nothing but its own element, and when the arrays
+    are only ever accessed one element at a time, so that the change of type can't be seen.
+
+    unrollLoops() copies the body of a counted loop once for each iteration, so that the
+    counter becomes a constant in each copy. Loops which are too big for that are unrolled
+    by a factor which divides their trip count, so only one copy needs to test the counter.
+*/
+struct LoopUnrolling
+{
+    /** The limits used to decide whether to unroll a loop. Sizes are measured in HEART
+        statements, in the same way as FunctionInlining does.
+    */
+    struct CostModel
+    {
+        int64_t maxFullUnrollTripCount;
+        size_t maxFullyUnrolledSize, maxPartialUnrollFactor, maxPartiallyUnrolledSize, maxGrowthPerFunction;
+
+        static CostModel forOptimisationLevel (int level)
+        {
+            if (level <= 1)  return { 0, 0, 0, 0, 0 };
+            if (level == 2)  return { 16, 64, 2, 32, 256 };
+
+            return { 64, 256, 4, 64, 1024 };
+        }
+    };
+
+    static void widenVectorLoops (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                widenVectorLoops (program, m, f);
+    }
+
+    static void unrollLoops (Program& program, int optimisationLevel)
+    {
+        unrollLoops (program, CostModel::forOptimisationLevel (optimisationLevel));
+    }
+
+    static void unrollLoops (Program& program, CostModel costModel)
+    {
+        if (costModel.maxFullUnrollTripCount == 0)
+            return;
+
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                unrollLoops (m, f, costModel);
+    }
+
+    //==============================================================================
+    static void widenVectorLoops (Program& program, Module& module, heart::Function& f)
+    {
+        for (;;)
+        {
+            SSAOptimisations::SSAValues values (f);
+
+            if (! (values.isValid && widenFirstPossibleLoop (program, module, values)))
+                break;
+
+            SSAOptimisations::tidyBlocks (module, f);
+        }
+    }
+
+    static void unrollLoops (Module& module, heart::Function& f, CostModel costModel)
+    {
+        std::unordered_set<const heart::Block*> unrolledHeaders;
+        size_t growth = 0;
+
+        for (;;)
+        {
+            SSAOptimisations::SSAValues values (f);
+
+            if (! (values.isValid && unrollFirstPossibleLoop (module, f, values, costModel, unrolledHeaders, growth)))
+                break;
+
+            SSAOptimisations::keepBlockParametersLocal (module, f);
+            SSAOptimisations::tidyBlocks (module, f);
+        }
+
+        if (! unrolledHeaders.empty())
+        {
+            SSAOptimisations::propagateConstants (module, f);
+            SSAOptimisations::removeRedundantValues (module, f);
+            useFixedIndexesWherePossible (f);
+        }
+    }
+
+private:
+    static constexpr size_t notFound = CallFlowGraph::DominatorTree::notFound;
+    static constexpr int64_t maxTripCountToAnalyse = 65536;
+
+    //==============================================================================
+    /** A natural loop which is only left from its header, and whose exit test compares a
+        header parameter against a constant. The parameter starts at a constant, and goes up
+        or down by a constant amount each time around the loop, so the number of times that
+        the loop will run can be worked out in advance.
+    */
+    struct CountedLoop
+    {
+        const CallFlowGraph::NaturalLoop& loop;
+        size_t preheader, latch;
+        heart::BranchIf& exitTest;
+        size_t continueTargetIndex;     // which of the exit test's targets stays in the loop
+        size_t counterIndex;
+        int64_t initialValue, step, tripCount;
+
+        heart::Block& getContinueTarget() const    { return exitTest.targets[continueTargetIndex]; }
+        heart::Block& getExitTarget() const        { return exitTest.targets[1 - continueTargetIndex]; }
+    };
+
+    static std::optional<CountedLoop> findCountedLoop (SSAOptimisations::SSAValues& values,
+                                                       const CallFlowGraph::NaturalLoop& loop,
+                                                       int64_t maxTripCount)
+    {
+        auto& dominators = values.dominators;
+
+        if (loop.latches.size() != 1)
+            return {};
+
+        auto preheader = LoopOptimisations::findPreheader (dominators, loop);
+
+        if (preheader == notFound)
+            return {};
+
+        auto& header = dominators.blocks[loop.header].get();
+        auto exitTest = cast<heart::BranchIf> (header.terminator);
+        auto latchBranch = cast<heart::Branch> (dominators.blocks[loop.latches.front()]->terminator);
+
+        if (exitTest == nullptr || latchBranch == nullptr || ! exitTest->isConditional())
+            return {};
+
+        auto firstTargetIsInLoop = loop.contains (dominators.getIndex (exitTest->targets[0]));
+
+        if (firstTargetIsInLoop == loop.contains (dominators.getIndex (exitTest->targets[1])))
+            return {};
+
+        for (auto blockIndex : loop.blocks)
+        {
+            if (blockIndex == loop.header)
+                continue;
+
+            auto& terminator = *dominators.blocks[blockIndex]->terminator;
+
+            if (! (is_type<heart::Branch> (terminator) || is_type<heart::BranchIf> (terminator)))
+                return {};
+
+            for (auto dest : terminator.getDestinationBlocks())
+                if (! loop.contains (dominators.getIndex (dest)))
+                    return {};
+        }
+
+        auto condition = cast<heart::BinaryOperator> (getSource (values, exitTest->condition));
+
+        if (condition == nullptr || ! isComparison (condition->operation))
+            return {};
+
+        auto counterIndex = findCounterParameter (values, header, condition->lhs);
+        auto counterIsOnLeft = counterIndex != notFound;
+
+        if (! counterIsOnLeft)
+            counterIndex = findCounterParameter (values, header, condition->rhs);
+
+        if (counterIndex == notFound)
+            return {};
+
+        auto limit = getIntegerConstant (getSource (values, counterIsOnLeft ? condition->rhs : condition->lhs));
+        auto& counter = header.parameters[counterIndex].get();
+        auto& entryBranch = *cast<heart::Branch> (dominators.blocks[preheader]->terminator);
+        auto initialValue = getIntegerConstant (getSource (values, entryBranch.targetArgs[counterIndex]));
+        auto step = getStep (values, latchBranch->targetArgs[counterIndex], counter);
+
+        if (limit == nullptr || initialValue == nullptr || step == 0)
+            return {};
+
+        CountedLoop result { loop, preheader, loop.latches.front(), *exitTest, firstTargetIsInLoop ? 0u : 1u,
+                             counterIndex, initialValue->value.getAsInt64(), step, 0 };
+
+        auto limitValue = limit->value.getAsInt64();
+        auto value = result.initialValue;
+
+        for (;;)
+        {
+            auto passed = counterIsOnLeft ? compare (condition->operation, value, limitValue)
+                                          : compare (condition->operation, limitValue, value);
+
+            if (passed != (result.continueTargetIndex == 0))
+                return result;
+
+            if (++result.tripCount > maxTripCount)
+                return {};
+
+            value = addToCounter (value, step, counter.type);
+        }
+    }
+
+    static bool isCounterType (const Type& type)
+    {
+        if (type.isReference() || type.isConst())
+            return false;
+
+        if (type.isBoundedInt())
+            return type.isWrapped();
+
+        return type.isInteger32() || type.isInteger64();
+    }
+
+    static int64_t addToCounter (int64_t value, int64_t step, const Type& type)
+    {
+        if (type.isBoundedInt())
+        {
+            auto limit = static_cast<int64_t> (type.getBoundedIntLimit());
+            return (((value + step) % limit) + limit) % limit;
+        }
+
+        auto result = static_cast<uint64_t> (value) + static_cast<uint64_t> (step);
+
+        if (type.isInteger32())
+            return static_cast<int32_t> (static_cast<uint32_t> (result));
+
+        return static_cast<int64_t> (result);
+    }
+
+    static bool isComparison (BinaryOp::Op op)
+    {
+        return op == BinaryOp::Op::lessThan     || op == BinaryOp::Op::lessThanOrEqual
+            || op == BinaryOp::Op::greaterThan  || op == BinaryOp::Op::greaterThanOrEqual
+            || op == BinaryOp::Op::equals       || op == BinaryOp::Op::notEquals;
+    }
+
+    static bool compare (BinaryOp::Op op, int64_t a, int64_t b)
+    {
+        switch (op)
+        {
+            case BinaryOp::Op::lessThan:            return a < b;
+            case BinaryOp::Op::lessThanOrEqual:     return a <= b;
+            case BinaryOp::Op::greaterThan:         return a > b;
+            case BinaryOp::Op::greaterThanOrEqual:  return a >= b;
+            case BinaryOp::Op::equals:              return a == b;
+            case BinaryOp::Op::notEquals:           return a != b;
+            default:                                SOUL_ASSERT_FALSE; return false;
+        }
+    }
+
+    // Looks through any constants to find the expression which produced a value
+    static heart::Expression& getSource (SSAOptimisations::SSAValues& values, heart::Expression& e)
+    {
+        if (auto v = cast<heart::Variable> (e))
+            if (auto d = values.getDefinition (*v))
+                if (auto a = cast<heart::AssignFromValue> (d->assignment))
+                    return getSource (values, a->source);
+
+        return e;
+    }
+
+    static bool isValueOf (SSAOptimisations::SSAValues& values, heart::Expression& e, const heart::Variable& v)
+    {
+        return std::addressof (getSource (values, e)) == std::addressof (v);
+    }
+
+    static pool_ptr<heart::Constant> getIntegerConstant (heart::Expression& e)
+    {
+        if (auto c = cast<heart::Constant> (e))
+            if (c->value.getType().isPrimitiveInteger() || c->value.getType().isBoundedInt())
+                return c;
+
+        return {};
+    }
+
+    // Finds the header parameter that a comparison operand reads, allowing for the cast
+    // that's used to compare a bounded int with an integer
+    static size_t findCounterParameter (SSAOptimisations::SSAValues& values, heart::Block& header, heart::Expression& operand)
+    {
+        auto* source = std::addressof (getSource (values, operand));
+
+        if (auto t = cast<heart::TypeCast> (*source))
+            if (t->destType.isPrimitiveInteger() && t->source->getType().isBoundedInt())
+                source = std::addressof (getSource (values, t->source));
+
+        for (size_t i = 0; i < header.parameters.size(); ++i)
+            if (header.parameters[i].getPointer() == source && isCounterType (header.parameters[i]->type))
+                return i;
+
+        return notFound;
+    }
+
+    // Returns the amount that a value adds to a parameter, or 0 if it isn't of that form
+    static int64_t getStep (SSAOptimisations::SSAValues& values, heart::Expression& value, const heart::Variable& param)
+    {
+        if (auto b = cast<heart::BinaryOperator> (getSource (values, value)))
+        {
+            if (b->getType().isIdentical (param.type))
+            {
+                if (b->operation == BinaryOp::Op::add)
+                {
+                    if (isValueOf (values, b->lhs, param))
+                        if (auto c = getIntegerConstant (b->rhs))
+                            return c->value.getAsInt64();
+
+                    if (isValueOf (values, b->rhs, param))
+                        if (auto c = getIntegerConstant (b->lhs))
+                            return c->value.getAsInt64();
+                }
+
+                if (b->operation == BinaryOp::Op::subtract && isValueOf (values, b->lhs, param))
+                    if (auto c = getIntegerConstant (b->rhs))
+                        if (c->value.getAsInt64() != std::numeric_limits<int64_t>::min())
+                            return -c->value.getAsInt64();
+            }
+        }
+
+        return 0;
+    }
+
+    //==============================================================================
+    /** The variables which a loop defines, and checks for the things that would stop it
+        being copied or replaced.
+    */
+    struct LoopContents
+    {
+        LoopContents (SSAOptimisations::SSAValues& v, const CallFlowGraph::NaturalLoop& l)  : values (v), loop (l)
+        {
+            for (auto blockIndex : loop.blocks)
+            {
+                auto& b = values.dominators.blocks[blockIndex].get();
+                size += 1 + static_cast<size_t> (std::distance (b.statements.begin(), b.statements.end()));
+
+                for (auto& p : b.parameters)
+                    definedVariables.insert (p.getPointer());
+
+                for (auto s : b.statements)
+                {
+                    if (is_type<heart::AdvanceClock> (*s))
+                        containsAdvance = true;
+
+                    if (auto a = cast<heart::Assignment> (*s))
+                        if (auto target = cast<heart::Variable> (a->target))
+                            if (target->isConstant())
+                                definedVariables.insert (target.get());
+                }
+            }
+        }
+
+        bool defines (const heart::Variable& v) const
+        {
+            return definedVariables.find (std::addressof (v)) != definedVariables.end();
+        }
+
+        /** Checks that every value the loop defines is an SSA value, and that the only ones
+            read after the loop are defined by its header (or if requireNoneUsedOutside is
+            set, that none of them are).
+        */
+        bool canBeTransformed (bool requireNoneUsedOutside) const
+        {
+            if (containsAdvance)
+                return false;
+
+            for (auto v : definedVariables)
+                if (! values.contains (*v))
+                    return false;
+
+            bool isValid = true;
+
+            for (size_t i = 0; i < values.dominators.blocks.size(); ++i)
+            {
+                if (loop.contains (i))
+                    continue;
+
+                values.dominators.blocks[i]->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                {
+                    if (auto v = cast<heart::Variable> (value))
+                        if (defines (*v) && (requireNoneUsedOutside || values.getDefinition (*v)->blockIndex != loop.header))
+                            isValid = false;
+                });
+            }
+
+            return isValid;
+        }
+
+        SSAOptimisations::SSAValues& values;
+        const CallFlowGraph::NaturalLoop& loop;
+        std::unordered_set<const heart::Variable*> definedVariables;
+        size_t size = 0;
+        bool containsAdvance = false;
+    };
+
+    //==============================================================================
+    static bool unrollFirstPossibleLoop (Module& module, heart::Function& f, SSAOptimisations::SSAValues& values,
+                                         CostModel costModel, std::unordered_set<const heart::Block*>& unrolledHeaders,
+                                         size_t& growth)
+    {
+        for (auto& loop : CallFlowGraph::findNaturalLoops (values.dominators))
+        {
+            auto& header = values.dominators.blocks[loop.header].get();
+
+            if (unrolledHeaders.find (std::addressof (header)) != unrolledHeaders.end())
+                continue;
+
+            auto countedLoop = findCountedLoop (values, loop, maxTripCountToAnalyse);
+
+            if (! countedLoop)
+                continue;
+
+            LoopContents contents (values, loop);
+
+            if (! contents.canBeTransformed (false))
+                continue;
+
+            auto tripCount = static_cast<size_t> (countedLoop->tripCount);
+
+            if (countedLoop->tripCount <= costModel.maxFullUnrollTripCount
+                 && tripCount * contents.size <= costModel.maxFullyUnrolledSize
+                 && growth + tripCount * contents.size <= costModel.maxGrowthPerFunction)
+            {
+                LoopUnroller (module, f, values, *countedLoop, contents).unrollFully();
+                growth += tripCount * contents.size;
+                unrolledHeaders.insert (std::addressof (header));
+                return true;
+            }
+
+            for (auto factor = costModel.maxPartialUnrollFactor; factor > 1; factor /= 2)
+            {
+                if (tripCount > factor && tripCount % factor == 0
+                     && factor * contents.size <= costModel.maxPartiallyUnrolledSize
+                     && growth + (factor - 1) * contents.size <= costModel.maxGrowthPerFunction)
+                {
+                    LoopUnroller (module, f, values, *countedLoop, contents).unrollPartially (factor);
+                    growth += (factor - 1) * contents.size;
+                    unrolledHeaders.insert (std::addressof (header));
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Once the counter has been replaced by a constant, an element can be accessed directly
+    static void useFixedIndexesWherePossible (heart::Function& f)
+    {
+        f.visitExpressions ([] (pool_ref<heart::Expression>& value, AccessType)
+        {
+            if (auto a = cast<heart::ArrayElement> (value))
+            {
+                if (a->isDynamic())
+                {
+                    auto index = a->dynamicIndex->getAsConstant();
+                    auto& parentType = a->parent->getType();
+
+                    if (index.isValid() && (index.getType().isPrimitiveInteger() || index.getType().isBoundedInt())
+                         && (parentType.isVector() || parentType.isFixedSizeArray())
+                         && parentType.isValidArrayOrVectorIndex (index.getAsInt64()))
+                        a->optimiseDynamicIndexIfPossible();
+                }
+            }
+        });
+    }
+
+    //==============================================================================
+    struct LoopUnroller
+    {
+        LoopUnroller (Module& m, heart::Function& fn, SSAOptimisations::SSAValues& v,
+                      const CountedLoop& l, const LoopContents& c)
+            : module (m), f (fn), values (v), dominators (v.dominators), countedLoop (l), contents (c),
+              loop (l.loop), parameterNames (m, fn)
+        {
+            for (auto blockIndex : loop.blocks)
+                loopBlocks.push_back (dominators.blocks[blockIndex]);
+        }
+
+        /** Makes a copy of the loop for each iteration, plus a copy of the header for the
+            final exit test, which then goes straight to the block after the loop.
+        */
+        void unrollFully()
+        {
+            auto numIterations = static_cast<size_t> (countedLoop.tripCount);
+            createIterations (numIterations + 1, true);
+
+            for (size_t i = 0; i < iterations.size(); ++i)
+            {
+                auto& header = getBlock (i, loopBlocks.front());
+                header.terminator = module.allocate<heart::Branch> (i < numIterations ? getBlock (i, countedLoop.getContinueTarget())
+                                                                                        : countedLoop.getExitTarget());
+            }
+
+            // Anything after the loop can only read values from the header, which now come from its last copy
+            auto& lastIteration = iterations.back();
+
+            for (size_t i = 0; i < dominators.blocks.size(); ++i)
+            {
+                if (! loop.contains (i))
+                {
+                    dominators.blocks[i]->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                    {
+                        if (auto v = cast<heart::Variable> (value))
+                            if (contents.defines (*v))
+                                value = lastIteration.getVariable (*v);
+                    });
+                }
+            }
+
+            f.rebuildBlockPredecessors();
+        }
+
+        /** Makes (factor - 1) extra copies of the loop, which are chained together so that only
+            the original header tests the counter. This relies on the trip count being a
+            multiple of the factor.
+        */
+        void unrollPartially (size_t factor)
+        {
+            createIterations (factor, false);
+
+            for (size_t i = 1; i < iterations.size(); ++i)
+            {
+                auto& header = getBlock (i, loopBlocks.front());
+                header.terminator = module.allocate<heart::Branch> (getBlock (i, countedLoop.getContinueTarget()));
+            }
+
+            f.rebuildBlockPredecessors();
+        }
+
+    private:
+        struct Iteration
+        {
+            std::unordered_map<const heart::Block*, pool_ptr<heart::Block>> blocks;
+            std::unordered_map<const heart::Variable*, pool_ptr<heart::Variable>> variables;
+
+            heart::Variable& getVariable (heart::Variable& v)
+            {
+                auto found = variables.find (std::addressof (v));
+                return found != variables.end() ? *found->second : v;
+            }
+        };
+
+        Module& module;
+        heart::Function& f;
+        SSAOptimisations::SSAValues& values;
+        CallFlowGraph::DominatorTree& dominators;
+        const CountedLoop& countedLoop;
+        const LoopContents& contents;
+        const CallFlowGraph::NaturalLoop& loop;
+        SSAOptimisations::ParameterNameGenerator parameterNames;
+        std::vector<pool_ref<heart::Block>> loopBlocks;
+        std::vector<Iteration> iterations;
+        Iteration* currentIteration = nullptr;
+        heart::Block* nextHeader = nullptr;
+
+        heart::Block& getBlock (size_t iteration, heart::Block& original)
+        {
+            auto found = iterations[iteration].blocks.find (std::addressof (original));
+            return found != iterations[iteration].blocks.end() ? *found->second : original;
+        }
+
+        // The first iteration uses the original blocks. If lastIsHeaderOnly is set, the final
+        // iteration only gets a copy of the header.
+        void createIterations (size_t numIterations, bool lastIsHeaderOnly)
+        {
+            iterations.resize (numIterations);
+            auto insertIndex = getIndexOfLastLoopBlock() + 1;
+
+            for (size_t i = 1; i < numIterations; ++i)
+            {
+                auto isHeaderOnly = lastIsHeaderOnly && i == numIterations - 1;
+
+                for (auto& b : loopBlocks)
+                {
+                    auto& newBlock = heart::Utilities::insertBlock (module, f, insertIndex++,
+                                                                    SSAOptimisations::createUniqueBlockName (f, b->name.toString() + "_unrolled_"));
+                    iterations[i].blocks[b.getPointer()] = newBlock;
+
+                    if (isHeaderOnly)
+                        break;
+                }
+            }
+
+            for (size_t i = 1; i < numIterations; ++i)
+            {
+                currentIteration = std::addressof (iterations[i]);
+                nextHeader = std::addressof (getBlock ((i + 1) % numIterations, loopBlocks.front()));
+
+                for (auto& b : loopBlocks)
+                {
+                    auto newBlock = currentIteration->blocks.find (b.getPointer());
+
+                    if (newBlock != currentIteration->blocks.end())
+                        cloneBlock (*newBlock->second, b);
+                }
+            }
+
+            // The back-edge from the original latch goes to the second iteration
+            if (numIterations > 1)
+                cast<heart::Branch> (dominators.blocks[countedLoop.latch]->terminator)->target = getBlock (1, loopBlocks.front());
+        }
+
+        size_t getIndexOfLastLoopBlock() const
+        {
+            size_t lastIndex = 0;
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
+                if (contains (loopBlocks, f.blocks[i]))
+                    lastIndex = i;
+
+            return lastIndex;
+        }
+
+        //==============================================================================
+        void cloneBlock (heart::Block& target, heart::Block& source)
+        {
+            LinkedList<heart::Statement>::Iterator last;
+
+            for (auto& p : source.parameters)
+                target.addParameter (getRemappedVariable (p));
+
+            for (auto s : source.statements)
+                last = target.statements.insertAfter (last, cloneStatement (*s));
+
+            target.terminator = cloneTerminator (*source.terminator);
+        }
+
+        heart::Block& getRemappedBlock (heart::Block& b)
+        {
+            if (std::addressof (b) == loopBlocks.front().getPointer())
+                return *nextHeader;
+
+            auto found = currentIteration->blocks.find (std::addressof (b));
+            return found != currentIteration->blocks.end() ? *found->second : b;
+        }
+
+        heart::Variable& getRemappedVariable (heart::Variable& old)
+        {
+            if (! contents.defines (old))
+                return old;
+
+            auto& v = currentIteration->variables[std::addressof (old)];
+
+            if (v == nullptr)
+            {
+                if (values.isBlockParameter (old))
+                    v = module.allocate<heart::Variable> (old.location, old.type,
+                                                          module.allocator.get (parameterNames.createName (old, "unrolled")),
+                                                          old.role);
+                else
+                    v = module.allocate<heart::Variable> (old.location, old.type, old.name, old.role);
+
+                v->annotation = old.annotation;
+            }
+
+            return *v;
+        }
+
+        heart::Statement& cloneStatement (heart::Statement& s)
+        {
+            #define SOUL_CLONE_STATEMENT(Type)     if (auto t = cast<const heart::Type> (s)) return clone (*t);
+            SOUL_HEART_STATEMENTS (SOUL_CLONE_STATEMENT)
+            #undef SOUL_CLONE_STATEMENT
+            SOUL_ASSERT_FALSE;
+            return s;
+        }
+
+        heart::Terminator& cloneTerminator (heart::Terminator& t)
+        {
+            if (auto b = cast<heart::Branch> (t))
+            {
+                auto& newBranch = module.allocate<heart::Branch> (getRemappedBlock (b->target));
+
+                for (auto& arg : b->targetArgs)
+                    newBranch.targetArgs.push_back (cloneExpression (arg));
+
+                return newBranch;
+            }
+
+            auto b = cast<heart::BranchIf> (t);
+            SOUL_ASSERT (b != nullptr && ! b->isParameterised());
+
+            return module.allocate<heart::BranchIf> (cloneExpression (b->condition),
+                                                     getRemappedBlock (b->targets[0]),
+                                                     getRemappedBlock (b->targets[1]));
+        }
+
+        heart::AssignFromValue& clone (const heart::AssignFromValue& old)
+        {
+            return module.allocate<heart::AssignFromValue> (old.location, cloneExpression (*old.target), cloneExpression (old.source));
+        }
+
+        heart::FunctionCall& clone (const heart::FunctionCall& old)
+        {
+            auto& fc = module.allocate<heart::FunctionCall> (old.location, cloneExpressionPtr (old.target), old.getFunction());
+
+            for (auto& arg : old.arguments)
+                fc.arguments.push_back (cloneExpression (arg));
+
+            return fc;
+        }
+
+        heart::ReadStream& clone (const heart::ReadStream& old)
+        {
+            return module.allocate<heart::ReadStream> (old.location, cloneExpression (*old.target), old.source);
+        }
+
+        heart::WriteStream& clone (const heart::WriteStream& old)
+        {
+            return module.allocate<heart::WriteStream> (old.location, old.target, cloneExpressionPtr (old.element), cloneExpression (old.value));
+        }
+
+        heart::AdvanceClock& clone (const heart::AdvanceClock& a)
+        {
+            return module.allocate<heart::AdvanceClock> (a.location);
+        }
+
+        heart::Expression& cloneExpression (heart::Expression& old)
+        {
+            if (auto c = cast<heart::Constant> (old))
+                return module.allocate<heart::Constant> (c->location, c->value);
+
+            if (auto b = cast<heart::BinaryOperator> (old))
+                return module.allocate<heart::BinaryOperator> (b->location, cloneExpression (b->lhs), cloneExpression (b->rhs), b->operation);
+
+            if (auto u = cast<heart::UnaryOperator> (old))
+                return module.allocate<heart::UnaryOperator> (u->location, cloneExpression (u->source), u->operation);
+
+            if (auto t = cast<heart::TypeCast> (old))
+                return module.allocate<heart::TypeCast> (t->location, cloneExpression (t->source), t->destType);
+
+            if (auto fc = cast<heart::PureFunctionCall> (old))
+            {
+                auto& newCall = module.allocate<heart::PureFunctionCall> (fc->location, fc->function);
+
+                for (auto& arg : fc->arguments)
+                    newCall.arguments.push_back (cloneExpression (arg));
+
+                return newCall;
+            }
+
+            if (auto v = cast<heart::Variable> (old))
+                return getRemappedVariable (*v);
+
+            if (auto a = cast<heart::ArrayElement> (old))
+            {
+                auto& newElement = module.allocate<heart::ArrayElement> (a->location, cloneExpression (a->parent),
+                                                                         a->fixedStartIndex, a->fixedEndIndex);
+                newElement.dynamicIndex = cloneExpressionPtr (a->dynamicIndex);
+                newElement.suppressWrapWarning = a->suppressWrapWarning;
+                newElement.isRangeTrusted = a->isRangeTrusted;
+                return newElement;
+            }
+
+            if (auto s = cast<heart::StructElement> (old))
+                return module.allocate<heart::StructElement> (s->location, cloneExpression (s->parent), s->memberName);
+
+            auto pp = cast<heart::ProcessorProperty> (old);
+            SOUL_ASSERT (pp != nullptr);
+            return module.allocate<heart::ProcessorProperty> (pp->location, pp->property);
+        }
+
+        pool_ptr<heart::Expression> cloneExpressionPtr (pool_ptr<heart::Expression> old)
+        {
+            if (old != nullptr)
+                return cloneExpression (*old);
+
+            return {};
+        }
+    };
+
+    //==============================================================================
+    static bool widenFirstPossibleLoop (Program& program, Module& module, SSAOptimisations::SSAValues& values)
+    {
+        for (auto& loop : CallFlowGraph::findNaturalLoops (values.dominators))
+        {
+            if (loop.blocks.size() != 2)
+                continue;
+
+            auto countedLoop = findCountedLoop (values, loop, Type::maxVectorSize);
+
+            if (countedLoop && VectorWidener (program, module, values, *countedLoop).perform())
+                return true;
+        }
+
+        return false;
+    }
+
+    /** Handles a loop with a header and one body block, where the counter goes from 0 to the
+        size of the arrays it indexes, and where each statement either writes an element of an
+        array or calculates a value for the current element.
+    */
+    struct VectorWidener
+    {
+        VectorWidener (Program& p, Module& m, SSAOptimisations::SSAValues& v, const CountedLoop& l)
+            : program (p), module (m), values (v), dominators (v.dominators), countedLoop (l), loop (l.loop),
+              header (dominators.blocks[loop.header]), counter (header.parameters[l.counterIndex])
+        {
+        }
+
+        bool perform()
+        {
+            auto numLanes = countedLoop.tripCount;
+
+            if (countedLoop.initialValue != 0 || countedLoop.step != 1 || numLanes < 2
+                 || header.parameters.size() != 1 || ! LoopContents (values, loop).canBeTransformed (true))
+                return false;
+
+            if (! (findCounterValues (header) && findCounterValues (dominators.blocks[countedLoop.latch])))
+                return false;
+
+            for (auto s : dominators.blocks[countedLoop.latch]->statements)
+                if (! addLaneStatement (*s))
+                    return false;
+
+            if (stores.empty() || ! elementType.isPrimitive() || ! canArraysBeChangedToVectors())
+                return false;
+
+            vectorType = Type::createVector (elementType.getPrimitiveType(), static_cast<Type::ArraySize> (numLanes));
+
+            for (auto& array : arrays)
+                changeArrayToVector (array);
+
+            auto& preheader = dominators.blocks[countedLoop.preheader].get();
+            auto last = preheader.statements.getLast();
+
+            for (auto& s : laneStatements)
+                last = preheader.statements.insertAfter (last, widenStatement (s));
+
+            preheader.terminator = module.allocate<heart::Branch> (countedLoop.getExitTarget());
+            return true;
+        }
+
+    private:
+        Program& program;
+        Module& module;
+        SSAOptimisations::SSAValues& values;
+        CallFlowGraph::DominatorTree& dominators;
+        const CountedLoop& countedLoop;
+        const CallFlowGraph::NaturalLoop& loop;
+        heart::Block& header;
+        heart::Variable& counter;
+        Type elementType, vectorType;
+        std::unordered_set<const heart::Variable*> counterValues, laneValues;
+        std::vector<pool_ref<heart::AssignFromValue>> laneStatements, stores;
+        std::vector<pool_ref<heart::Variable>> arrays;
+        std::unordered_map<const heart::Variable*, pool_ptr<heart::Variable>> widenedValues;
+
+        // Finds the values which are calculated from the counter and constants, which can
+        // only be used by the exit test, the back-edge and the array indexes
+        bool findCounterValues (heart::Block& b)
+        {
+            counterValues.insert (std::addressof (counter));
+
+            for (auto s : b.statements)
+            {
+                if (auto a = cast<heart::AssignFromValue> (*s))
+                {
+                    if (auto target = cast<heart::Variable> (a->target))
+                    {
+                        if (isCounterValue (a->source))
+                        {
+                            counterValues.insert (target.get());
+                            continue;
+                        }
+                    }
+                }
+
+                if (std::addressof (b) == std::addressof (header))
+                    return false;
+            }
+
+            return true;
+        }
+
+        bool isCounterValue (heart::Expression& e) const
+        {
+            if (auto v = cast<heart::Variable> (e))
+                return counterValues.find (v.get()) != counterValues.end();
+
+            if (is_type<heart::Constant> (e))
+                return e.getType().isPrimitiveInteger() || e.getType().isBoundedInt();
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+                return isCounterValue (b->lhs) && isCounterValue (b->rhs);
+
+            if (auto t = cast<heart::TypeCast> (e))
+                return isCounterValue (t->source);
+
+            return false;
+        }
+
+        bool addLaneStatement (heart::Statement& s)
+        {
+            auto a = cast<heart::AssignFromValue> (s);
+
+            if (a == nullptr)
+                return false;
+
+            if (auto target = cast<heart::Variable> (a->target))
+            {
+                if (counterValues.find (target.get()) != counterValues.end())
+                    return true;
+
+                if (target->isConstant() && isLaneValue (a->source))
+                {
+                    laneValues.insert (target.get());
+                    laneStatements.push_back (*a);
+                    return true;
+                }
+
+                return false;
+            }
+
+            if (auto element = cast<heart::ArrayElement> (a->target))
+            {
+                if (isLaneElement (*element) && isLaneValue (a->source))
+                {
+                    laneStatements.push_back (*a);
+                    stores.push_back (*a);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool hasElementType (heart::Expression& e)
+        {
+            auto& type = e.getType();
+
+            if (! (type.isFloat32() || type.isFloat64() || type.isInteger32() || type.isInteger64()) || type.isReference())
+                return false;
+
+            if (! elementType.isValid())
+                elementType = type.removeConstIfPresent();
+
+            return type.removeConstIfPresent().isIdentical (elementType);
+        }
+
+        // True if this is the element of an array that the current iteration is working on
+        bool isLaneElement (heart::ArrayElement& element)
+        {
+            auto array = cast<heart::Variable> (element.parent);
+
+            if (array == nullptr || ! element.isDynamic() || ! hasElementType (element))
+                return false;
+
+            auto& arrayType = array->type;
+
+            if (! (arrayType.isFixedSizeArray() || arrayType.isVector()) || arrayType.isReference()
+                 || static_cast<int64_t> (arrayType.getArrayOrVectorSize()) != countedLoop.tripCount)
+                return false;
+
+            auto* index = element.dynamicIndex.get();
+
+            if (auto t = cast<heart::TypeCast> (*index))
+            {
+                if (! (t->destType.isBoundedInt() && static_cast<int64_t> (t->destType.getBoundedIntLimit()) == countedLoop.tripCount))
+                    return false;
+
+                index = t->source.getPointer();
+            }
+
+            if (! isValueOf (values, *index, counter))
+                return false;
+
+            if (! contains (arrays, *array))
+                arrays.push_back (*array);
+
+            return true;
+        }
+
+        bool isLaneValue (heart::Expression& e)
+        {
+            if (! hasElementType (e))
+                return false;
+
+            if (is_type<heart::Constant> (e))
+                return true;
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                if (laneValues.find (v.get()) != laneValues.end())
+                    return true;
+
+                auto d = values.getDefinition (*v);
+                return d != nullptr && ! loop.contains (d->blockIndex);
+            }
+
+            if (auto a = cast<heart::ArrayElement> (e))
+                return isLaneElement (*a);
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+                return isLaneOperator (b->operation) && isLaneValue (b->lhs) && isLaneValue (b->rhs);
+
+            return false;
+        }
+
+        bool isLaneOperator (BinaryOp::Op op) const
+        {
+            if (op == BinaryOp::Op::add || op == BinaryOp::Op::subtract || op == BinaryOp::Op::multiply)
+                return true;
+
+            // (an integer division could fail on a lane which the original loop would never have reached)
+            if (op == BinaryOp::Op::divide)
+                return elementType.isFloatingPoint();
+
+            if (op == BinaryOp::Op::bitwiseAnd || op == BinaryOp::Op::bitwiseOr || op == BinaryOp::Op::bitwiseXor)
+                return elementType.isInteger();
+
+            return false;
+        }
+
+        //==============================================================================
+        // An array can only be changed into a vector if everything that uses it reads or writes
+        // single elements, apart from whole-array assignments of a constant.
+        bool canArraysBeChangedToVectors()
+        {
+            for (auto& array : arrays)
+            {
+                if (! array->type.getElementType().isIdentical (elementType))
+                    return false;
+
+                if (array->type.isArray() && ! ((array->isState() || array->isMutableLocal()) && ! array->isExternal()))
+                    return false;
+            }
+
+            std::unordered_map<const heart::Variable*, size_t> numUses, numElementUses;
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions)
+                {
+                    f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                    {
+                        if (auto v = cast<heart::Variable> (value))
+                            ++numUses[v.get()];
+
+                        if (auto a = cast<heart::ArrayElement> (value))
+                            if (a->isSingleElement())
+                                if (auto v = cast<heart::Variable> (a->parent))
+                                    ++numElementUses[v.get()];
+                    });
+
+                    f->visitStatements<heart::AssignFromValue> ([&] (heart::AssignFromValue& a)
+                    {
+                        if (auto v = cast<heart::Variable> (a.target))
+                            if (is_type<heart::Constant> (a.source))
+                                ++numElementUses[v.get()];
+                    });
+                }
+            }
+
+            for (auto& array : arrays)
+                if (array->type.isArray() && numUses[array.getPointer()] != numElementUses[array.getPointer()])
+                    return false;
+
+            return true;
+        }
+
+        void changeArrayToVector (heart::Variable& array)
+        {
+            if (array.type.isVector())
+                return;
+
+            array.type = vectorType;
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions)
+                {
+                    f->visitStatements<heart::AssignFromValue> ([&] (heart::AssignFromValue& a)
+                    {
+                        if (a.target == array)
+                        {
+                            auto& oldValue = cast<heart::Constant> (a.source)->value;
+                            a.source = module.allocator.allocateConstant (Value::createFromRawData (vectorType, oldValue.getPackedData(),
+                                                                                                    oldValue.getPackedDataSize()));
+                        }
+                    });
+                }
+            }
+        }
+
+        //==============================================================================
+        heart::AssignFromValue& widenStatement (heart::AssignFromValue& s)
+        {
+            auto& newSource = widenValue (s.source);
+
+            if (auto element = cast<heart::ArrayElement> (s.target))
+                return module.allocate<heart::AssignFromValue> (s.location, element->parent, newSource);
+
+            auto& target = *cast<heart::Variable> (s.target);
+            auto& newTarget = module.allocate<heart::Variable> (target.location, vectorType, target.name, heart::Variable::Role::constant);
+            widenedValues[std::addressof (target)] = newTarget;
+            return module.allocate<heart::AssignFromValue> (s.location, newTarget, newSource);
+        }
+
+        heart::Expression& widenValue (heart::Expression& e)
+        {
+            if (auto c = cast<heart::Constant> (e))
+                return module.allocator.allocateConstant (c->value.castToTypeExpectingSuccess (vectorType));
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto widened = widenedValues.find (v.get());
+
+                if (widened != widenedValues.end())
+                    return *widened->second;
+
+                return module.allocate<heart::TypeCast> (v->location, *v, vectorType);
+            }
+
+            if (auto a = cast<heart::ArrayElement> (e))
+                return a->parent;
+
+            auto b = cast<heart::BinaryOperator> (e);
+            SOUL_ASSERT (b != nullptr);
+            return module.allocate<heart::BinaryOperator> (b->location, widenValue (b->lhs), widenValue (b->rhs), b->operation);
+        }
+    };
+};
+
+} // namespace soul
@@ -0,0 +1,344 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Chooses and runs the HEART optimisation passes for a BuildSettings::optimisationLevel,
+    keeping a record of how long each pass took and how much it shrank the program.
+
+    Level 0 just does the block tidying and unused-variable removal that the back-ends rely
+    on. Level 1 adds copy propagation and dead-store elimination, and level 2 (the default)
+    adds the SSA passes: constant propagation, redundant value removal and dead code removal.
+    None of these make the program any bigger.
+
+    Level 3 starts by running the level 2 passes, and then adds graph flattening, the struct
+    layout changes, the loop passes and function inlining, re-running the pipeline until the
+    program stops getting smaller. The passes which can make the program bigger (flattening,
+    inlining, loop-invariant hoisting and unrolling) are each followed by the level 2 passes
+    to tidy up after them, and if the program has then grown more than maxGrowthPercent beyond
+    the size that level 2 produced, the pass is undone and isn't tried again.
+    A level of -1 means "use the default".
+*/
+struct OptimisationPipeline
+{
+    static constexpr int defaultOptimisationLevel = 2;
+    static constexpr int maxOptimisationLevel = 3;
+
+    /** The level at which the passes that change the program's structure, or may make it bigger, are enabled. */
+    static constexpr int fullOptimisationLevel = 3;
+
+    /** How much bigger (in statements) than the level 2 result the passes that grow code can make the program. */
+    static constexpr size_t maxGrowthPercent = 10;
+
+    static int getEffectiveLevel (int requestedLevel)
+    {
+        return requestedLevel < 0 ? defaultOptimisationLevel
+                                  : std::min (requestedLevel, maxOptimisationLevel);
+    }
+
+    //==============================================================================
+    /** A rough measure of how much HEART code a program contains. */
+    struct ProgramSize
+    {
+        size_t functions = 0, blocks = 0, statements = 0, variables = 0;
+
+        static ProgramSize measure (Program& program)
+        {
+            ProgramSize size;
+
+            for (auto& m : program.getModules())
+            {
+                size.variables += m->stateVariables.size();
+
+                for (auto& f : m->functions)
+                {
+                    ++size.functions;
+                    size.blocks += f->blocks.size();
+
+                    for (auto& b : f->blocks)
+                        size.statements += static_cast<size_t> (std::distance (b->statements.begin(), b->statements.end()));
+
+                    size.variables += countLocalVariables (f);
+                }
+            }
+
+            return size;
+        }
+
+        bool operator== (const ProgramSize& other) const
+        {
+            return functions == other.functions && blocks == other.blocks
+                    && statements == other.statements && variables == other.variables;
+        }
+
+        bool operator!= (const ProgramSize& other) const    { return ! operator== (other); }
+
+        std::string getDescription() const
+        {
+            return std::to_string (functions) + " functions, " + std::to_string (blocks) + " blocks, "
+                     + std::to_string (statements) + " statements, " + std::to_string (variables) + " variables";
+        }
+    };
+
+    //==============================================================================
+    struct PassStatistics
+    {
+        std::string name;
+        double seconds = 0;
+        ProgramSize sizeBefore, sizeAfter;
+
+        /** True if the pass made the program too big, and was undone. In that case, sizeAfter
+            is the size that the pass would have produced, rather than the program's actual size.
+        */
+        bool wasUndone = false;
+    };
+
+    struct Statistics
+    {
+        int optimisationLevel = 0;
+        std::vector<PassStatistics> passes;
+        ProgramSize finalSize;
+
+        double getTotalSeconds() const
+        {
+            double total = 0;
+
+            for (auto& p : passes)
+                total += p.seconds;
+
+            return total;
+        }
+
+        std::string getDescription() const
+        {
+            std::ostringstream out;
+            out << "Optimisation level " << optimisationLevel << ", total time "
+                << getDescriptionOfTimeInSeconds (getTotalSeconds()) << std::endl;
+
+            for (auto& p : passes)
+            {
+                out << padded (p.name, 32) << padded (getDescriptionOfTimeInSeconds (p.seconds), 12)
+                    << getSizeDelta (p.sizeBefore.blocks, p.sizeAfter.blocks) << " blocks, "
+                    << getSizeDelta (p.sizeBefore.statements, p.sizeAfter.statements) << " statements, "
+                    << getSizeDelta (p.sizeBefore.variables, p.sizeAfter.variables) << " variables"
+                    << (p.wasUndone ? " (too big - undone)" : "") << std::endl;
+            }
+
+            out << "Final size: " << finalSize.getDescription() << std::endl;
+
+            return out.str();
+        }
+
+    private:
+        static std::string getSizeDelta (size_t before, size_t after)
+        {
+            if (after < before)  return "-" + std::to_string (before - after);
+            if (after > before)  return "+" + std::to_string (after - before);
+            return "0";
+        }
+    };
+
+    //==============================================================================
+    /** Runs the passes for the given level, and returns the timing and size results. */
+    static Statistics run (Program& program, int optimisationLevel)
+    {
+        Statistics stats;
+        stats.optimisationLevel = getEffectiveLevel (optimisationLevel);
+
+        auto size = ProgramSize::measure (program);
+        size_t maxStatements = 0;
+        std::vector<const Pass*> undonePasses;
+
+        auto runPipeline = [&] (int level, bool isFirstIteration)
+        {
+            for (auto& pass : getPasses())
+            {
+                if (pass.minimumLevel > level
+                     || (pass.runOnlyOnce && ! isFirstIteration)
+                     || contains (undonePasses, &pass))
+                    continue;
+
+                PassStatistics passStats;
+                passStats.name = pass.name;
+                passStats.sizeBefore = size;
+
+                Program originalProgram;
+
+                if (pass.mayGrowCode)
+                    originalProgram = program.clone();
+
+                auto startTime = std::chrono::high_resolution_clock::now();
+                pass.function (program, level);
+
+                if (pass.mayGrowCode)
+                    runTidyingPasses (program);
+
+                markAllModulesAsModified (program);
+
+                passStats.seconds = std::chrono::duration<double> (std::chrono::high_resolution_clock::now() - startTime).count();
+                passStats.sizeAfter = ProgramSize::measure (program);
+
+                if (pass.mayGrowCode && passStats.sizeAfter.statements > maxStatements)
+                {
+                    program = originalProgram;
+                    passStats.wasUndone = true;
+                    undonePasses.push_back (&pass);
+                }
+                else
+                {
+                    size = passStats.sizeAfter;
+                }
+
+                stats.passes.push_back (std::move (passStats));
+            }
+        };
+
+        if (stats.optimisationLevel >= fullOptimisationLevel)
+        {
+            runPipeline (defaultOptimisationLevel, false);
+            maxStatements = size.statements + size.statements * maxGrowthPercent / 100;
+        }
+
+        runPipeline (stats.optimisationLevel, true);
+
+        if (stats.optimisationLevel >= maxOptimisationLevel)
+        {
+            for (int i = 1; i < maxNumIterations; ++i)
+            {
+                auto sizeBeforeIteration = size;
+                runPipeline (stats.optimisationLevel, false);
+
+                if (size == sizeBeforeIteration)
+                    break;
+            }
+        }
+
+        stats.finalSize = size;
+        return stats;
+    }
+
+private:
+    //==============================================================================
+    static constexpr int maxNumIterations = 4;
+
+    struct Pass
+    {
+        enum Flags { none = 0, onFirstIterationOnly = 1, canGrowCode = 2 };
+
+        Pass (const char* passName, void (*fn) (Program&), int level, int flags = none)
+            : Pass (passName, std::function<void(Program&, int)> ([fn] (Program& p, int) { fn (p); }), level, flags) {}
+
+        Pass (const char* passName, void (*fn) (Program&, int optimisationLevel), int level, int flags = none)
+            : Pass (passName, std::function<void(Program&, int)> (fn), level, flags) {}
+
+        Pass (const char* passName, std::function<void(Program&, int)> fn, int level, int flags)
+            : name (passName), function (std::move (fn)), minimumLevel (level),
+              runOnlyOnce ((flags & onFirstIterationOnly) != 0), mayGrowCode ((flags & canGrowCode) != 0) {}
+
+        const char* name;
+        std::function<void(Program&, int)> function;
+        int minimumLevel;
+        bool runOnlyOnce, mayGrowCode;
+    };
+
+    static ArrayView<Pass> getPasses()
+    {
+        static Pass passes[] =
+        {
+            { "flattenGraphs",                  flattenGraphs,                                      fullOptimisationLevel, Pass::onFirstIterationOnly | Pass::canGrowCode },
+            { "removeUnreadStructMembers",      removeUnreadStructMembers,                          fullOptimisationLevel, Pass::onFirstIterationOnly },
+            { "convertStateArrays",             convertStateArrays,                                 fullOptimisationLevel, Pass::onFirstIterationOnly },
+            { "optimiseFunctionBlocks",         Optimisations::optimiseFunctionBlocks,              0 },
+            { "removeUnusedVariables",          Optimisations::removeUnusedVariables,               0 },
+            { "inlineFunctions",                FunctionInlining::inlineFunctions,                  fullOptimisationLevel, Pass::canGrowCode },
+            { "propagateCopies",                DeadStoreElimination::propagateCopies,              1 },
+            { "promoteLocalVariables",          SSAOptimisations::promoteLocalVariables,            2 },
+            { "propagateConstants",             SSAOptimisations::propagateConstants,               2 },
+            { "removeRedundantValues",          SSAOptimisations::removeRedundantValues,            2 },
+            { "hoistLoopInvariants",            LoopOptimisations::hoistLoopInvariants,             fullOptimisationLevel, Pass::canGrowCode },
+            { "reduceLoopStrength",             LoopOptimisations::reduceLoopStrength,              fullOptimisationLevel },
+            { "widenVectorLoops",               LoopUnrolling::widenVectorLoops,                    fullOptimisationLevel },
+            { "unrollLoops",                    LoopUnrolling::unrollLoops,                         fullOptimisationLevel, Pass::canGrowCode },
+            { "removeDeadCode",                 SSAOptimisations::removeDeadCode,                   2 },
+            { "removeDeadStores",               DeadStoreElimination::removeDeadStores,             1 },
+            { "removeUnreadStateVariables",     DeadStoreElimination::removeUnreadStateVariables,   1 },
+            { "garbageCollectStringDictionary", Optimisations::garbageCollectStringDictionary,      1 }
+        };
+
+        return passes;
+    }
+
+    /** Runs the passes from levels 1 and 2 in order, to clean up after a pass that can grow the code. */
+    static void runTidyingPasses (Program& program)
+    {
+        for (auto& pass : getPasses())
+            if (pass.minimumLevel <= defaultOptimisationLevel && ! pass.mayGrowCode)
+                pass.function (program, defaultOptimisationLevel);
+    }
+
+    static void markAllModulesAsModified (Program& program)
+    {
+        for (auto& m : program.getModules())
+            m->markAsModified();
+    }
+
+    static void flattenGraphs (Program& program)
+    {
+        auto results = GraphFlattener::flatten (program);
+
+        SOUL_LOG (program.getMainProcessorOrThrowError().originalFullName + ": graph flattening",
+                  [&] { return results.getDescription(); });
+    }
+
+    static void removeUnreadStructMembers (Program& program)
+    {
+        auto results = Optimisations::removeUnreadStructMembers (program);
+
+        SOUL_LOG (program.getMainProcessorOrThrowError().originalFullName + ": unread struct members",
+                  [&] { return results.getDescription(); });
+    }
+
+    static void convertStateArrays (Program& program)
+    {
+        auto results = StructOfArrays::convertStateArrays (program);
+
+        SOUL_LOG (program.getMainProcessorOrThrowError().originalFullName + ": struct-of-arrays",
+                  [&] { return results.getDescription(); });
+    }
+
+    static size_t countLocalVariables (heart::Function& f)
+    {
+        std::unordered_set<const heart::Variable*> locals;
+
+        f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+        {
+            if (auto v = cast<heart::Variable> (value))
+                if (v->isFunctionLocal())
+                    locals.insert (v.get());
+        });
+
+        return locals.size();
+    }
+};
+
+} // namespace soul
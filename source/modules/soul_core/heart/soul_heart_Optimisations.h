@@ -149,6 +149,151 @@ struct Optimisations
         return results;
     }
 
+    struct StructMemberRemovalResults
+    {
+        struct StateSize
+        {
+            std::string processorName;
+            size_t bytesBefore = 0, bytesAfter = 0;
+        };
+
+        size_t numMembersRemoved = 0, numStructsChanged = 0;
+        std::vector<StateSize> processorStateSizes;
+
+        std::string getDescription() const
+        {
+            std::ostringstream out;
+            out << "Removed " << numMembersRemoved << " unread members from " << numStructsChanged << " structs" << std::endl;
+
+            for (auto& p : processorStateSizes)
+                if (p.bytesAfter < p.bytesBefore)
+                    out << "  " << p.processorName << ": " << (p.bytesBefore - p.bytesAfter) << " bytes saved ("
+                        << p.bytesBefore << " -> " << p.bytesAfter << ")" << std::endl;
+
+            return out.str();
+        }
+    };
+
+    /** Deletes the struct members which findUnreadStructMembers() finds, along with the statements
+        which write to them, and rewrites any constants of those struct types to match.
+
+        Structs which can be seen from outside the program (i.e. the ones used by endpoints,
+        external variables, exported functions or unsized arrays) are left alone, as are members
+        which are written by a function call or a stream read. A struct always keeps at least
+        one member.
+    */
+    static StructMemberRemovalResults removeUnreadStructMembers (Program& program)
+    {
+        StructMemberRemovalResults results;
+        auto membersToRemove = findRemovableStructMembers (program);
+
+        if (membersToRemove.empty())
+            return results;
+
+        auto getStateSizes = [&]
+        {
+            std::vector<size_t> sizes;
+
+            for (auto& m : program.getModules())
+            {
+                size_t total = 0;
+
+                for (auto& v : m->stateVariables)
+                    if (! v->type.isUnsizedArray())
+                        total += v->type.getPackedSizeInBytes();
+
+                sizes.push_back (total);
+            }
+
+            return sizes;
+        };
+
+        auto sizesBefore = getStateSizes();
+
+        auto isRemovedMember = [&] (heart::StructElement& e)
+        {
+            auto found = membersToRemove.find (std::addressof (e.getStruct()));
+            return found != membersToRemove.end() && contains (found->second, e.memberName);
+        };
+
+        auto writesRemovedMember = [&] (heart::Statement& s)
+        {
+            if (auto a = cast<heart::AssignFromValue> (s))
+            {
+                for (pool_ptr<heart::Expression> target = a->target; target != nullptr;)
+                {
+                    if (auto e = cast<heart::StructElement> (target))
+                    {
+                        if (isRemovedMember (*e))
+                            return true;
+
+                        target = e->parent;
+                    }
+                    else if (auto e2 = cast<heart::ArrayElement> (target))
+                    {
+                        target = e2->parent;
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+            }
+
+            return false;
+        };
+
+        // The constants have to be repacked while the structs still have their old layout,
+        // and turned back into values once the members have gone.
+        std::vector<std::pair<pool_ref<heart::Constant>, std::vector<uint8_t>>> constantsToUpdate;
+        std::unordered_set<const heart::Constant*> constantsFound;
+
+        for (auto& m : program.getModules())
+        {
+            for (auto& f : m->functions)
+            {
+                for (auto& b : f->blocks)
+                    b->statements.removeMatches (writesRemovedMember);
+
+                f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                {
+                    if (auto c = cast<heart::Constant> (value))
+                    {
+                        if (typeContainsStructs (c->value.getType(), membersToRemove)
+                             && constantsFound.insert (c.get()).second)
+                        {
+                            std::vector<uint8_t> newData;
+                            packWithoutRemovedMembers (newData, c->value.getType(),
+                                                       static_cast<const uint8_t*> (c->value.getPackedData()), membersToRemove);
+                            constantsToUpdate.push_back ({ *c, std::move (newData) });
+                        }
+                    }
+                });
+            }
+        }
+
+        for (auto& s : membersToRemove)
+        {
+            for (auto& name : s.second)
+                s.first->removeMember (name);
+
+            results.numMembersRemoved += s.second.size();
+            ++results.numStructsChanged;
+        }
+
+        for (auto& c : constantsToUpdate)
+            c.first->value = Value::createFromRawData (c.first->value.getType(), c.second.data(), c.second.size());
+
+        auto sizesAfter = getStateSizes();
+        auto modules = program.getModules();
+
+        for (size_t i = 0; i < modules.size(); ++i)
+            if (modules[i]->isProcessor())
+                results.processorStateSizes.push_back ({ modules[i]->originalFullName, sizesBefore[i], sizesAfter[i] });
+
+        return results;
+    }
+
     static void optimiseFunctionBlocks (Program& program)
     {
         for (auto& m : program.getModules())
@@ -388,6 +533,167 @@ private:
         }
     }
 
+    //==============================================================================
+    using StructMemberNames = std::unordered_map<Structure*, std::vector<std::string>>;
+
+    static StructMemberNames findRemovableStructMembers (Program& program)
+    {
+        std::unordered_set<const Structure*> visibleStructs;
+        std::unordered_map<const Structure*, std::unordered_set<std::string>> membersWrittenByOtherStatements;
+
+        auto addVisibleStructs = [&] (const Type& type)
+        {
+            recursivelyAddStructs (type, visibleStructs);
+        };
+
+        for (auto& m : program.getModules())
+        {
+            for (auto& i : m->inputs)
+                for (auto& t : i->dataTypes)
+                    addVisibleStructs (t);
+
+            for (auto& o : m->outputs)
+                for (auto& t : o->dataTypes)
+                    addVisibleStructs (t);
+
+            for (auto& v : m->stateVariables)
+                if (v->isExternal())
+                    addVisibleStructs (v->type);
+
+            for (auto& f : m->functions)
+            {
+                if (f->isExported)
+                {
+                    addVisibleStructs (f->returnType);
+
+                    for (auto& p : f->parameters)
+                        addVisibleStructs (p->type);
+                }
+
+                f->visitStatements<heart::Assignment> ([&] (heart::Assignment& a)
+                {
+                    if (! is_type<heart::AssignFromValue> (a))
+                        for (auto target = a.target; target != nullptr;)
+                        {
+                            if (auto e = cast<heart::StructElement> (target))
+                            {
+                                membersWrittenByOtherStatements[std::addressof (e->getStruct())].insert (e->memberName);
+                                target = e->parent;
+                            }
+                            else if (auto e2 = cast<heart::ArrayElement> (target))
+                            {
+                                target = e2->parent;
+                            }
+                            else
+                            {
+                                break;
+                            }
+                        }
+                });
+            }
+        }
+
+        heart::Utilities::visitAllTypes (program, [&] (const Type& t)
+        {
+            if (t.isUnsizedArray())
+                addVisibleStructs (t.getArrayElementType());
+        });
+
+        StructMemberNames results;
+
+        for (auto& unused : findUnreadStructMembers (program))
+        {
+            auto& s = unused.structure;
+
+            if (visibleStructs.find (std::addressof (s)) != visibleStructs.end())
+                continue;
+
+            std::vector<std::string> names;
+            auto& membersToKeep = membersWrittenByOtherStatements[std::addressof (s)];
+
+            for (auto index : unused.unusedMembers)
+            {
+                auto& name = s.getMemberName (index);
+
+                if (membersToKeep.find (name) == membersToKeep.end())
+                    names.push_back (name);
+            }
+
+            if (names.size() == s.getNumMembers())
+                names.pop_back();
+
+            if (! names.empty())
+                results[std::addressof (s)] = std::move (names);
+        }
+
+        return results;
+    }
+
+    static void recursivelyAddStructs (const Type& type, std::unordered_set<const Structure*>& structs)
+    {
+        if (type.isStruct())
+        {
+            if (structs.insert (type.getStruct().get()).second)
+                for (auto& m : type.getStructRef().getMembers())
+                    recursivelyAddStructs (m.type, structs);
+        }
+        else if (type.isArray())
+        {
+            recursivelyAddStructs (type.getArrayElementType(), structs);
+        }
+    }
+
+    static bool typeContainsStructs (const Type& type, const StructMemberNames& structs)
+    {
+        if (type.isStruct())
+        {
+            if (structs.find (type.getStruct().get()) != structs.end())
+                return true;
+
+            for (auto& m : type.getStructRef().getMembers())
+                if (typeContainsStructs (m.type, structs))
+                    return true;
+        }
+        else if (type.isFixedSizeArray())
+        {
+            return typeContainsStructs (type.getArrayElementType(), structs);
+        }
+
+        return false;
+    }
+
+    // Copies a packed value of the given type, leaving out the data for the members which are
+    // going to be removed. This must be called before the structs are changed.
+    static void packWithoutRemovedMembers (std::vector<uint8_t>& dest, const Type& type,
+                                           const uint8_t* source, const StructMemberNames& membersToRemove)
+    {
+        if (type.isStruct())
+        {
+            auto& s = type.getStructRef();
+            auto removed = membersToRemove.find (std::addressof (s));
+
+            for (auto& m : s.getMembers())
+            {
+                if (removed == membersToRemove.end() || ! contains (removed->second, m.name))
+                    packWithoutRemovedMembers (dest, m.type, source, membersToRemove);
+
+                source += m.type.getPackedSizeInBytes();
+            }
+        }
+        else if (type.isFixedSizeArray())
+        {
+            auto elementType = type.getArrayElementType();
+            auto elementSize = elementType.getPackedSizeInBytes();
+
+            for (size_t i = 0; i < type.getArraySize(); ++i)
+                packWithoutRemovedMembers (dest, elementType, source + i * elementSize, membersToRemove);
+        }
+        else
+        {
+            dest.insert (dest.end(), source, source + type.getPackedSizeInBytes());
+        }
+    }
+
     //==============================================================================
     static bool findAndReplaceFirstDuplicateConstant (heart::Function& f)
     {
@@ -569,6 +875,17 @@ private:
                 for (size_t i = 0; i < targetFunction.parameters.size(); ++i)
                 {
                     auto& param = targetFunction.parameters[i].get();
+
+                    // a reference to one of the caller's variables can just use that variable directly
+                    if (param.type.isReference())
+                    {
+                        if (auto v = cast<heart::Variable> (call.arguments[i]))
+                        {
+                            remappedVariables[param] = v;
+                            continue;
+                        }
+                    }
+
                     auto newParamName = inlinedFnName + "_param_" + makeSafeIdentifierName (param.name.toString());
                     auto& localParamVar = builder.createMutableLocalVariable (param.type, newParamName);
                     builder.addAssignment (localParamVar, call.arguments[i]);
@@ -601,6 +918,9 @@ private:
         {
             LinkedList<heart::Statement>::Iterator last;
 
+            for (auto& p : source.parameters)
+                target.addParameter (getRemappedVariable (p));
+
             for (auto s : source.statements)
                 last = target.statements.insertAfter (last, cloneStatement (*s));
 
@@ -631,14 +951,25 @@ private:
 
         heart::Branch& clone (const heart::Branch& old)
         {
-            return module.allocate<heart::Branch> (*remappedBlocks[old.target]);
+            auto& b = module.allocate<heart::Branch> (*remappedBlocks[old.target]);
+
+            for (auto& arg : old.targetArgs)
+                b.targetArgs.push_back (cloneExpression (arg));
+
+            return b;
         }
 
         heart::BranchIf& clone (const heart::BranchIf& old)
         {
-            return module.allocate<heart::BranchIf> (cloneExpression (old.condition),
-                                                     *remappedBlocks[old.targets[0]],
-                                                     *remappedBlocks[old.targets[1]]);
+            auto& b = module.allocate<heart::BranchIf> (cloneExpression (old.condition),
+                                                        *remappedBlocks[old.targets[0]],
+                                                        *remappedBlocks[old.targets[1]]);
+
+            for (int i = 0; i < 2; ++i)
+                for (auto& arg : old.targetArgs[i])
+                    b.targetArgs[i].push_back (cloneExpression (arg));
+
+            return b;
         }
 
         heart::Terminator& clone (const heart::ReturnVoid&)    { return module.allocate<heart::Branch> (*postCallResumeBlock); }
@@ -0,0 +1,1753 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Scalar optimisations which treat each function as static-single-assignment code.
+
+    promoteLocalVariables() replaces mutable local variables with constants, and uses
+    block parameters to pass values into blocks where control flow merges. After that,
+    most constants have a single definition which dominates all their uses, so the other
+    passes can propagate constants along the branches which can actually be taken, share
+    identical expressions between blocks, and remove code whose results are never used.
+
+    A block parameter is only ever read inside its own block (and never after an advance
+    call), and a branch never passes one of its target's own parameters as an argument,
+    so a back-end can treat each parameter as a variable that's written just before
+    jumping to the block.
+*/
+struct SSAOptimisations
+{
+    static void promoteLocalVariables (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                promoteLocalVariables (m, f);
+    }
+
+    static void propagateConstants (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                propagateConstants (m, f);
+    }
+
+    static void removeRedundantValues (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                removeRedundantValues (m, f);
+    }
+
+    static void removeDeadCode (Program& program)
+    {
+        for (auto& m : program.getModules())
+            for (auto& f : m->functions)
+                removeDeadCode (m, f);
+    }
+
+    //==============================================================================
+    /** Replaces the mutable local variables of primitive, vector and bounded int types with
+        a new constant for each value that gets assigned to them.
+
+        Variables which are written via an element or a reference, or whose values are still
+        needed after an advance call, are left alone.
+    */
+    static void promoteLocalVariables (Module& module, heart::Function& f)
+    {
+        if (f.hasNoBody || f.blocks.empty())
+            return;
+
+        auto variables = findPromotableVariables (f);
+
+        if (variables.empty())
+            return;
+
+        f.rebuildBlockPredecessors();
+
+        if (! f.blocks.front()->predecessors.empty())
+            addEntryBlock (module, f);
+
+        if (! canBeOptimised (f, CallFlowGraph::DominatorTree (f)))
+            return;
+
+        splitConditionalBranchesIntoMergeBlocks (module, f);
+        VariablePromoter (module, f, variables).perform();
+        removeRedundantBlockParameters (f);
+        keepBlockParametersLocal (module, f);
+        tidyBlocks (module, f);
+    }
+
+    /** Works out which values are constant along the paths which can actually be taken,
+        replaces reads of them with the constant, and removes the branches that can't happen.
+    */
+    static void propagateConstants (Module& module, heart::Function& f)
+    {
+        SSAValues values (f);
+
+        if (values.isValid)
+        {
+            ConstantPropagator (module, values).perform();
+            tidyBlocks (module, f);
+        }
+    }
+
+    /** Replaces expressions which have already been calculated by a dominating block with
+        the existing value, and removes copies of values.
+    */
+    static void removeRedundantValues (Module& module, heart::Function& f)
+    {
+        SSAValues values (f);
+
+        if (values.isValid)
+        {
+            ValueNumberer (values).perform();
+            keepBlockParametersLocal (module, f);
+            tidyBlocks (module, f);
+        }
+    }
+
+    /** Removes constants and block parameters which don't contribute to anything with a
+        side-effect, a branch condition or a return value.
+    */
+    static void removeDeadCode (Module& module, heart::Function& f)
+    {
+        SSAValues values (f);
+
+        if (values.isValid)
+        {
+            removeUnusedValues (values);
+            tidyBlocks (module, f);
+        }
+    }
+
+    //==============================================================================
+    // These are also used by other passes which work on the SSA form
+    static bool canBeOptimised (heart::Function& f, const CallFlowGraph::DominatorTree& dominators)
+    {
+        if (f.hasNoBody || f.blocks.empty()
+             || dominators.blocks.size() != f.blocks.size()
+             || ! f.blocks.front()->predecessors.empty())
+            return false;
+
+        for (auto& b : f.blocks)
+        {
+            if (b->terminator == nullptr)
+                return false;
+
+            if (auto branchIf = cast<heart::BranchIf> (b->terminator))
+                if (branchIf->isParameterised())
+                    return false;
+        }
+
+        return ! hasExpressionsSharedBetweenStatements (f);
+    }
+
+    // The passes replace expressions by changing the slot that refers to them, so if the same
+    // expression object was used by two statements, changing one would also change the other
+    static bool hasExpressionsSharedBetweenStatements (heart::Function& f)
+    {
+        std::unordered_map<const heart::Expression*, const void*> owners;
+        const void* currentOwner = nullptr;
+        bool anyShared = false;
+
+        auto checkOwner = [&] (pool_ref<heart::Expression>& value, AccessType)
+        {
+            if (! (is_type<heart::Variable> (value) || is_type<heart::Constant> (value)))
+            {
+                auto& owner = owners[value.getPointer()];
+
+                if (owner != nullptr && owner != currentOwner)
+                    anyShared = true;
+
+                owner = currentOwner;
+            }
+        };
+
+        for (auto& b : f.blocks)
+        {
+            for (auto s : b->statements)
+            {
+                currentOwner = s;
+                s->visitExpressions (checkOwner);
+            }
+
+            currentOwner = b->terminator.get();
+            b->terminator->visitExpressions (checkOwner);
+        }
+
+        return anyShared;
+    }
+
+    static bool isFoldableType (const Type& type)
+    {
+        return type.isPrimitive() && ! type.isVoid();
+    }
+
+    static bool isSameConstant (const Value& a, const Value& b)
+    {
+        return a.getType().isIdentical (b.getType())
+                && a.getPackedDataSize() == b.getPackedDataSize()
+                && std::memcmp (a.getPackedData(), b.getPackedData(), a.getPackedDataSize()) == 0;
+    }
+
+    static bool isSameValue (heart::Expression& a, heart::Expression& b)
+    {
+        if (std::addressof (a) == std::addressof (b))
+            return true;
+
+        if (auto c1 = cast<heart::Constant> (a))
+            if (auto c2 = cast<heart::Constant> (b))
+                return isSameConstant (c1->value, c2->value);
+
+        return false;
+    }
+
+    static std::string createUniqueBlockName (const heart::Function& f, const std::string& prefix)
+    {
+        for (size_t i = 0;; ++i)
+        {
+            auto name = prefix + std::to_string (i);
+
+            if (heart::Utilities::findBlock (f, name) == nullptr)
+                return name;
+        }
+    }
+
+    static void tidyBlocks (Module& module, heart::Function& f)
+    {
+        Optimisations::optimiseFunctionBlocks (f, module.allocator);
+
+        if (removeRedundantBlockParameters (f))
+        {
+            keepBlockParametersLocal (module, f);
+            Optimisations::optimiseFunctionBlocks (f, module.allocator);
+        }
+
+        putBlocksInDominatorOrder (f);
+    }
+
+    //==============================================================================
+    /** Finds the variables in a function which have a single definition that dominates all of
+        their uses, i.e. the block parameters, the constants which pass that test, and any
+        function parameters which are passed by value and never modified.
+    */
+    struct SSAValues
+    {
+        SSAValues (heart::Function& f)  : dominators (f)
+        {
+            isValid = canBeOptimised (f, dominators);
+
+            if (isValid)
+                findDefinitions (f);
+        }
+
+        struct Definition
+        {
+            size_t blockIndex = 0;
+            pool_ptr<heart::Assignment> assignment;  // null for parameters
+            size_t statementIndex = 0;
+            bool isBlockParameter = false;
+        };
+
+        const Definition* getDefinition (const heart::Variable& v) const
+        {
+            auto d = definitions.find (std::addressof (v));
+            return d != definitions.end() ? std::addressof (d->second) : nullptr;
+        }
+
+        bool contains (const heart::Variable& v) const
+        {
+            return definitions.find (std::addressof (v)) != definitions.end();
+        }
+
+        bool isBlockParameter (const heart::Variable& v) const
+        {
+            auto d = getDefinition (v);
+            return d != nullptr && d->isBlockParameter;
+        }
+
+        bool isFunctionParameter (const heart::Variable& v) const
+        {
+            auto d = getDefinition (v);
+            return d != nullptr && d->assignment == nullptr && ! d->isBlockParameter;
+        }
+
+        heart::Block& getBlock (const Definition& d) const     { return dominators.blocks[d.blockIndex]; }
+
+        /** Records a constant which has been added to the end of a block, or moved there. */
+        void setDefinitionAtEndOfBlock (const heart::Variable& v, size_t blockIndex, heart::Assignment& assignment)
+        {
+            definitions[std::addressof (v)] = { blockIndex, assignment, terminatorIndex - 1, false };
+        }
+
+        CallFlowGraph::DominatorTree dominators;
+        bool isValid = false;
+
+    private:
+        std::unordered_map<const heart::Variable*, Definition> definitions;
+
+        static constexpr size_t terminatorIndex = std::numeric_limits<size_t>::max();
+
+        void findDefinitions (heart::Function& f)
+        {
+            std::unordered_map<const heart::Variable*, uint32_t> numWrites;
+
+            f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode != AccessType::read)
+                    if (auto v = cast<heart::Variable> (value))
+                        ++numWrites[v.get()];
+            });
+
+            for (auto& p : f.parameters)
+                if (! p->type.isReference() && numWrites[p.getPointer()] == 0)
+                    definitions[p.getPointer()] = { 0, {}, 0, false };
+
+            for (size_t i = 0; i < dominators.blocks.size(); ++i)
+            {
+                auto& b = dominators.blocks[i].get();
+
+                for (auto& p : b.parameters)
+                    definitions[p.getPointer()] = { i, {}, 0, true };
+
+                size_t statementIndex = 0;
+
+                for (auto s : b.statements)
+                {
+                    ++statementIndex;
+
+                    if (auto a = cast<heart::Assignment> (*s))
+                        if (auto v = cast<heart::Variable> (a->target))
+                            if (v->isConstant() && numWrites[v.get()] == 1)
+                                definitions[v.get()] = { i, a, statementIndex, false };
+                }
+            }
+
+            removeDefinitionsWhichDoNotDominateTheirUses();
+        }
+
+        void removeDefinitionsWhichDoNotDominateTheirUses()
+        {
+            std::vector<const heart::Variable*> badDefinitions;
+
+            for (size_t i = 0; i < dominators.blocks.size(); ++i)
+            {
+                size_t position = 0;
+
+                auto checkRead = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+                {
+                    if (mode == AccessType::read)
+                    {
+                        if (auto v = cast<heart::Variable> (value))
+                        {
+                            auto d = definitions.find (v.get());
+
+                            if (d != definitions.end() && d->second.assignment != nullptr)
+                            {
+                                auto& def = d->second;
+
+                                if (! (dominators.dominates (def.blockIndex, i)
+                                        && (def.blockIndex != i || def.statementIndex < position)))
+                                    badDefinitions.push_back (v.get());
+                            }
+                        }
+                    }
+                };
+
+                auto& b = dominators.blocks[i].get();
+
+                for (auto s : b.statements)
+                {
+                    ++position;
+                    s->visitExpressions (checkRead);
+                }
+
+                position = terminatorIndex;
+                b.terminator->visitExpressions (checkRead);
+            }
+
+            for (auto v : badDefinitions)
+                definitions.erase (v);
+        }
+    };
+
+    //==============================================================================
+    // Replaces any block parameters whose incoming arguments are all the same value (or the
+    // parameter itself) with that value.
+    static bool removeRedundantBlockParameters (heart::Function& f)
+    {
+        SSAValues values (f);
+
+        if (! values.isValid)
+            return false;
+
+        auto canReplaceWith = [&] (heart::Expression& e)
+        {
+            if (auto v = cast<heart::Variable> (e))
+                return values.contains (*v);
+
+            return is_type<heart::Constant> (e);
+        };
+
+        bool anyRemoved = false;
+
+        for (bool anyChanged = true; anyChanged;)
+        {
+            anyChanged = false;
+
+            for (auto& b : f.blocks)
+            {
+                for (size_t i = 0; i < b->parameters.size(); ++i)
+                {
+                    auto& param = b->parameters[i].get();
+                    pool_ptr<heart::Expression> singleValue;
+                    bool isRedundant = true;
+
+                    for (auto& pred : b->predecessors)
+                    {
+                        auto branch = cast<heart::Branch> (pred->terminator);
+
+                        if (branch == nullptr)
+                        {
+                            isRedundant = false;
+                            break;
+                        }
+
+                        auto& arg = branch->targetArgs[i].get();
+
+                        if (std::addressof (arg) == std::addressof (param))
+                            continue;
+
+                        if (singleValue == nullptr)
+                        {
+                            singleValue = arg;
+                        }
+                        else if (! isSameValue (*singleValue, arg))
+                        {
+                            isRedundant = false;
+                            break;
+                        }
+                    }
+
+                    if (isRedundant && singleValue != nullptr
+                         && singleValue->getType().isIdentical (param.type)
+                         && canReplaceWith (*singleValue))
+                    {
+                        auto& replacement = *singleValue;
+
+                        f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                        {
+                            if (value == param)
+                                value = replacement;
+                        });
+
+                        removeBlockParameter (b, i);
+                        --i;
+                        anyChanged = true;
+                        anyRemoved = true;
+                    }
+                }
+            }
+        }
+
+        return anyRemoved;
+    }
+
+    static void removeBlockParameter (heart::Block& b, size_t index)
+    {
+        b.parameters.erase (b.parameters.begin() + static_cast<std::ptrdiff_t> (index));
+
+        for (auto& pred : b.predecessors)
+        {
+            auto branch = cast<heart::Branch> (pred->terminator);
+            SOUL_ASSERT (branch != nullptr && index < branch->targetArgs.size());
+            branch->targetArgs.erase (branch->targetArgs.begin() + index);
+        }
+    }
+
+    // Makes sure that block parameters are only read by their own block, before any advance
+    // call, and aren't passed back into their own block. Any other reads are replaced by a
+    // copy of the parameter which is made at the start of the block.
+    static void keepBlockParametersLocal (Module& module, heart::Function& f)
+    {
+        std::unordered_map<const heart::Variable*, const heart::Block*> parameterBlocks;
+
+        for (auto& b : f.blocks)
+            for (auto& p : b->parameters)
+                parameterBlocks[p.getPointer()] = b.getPointer();
+
+        if (parameterBlocks.empty())
+            return;
+
+        std::unordered_map<const heart::Variable*, pool_ptr<heart::Variable>> copies;
+
+        for (auto& b : f.blocks)
+        {
+            const heart::Block* currentBlock = b.getPointer();
+            const heart::Block* branchTarget = nullptr;
+            bool hasPassedAdvance = false;
+
+            auto replaceIllegalReads = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode == AccessType::read)
+                {
+                    if (auto v = cast<heart::Variable> (value))
+                    {
+                        auto block = parameterBlocks.find (v.get());
+
+                        if (block != parameterBlocks.end()
+                             && (block->second != currentBlock || hasPassedAdvance || branchTarget == currentBlock))
+                        {
+                            auto& copy = copies[v.get()];
+
+                            if (copy == nullptr)
+                                copy = module.allocate<heart::Variable> (v->location, v->type, heart::Variable::Role::constant);
+
+                            value = *copy;
+                        }
+                    }
+                }
+            };
+
+            for (auto s : b->statements)
+            {
+                if (is_type<heart::AdvanceClock> (*s))
+                    hasPassedAdvance = true;
+
+                s->visitExpressions (replaceIllegalReads);
+            }
+
+            if (auto branch = cast<heart::Branch> (b->terminator))
+                branchTarget = branch->target.getPointer();
+
+            b->terminator->visitExpressions (replaceIllegalReads);
+        }
+
+        for (auto& b : f.blocks)
+        {
+            LinkedList<heart::Statement>::Iterator last;
+
+            for (auto& p : b->parameters)
+            {
+                auto copy = copies.find (p.getPointer());
+
+                if (copy != copies.end())
+                    last = b->statements.insertAfter (last, module.allocate<heart::AssignFromValue> (p->location, *copy->second, p));
+            }
+        }
+    }
+
+    // HEART can only be parsed if each value's definition appears before its uses, which is
+    // the case for any block ordering where dominators come before the blocks they dominate.
+    static void putBlocksInDominatorOrder (heart::Function& f)
+    {
+        CallFlowGraph::DominatorTree dominators (f);
+
+        if (dominators.blocks.size() != f.blocks.size())
+            return;
+
+        std::unordered_map<const heart::Block*, size_t> positions;
+
+        for (size_t i = 0; i < f.blocks.size(); ++i)
+            positions[f.blocks[i].getPointer()] = i;
+
+        for (size_t i = 1; i < dominators.blocks.size(); ++i)
+        {
+            auto& dominator = dominators.blocks[dominators.getImmediateDominator (i)];
+
+            if (positions[dominator.getPointer()] > positions[dominators.blocks[i].getPointer()])
+            {
+                f.blocks = dominators.blocks;
+                return;
+            }
+        }
+    }
+
+    /** Creates names for new block parameters. These are looked up by name when HEART is
+        parsed, so they can't clash with any other variable, even after the printer has added
+        suffixes to any duplicate local variable names.
+    */
+    struct ParameterNameGenerator
+    {
+        ParameterNameGenerator (Module& module, heart::Function& f)
+        {
+            auto addName = [this] (const heart::Variable& v)
+            {
+                if (v.name.isValid())
+                    namesInUse.insert (v.name.toString());
+            };
+
+            for (auto& v : module.stateVariables)
+                addName (v);
+
+            for (auto& p : f.parameters)
+                addName (p);
+
+            for (auto& b : f.blocks)
+                for (auto& p : b->parameters)
+                    addName (p);
+
+            f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+            {
+                if (auto v = cast<heart::Variable> (value))
+                    addName (*v);
+            });
+        }
+
+        std::string createName (const heart::Variable& source, const std::string& suffix)
+        {
+            auto prefix = "_" + (source.name.isValid() ? source.name.toString() + "_" : std::string()) + suffix;
+
+            for (;;)
+            {
+                auto name = prefix + std::to_string (nextIndex++);
+
+                if (namesInUse.insert (name).second)
+                    return name;
+            }
+        }
+
+    private:
+        std::unordered_set<std::string> namesInUse;
+        size_t nextIndex = 0;
+    };
+
+private:
+    //==============================================================================
+    static std::vector<pool_ref<heart::Variable>> findPromotableVariables (heart::Function& f)
+    {
+        std::vector<pool_ref<heart::Variable>> variablesFound;
+        std::unordered_map<const heart::Variable*, int> numWholeWrites, numWrites;
+        std::unordered_set<const heart::Variable*> variablesWithImplicitCasts;
+
+        for (auto& b : f.blocks)
+        {
+            for (auto s : b->statements)
+            {
+                if (auto a = cast<heart::Assignment> (*s))
+                {
+                    if (auto v = cast<heart::Variable> (a->target))
+                    {
+                        if (v->isMutableLocal())
+                        {
+                            ++numWholeWrites[v.get()];
+
+                            // a constant takes its type from its value when HEART is parsed, so variables
+                            // which rely on an implicit cast when they're assigned can't be replaced
+                            if (auto assignment = cast<heart::AssignFromValue> (*s))
+                                if (! assignment->source->getType().isIdentical (v->type))
+                                    variablesWithImplicitCasts.insert (v.get());
+                        }
+                    }
+                }
+            }
+        }
+
+        f.visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
+        {
+            if (auto v = cast<heart::Variable> (value))
+            {
+                if (v->isMutableLocal())
+                {
+                    if (numWrites.find (v.get()) == numWrites.end())
+                        variablesFound.push_back (*v);
+
+                    auto& count = numWrites[v.get()];
+
+                    if (mode != AccessType::read)
+                        ++count;
+                }
+            }
+        });
+
+        removeIf (variablesFound, [&] (heart::Variable& v)
+        {
+            auto& type = v.getType();
+
+            return type.isReference()
+                    || ! (type.isPrimitive() || type.isVector() || type.isBoundedInt())
+                    || numWrites[std::addressof (v)] != numWholeWrites[std::addressof (v)]
+                    || variablesWithImplicitCasts.find (std::addressof (v)) != variablesWithImplicitCasts.end();
+        });
+
+        removeVariablesLiveAcrossAdvance (f, variablesFound);
+        return variablesFound;
+    }
+
+    static void removeVariablesLiveAcrossAdvance (heart::Function& f, std::vector<pool_ref<heart::Variable>>& variables)
+    {
+        if (variables.empty() || heart::Utilities::findFirstAdvanceCall (f) == nullptr)
+            return;
+
+        using VariableSet = std::vector<bool>;
+        std::unordered_map<const heart::Variable*, size_t> variableIndexes;
+        std::unordered_map<const heart::Block*, size_t> blockIndexes;
+
+        for (size_t i = 0; i < variables.size(); ++i)
+            variableIndexes[variables[i].getPointer()] = i;
+
+        for (size_t i = 0; i < f.blocks.size(); ++i)
+            blockIndexes[f.blocks[i].getPointer()] = i;
+
+        auto addReads = [&] (VariableSet& live)
+        {
+            return [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode != AccessType::write)
+                {
+                    if (auto v = cast<heart::Variable> (value))
+                    {
+                        auto i = variableIndexes.find (v.get());
+
+                        if (i != variableIndexes.end())
+                            live[i->second] = true;
+                    }
+                }
+            };
+        };
+
+        VariableSet liveAcrossAdvance (variables.size());
+        std::vector<VariableSet> liveAtStart (f.blocks.size(), VariableSet (variables.size()));
+
+        auto findLiveVariablesAtStart = [&] (heart::Block& b, bool recordAdvances)
+        {
+            VariableSet live (variables.size());
+
+            for (auto dest : b.terminator->getDestinationBlocks())
+            {
+                auto& destLive = liveAtStart[blockIndexes[dest.getPointer()]];
+
+                for (size_t i = 0; i < live.size(); ++i)
+                    if (destLive[i])
+                        live[i] = true;
+            }
+
+            b.terminator->visitExpressions (addReads (live));
+
+            std::vector<heart::Statement*> statements;
+
+            for (auto s : b.statements)
+                statements.push_back (s);
+
+            for (auto s = statements.rbegin(); s != statements.rend(); ++s)
+            {
+                if (is_type<heart::AdvanceClock> (**s))
+                {
+                    if (recordAdvances)
+                        for (size_t i = 0; i < live.size(); ++i)
+                            if (live[i])
+                                liveAcrossAdvance[i] = true;
+
+                    continue;
+                }
+
+                if (auto a = cast<heart::Assignment> (**s))
+                {
+                    if (auto v = cast<heart::Variable> (a->target))
+                    {
+                        auto i = variableIndexes.find (v.get());
+
+                        if (i != variableIndexes.end())
+                            live[i->second] = false;
+                    }
+                }
+
+                (*s)->visitExpressions (addReads (live));
+            }
+
+            return live;
+        };
+
+        for (bool anyChanged = true; anyChanged;)
+        {
+            anyChanged = false;
+
+            for (size_t i = f.blocks.size(); i-- > 0;)
+            {
+                auto live = findLiveVariablesAtStart (f.blocks[i], false);
+
+                if (live != liveAtStart[i])
+                {
+                    liveAtStart[i] = std::move (live);
+                    anyChanged = true;
+                }
+            }
+        }
+
+        for (auto& b : f.blocks)
+            if (heart::Utilities::doesBlockCallAdvance (b))
+                findLiveVariablesAtStart (b, true);
+
+        removeIf (variables, [&] (heart::Variable& v) { return liveAcrossAdvance[variableIndexes[std::addressof (v)]]; });
+    }
+
+    static void addEntryBlock (Module& module, heart::Function& f)
+    {
+        auto& oldEntry = f.blocks.front().get();
+        auto& newEntry = heart::Utilities::insertBlock (module, f, 0, createUniqueBlockName (f, "@entry_"));
+        newEntry.terminator = module.allocate<heart::Branch> (oldEntry);
+        f.rebuildBlockPredecessors();
+    }
+
+    // Block parameters can only be passed by unconditional branches, so any conditional
+    // branch into a block with more than one predecessor gets its own intermediate block.
+    // The ones which don't end up needing any parameters get removed again afterwards.
+    static void splitConditionalBranchesIntoMergeBlocks (Module& module, heart::Function& f)
+    {
+        struct Edge
+        {
+            heart::Block& source;
+            heart::BranchIf& branch;
+            size_t targetIndex;
+        };
+
+        std::vector<Edge> edgesToSplit;
+
+        for (auto& b : f.blocks)
+            if (auto branchIf = cast<heart::BranchIf> (b->terminator))
+                for (size_t i = 0; i < 2; ++i)
+                    if (branchIf->targets[i]->predecessors.size() > 1)
+                        edgesToSplit.push_back ({ b, *branchIf, i });
+
+        for (auto& edge : edgesToSplit)
+        {
+            auto sourceIndex = static_cast<size_t> (std::distance (f.blocks.begin(),
+                                                                   std::find (f.blocks.begin(), f.blocks.end(), edge.source)));
+
+            auto& newBlock = heart::Utilities::insertBlock (module, f, sourceIndex + 1, createUniqueBlockName (f, "@edge_"));
+            newBlock.terminator = module.allocate<heart::Branch> (edge.branch.targets[edge.targetIndex]);
+            edge.branch.targets[edge.targetIndex] = newBlock;
+        }
+
+        f.rebuildBlockPredecessors();
+    }
+
+    //==============================================================================
+    /** Builds the SSA form using the algorithm from "Simple and Efficient Construction of
+        Static Single Assignment Form" (Braun et al. 2013), which visits the blocks in order
+        and only adds block parameters where different values actually meet.
+    */
+    struct VariablePromoter
+    {
+        VariablePromoter (Module& m, heart::Function& fn, ArrayView<pool_ref<heart::Variable>> vars)
+            : module (m), dominators (fn), variables (vars.begin(), vars.end()), parameterNames (m, fn)
+        {
+            for (size_t i = 0; i < variables.size(); ++i)
+                variableIndexes[variables[i].getPointer()] = i;
+
+            blockStates.resize (dominators.blocks.size());
+
+            for (auto& state : blockStates)
+                state.currentValues.resize (variables.size());
+        }
+
+        void perform()
+        {
+            for (size_t i = 0; i < dominators.blocks.size(); ++i)
+            {
+                sealIfAllPredecessorsAreFilled (i);
+                rewriteBlock (i);
+                blockStates[i].isFilled = true;
+
+                for (auto dest : dominators.blocks[i]->terminator->getDestinationBlocks())
+                    sealIfAllPredecessorsAreFilled (dominators.getIndex (dest));
+            }
+        }
+
+    private:
+        struct IncompleteParameter
+        {
+            size_t variableIndex;
+            heart::Variable& parameter;
+        };
+
+        struct BlockState
+        {
+            std::vector<pool_ptr<heart::Expression>> currentValues;
+            std::vector<IncompleteParameter> incompleteParameters;
+            bool isFilled = false, isSealed = false;
+        };
+
+        Module& module;
+        CallFlowGraph::DominatorTree dominators;
+        std::vector<pool_ref<heart::Variable>> variables;
+        std::unordered_map<const heart::Variable*, size_t> variableIndexes;
+        std::vector<BlockState> blockStates;
+        ParameterNameGenerator parameterNames;
+
+        static constexpr size_t notFound = std::numeric_limits<size_t>::max();
+
+        size_t getVariableIndex (heart::Expression& e) const
+        {
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto i = variableIndexes.find (v.get());
+
+                if (i != variableIndexes.end())
+                    return i->second;
+            }
+
+            return notFound;
+        }
+
+        void rewriteBlock (size_t blockIndex)
+        {
+            auto& block = dominators.blocks[blockIndex].get();
+
+            auto replaceReads = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode == AccessType::read)
+                {
+                    auto index = getVariableIndex (value);
+
+                    if (index != notFound)
+                        value = readVariable (index, blockIndex);
+                }
+            };
+
+            for (auto s : block.statements)
+            {
+                s->visitExpressions (replaceReads);
+
+                if (auto a = cast<heart::Assignment> (*s))
+                {
+                    if (a->target != nullptr)
+                    {
+                        auto index = getVariableIndex (*a->target);
+
+                        if (index != notFound)
+                        {
+                            auto& oldVariable = variables[index].get();
+                            auto& newValue = module.allocate<heart::Variable> (oldVariable.location, oldVariable.type,
+                                                                               oldVariable.name, heart::Variable::Role::constant);
+                            a->target = newValue;
+                            blockStates[blockIndex].currentValues[index] = newValue;
+                        }
+                    }
+                }
+            }
+
+            block.terminator->visitExpressions (replaceReads);
+        }
+
+        heart::Expression& readVariable (size_t variableIndex, size_t blockIndex)
+        {
+            if (auto value = blockStates[blockIndex].currentValues[variableIndex])
+                return *value;
+
+            auto& block = dominators.blocks[blockIndex].get();
+            auto& state = blockStates[blockIndex];
+            pool_ptr<heart::Expression> value;
+
+            if (! state.isSealed)
+            {
+                auto& param = addBlockParameter (variableIndex, block);
+                state.incompleteParameters.push_back ({ variableIndex, param });
+                value = param;
+            }
+            else if (block.predecessors.empty())
+            {
+                value = module.allocator.allocateZeroInitialiser (variables[variableIndex]->type);
+            }
+            else if (block.predecessors.size() == 1)
+            {
+                value = readVariable (variableIndex, dominators.getIndex (block.predecessors.front()));
+            }
+            else
+            {
+                auto& param = addBlockParameter (variableIndex, block);
+                state.currentValues[variableIndex] = param;
+                addBranchArguments (variableIndex, block);
+                value = param;
+            }
+
+            blockStates[blockIndex].currentValues[variableIndex] = value;
+            return *value;
+        }
+
+        void sealIfAllPredecessorsAreFilled (size_t blockIndex)
+        {
+            auto& state = blockStates[blockIndex];
+
+            if (state.isSealed)
+                return;
+
+            auto& block = dominators.blocks[blockIndex].get();
+
+            for (auto& pred : block.predecessors)
+                if (! blockStates[dominators.getIndex (pred)].isFilled)
+                    return;
+
+            for (auto& p : state.incompleteParameters)
+                addBranchArguments (p.variableIndex, block);
+
+            state.incompleteParameters.clear();
+            state.isSealed = true;
+        }
+
+        void addBranchArguments (size_t variableIndex, heart::Block& block)
+        {
+            for (auto& pred : block.predecessors)
+            {
+                auto& value = readVariable (variableIndex, dominators.getIndex (pred));
+                auto branch = cast<heart::Branch> (pred->terminator);
+                SOUL_ASSERT (branch != nullptr && branch->target == block);
+                branch->targetArgs.push_back (value);
+            }
+        }
+
+        heart::Variable& addBlockParameter (size_t variableIndex, heart::Block& block)
+        {
+            auto& oldVariable = variables[variableIndex].get();
+            auto& param = module.allocate<heart::Variable> (oldVariable.location, oldVariable.type,
+                                                            module.allocator.get (parameterNames.createName (oldVariable, "phi")),
+                                                            heart::Variable::Role::parameter);
+            block.addParameter (param);
+            return param;
+        }
+    };
+
+    //==============================================================================
+    /** Sparse conditional constant propagation, as described in "Constant Propagation with
+        Conditional Branches" (Wegman and Zadeck 1991).
+    */
+    struct ConstantPropagator
+    {
+        ConstantPropagator (Module& m, SSAValues& v)
+            : module (m), values (v), dominators (v.dominators), blockStates (v.dominators.blocks.size())
+        {
+        }
+
+        void perform()
+        {
+            findConstantValues();
+            replaceReadsOfConstantValues();
+        }
+
+    private:
+        struct LatticeValue
+        {
+            enum class State
+            {
+                unknown,
+                constant,
+                varying
+            };
+
+            State state = State::unknown;
+            Value value;
+
+            static LatticeValue varying()                   { return { State::varying, {} }; }
+            static LatticeValue constant (Value v)          { return { State::constant, std::move (v) }; }
+
+            bool isUnknown() const                          { return state == State::unknown; }
+            bool isConstant() const                         { return state == State::constant; }
+            bool isVarying() const                          { return state == State::varying; }
+
+            bool operator== (const LatticeValue& other) const
+            {
+                return state == other.state && (state != State::constant || isSameConstant (value, other.value));
+            }
+
+            bool operator!= (const LatticeValue& other) const     { return ! operator== (other); }
+
+            LatticeValue meet (const LatticeValue& other) const
+            {
+                if (isUnknown())    return other;
+                if (other.isUnknown() || *this == other)    return *this;
+
+                return varying();
+            }
+
+            LatticeValue castTo (const Type& type) const
+            {
+                if (! isConstant())
+                    return *this;
+
+                if (! isFoldableType (type))
+                    return varying();
+
+                auto result = value.tryCastToType (type.removeConstIfPresent());
+                return result.isValid() ? constant (std::move (result)) : varying();
+            }
+        };
+
+        struct BlockState
+        {
+            bool isExecutable = false;
+            LatticeValue condition;
+        };
+
+        Module& module;
+        SSAValues& values;
+        CallFlowGraph::DominatorTree& dominators;
+        std::vector<BlockState> blockStates;
+        std::unordered_map<const heart::Variable*, LatticeValue> lattice;
+
+        //==============================================================================
+        void findConstantValues()
+        {
+            blockStates.front().isExecutable = true;
+
+            for (bool anyChanged = true; anyChanged;)
+            {
+                anyChanged = false;
+
+                for (size_t i = 0; i < dominators.blocks.size(); ++i)
+                    if (blockStates[i].isExecutable)
+                        if (evaluateBlock (dominators.blocks[i]))
+                            anyChanged = true;
+            }
+        }
+
+        bool evaluateBlock (heart::Block& block)
+        {
+            bool anyChanged = false;
+
+            for (size_t i = 0; i < block.parameters.size(); ++i)
+            {
+                auto& param = block.parameters[i].get();
+                LatticeValue value;
+
+                for (auto& pred : block.predecessors)
+                    if (isEdgeExecutable (pred, block))
+                        if (auto branch = cast<heart::Branch> (pred->terminator))
+                            value = value.meet (evaluate (branch->targetArgs[i]).castTo (param.type));
+
+                anyChanged = update (param, value) || anyChanged;
+            }
+
+            for (auto s : block.statements)
+            {
+                if (auto a = cast<heart::Assignment> (*s))
+                {
+                    if (auto v = cast<heart::Variable> (a->target))
+                    {
+                        if (values.contains (*v))
+                        {
+                            auto assignment = cast<heart::AssignFromValue> (*s);
+                            auto value = assignment != nullptr ? evaluate (assignment->source).castTo (v->type)
+                                                               : LatticeValue::varying();
+
+                            anyChanged = update (*v, value) || anyChanged;
+                        }
+                    }
+                }
+            }
+
+            auto& state = blockStates[dominators.getIndex (block)];
+
+            if (auto branchIf = cast<heart::BranchIf> (block.terminator))
+            {
+                auto condition = state.condition.meet (evaluate (branchIf->condition).castTo (PrimitiveType::bool_));
+
+                if (condition != state.condition)
+                {
+                    state.condition = condition;
+                    anyChanged = true;
+                }
+            }
+
+            for (auto dest : block.terminator->getDestinationBlocks())
+            {
+                auto& destState = blockStates[dominators.getIndex (dest)];
+
+                if (! destState.isExecutable && isEdgeExecutable (block, dest))
+                {
+                    destState.isExecutable = true;
+                    anyChanged = true;
+                }
+            }
+
+            return anyChanged;
+        }
+
+        bool isEdgeExecutable (heart::Block& source, heart::Block& dest) const
+        {
+            auto& state = blockStates[dominators.getIndex (source)];
+
+            if (! state.isExecutable)
+                return false;
+
+            if (auto branchIf = cast<heart::BranchIf> (source.terminator))
+            {
+                if (state.condition.isUnknown())
+                    return false;
+
+                if (state.condition.isConstant())
+                    return branchIf->targets[state.condition.value.getAsBool() ? 0 : 1] == dest;
+            }
+
+            return true;
+        }
+
+        bool update (const heart::Variable& v, const LatticeValue& newValue)
+        {
+            auto& current = lattice[std::addressof (v)];
+            auto merged = current.meet (newValue);
+
+            if (merged == current)
+                return false;
+
+            current = std::move (merged);
+            return true;
+        }
+
+        //==============================================================================
+        LatticeValue evaluate (heart::Expression& e) const
+        {
+            if (auto c = cast<heart::Constant> (e))
+                return isFoldableType (c->value.getType()) ? LatticeValue::constant (c->value)
+                                                           : LatticeValue::varying();
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                if (! values.contains (*v) || values.isFunctionParameter (*v))
+                    return LatticeValue::varying();
+
+                auto value = lattice.find (v.get());
+                return value != lattice.end() ? value->second : LatticeValue();
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                auto lhs = evaluate (b->lhs);
+                auto rhs = evaluate (b->rhs);
+
+                if (lhs.isVarying() || rhs.isVarying())  return LatticeValue::varying();
+                if (lhs.isUnknown() || rhs.isUnknown())  return {};
+
+                return foldBinaryOperator (*b, lhs.value, rhs.value);
+            }
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                auto source = evaluate (u->source);
+
+                if (! source.isConstant())
+                    return source;
+
+                auto result = source.value;
+
+                if (UnaryOp::apply (result, u->operation))
+                    return LatticeValue::constant (result).castTo (u->getType());
+
+                return LatticeValue::varying();
+            }
+
+            if (auto t = cast<heart::TypeCast> (e))
+            {
+                auto source = evaluate (t->source);
+
+                if (! source.isConstant())
+                    return source;
+
+                if (source.value.getType().isFloatingPoint() && t->destType.isInteger()
+                     && ! isInIntegerRange (source.value.getAsDouble(), t->destType))
+                    return LatticeValue::varying();
+
+                return source.castTo (t->destType);
+            }
+
+            if (auto a = cast<heart::ArrayElement> (e))
+                return evaluateArrayElement (*a);
+
+            if (auto s = cast<heart::StructElement> (e))
+                if (auto parent = cast<heart::Constant> (s->parent))
+                    return LatticeValue::constant (parent->value.getSubElement (s->getMemberIndex())).castTo (s->getType());
+
+            return LatticeValue::varying();
+        }
+
+        LatticeValue evaluateArrayElement (heart::ArrayElement& a) const
+        {
+            auto parent = cast<heart::Constant> (a.parent);
+
+            if (parent == nullptr || ! a.isSingleElement())
+                return LatticeValue::varying();
+
+            auto& parentType = parent->value.getType();
+
+            if (! (parentType.isVector() || parentType.isFixedSizeArray()))
+                return LatticeValue::varying();
+
+            auto index = static_cast<int64_t> (a.fixedStartIndex);
+
+            if (a.isDynamic())
+            {
+                auto indexValue = evaluate (*a.dynamicIndex);
+
+                if (! indexValue.isConstant())
+                    return indexValue;
+
+                if (! indexValue.value.getType().isInteger())
+                    return LatticeValue::varying();
+
+                index = indexValue.value.getAsInt64();
+            }
+
+            if (! parentType.isValidArrayOrVectorIndex (index))
+                return LatticeValue::varying();
+
+            return LatticeValue::constant (parent->value.getSubElement (static_cast<size_t> (index))).castTo (a.getType());
+        }
+
+        static LatticeValue foldBinaryOperator (heart::BinaryOperator& b, Value lhs, Value rhs)
+        {
+            auto op = b.operation;
+            auto& resultType = b.getType();
+            auto operandType = BinaryOp::getTypes (op, lhs.getType(), rhs.getType()).operandType;
+
+            if (! (isFoldableType (operandType) && isFoldableType (resultType)))
+                return LatticeValue::varying();
+
+            // NaNs and signed zeros make floating-point equality tests too risky to fold
+            if (operandType.isFloatingPoint() && BinaryOp::isEqualityOperator (op))
+                return LatticeValue::varying();
+
+            if (op == BinaryOp::Op::divide || op == BinaryOp::Op::modulo)
+            {
+                auto divisor = rhs.tryCastToType (operandType);
+
+                if (! divisor.isValid() || divisor.isZero())
+                    return LatticeValue::varying();
+
+                if (operandType.isInteger() && divisor.getAsInt64() == -1)
+                    return LatticeValue::varying();
+            }
+
+            if (op == BinaryOp::Op::leftShift || op == BinaryOp::Op::rightShift || op == BinaryOp::Op::rightShiftUnsigned)
+            {
+                auto numBits = operandType.isInteger64() ? 64 : 32;
+                auto shift = rhs.getAsInt64();
+
+                if (shift < 0 || shift >= numBits)
+                    return LatticeValue::varying();
+            }
+
+            bool failed = false;
+
+            if (BinaryOp::apply (lhs, rhs, op, [&] (CompileMessage) { failed = true; }) && ! failed)
+                return LatticeValue::constant (lhs).castTo (resultType);
+
+            return LatticeValue::varying();
+        }
+
+        static bool isInIntegerRange (double value, const Type& integerType)
+        {
+            if (integerType.isInteger64())
+                return value >= -9223372036854775808.0 && value < 9223372036854775808.0;
+
+            return value >= -2147483648.0 && value < 2147483648.0;
+        }
+
+        //==============================================================================
+        void replaceReadsOfConstantValues()
+        {
+            // Remembers which variable each new constant replaced, in case it turns out
+            // to be a divisor or array index that can't be a constant
+            std::unordered_map<const heart::Constant*, pool_ref<heart::Variable>> replacedVariables;
+
+            auto replaceReads = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (auto v = cast<heart::Variable> (value))
+                {
+                    if (mode == AccessType::read && ! v->type.isBoundedInt())
+                    {
+                        auto constant = lattice.find (v.get());
+
+                        if (constant != lattice.end() && constant->second.isConstant())
+                        {
+                            auto& c = module.allocator.allocateConstant (constant->second.value);
+                            replacedVariables.emplace (std::addressof (c), *v);
+                            value = c;
+                        }
+                    }
+
+                    return;
+                }
+
+                auto getReplacedVariable = [&] (pool_ptr<heart::Expression> e) -> pool_ptr<heart::Variable>
+                {
+                    if (auto c = cast<heart::Constant> (e))
+                    {
+                        auto original = replacedVariables.find (c.get());
+
+                        if (original != replacedVariables.end())
+                            return original->second;
+                    }
+
+                    return {};
+                };
+
+                if (auto a = cast<heart::ArrayElement> (value))
+                {
+                    if (auto original = getReplacedVariable (a->dynamicIndex))
+                    {
+                        auto& parentType = a->parent->getType();
+
+                        if ((parentType.isVector() || parentType.isFixedSizeArray())
+                              && parentType.isValidArrayOrVectorIndex (cast<heart::Constant> (a->dynamicIndex)->value.getAsInt64()))
+                            a->optimiseDynamicIndexIfPossible();
+                        else
+                            a->dynamicIndex = original;
+                    }
+
+                    return;
+                }
+
+                if (auto b = cast<heart::BinaryOperator> (value))
+                    if (b->operation == BinaryOp::Op::divide || b->operation == BinaryOp::Op::modulo)
+                        if (auto original = getReplacedVariable (b->rhs))
+                            if (cast<heart::Constant> (b->rhs)->value.isZero())
+                                b->rhs = *original;
+            };
+
+            for (size_t i = 0; i < dominators.blocks.size(); ++i)
+            {
+                if (! blockStates[i].isExecutable)
+                    continue;
+
+                auto& block = dominators.blocks[i].get();
+
+                for (auto s : block.statements)
+                    s->visitExpressions (replaceReads);
+
+                block.terminator->visitExpressions (replaceReads);
+
+                if (auto branchIf = cast<heart::BranchIf> (block.terminator))
+                    if (blockStates[i].condition.isConstant())
+                        block.terminator = module.allocate<heart::Branch> (branchIf->targets[blockStates[i].condition.value.getAsBool() ? 0 : 1]);
+            }
+        }
+    };
+
+    //==============================================================================
+    /** Dominator-based value numbering: any pure expression which has already been calculated
+        by a constant in a dominating block is replaced by that constant.
+    */
+    struct ValueNumberer
+    {
+        ValueNumberer (SSAValues& v) : values (v) {}
+
+        void perform()
+        {
+            visitBlock (0);
+        }
+
+    private:
+        SSAValues& values;
+        std::unordered_map<std::string, pool_ref<heart::Variable>> availableValues;
+        std::unordered_map<const heart::Variable*, pool_ref<heart::Variable>> copiedValues;
+
+        void visitBlock (size_t blockIndex)
+        {
+            auto& block = values.dominators.blocks[blockIndex].get();
+            std::vector<std::string> keysAdded;
+            const heart::Block* branchTarget = nullptr;
+            bool hasPassedAdvance = false;
+
+            auto replaceReads = [&] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode == AccessType::read)
+                    replaceWithExistingValue (value, block, branchTarget, hasPassedAdvance);
+            };
+
+            for (auto s : block.statements)
+            {
+                if (is_type<heart::AdvanceClock> (*s))
+                    hasPassedAdvance = true;
+
+                s->visitExpressions (replaceReads);
+
+                if (auto a = cast<heart::AssignFromValue> (*s))
+                    if (auto target = cast<heart::Variable> (a->target))
+                        if (values.contains (*target))
+                            addAvailableValue (*target, a->source, keysAdded);
+            }
+
+            if (auto branch = cast<heart::Branch> (block.terminator))
+                branchTarget = branch->target.getPointer();
+
+            block.terminator->visitExpressions (replaceReads);
+
+            for (auto child : values.dominators.getChildren (blockIndex))
+                visitBlock (child);
+
+            for (auto& key : keysAdded)
+                availableValues.erase (key);
+        }
+
+        void replaceWithExistingValue (pool_ref<heart::Expression>& value, const heart::Block& block,
+                                       const heart::Block* branchTarget, bool hasPassedAdvance)
+        {
+            if (auto v = cast<heart::Variable> (value))
+            {
+                // follow the chain of copies back as far as possible, but block parameters
+                // must stay local to their own block
+                for (auto source = findCopiedValue (*v); source != nullptr; source = findCopiedValue (*source))
+                {
+                    if (auto d = values.getDefinition (*source))
+                        if (d->isBlockParameter && (std::addressof (values.getBlock (*d)) != std::addressof (block)
+                                                     || hasPassedAdvance || branchTarget == std::addressof (block)))
+                            continue;
+
+                    value = *source;
+                }
+
+                return;
+            }
+
+            if (is_type<heart::Constant> (value))
+                return;
+
+            std::string key;
+
+            if (getKey (value, key))
+            {
+                auto existing = availableValues.find (key);
+
+                if (existing != availableValues.end() && existing->second->type.isIdentical (value->getType()))
+                    value = existing->second;
+            }
+        }
+
+        void addAvailableValue (heart::Variable& target, heart::Expression& source, std::vector<std::string>& keysAdded)
+        {
+            if (! source.getType().isIdentical (target.type))
+                return;
+
+            if (auto v = cast<heart::Variable> (source))
+            {
+                if (values.contains (*v))
+                    copiedValues.emplace (std::addressof (target), *v);
+
+                return;
+            }
+
+            std::string key;
+
+            if (! is_type<heart::Constant> (source) && getKey (source, key))
+                if (availableValues.emplace (key, target).second)
+                    keysAdded.push_back (std::move (key));
+        }
+
+        pool_ptr<heart::Variable> findCopiedValue (heart::Variable& v) const
+        {
+            auto source = copiedValues.find (std::addressof (v));
+            return source != copiedValues.end() ? pool_ptr<heart::Variable> (source->second) : pool_ptr<heart::Variable>();
+        }
+
+        heart::Variable& getOriginalValue (heart::Variable& v) const
+        {
+            auto source = findCopiedValue (v);
+            return source != nullptr ? getOriginalValue (*source) : v;
+        }
+
+        // Creates a string which will be the same for any two expressions that are guaranteed
+        // to produce the same value, or returns false if the expression isn't pure
+        bool getKey (heart::Expression& e, std::string& key) const
+        {
+            if (auto c = cast<heart::Constant> (e))
+            {
+                key += "c" + c->value.getType().getDescription() + ":";
+                auto data = static_cast<const uint8_t*> (c->value.getPackedData());
+
+                for (size_t i = 0; i < c->value.getPackedDataSize(); ++i)
+                {
+                    key += "0123456789abcdef"[data[i] >> 4];
+                    key += "0123456789abcdef"[data[i] & 15];
+                }
+
+                return true;
+            }
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto& original = getOriginalValue (*v);
+
+                if (! values.contains (original))
+                    return false;
+
+                key += "v" + std::to_string (reinterpret_cast<size_t> (std::addressof (original)));
+                return true;
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                std::string lhs, rhs;
+
+                if (! (getKey (b->lhs, lhs) && getKey (b->rhs, rhs)))
+                    return false;
+
+                if (isCommutative (b->operation) && rhs < lhs)
+                    std::swap (lhs, rhs);
+
+                key += "b" + std::to_string (static_cast<int> (b->operation)) + "(" + lhs + "," + rhs + ")";
+                return true;
+            }
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                key += "u" + std::to_string (static_cast<int> (u->operation)) + "(";
+                return getKey (u->source, key) && (key += ")", true);
+            }
+
+            if (auto t = cast<heart::TypeCast> (e))
+            {
+                key += "t" + t->destType.getDescription() + "(";
+                return getKey (t->source, key) && (key += ")", true);
+            }
+
+            if (auto a = cast<heart::ArrayElement> (e))
+            {
+                key += "a(";
+
+                if (! getKey (a->parent, key))
+                    return false;
+
+                if (a->isDynamic())
+                {
+                    key += ")[";
+                    return getKey (*a->dynamicIndex, key) && (key += "]", true);
+                }
+
+                key += ")[" + std::to_string (a->fixedStartIndex) + ":" + std::to_string (a->fixedEndIndex) + "]";
+                return true;
+            }
+
+            if (auto s = cast<heart::StructElement> (e))
+            {
+                key += "s(";
+                return getKey (s->parent, key) && (key += ")." + s->memberName, true);
+            }
+
+            if (auto fc = cast<heart::PureFunctionCall> (e))
+            {
+                if (fc->function.intrinsicType == IntrinsicType::none)
+                    return false;
+
+                key += "f" + std::to_string (reinterpret_cast<size_t> (std::addressof (fc->function))) + "(";
+
+                for (auto& arg : fc->arguments)
+                {
+                    if (! getKey (arg, key))
+                        return false;
+
+                    key += ",";
+                }
+
+                key += ")";
+                return true;
+            }
+
+            return false;
+        }
+
+        static bool isCommutative (BinaryOp::Op op)
+        {
+            return op == BinaryOp::Op::add        || op == BinaryOp::Op::multiply
+                || op == BinaryOp::Op::bitwiseOr  || op == BinaryOp::Op::bitwiseAnd  || op == BinaryOp::Op::bitwiseXor
+                || op == BinaryOp::Op::logicalOr  || op == BinaryOp::Op::logicalAnd
+                || op == BinaryOp::Op::equals     || op == BinaryOp::Op::notEquals;
+        }
+    };
+
+    //==============================================================================
+    static bool isRemovableDefinition (const SSAValues& values, heart::Statement& s)
+    {
+        if (auto a = cast<heart::AssignFromValue> (s))
+            if (auto target = cast<heart::Variable> (a->target))
+                return values.contains (*target);
+
+        return false;
+    }
+
+    static void removeUnusedValues (SSAValues& values)
+    {
+        std::unordered_set<const heart::Variable*> liveValues;
+        std::vector<const heart::Variable*> valuesToVisit;
+
+        auto markLive = [&] (pool_ref<heart::Expression>& value, AccessType)
+        {
+            if (auto v = cast<heart::Variable> (value))
+                if (values.contains (*v) && liveValues.insert (v.get()).second)
+                    valuesToVisit.push_back (v.get());
+        };
+
+        for (auto& b : values.dominators.blocks)
+        {
+            for (auto s : b->statements)
+                if (! isRemovableDefinition (values, *s))
+                    s->visitExpressions (markLive);
+
+            if (! is_type<heart::Branch> (b->terminator))
+                b->terminator->visitExpressions (markLive);
+        }
+
+        while (! valuesToVisit.empty())
+        {
+            auto v = valuesToVisit.back();
+            valuesToVisit.pop_back();
+
+            auto d = values.getDefinition (*v);
+
+            if (d->assignment != nullptr)
+            {
+                d->assignment->visitExpressions (markLive);
+            }
+            else if (d->isBlockParameter)
+            {
+                auto& block = values.getBlock (*d);
+                auto paramIndex = static_cast<size_t> (std::distance (block.parameters.begin(),
+                                                                      std::find (block.parameters.begin(), block.parameters.end(), *v)));
+
+                for (auto& pred : block.predecessors)
+                {
+                    if (auto branch = cast<heart::Branch> (pred->terminator))
+                    {
+                        auto& arg = branch->targetArgs[paramIndex];
+                        arg->visitExpressions (markLive, AccessType::read);
+                        markLive (arg, AccessType::read);
+                    }
+                }
+            }
+        }
+
+        for (auto& b : values.dominators.blocks)
+        {
+            b->statements.removeMatches ([&] (heart::Statement& s)
+            {
+                return isRemovableDefinition (values, s)
+                        && liveValues.find (cast<heart::Variable> (cast<heart::Assignment> (s)->target).get()) == liveValues.end();
+            });
+
+            for (size_t i = b->parameters.size(); i-- > 0;)
+                if (liveValues.find (b->parameters[i].getPointer()) == liveValues.end())
+                    removeBlockParameter (b, i);
+        }
+    }
+};
+
+} // namespace soul
@@ -0,0 +1,356 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Re-orders the state variables of each processor so that the back-ends, which lay out
+    state in the order of Module::stateVariables, put the values that the run loop uses
+    on every sample next to each other.
+
+    Each variable gets an estimate of how often it's accessed, by weighting each access
+    with the depth of the loops around it and the way the function containing it gets
+    called. The variables are then split into three regions: the hot values which are
+    used inside the run loop, the cold ones which are only used by events and
+    initialisation, and the large arrays (such as delay lines) which go at the end, each
+    with an "alignment" annotation asking for it to start on a cache line.
+
+    When a graph has been flattened, its processor instances all live in one module, so
+    this also puts the hot state of all the instances together.
+*/
+struct StateLayoutPlanner
+{
+    static constexpr size_t cacheLineSize = 64;
+    static constexpr size_t minLargeArraySize = 4 * cacheLineSize;
+
+    //==============================================================================
+    struct ModuleLayout
+    {
+        std::string moduleName;
+        size_t numVariables = 0, hotBytes = 0, coldBytes = 0, largeArrayBytes = 0,
+               footprintBefore = 0, footprintAfter = 0, paddingBefore = 0, paddingAfter = 0;
+    };
+
+    struct Report
+    {
+        std::vector<ModuleLayout> modules;
+
+        std::string getDescription() const
+        {
+            std::ostringstream out;
+
+            for (auto& m : modules)
+            {
+                out << m.moduleName << ": " << m.numVariables << " variables, "
+                    << m.hotBytes << " hot bytes, " << m.coldBytes << " cold bytes, "
+                    << m.largeArrayBytes << " bytes of large arrays" << std::endl
+                    << "  footprint " << m.footprintBefore << " -> " << m.footprintAfter << " bytes, "
+                    << "padding " << m.paddingBefore << " -> " << m.paddingAfter << " bytes" << std::endl;
+            }
+
+            return out.str();
+        }
+    };
+
+    //==============================================================================
+    static Report planLayout (Program& program)
+    {
+        Report report;
+        auto accessWeights = AccessWeights::estimate (program);
+
+        for (auto& m : program.getModules())
+        {
+            if (m->isProcessor() && ! m->stateVariables.empty())
+            {
+                report.modules.push_back (planLayout (m, accessWeights));
+                m->markAsModified();
+            }
+        }
+
+        return report;
+    }
+
+private:
+    //==============================================================================
+    static constexpr double loopWeight = 8.0;
+    static constexpr double eventFunctionWeight = 1.0;
+    static constexpr size_t maxLoopDepth = 4;
+
+    enum class Region
+    {
+        hot,
+        cold,
+        largeArray
+    };
+
+    /** Estimates the relative number of times each state variable gets accessed. An access
+        inside one level of loop in the run function (i.e. once per sample) has a weight of
+        loopWeight, so anything with at least that weight counts as hot.
+    */
+    struct AccessWeights
+    {
+        static AccessWeights estimate (Program& program)
+        {
+            AccessWeights weights;
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions)
+                {
+                    if (f->functionType.isRun())
+                        weights.addAccesses (weights.getAccesses (f), 1.0);
+                    else if (f->functionType.isEvent())
+                        weights.addAccesses (weights.getAccesses (f), eventFunctionWeight);
+                }
+            }
+
+            return weights;
+        }
+
+        double getWeight (const heart::Variable& v) const
+        {
+            auto found = variableWeights.find (std::addressof (v));
+            return found != variableWeights.end() ? found->second : 0;
+        }
+
+    private:
+        using Accesses = std::unordered_map<const heart::Variable*, double>;
+
+        Accesses variableWeights;
+        std::unordered_map<const heart::Function*, Accesses> functionAccesses;
+
+        void addAccesses (const Accesses& accesses, double weight)
+        {
+            for (auto& a : accesses)
+                variableWeights[a.first] += a.second * weight;
+        }
+
+        // Returns the weighted accesses for a single call to a function, including the
+        // accesses made by any functions that it calls
+        const Accesses& getAccesses (heart::Function& f)
+        {
+            auto found = functionAccesses.find (std::addressof (f));
+
+            if (found != functionAccesses.end())
+                return found->second;
+
+            // (this empty entry also stops a recursive call from going round forever)
+            auto& accesses = functionAccesses[std::addressof (f)];
+
+            if (f.hasNoBody || f.blocks.empty())
+                return accesses;
+
+            auto blockWeights = getBlockWeights (f);
+            Accesses result;
+
+            auto addCall = [&] (heart::Function& target, double weight)
+            {
+                for (auto& a : getAccesses (target))
+                    result[a.first] += a.second * weight;
+            };
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
+            {
+                auto weight = blockWeights[i];
+                auto& b = f.blocks[i].get();
+
+                auto addAccess = [&] (pool_ref<heart::Expression>& value, AccessType)
+                {
+                    if (auto v = cast<heart::Variable> (value))
+                    {
+                        if (v->isState())
+                            result[v.get()] += weight;
+                    }
+                    else if (auto call = cast<heart::PureFunctionCall> (value))
+                    {
+                        addCall (call->function, weight);
+                    }
+                };
+
+                for (auto s : b.statements)
+                {
+                    s->visitExpressions (addAccess);
+
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                        addCall (call->getFunction(), weight);
+                }
+
+                if (b.terminator != nullptr)
+                    b.terminator->visitExpressions (addAccess);
+            }
+
+            accesses = std::move (result);
+            return accesses;
+        }
+
+        /** Gives each block a weight of loopWeight to the power of the number of loops it's in. */
+        static std::vector<double> getBlockWeights (heart::Function& f)
+        {
+            std::vector<double> weights (f.blocks.size(), 1.0);
+
+            f.rebuildBlockPredecessors();
+            CallFlowGraph::DominatorTree dominators (f);
+
+            if (dominators.blocks.size() == f.blocks.size())
+            {
+                std::vector<size_t> loopDepths (f.blocks.size());
+
+                for (auto& loop : CallFlowGraph::findNaturalLoops (dominators))
+                    for (auto blockIndex : loop.blocks)
+                        ++loopDepths[blockIndex];
+
+                for (size_t i = 0; i < f.blocks.size(); ++i)
+                {
+                    auto& b = dominators.blocks[i].get();
+                    auto index = static_cast<size_t> (std::distance (f.blocks.begin(), std::find (f.blocks.begin(), f.blocks.end(), b)));
+                    weights[index] = std::pow (loopWeight, static_cast<double> (std::min (loopDepths[i], maxLoopDepth)));
+                }
+            }
+
+            return weights;
+        }
+    };
+
+    //==============================================================================
+    struct VariableInfo
+    {
+        pool_ref<heart::Variable> variable;
+        Region region;
+        double weight;
+        size_t size, alignment;
+    };
+
+    static ModuleLayout planLayout (Module& module, const AccessWeights& accessWeights)
+    {
+        ModuleLayout layout;
+        layout.moduleName = module.originalFullName;
+        layout.numVariables = module.stateVariables.size();
+
+        std::vector<VariableInfo> variables;
+
+        for (auto& v : module.stateVariables)
+        {
+            auto size = getSize (v->type);
+            auto weight = accessWeights.getWeight (v);
+            auto region = (size >= minLargeArraySize && v->type.isFixedSizeArray()) ? Region::largeArray
+                                                                                    : (weight >= loopWeight ? Region::hot : Region::cold);
+
+            variables.push_back ({ v, region, weight, size, getAlignment (v->type) });
+        }
+
+        calculateFootprint (variables, false, layout.footprintBefore, layout.paddingBefore);
+
+        std::stable_sort (variables.begin(), variables.end(), [] (const VariableInfo& a, const VariableInfo& b)
+        {
+            if (a.region != b.region)
+                return a.region < b.region;
+
+            // within the hot and cold regions, putting the most-aligned values first leaves
+            // the fewest gaps, but large arrays are just ordered by how busy they are
+            if (a.region == Region::largeArray || a.alignment == b.alignment)
+                return a.weight > b.weight;
+
+            return a.alignment > b.alignment;
+        });
+
+        module.stateVariables.clear();
+
+        for (auto& v : variables)
+        {
+            module.stateVariables.push_back (v.variable);
+
+            if (v.region == Region::hot)         layout.hotBytes += v.size;
+            if (v.region == Region::cold)        layout.coldBytes += v.size;
+
+            if (v.region == Region::largeArray)
+            {
+                layout.largeArrayBytes += v.size;
+                v.variable->annotation.set ("alignment", static_cast<int32_t> (cacheLineSize));
+            }
+        }
+
+        calculateFootprint (variables, true, layout.footprintAfter, layout.paddingAfter);
+        return layout;
+    }
+
+    static void calculateFootprint (const std::vector<VariableInfo>& variables, bool alignLargeArrays,
+                                    size_t& footprint, size_t& padding)
+    {
+        size_t offset = 0, maxAlignment = 1;
+        padding = 0;
+
+        for (auto& v : variables)
+        {
+            auto alignment = (alignLargeArrays && v.region == Region::largeArray) ? std::max (cacheLineSize, v.alignment)
+                                                                                  : v.alignment;
+            auto start = alignOffset (offset, alignment);
+            padding += start - offset;
+            offset = start + v.size;
+            maxAlignment = std::max (maxAlignment, alignment);
+        }
+
+        footprint = alignOffset (offset, maxAlignment);
+        padding += footprint - offset;
+    }
+
+    static size_t alignOffset (size_t offset, size_t alignment)
+    {
+        return ((offset + alignment - 1) / alignment) * alignment;
+    }
+
+    static size_t getSize (const Type& type)
+    {
+        if (type.isUnsizedArray())
+            return sizeof (void*);
+
+        return type.getPackedSizeInBytes();
+    }
+
+    /** The alignment that a back-end would naturally give a value of this type. */
+    static size_t getAlignment (const Type& type)
+    {
+        if (type.isUnsizedArray())
+            return sizeof (void*);
+
+        if (type.isArray())
+            return getAlignment (type.getArrayElementType());
+
+        if (type.isStruct())
+        {
+            size_t alignment = 1;
+
+            for (auto& m : type.getStructRef().getMembers())
+                alignment = std::max (alignment, getAlignment (m.type));
+
+            return alignment;
+        }
+
+        size_t alignment = 1;
+
+        while (alignment < type.getPackedSizeInBytes() && alignment < 16)
+            alignment *= 2;
+
+        return alignment;
+    }
+};
+
+} // namespace soul
@@ -0,0 +1,344 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Splits state variables which are fixed-size arrays of structs (e.g. the VoiceInfo
+    array in a voice allocator) into one array per struct member, so that a loop which
+    scans a single member reads contiguous memory.
+
+    A variable is only converted if every use of it picks a single element and then a
+    member, i.e. an expression like `$voices[$i].note`, which becomes `$voices_note[$i]`.
+    The one exception is an assignment of a constant to the whole variable (which is how
+    state gets initialised), and that gets split into an assignment to each new array.
+*/
+struct StructOfArrays
+{
+    struct Results
+    {
+        std::vector<std::string> convertedVariables;
+
+        std::string getDescription() const
+        {
+            std::ostringstream out;
+            out << "Converted " << convertedVariables.size() << " state arrays of structs into struct-of-arrays" << std::endl;
+
+            for (auto& name : convertedVariables)
+                out << "  " << name << std::endl;
+
+            return out.str();
+        }
+    };
+
+    static Results convertStateArrays (Program& program)
+    {
+        Results results;
+
+        for (auto& m : program.getModules())
+            convertStateArrays (m, results);
+
+        return results;
+    }
+
+private:
+    //==============================================================================
+    struct Candidate
+    {
+        size_t numUses = 0, numMemberUses = 0;
+        std::vector<pool_ref<heart::Variable>> memberArrays;
+    };
+
+    using CandidateMap = std::unordered_map<const heart::Variable*, Candidate>;
+
+    static void convertStateArrays (Module& module, Results& results)
+    {
+        CandidateMap candidates;
+
+        for (auto& v : module.stateVariables)
+            if (isSuitableType (v->type) && ! v->isExternal())
+                candidates[std::addressof (v.get())] = {};
+
+        if (candidates.empty())
+            return;
+
+        countUses (module, candidates);
+
+        std::vector<pool_ref<heart::Variable>> newStateVariables;
+
+        for (auto& v : module.stateVariables)
+        {
+            auto found = candidates.find (std::addressof (v.get()));
+
+            if (found == candidates.end() || found->second.numUses != found->second.numMemberUses)
+            {
+                newStateVariables.push_back (v);
+                continue;
+            }
+
+            auto arraySize = v->type.getArraySize();
+
+            for (auto& member : v->type.getArrayElementType().getStructRef().getMembers())
+            {
+                auto name = addSuffixToMakeUnique (v->name.toString() + "_" + member.name,
+                                                   [&] (const std::string& nm) { return module.findStateVariable (nm) != nullptr
+                                                                                         || containsVariableNamed (newStateVariables, nm); });
+
+                auto& memberArray = module.allocate<heart::Variable> (v->location, member.type.createArray (arraySize),
+                                                                      module.allocator.get (name), heart::Variable::Role::state);
+                memberArray.annotation = v->annotation;
+                newStateVariables.push_back (memberArray);
+                found->second.memberArrays.push_back (memberArray);
+            }
+
+            results.convertedVariables.push_back (module.originalFullName + ": " + v->name.toString());
+        }
+
+        if (newStateVariables.size() == module.stateVariables.size())
+            return;
+
+        for (auto it = candidates.begin(); it != candidates.end();)
+        {
+            if (it->second.memberArrays.empty())
+                it = candidates.erase (it);
+            else
+                ++it;
+        }
+
+        module.stateVariables = std::move (newStateVariables);
+        rewriteUses (module, candidates);
+    }
+
+    static bool containsVariableNamed (const std::vector<pool_ref<heart::Variable>>& variables, const std::string& name)
+    {
+        for (auto& v : variables)
+            if (v->name == name)
+                return true;
+
+        return false;
+    }
+
+    static bool isSuitableType (const Type& type)
+    {
+        if (! (type.isFixedSizeArray() && type.getArraySize() > 1 && type.getArrayElementType().isStruct()))
+            return false;
+
+        auto& members = type.getArrayElementType().getStructRef().getMembers();
+
+        if (members.size() < 2)
+            return false;
+
+        for (auto& m : members)
+            if (m.type.isUnsizedArray() || m.type.isReference())
+                return false;
+
+        return true;
+    }
+
+    //==============================================================================
+    static pool_ptr<heart::ArrayElement> getElementOfCandidate (heart::Expression& e, CandidateMap& candidates)
+    {
+        if (auto element = cast<heart::ArrayElement> (e))
+            if (element->isSingleElement())
+                if (auto v = cast<heart::Variable> (element->parent))
+                    if (candidates.find (v.get()) != candidates.end())
+                        return element;
+
+        return {};
+    }
+
+    static pool_ptr<heart::Variable> getCandidateInitialisedByConstant (heart::Statement& s, CandidateMap& candidates)
+    {
+        if (auto a = cast<heart::AssignFromValue> (s))
+            if (auto v = cast<heart::Variable> (a->target))
+                if (candidates.find (v.get()) != candidates.end() && cast<heart::Constant> (a->source) != nullptr)
+                    return v;
+
+        return {};
+    }
+
+    /** Finds a copy of a whole struct into or out of an element of a candidate, which can be
+        split into a copy of each member. The source has to be something which can be cheaply
+        read more than once, and the target can't be a local variable that's being declared.
+    */
+    static pool_ptr<heart::AssignFromValue> getSplittableElementCopy (heart::Statement& s, CandidateMap& candidates)
+    {
+        if (auto a = cast<heart::AssignFromValue> (s))
+        {
+            if (a->target != nullptr && a->target->getType().isStruct())
+            {
+                auto& source = a->source.get();
+
+                if (! (is_type<heart::Constant> (source) || is_type<heart::Variable> (source)
+                        || is_type<heart::ArrayElement> (source) || is_type<heart::StructElement> (source)))
+                    return {};
+
+                if (getElementOfCandidate (*a->target, candidates) != nullptr)
+                    return a;
+
+                if (getElementOfCandidate (source, candidates) != nullptr)
+                {
+                    auto targetVariable = cast<heart::Variable> (a->target);
+
+                    if (targetVariable == nullptr || ! targetVariable->isFunctionLocal())
+                        return a;
+                }
+            }
+        }
+
+        return {};
+    }
+
+    static void countUses (Module& module, CandidateMap& candidates)
+    {
+        auto countMemberUse = [&] (heart::Expression& e)
+        {
+            if (auto element = getElementOfCandidate (e, candidates))
+                ++(candidates[cast<heart::Variable> (element->parent).get()].numMemberUses);
+        };
+
+        for (auto& f : module.functions)
+        {
+            f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+            {
+                if (auto v = cast<heart::Variable> (value))
+                {
+                    auto found = candidates.find (v.get());
+
+                    if (found != candidates.end())
+                        ++(found->second.numUses);
+                }
+                else if (auto member = cast<heart::StructElement> (value))
+                {
+                    countMemberUse (member->parent);
+                }
+            });
+
+            for (auto& b : f->blocks)
+            {
+                for (auto s : b->statements)
+                {
+                    if (auto v = getCandidateInitialisedByConstant (*s, candidates))
+                    {
+                        ++(candidates[v.get()].numMemberUses);
+                    }
+                    else if (auto copy = getSplittableElementCopy (*s, candidates))
+                    {
+                        countMemberUse (*copy->target);
+                        countMemberUse (copy->source);
+                    }
+                }
+            }
+        }
+    }
+
+    static void rewriteUses (Module& module, CandidateMap& candidates)
+    {
+        for (auto& f : module.functions)
+        {
+            for (auto& b : f->blocks)
+                splitStructAssignments (module, b, candidates);
+
+            f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+            {
+                if (auto member = cast<heart::StructElement> (value))
+                {
+                    if (auto element = getElementOfCandidate (member->parent, candidates))
+                    {
+                        auto& candidate = candidates[cast<heart::Variable> (element->parent).get()];
+                        auto& memberArray = candidate.memberArrays[member->getMemberIndex()].get();
+
+                        auto& newElement = element->isDynamic()
+                                             ? module.allocate<heart::ArrayElement> (element->location, memberArray, *element->dynamicIndex)
+                                             : module.allocate<heart::ArrayElement> (element->location, memberArray, element->fixedStartIndex);
+
+                        newElement.isRangeTrusted = element->isRangeTrusted;
+                        newElement.suppressWrapWarning = element->suppressWrapWarning;
+                        value = newElement;
+                    }
+                }
+            });
+        }
+    }
+
+    /** Replaces the whole-struct assignments which involve a converted variable with an
+        assignment for each member. The StructElements that this creates then get turned
+        into member array accesses along with all the others.
+    */
+    static void splitStructAssignments (Module& module, heart::Block& block, CandidateMap& candidates)
+    {
+        LinkedList<heart::Statement>::Iterator last;
+
+        for (auto s : block.statements)
+        {
+            std::vector<pool_ref<heart::Statement>> replacements;
+
+            if (auto v = getCandidateInitialisedByConstant (*s, candidates))
+            {
+                auto& memberArrays = candidates[v.get()].memberArrays;
+                auto value = cast<heart::AssignFromValue> (*s)->source->getAsConstant();
+                auto arraySize = v->type.getArraySize();
+
+                for (size_t i = 0; i < memberArrays.size(); ++i)
+                {
+                    std::vector<Value> elements;
+
+                    for (size_t j = 0; j < arraySize; ++j)
+                        elements.push_back (value.getSubElement (SubElementPath (j, i)));
+
+                    auto& memberValue = module.allocator.allocateConstant (Value::createArrayOrVector (memberArrays[i]->type, elements));
+                    replacements.push_back (module.allocate<heart::AssignFromValue> (s->location, memberArrays[i], memberValue));
+                }
+            }
+            else if (auto copy = getSplittableElementCopy (*s, candidates))
+            {
+                auto& members = copy->target->getType().getStructRef().getMembers();
+
+                for (size_t i = 0; i < members.size(); ++i)
+                {
+                    auto& target = module.allocate<heart::StructElement> (s->location, *copy->target, members[i].name);
+                    auto sourceValue = copy->source->getAsConstant();
+
+                    auto& source = sourceValue.isValid()
+                                     ? static_cast<heart::Expression&> (module.allocator.allocateConstant (sourceValue.getSubElement (i)))
+                                     : static_cast<heart::Expression&> (module.allocate<heart::StructElement> (s->location, copy->source, members[i].name));
+
+                    replacements.push_back (module.allocate<heart::AssignFromValue> (s->location, target, source));
+                }
+            }
+
+            if (replacements.empty())
+            {
+                last = s;
+                continue;
+            }
+
+            block.statements.replaceAfter (last, replacements.front());
+            last = replacements.front().get();
+
+            for (size_t i = 1; i < replacements.size(); ++i)
+                last = block.statements.insertAfter (last, replacements[i]);
+        }
+    }
+};
+
+} // namespace soul
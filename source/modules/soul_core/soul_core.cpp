@@ -70,7 +70,19 @@
 #include "types/soul_EndpointType.cpp"
 #include "heart/soul_heart_Printer.h"
 #include "heart/soul_heart_Parser.h"
+#include "heart/soul_heart_BinaryFormat.h"
+#include "heart/soul_heart_Hasher.h"
 #include "heart/soul_heart_Checker.h"
+#include "heart/soul_heart_SSAOptimisations.h"
+#include "heart/soul_heart_LoopOptimisations.h"
+#include "heart/soul_heart_LoopUnrolling.h"
+#include "heart/soul_heart_DeadStoreElimination.h"
+#include "heart/soul_heart_FunctionInlining.h"
+#include "heart/soul_ModuleCloner.h"
+#include "heart/soul_heart_GraphFlattener.h"
+#include "heart/soul_heart_StructOfArrays.h"
+#include "heart/soul_heart_StateLayout.h"
+#include "heart/soul_heart_OptimisationPipeline.h"
 #include "types/soul_Type.cpp"
 #include "library/soul_library.h"
 #include "compiler/soul_ASTVisitor.h"
@@ -81,10 +93,10 @@
 #include "compiler/soul_Compiler.cpp"
 #include "heart/soul_Intrinsics.cpp"
 #include "heart/soul_heart_FunctionBuilder.cpp"
-#include "heart/soul_ModuleCloner.h"
 #include "heart/soul_Module.cpp"
 #include "heart/soul_Program.cpp"
 #include "venue/soul_ThreadedVenue.cpp"
+#include "venue/soul_MultiLanePerformer.cpp"
 #include "diagnostics/soul_CodeLocation.cpp"
 #include "diagnostics/soul_Logging.cpp"
 #include "diagnostics/soul_CompileMessageList.cpp"
@@ -49,6 +49,7 @@
 #include <sstream>
 #include <array>
 #include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <functional>
 #include <mutex>
@@ -59,6 +60,7 @@
 #include <atomic>
 #include <limits>
 #include <condition_variable>
+#include <thread>
 #include <cassert>
 #include <random>
 #include <optional>
@@ -140,6 +142,8 @@ namespace soul
 #include "venue/soul_Endpoints.h"
 #include "venue/soul_Performer.h"
 #include "venue/soul_Venue.h"
+#include "venue/soul_EndpointServiceTable.h"
+#include "venue/soul_PerformerStateTransfer.h"
 
 #include "utilities/soul_EventQueue.h"
 #include "utilities/soul_AudioDataGeneration.h"
@@ -41,7 +41,7 @@ namespace soul
                 return i.handle;
 
         auto handle = nextIndex++;
-        items.push_back ({ handle, std::make_unique<Value> (std::move (value)) });
+        items.push_back ({ handle, std::make_shared<const Value> (std::move (value)) });
         return handle;
     }
 
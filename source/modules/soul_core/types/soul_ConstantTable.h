@@ -39,10 +39,11 @@ public:
     */
     const Value* getValueForHandle (Handle) const;
 
+    /** The values are immutable once added, so they can be shared between tables. */
     struct Item
     {
         Handle handle;
-        std::unique_ptr<Value> value;
+        std::shared_ptr<const Value> value;
     };
 
     const Item* begin() const;
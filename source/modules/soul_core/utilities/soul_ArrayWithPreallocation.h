@@ -99,6 +99,25 @@ struct ArrayWithPreallocation
 
     ArrayWithPreallocation& operator= (const ArrayWithPreallocation& other)
     {
+        if constexpr (std::is_trivial<Item>::value)
+        {
+            if (this != std::addressof (other))
+            {
+                if (other.size() == 0)
+                {
+                    clear();
+                }
+                else
+                {
+                    reserve (other.size());
+                    memcpy (static_cast<void*> (items), other.items, other.size() * sizeof (Item));
+                    numActive = other.size();
+                }
+            }
+
+            return *this;
+        }
+
         if (other.size() > numActive)
         {
             reserve (other.size());
@@ -238,8 +257,16 @@ struct ArrayWithPreallocation
         {
             reserve (newSize);
 
-            while (numActive < newSize)
-                new (items + numActive++) Item (Item());
+            if constexpr (std::is_trivial<Item>::value)
+            {
+                memset (static_cast<void*> (items + numActive), 0, (newSize - numActive) * sizeof (Item));
+                numActive = newSize;
+            }
+            else
+            {
+                while (numActive < newSize)
+                    new (items + numActive++) Item (Item());
+            }
         }
         else
         {
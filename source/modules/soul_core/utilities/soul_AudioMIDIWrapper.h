@@ -272,6 +272,24 @@ struct AudioMIDIWrapper
         MIDIEvent* midiOut;
         uint32_t frameOffset = 0, midiInCount = 0, midiOutCount = 0, midiOutCapacity = 0;
 
+        /** Returns a context for a range of this one's frames.
+            This is meant for the contexts that iterateInBlocks() produces, whose incoming MIDI all
+            belongs to their first frame, so a range which starts later doesn't get any of it.
+        */
+        RenderContext getFrameRange (uint32_t start, uint32_t numFrames) const
+        {
+            auto context = *this;
+            context.inputChannels  = inputChannels.getFrameRange ({ start, start + numFrames });
+            context.outputChannels = outputChannels.getFrameRange ({ start, start + numFrames });
+            context.totalFramesRendered += start;
+            context.frameOffset += start;
+
+            if (start != 0)
+                context.midiInCount = 0;
+
+            return context;
+        }
+
         template <typename RenderBlockFn>
         void iterateInBlocks (uint32_t maxFramesPerBlock, RenderBlockFn&& render)
         {
@@ -83,9 +83,9 @@ struct Identifier  final
                     s = halfway;
             }
 
-            auto* sharedString = new std::string (newString);
-            strings.insert (strings.begin() + (int) s, std::unique_ptr<std::string> (sharedString));
-            return Identifier (sharedString);
+            auto sharedString = std::make_shared<const std::string> (newString);
+            strings.insert (strings.begin() + (int) s, sharedString);
+            return Identifier (sharedString.get());
         }
 
         Identifier get (const Identifier& i)
@@ -96,13 +96,23 @@ struct Identifier  final
             return get (i.toString());
         }
 
+        /** Makes this empty pool share all the strings from another one, so that any
+            Identifier which came from the other pool is also valid in this one.
+            The strings themselves are never modified, so they don't need to be copied.
+        */
+        void shareStringsFrom (const Pool& other)
+        {
+            SOUL_ASSERT (strings.empty());
+            strings = other.strings;
+        }
+
         void clear()
         {
             strings.clear();
         }
 
     private:
-        std::vector<std::unique_ptr<std::string>> strings;
+        std::vector<std::shared_ptr<const std::string>> strings;
     };
 
 private:
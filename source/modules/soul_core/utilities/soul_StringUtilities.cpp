@@ -416,6 +416,129 @@ std::string HashBuilder::toString() const
     return std::string (result, result + 32);
 }
 
+//==============================================================================
+static inline uint64_t rotateLeft64 (uint64_t n, int bits) noexcept   { return (n << bits) | (n >> (64 - bits)); }
+
+static inline uint64_t finaliseHash64 (uint64_t k) noexcept
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+static constexpr uint64_t fastHashConstant1 = 0x87c37b91114253d5ull;
+static constexpr uint64_t fastHashConstant2 = 0x4cf5ad432745937full;
+
+FastHashBuilder& FastHashBuilder::addBytes (const void* data, size_t size) noexcept
+{
+    if (size == 0)
+        return *this;
+
+    auto source = static_cast<const uint8_t*> (data);
+    totalLength += size;
+
+    if (numPending != 0)
+    {
+        auto numToCopy = std::min (size, sizeof (pending) - numPending);
+        memcpy (pending + numPending, source, numToCopy);
+        numPending += numToCopy;
+        source += numToCopy;
+        size -= numToCopy;
+
+        if (numPending < sizeof (pending))
+            return *this;
+
+        processBlock (pending);
+        numPending = 0;
+    }
+
+    while (size >= sizeof (pending))
+    {
+        processBlock (source);
+        source += sizeof (pending);
+        size -= sizeof (pending);
+    }
+
+    if (size != 0)
+        memcpy (pending, source, size);
+
+    numPending = size;
+    return *this;
+}
+
+void FastHashBuilder::processBlock (const uint8_t* block) noexcept
+{
+    uint64_t k1, k2;
+    memcpy (std::addressof (k1), block, sizeof (k1));
+    memcpy (std::addressof (k2), block + sizeof (k1), sizeof (k2));
+
+    k1 *= fastHashConstant1;  k1 = rotateLeft64 (k1, 31);  k1 *= fastHashConstant2;  h1 ^= k1;
+    h1 = rotateLeft64 (h1, 27);  h1 += h2;  h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= fastHashConstant2;  k2 = rotateLeft64 (k2, 33);  k2 *= fastHashConstant1;  h2 ^= k2;
+    h2 = rotateLeft64 (h2, 31);  h2 += h1;  h2 = h2 * 5 + 0x38495ab5;
+}
+
+FastHashBuilder& FastHashBuilder::operator<< (const std::string& s) noexcept
+{
+    return *this << std::string_view (s);
+}
+
+FastHashBuilder& FastHashBuilder::operator<< (std::string_view s) noexcept
+{
+    // (the length goes in first, so that adjacent strings can't run into each other)
+    *this << static_cast<uint64_t> (s.length());
+    return addBytes (s.data(), s.length());
+}
+
+FastHashBuilder& FastHashBuilder::operator<< (Hash hash) noexcept
+{
+    return *this << hash.part1 << hash.part2;
+}
+
+FastHashBuilder::Hash FastHashBuilder::getHash() const noexcept
+{
+    uint64_t k1 = 0, k2 = 0;
+    auto a = h1, b = h2;
+
+    for (size_t i = numPending; i > 8; --i)
+        k2 = (k2 << 8) | pending[i - 1];
+
+    for (size_t i = std::min (numPending, (size_t) 8); i > 0; --i)
+        k1 = (k1 << 8) | pending[i - 1];
+
+    if (numPending > 8)
+    {
+        k2 *= fastHashConstant2;  k2 = rotateLeft64 (k2, 33);  k2 *= fastHashConstant1;  b ^= k2;
+    }
+
+    if (numPending > 0)
+    {
+        k1 *= fastHashConstant1;  k1 = rotateLeft64 (k1, 31);  k1 *= fastHashConstant2;  a ^= k1;
+    }
+
+    a ^= totalLength;
+    b ^= totalLength;
+    a += b;
+    b += a;
+    a = finaliseHash64 (a);
+    b = finaliseHash64 (b);
+    a += b;
+    b += a;
+
+    return { a, b };
+}
+
+std::string FastHashBuilder::toString() const
+{
+    auto hash = getHash();
+    return toHexString (static_cast<int64_t> (hash.part1), 16)
+         + toHexString (static_cast<int64_t> (hash.part2), 16);
+}
+
 std::string toCppStringLiteral (const std::string& text,
                                 int maxCharsOnLine, bool breakAtNewLines,
                                 bool replaceSingleQuotes, bool allowStringBreaks)
@@ -174,5 +174,46 @@ private:
     uint32_t index = 0;
 };
 
+//==============================================================================
+/** A fast streaming 128-bit hasher (using the MurmurHash3 algorithm), for hashing
+    large amounts of binary data without building it into a string first.
+    Like HashBuilder, it's not cryptographically strong.
+*/
+struct FastHashBuilder
+{
+    FastHashBuilder& addBytes (const void* data, size_t size) noexcept;
+
+    FastHashBuilder& operator<< (const std::string&) noexcept;
+    FastHashBuilder& operator<< (std::string_view) noexcept;
+
+    template <typename Primitive>
+    FastHashBuilder& operator<< (Primitive value) noexcept
+    {
+        static_assert (std::is_arithmetic<Primitive>::value || std::is_enum<Primitive>::value, "Only primitive types can be added");
+        return addBytes (std::addressof (value), sizeof (value));
+    }
+
+    /** The two 64-bit halves of a hash value. */
+    struct Hash
+    {
+        uint64_t part1 = 0, part2 = 0;
+
+        bool operator== (const Hash& other) const noexcept    { return part1 == other.part1 && part2 == other.part2; }
+        bool operator!= (const Hash& other) const noexcept    { return ! operator== (other); }
+    };
+
+    FastHashBuilder& operator<< (Hash) noexcept;
+
+    Hash getHash() const noexcept;
+    std::string toString() const;
+
+private:
+    uint64_t h1 = 0, h2 = 0, totalLength = 0;
+    uint8_t pending[16] = {};
+    size_t numPending = 0;
+
+    void processBlock (const uint8_t*) noexcept;
+};
+
 
 } // namespace soul
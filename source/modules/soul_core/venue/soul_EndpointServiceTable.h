@@ -0,0 +1,399 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    A list of events for one endpoint, as used by Venue::Session::ServicedEndpoint.
+
+    The storage for the events is kept between blocks, so once it has grown to hold
+    the number of events that a block typically needs, adding or reading events won't
+    allocate. Note that string handles inside the events aren't resolved, so endpoints
+    which send strings are better serviced with a per-endpoint callback.
+*/
+struct EndpointEventList
+{
+    EndpointEventList() = default;
+    EndpointEventList (const EndpointEventList&) = delete;
+    EndpointEventList (EndpointEventList&&) = default;
+
+    size_t size() const                                             { return numEvents; }
+    bool empty() const                                              { return numEvents == 0; }
+    void clear()                                                    { numEvents = 0; }
+
+    /** The offset of the event from the start of the block. */
+    uint32_t getFrameOffset (size_t index) const                    { SOUL_ASSERT (index < numEvents); return frameOffsets[index]; }
+    const choc::value::ValueView& getValue (size_t index) const     { SOUL_ASSERT (index < numEvents); return values[index].getView(); }
+
+    /** Returns a range of the event values, which can be passed to Performer::addInputEvents(). */
+    ArrayView<const choc::value::Value> getValues (size_t start, size_t end) const
+    {
+        SOUL_ASSERT (start <= end && end <= numEvents);
+        return { values.data() + start, end - start };
+    }
+
+    /** Appends an event to the list.
+        Input events should be added in time order. An event whose offset is earlier than the
+        one before it is delivered along with that previous event.
+    */
+    void add (uint32_t frameOffset, const choc::value::ValueView& value)
+    {
+        if (numEvents == values.size())
+        {
+            values.emplace_back();
+            frameOffsets.emplace_back();
+        }
+
+        frameOffsets[numEvents] = frameOffset;
+        auto& v = values[numEvents++];
+
+        // if the slot already holds a value of this type, just overwrite its data
+        if (v.getType() == value.getType())
+            std::memcpy (v.getRawData(), value.getRawData(), value.getType().getValueDataSize());
+        else
+            v = choc::value::Value (value);
+    }
+
+    template <typename Fn>
+    void iterate (Fn&& fn) const
+    {
+        for (size_t i = 0; i < numEvents; ++i)
+            fn (frameOffsets[i], values[i].getView());
+    }
+
+private:
+    std::vector<uint32_t> frameOffsets;
+    std::vector<choc::value::Value> values;
+    size_t numEvents = 0;
+};
+
+//==============================================================================
+/**
+    Keeps track of the service callbacks that have been attached to a Venue::Session,
+    and invokes them around each block that the session renders.
+
+    Per-endpoint callbacks are called individually, while block callbacks are given
+    one table of all their endpoints, with the stream buffers and event lists already
+    mapped, so that the whole table gets serviced in a single call. Each event list is
+    then handed to the performer with one Performer::addInputEvents() call.
+*/
+struct EndpointServiceTable
+{
+    using Session = Venue::Session;
+
+    bool addInputCallback (Performer& performer, const EndpointID& endpoint, Session::EndpointServiceFn callback)
+    {
+        if (! containsEndpoint (performer.getInputEndpoints(), endpoint))
+            return false;
+
+        inputCallbacks.push_back ({ performer.getEndpointHandle (endpoint), std::move (callback) });
+        return true;
+    }
+
+    bool addOutputCallback (Performer& performer, const EndpointID& endpoint, Session::EndpointServiceFn callback)
+    {
+        if (! containsEndpoint (performer.getOutputEndpoints(), endpoint))
+            return false;
+
+        outputCallbacks.push_back ({ performer.getEndpointHandle (endpoint), std::move (callback) });
+        return true;
+    }
+
+    bool addInputBlockCallback (Performer& performer, ArrayView<const EndpointID> endpoints, Session::BlockServiceFn callback)
+    {
+        return addBlockCallback (inputBlockCallbacks, performer, performer.getInputEndpoints(), endpoints, std::move (callback));
+    }
+
+    bool addOutputBlockCallback (Performer& performer, ArrayView<const EndpointID> endpoints, Session::BlockServiceFn callback)
+    {
+        return addBlockCallback (outputBlockCallbacks, performer, performer.getOutputEndpoints(), endpoints, std::move (callback));
+    }
+
+    /** Renders a block of frames, invoking all the service callbacks around it.
+
+        The block callbacks are called once for the whole block. If any of the input events
+        that they supply has a non-zero frame offset, the block is rendered in chunks which
+        begin at those offsets, so that each event reaches the performer at the right frame.
+        The per-endpoint callbacks are called around each chunk that gets rendered, and the
+        beforeAdvance and afterAdvance functions are given the start and length of each chunk.
+    */
+    template <typename BeforeAdvanceFn, typename AfterAdvanceFn>
+    void renderBlock (Session& session, Performer& performer, uint32_t numFrames,
+                      BeforeAdvanceFn&& beforeAdvance, AfterAdvanceFn&& afterAdvance)
+    {
+        fetchInputBlocks (session, numFrames);
+
+        for (uint32_t start = 0; start < numFrames;)
+        {
+            auto numChunkFrames = getNextInputEventFrame (start, numFrames) - start;
+
+            performer.prepare (numChunkFrames);
+            beforeAdvance (start, numChunkFrames);
+
+            for (auto& c : inputCallbacks)
+                c.callback (session, c.endpointHandle);
+
+            sendInputBlocks (performer, start, numChunkFrames, numFrames);
+            performer.advance();
+            afterAdvance (start, numChunkFrames);
+
+            for (auto& c : outputCallbacks)
+                c.callback (session, c.endpointHandle);
+
+            collectOutputBlocks (performer, start, numChunkFrames, numFrames);
+            start += numChunkFrames;
+        }
+
+        for (auto& c : outputBlockCallbacks)
+            c.callback (session, numFrames, c.table);
+    }
+
+    void renderBlock (Session& session, Performer& performer, uint32_t numFrames)
+    {
+        renderBlock (session, performer, numFrames, [] (uint32_t, uint32_t) {}, [] (uint32_t, uint32_t) {});
+    }
+
+private:
+    //==============================================================================
+    struct EndpointCallback
+    {
+        EndpointHandle endpointHandle;
+        Session::EndpointServiceFn callback;
+    };
+
+    /** Holds the frames for a stream, and re-uses them for any block size up to
+        the largest one that has been seen so far.
+    */
+    struct FrameBuffer
+    {
+        choc::value::ValueView getFrameArray (const EndpointDetails& details, uint32_t numFrames)
+        {
+            if (numFrames > capacity)
+            {
+                capacity = numFrames;
+                storage = choc::value::Value (choc::value::Type::createArray (details.getFrameType(), capacity));
+                frameSize = details.getFrameType().getValueDataSize();
+                numFramesInView = 0;
+            }
+
+            if (numFrames != numFramesInView)
+            {
+                numFramesInView = numFrames;
+                view = getFrameRange (details, 0, numFrames);
+            }
+
+            return view;
+        }
+
+        choc::value::ValueView getFrameRange (const EndpointDetails& details, uint32_t start, uint32_t numFrames)
+        {
+            SOUL_ASSERT (start + numFrames <= capacity);
+            auto rangeType = choc::value::Type::createArray (details.getFrameType(), numFrames);
+            return choc::value::ValueView (rangeType, getFrameData (start), nullptr);
+        }
+
+        void* getFrameData (uint32_t frame)     { return static_cast<uint8_t*> (storage.getViewReference().getRawData()) + frame * frameSize; }
+        void clear (uint32_t numFrames)         { std::memset (getFrameData (0), 0, numFrames * frameSize); }
+
+        choc::value::Value storage;
+        choc::value::ValueView view;
+        size_t frameSize = 0;
+        uint32_t capacity = 0, numFramesInView = 0;
+    };
+
+    struct BlockCallback
+    {
+        Session::BlockServiceFn callback;
+        std::vector<Session::ServicedEndpoint> table;
+        std::vector<FrameBuffer> buffers;
+        std::vector<EndpointEventList> eventLists;
+        std::vector<size_t> nextEventToSend;
+    };
+
+    std::vector<EndpointCallback> inputCallbacks, outputCallbacks;
+    std::vector<BlockCallback> inputBlockCallbacks, outputBlockCallbacks;
+
+    void fetchInputBlocks (Session& session, uint32_t numFrames)
+    {
+        for (auto& c : inputBlockCallbacks)
+        {
+            for (size_t i = 0; i < c.table.size(); ++i)
+            {
+                auto& entry = c.table[i];
+
+                if (isStream (*entry.details))
+                {
+                    // clear the frames, so that a callback which doesn't fill them won't replay an old block
+                    entry.frames = c.buffers[i].getFrameArray (*entry.details, numFrames);
+                    c.buffers[i].clear (numFrames);
+                }
+                else if (entry.events != nullptr)
+                {
+                    entry.events->clear();
+                }
+
+                c.nextEventToSend[i] = 0;
+            }
+
+            c.callback (session, numFrames, c.table);
+        }
+    }
+
+    uint32_t getNextInputEventFrame (uint32_t start, uint32_t numFrames) const
+    {
+        auto next = numFrames;
+
+        for (auto& c : inputBlockCallbacks)
+        {
+            for (size_t i = 0; i < c.table.size(); ++i)
+            {
+                if (auto events = c.table[i].events)
+                {
+                    for (auto e = c.nextEventToSend[i]; e < events->size(); ++e)
+                    {
+                        auto frame = events->getFrameOffset (e);
+
+                        if (frame > start)
+                        {
+                            next = std::min (next, frame);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        return next;
+    }
+
+    void sendInputBlocks (Performer& performer, uint32_t start, uint32_t numChunkFrames, uint32_t numFrames)
+    {
+        bool isWholeBlock = numChunkFrames == numFrames;
+        bool isLastChunk = start + numChunkFrames >= numFrames;
+
+        for (auto& c : inputBlockCallbacks)
+        {
+            for (size_t i = 0; i < c.table.size(); ++i)
+            {
+                auto& entry = c.table[i];
+
+                if (isStream (*entry.details))
+                {
+                    performer.setNextInputStreamFrames (entry.handle, isWholeBlock ? entry.frames
+                                                                                   : c.buffers[i].getFrameRange (*entry.details, start, numChunkFrames));
+                }
+                else if (auto events = entry.events)
+                {
+                    auto first = c.nextEventToSend[i];
+                    auto end = first;
+
+                    while (end < events->size() && events->getFrameOffset (end) <= start)
+                        ++end;
+
+                    // anything beyond the end of the block goes out with the last chunk
+                    if (isLastChunk)
+                        end = events->size();
+
+                    if (end > first)
+                        performer.addInputEvents (entry.handle, events->getValues (first, end));
+
+                    c.nextEventToSend[i] = end;
+                }
+            }
+        }
+    }
+
+    void collectOutputBlocks (Performer& performer, uint32_t start, uint32_t numChunkFrames, uint32_t numFrames)
+    {
+        bool isWholeBlock = numChunkFrames == numFrames;
+
+        for (auto& c : outputBlockCallbacks)
+        {
+            for (size_t i = 0; i < c.table.size(); ++i)
+            {
+                auto& entry = c.table[i];
+
+                if (isStream (*entry.details))
+                {
+                    auto frames = performer.getOutputStreamFrames (entry.handle);
+
+                    if (isWholeBlock)
+                    {
+                        entry.frames = frames;
+                    }
+                    else
+                    {
+                        // the block is being rendered in chunks, so gather them into one buffer
+                        auto& buffer = c.buffers[i];
+                        entry.frames = buffer.getFrameArray (*entry.details, numFrames);
+
+                        if (frames.getRawData() != nullptr)
+                            std::memcpy (buffer.getFrameData (start), frames.getRawData(), numChunkFrames * buffer.frameSize);
+                    }
+                }
+                else if (auto events = entry.events)
+                {
+                    if (start == 0)
+                        events->clear();
+
+                    performer.iterateOutputEvents (entry.handle, [&] (uint32_t frameOffset, const choc::value::ValueView& event) -> bool
+                    {
+                        events->add (start + frameOffset, event);
+                        return true;
+                    });
+                }
+            }
+        }
+    }
+
+    static bool addBlockCallback (std::vector<BlockCallback>& list, Performer& performer,
+                                  ArrayView<const EndpointDetails> available,
+                                  ArrayView<const EndpointID> endpoints, Session::BlockServiceFn callback)
+    {
+        for (auto& e : endpoints)
+            if (! containsEndpoint (available, e))
+                return false;
+
+        BlockCallback c;
+        c.callback = std::move (callback);
+        c.buffers.resize (endpoints.size());
+        c.eventLists.resize (endpoints.size());
+        c.nextEventToSend.resize (endpoints.size());
+
+        for (size_t i = 0; i < endpoints.size(); ++i)
+        {
+            Session::ServicedEndpoint entry;
+            entry.handle = performer.getEndpointHandle (endpoints[i]);
+            entry.details = std::addressof (findDetailsForID (available, endpoints[i]));
+
+            if (isEvent (*entry.details))
+                entry.events = std::addressof (c.eventLists[i]);
+
+            c.table.push_back (std::move (entry));
+        }
+
+        list.push_back (std::move (c));
+        return true;
+    }
+};
+
+} // namespace soul
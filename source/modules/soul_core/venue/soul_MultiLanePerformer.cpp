@@ -0,0 +1,402 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+namespace soul
+{
+
+//==============================================================================
+/**
+    The default MultiLanePerformer, which renders each lane with its own performer.
+
+    Lane 0 is loaded and linked in the normal way, and the other lanes are spawned from
+    it with Performer::createInstance(), so that they share its code. If the performer
+    can't do that, each lane falls back to loading and linking its own copy.
+*/
+struct LockStepLanePerformer  : public MultiLanePerformer
+{
+    LockStepLanePerformer (PerformerFactory& f, uint32_t numLanesToUse)
+        : factory (f), numLanes (std::max (1u, numLanesToUse))
+    {
+    }
+
+    ~LockStepLanePerformer() override
+    {
+        unload();
+    }
+
+    uint32_t getNumLanes() noexcept override      { return numLanes; }
+
+    bool load (CompileMessageList& messageList, const Program& programToLoad) noexcept override
+    {
+        unload();
+
+        auto firstLane = factory.createPerformer();
+
+        if (firstLane == nullptr || ! firstLane->load (messageList, programToLoad))
+            return false;
+
+        lanes.push_back (std::move (firstLane));
+        program = programToLoad;
+        return true;
+    }
+
+    void unload() noexcept override
+    {
+        for (auto& lane : lanes)
+            lane->unload();
+
+        lanes.clear();
+        endpoints.clear();
+        externals.clear();
+        program = {};
+        linked = false;
+    }
+
+    ArrayView<const EndpointDetails> getInputEndpoints() noexcept override      { return isLoaded() ? lanes.front()->getInputEndpoints() : ArrayView<const EndpointDetails>(); }
+    ArrayView<const EndpointDetails> getOutputEndpoints() noexcept override     { return isLoaded() ? lanes.front()->getOutputEndpoints() : ArrayView<const EndpointDetails>(); }
+    ArrayView<const ExternalVariable> getExternalVariables() noexcept override  { return isLoaded() ? lanes.front()->getExternalVariables() : ArrayView<const ExternalVariable>(); }
+
+    bool setExternalVariable (const char* name, const choc::value::ValueView& value) noexcept override
+    {
+        return shareExternalVariable (name, std::make_shared<const choc::value::Value> (value));
+    }
+
+    bool shareExternalVariable (const char* name, std::shared_ptr<const choc::value::Value> value) noexcept override
+    {
+        if (value == nullptr || ! isLoaded() || ! lanes.front()->shareExternalVariable (name, value))
+            return false;
+
+        // keep hold of it, in case the other lanes have to be loaded separately
+        removeIf (externals, [&] (const ExternalValue& e) { return e.name == name; });
+        externals.push_back ({ name, std::move (value) });
+        return true;
+    }
+
+    bool link (CompileMessageList& messageList, const BuildSettings& settings, LinkerCache* cache) noexcept override
+    {
+        if (! isLoaded() || isLinked())
+            return false;
+
+        if (! lanes.front()->link (messageList, settings, cache))
+            return false;
+
+        while (lanes.size() < numLanes)
+        {
+            auto newLane = lanes.front()->createInstance();
+
+            if (newLane == nullptr)
+            {
+                newLane = factory.createPerformer();
+
+                if (newLane == nullptr || ! newLane->load (messageList, program))
+                    return false;
+
+                for (auto& e : externals)
+                    newLane->shareExternalVariable (e.name.c_str(), e.value);
+
+                resolveEndpointHandles (*newLane, (uint32_t) lanes.size());
+
+                if (! newLane->link (messageList, settings, cache))
+                    return false;
+            }
+
+            lanes.push_back (std::move (newLane));
+        }
+
+        linked = true;
+        return true;
+    }
+
+    bool isLoaded() noexcept override     { return ! lanes.empty(); }
+    bool isLinked() noexcept override     { return linked; }
+
+    void reset() noexcept override
+    {
+        for (auto& lane : lanes)
+            lane->reset();
+    }
+
+    std::unique_ptr<Performer> createInstance() noexcept override
+    {
+        if (! isLinked())
+            return {};
+
+        auto newPerformer = std::make_unique<LockStepLanePerformer> (factory, numLanes);
+
+        for (auto& lane : lanes)
+        {
+            auto newLane = lane->createInstance();
+
+            if (newLane == nullptr)
+                return {};
+
+            newPerformer->lanes.push_back (std::move (newLane));
+        }
+
+        newPerformer->program = program;
+        newPerformer->externals = externals;
+        newPerformer->endpoints = endpoints;
+        newPerformer->linked = true;
+        return newPerformer;
+    }
+
+    uint64_t getStateSize() noexcept override
+    {
+        if (! isLinked())
+            return 0;
+
+        uint64_t total = 0;
+
+        for (auto& lane : lanes)
+        {
+            auto size = lane->getStateSize();
+
+            // if any lane can't save its state, then neither can the whole set
+            if (size == 0)
+                return 0;
+
+            total += size;
+        }
+
+        return total;
+    }
+
+    bool saveState (void* dest, uint64_t destSize) noexcept override
+    {
+        auto totalSize = getStateSize();
+
+        if (totalSize == 0 || destSize < totalSize)
+            return false;
+
+        auto d = static_cast<uint8_t*> (dest);
+
+        for (auto& lane : lanes)
+        {
+            auto size = lane->getStateSize();
+
+            if (! lane->saveState (d, size))
+                return false;
+
+            d += size;
+        }
+
+        return true;
+    }
+
+    bool loadState (const void* source, uint64_t sourceSize) noexcept override
+    {
+        auto totalSize = getStateSize();
+
+        if (totalSize == 0 || sourceSize != totalSize)
+            return false;
+
+        auto s = static_cast<const uint8_t*> (source);
+
+        for (auto& lane : lanes)
+        {
+            auto size = lane->getStateSize();
+
+            if (! lane->loadState (s, size))
+                return false;
+
+            s += size;
+        }
+
+        return true;
+    }
+
+    EndpointHandle getEndpointHandle (const EndpointID& endpointID) noexcept override
+    {
+        return getLaneEndpointHandle (0, endpointID);
+    }
+
+    EndpointHandle getLaneEndpointHandle (uint32_t lane, const EndpointID& endpointID) noexcept override
+    {
+        if (! isLoaded() || lane >= numLanes)
+            return {};
+
+        for (size_t i = 0; i < endpoints.size(); ++i)
+            if (endpoints[i].lane == lane && endpoints[i].endpointID == endpointID)
+                return EndpointHandle::create ((uint32_t) i + 1);
+
+        // Lanes which haven't been created yet will share lane 0's handles if they're spawned
+        // with createInstance(), or will have their own handles looked up if they're loaded separately
+        auto laneHandle = lanes[std::min (lane, (uint32_t) lanes.size() - 1)]->getEndpointHandle (endpointID);
+
+        if (! laneHandle)
+            return {};
+
+        endpoints.push_back ({ lane, endpointID, laneHandle });
+        return EndpointHandle::create ((uint32_t) endpoints.size());
+    }
+
+    void prepare (uint32_t numFramesToBeRendered) noexcept override
+    {
+        for (auto& lane : lanes)
+            lane->prepare (numFramesToBeRendered);
+    }
+
+    void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            lanes[e->lane]->setNextInputStreamFrames (e->laneHandle, frameArray);
+    }
+
+    void setSparseInputStreamTarget (EndpointHandle handle, const choc::value::ValueView& targetFrameValue,
+                                     uint32_t numFramesToReachValue, float curveShape) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            lanes[e->lane]->setSparseInputStreamTarget (e->laneHandle, targetFrameValue, numFramesToReachValue, curveShape);
+    }
+
+    void setInputValue (EndpointHandle handle, const choc::value::ValueView& newValue) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            lanes[e->lane]->setInputValue (e->laneHandle, newValue);
+    }
+
+    void addInputEvent (EndpointHandle handle, const choc::value::ValueView& eventData) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            lanes[e->lane]->addInputEvent (e->laneHandle, eventData);
+    }
+
+    choc::value::ValueView getOutputStreamFrames (EndpointHandle handle) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            return lanes[e->lane]->getOutputStreamFrames (e->laneHandle);
+
+        return {};
+    }
+
+    choc::value::ValueView getOutputValue (EndpointHandle handle) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            return lanes[e->lane]->getOutputValue (e->laneHandle);
+
+        return {};
+    }
+
+    void iterateOutputEvents (EndpointHandle handle, HandleNextOutputEventFn fn) noexcept override
+    {
+        if (auto e = findEndpoint (handle))
+            lanes[e->lane]->iterateOutputEvents (e->laneHandle, std::move (fn));
+    }
+
+    void advance() noexcept override
+    {
+        for (auto& lane : lanes)
+            lane->advance();
+    }
+
+    bool isEndpointActive (const EndpointID& endpointID) noexcept override
+    {
+        for (auto& lane : lanes)
+            if (lane->isEndpointActive (endpointID))
+                return true;
+
+        return false;
+    }
+
+    uint32_t getXRuns() noexcept override
+    {
+        uint32_t total = 0;
+
+        for (auto& lane : lanes)
+            total += lane->getXRuns();
+
+        return total;
+    }
+
+    uint32_t getBlockSize() noexcept override     { return isLoaded() ? lanes.front()->getBlockSize() : 0; }
+
+    bool hasError() noexcept override
+    {
+        for (auto& lane : lanes)
+            if (lane->hasError())
+                return true;
+
+        return false;
+    }
+
+    const char* getError() noexcept override
+    {
+        for (auto& lane : lanes)
+            if (lane->hasError())
+                return lane->getError();
+
+        return nullptr;
+    }
+
+private:
+    //==============================================================================
+    struct LaneEndpoint
+    {
+        uint32_t lane;
+        EndpointID endpointID;
+        EndpointHandle laneHandle;
+    };
+
+    struct ExternalValue
+    {
+        std::string name;
+        std::shared_ptr<const choc::value::Value> value;
+    };
+
+    PerformerFactory& factory;
+    const uint32_t numLanes;
+    std::vector<std::unique_ptr<Performer>> lanes;
+    std::vector<LaneEndpoint> endpoints;
+    std::vector<ExternalValue> externals;
+    Program program;
+    bool linked = false;
+
+    const LaneEndpoint* findEndpoint (EndpointHandle handle) const
+    {
+        auto index = handle.getRawHandle();
+
+        if (index == 0 || index > endpoints.size())
+            return nullptr;
+
+        auto& e = endpoints[index - 1];
+
+        if (e.lane >= lanes.size())
+            return nullptr;
+
+        return std::addressof (e);
+    }
+
+    void resolveEndpointHandles (Performer& lanePerformer, uint32_t lane)
+    {
+        for (auto& e : endpoints)
+            if (e.lane == lane)
+                e.laneHandle = lanePerformer.getEndpointHandle (e.endpointID);
+    }
+};
+
+std::unique_ptr<MultiLanePerformer> PerformerFactory::createMultiLanePerformer (uint32_t numLanes)
+{
+    return std::make_unique<LockStepLanePerformer> (*this, numLanes);
+}
+
+} // namespace soul
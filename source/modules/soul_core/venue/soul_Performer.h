@@ -73,9 +73,24 @@ public:
     */
     virtual ArrayView<const ExternalVariable> getExternalVariables() noexcept = 0;
 
-    /** Set the value of an external in the loaded program. */
+    /** Set the value of an external in the loaded program.
+        The performer takes its own copy of the data, so the value doesn't need to outlive
+        this call.
+    */
     virtual bool setExternalVariable (const char* name, const choc::value::ValueView& value) noexcept = 0;
 
+    /** Sets the value of an external from some immutable storage which the caller may also
+        be handing to other performers.
+        A performer which is able to use the data in place can override this and keep hold
+        of the pointer, so that any number of performers can share a single copy of (say) a
+        large sample. The default implementation just passes the value to setExternalVariable(),
+        which copies it.
+    */
+    virtual bool shareExternalVariable (const char* name, std::shared_ptr<const choc::value::Value> value) noexcept
+    {
+        return value != nullptr && setExternalVariable (name, *value);
+    }
+
     /** After loading a program, and optionally connecting up to some of its endpoints,
         link() will complete any preparations needed before the code can be executed.
         If this returns true, then you can safely start calling advance(). If it
@@ -99,6 +114,46 @@ public:
     */
     virtual void reset() noexcept = 0;
 
+    /** Creates a new performer which runs the same linked program as this one.
+        The new instance shares this performer's compiled code and constant data, and only
+        allocates a fresh state block, so it's much cheaper than calling load() and link()
+        on a new performer. It starts out already linked, in the same state that reset()
+        would produce, and the endpoint handles from this performer are also valid for it.
+        An implementation must keep the shared code alive for as long as any instance that
+        uses it still exists, even if the original performer is unloaded or deleted.
+        It may be called while this performer is being run on another thread, as it mustn't
+        touch this performer's state.
+        Returns nullptr if no program is linked, or if the implementation can't share its
+        code, in which case the caller should fall back to loading and linking as usual.
+        The default implementation always returns nullptr.
+    */
+    virtual std::unique_ptr<Performer> createInstance() noexcept        { return {}; }
+
+    /** Returns the number of bytes needed to hold a snapshot of the linked program's state.
+        Returns 0 if no program is linked, or if the implementation doesn't support saving
+        its state (which is what the default implementation does).
+        @see saveState, loadState
+    */
+    virtual uint64_t getStateSize() noexcept                            { return 0; }
+
+    /** Copies the entire state of the linked program into a block of memory as a flat binary image.
+        The destination must be at least getStateSize() bytes. The image is only meaningful to a
+        performer which has linked the same program with the same build settings.
+        This must not be called at the same time as advance().
+        Returns false if no program is linked, the destination is too small, or the
+        implementation doesn't support saving its state.
+    */
+    virtual bool saveState (void*, uint64_t) noexcept                   { return false; }
+
+    /** Replaces the state of the linked program with an image that was created by saveState().
+        Unlike reset(), this doesn't re-run any initialisation code, so it can be used to
+        instantly restore a processor that had been warmed-up or pre-rolled.
+        This must not be called at the same time as advance().
+        Returns false if no program is linked, the size doesn't match getStateSize(), or the
+        implementation doesn't support loading its state.
+    */
+    virtual bool loadState (const void*, uint64_t) noexcept             { return false; }
+
     /** When a program has been loaded (but not yet linked), this returns
         a handle that can be used later by other methods which need to reference
         an input or output endpoint.
@@ -159,6 +214,17 @@ public:
     */
     virtual void addInputEvent (EndpointHandle, const choc::value::ValueView& eventData) noexcept = 0;
 
+    /** Adds a batch of events to an input queue.
+        This has the same effect as calling addInputEvent() for each of the events in turn, which
+        is what the default implementation does, but an implementation can override it to take
+        the whole batch in one call.
+    */
+    virtual void addInputEvents (EndpointHandle handle, ArrayView<const choc::value::Value> events) noexcept
+    {
+        for (auto& e : events)
+            addInputEvent (handle, e.getView());
+    }
+
     /** Retrieves the most recent block of frames from an output stream.
         After a successful call to advance(), this may be called to get the block of frames which
         were rendered during that call. A nullptr return value indicates an error.
@@ -211,6 +277,35 @@ public:
     virtual const char* getError() noexcept = 0;
 };
 
+//==============================================================================
+/**
+    A performer which runs a number of "lanes" of the same program in lock-step.
+
+    Each lane behaves like a separate instance of the program with its own state, but
+    a single prepare() and advance() call renders all of them together, which lets an
+    implementation lay out the lanes' state as a structure-of-arrays and execute them
+    with SIMD instructions across the lanes.
+
+    The methods inherited from Performer refer to lane 0, except for prepare(), advance(),
+    reset() and the state snapshot methods, which apply to all lanes. Handles for the
+    endpoints of other lanes are obtained with getLaneEndpointHandle(), and can be passed
+    to the usual Performer methods to read or write that lane's buffers.
+
+    @see PerformerFactory::createMultiLanePerformer
+*/
+class MultiLanePerformer  : public Performer
+{
+public:
+    /** Returns the number of lanes that this performer runs. */
+    virtual uint32_t getNumLanes() noexcept = 0;
+
+    /** When a program has been loaded (but not yet linked), this returns a handle for the
+        given endpoint in one particular lane. Lane 0 returns the same handle as getEndpointHandle().
+        Will return a null handle if the lane or the ID is not found.
+    */
+    virtual EndpointHandle getLaneEndpointHandle (uint32_t lane, const EndpointID&) noexcept = 0;
+};
+
 //==============================================================================
 /**
     Provides a mechanism that a Performer may use to store and retrieve reusable
@@ -250,6 +345,14 @@ public:
     virtual ~PerformerFactory() {}
 
     virtual std::unique_ptr<Performer> createPerformer() = 0;
+
+    /** Creates a performer which runs the given number of lanes of a program in lock-step.
+        The default implementation simply runs a separate performer for each lane, sharing
+        the linked code between them where Performer::createInstance() allows. Factories
+        whose code generators can vectorise across lanes should override this.
+        The factory must outlive the performer that this returns.
+    */
+    virtual std::unique_ptr<MultiLanePerformer> createMultiLanePerformer (uint32_t numLanes);
 };
 
 } // namespace soul
@@ -0,0 +1,124 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Lets a session save or restore its performer's state from any thread, without the
+    render thread ever having to wait for a lock.
+
+    The calling thread posts its request and waits, and the render thread carries it out
+    between two blocks when it calls performPendingRequest(). If the session isn't
+    rendering, or the call is made on the render thread itself (e.g. from an endpoint
+    service callback), the operation is done straight away.
+*/
+struct PerformerStateTransfer
+{
+    PerformerStateTransfer() = default;
+    PerformerStateTransfer (const PerformerStateTransfer&) = delete;
+
+    using IsRenderingFn = std::function<bool()>;
+
+    bool saveState (Performer& performer, void* dest, uint64_t destSize, const IsRenderingFn& isRendering)
+    {
+        Request request;
+        request.saveDest = dest;
+        request.size = destSize;
+        return perform (performer, request, isRendering);
+    }
+
+    bool loadState (Performer& performer, const void* source, uint64_t sourceSize, const IsRenderingFn& isRendering)
+    {
+        Request request;
+        request.loadSource = source;
+        request.size = sourceSize;
+        return perform (performer, request, isRendering);
+    }
+
+    /** The render thread must call this between blocks. It never blocks. */
+    void performPendingRequest (Performer& performer) noexcept
+    {
+        renderThreadID = std::this_thread::get_id();
+
+        if (auto request = pendingRequest.exchange (nullptr))
+        {
+            request->result = request->apply (performer);
+            request->finished = true;
+        }
+    }
+
+private:
+    struct Request
+    {
+        void* saveDest = nullptr;
+        const void* loadSource = nullptr;
+        uint64_t size = 0;
+        bool result = false;
+        std::atomic<bool> finished { false };
+
+        bool apply (Performer& p) noexcept
+        {
+            return saveDest != nullptr ? p.saveState (saveDest, size)
+                                       : p.loadState (loadSource, size);
+        }
+    };
+
+    std::atomic<Request*> pendingRequest { nullptr };
+    std::atomic<std::thread::id> renderThreadID;
+    std::mutex callerLock;
+
+    static constexpr int maxWaitMilliseconds = 2000;
+
+    bool perform (Performer& performer, Request& request, const IsRenderingFn& isRendering)
+    {
+        // no point waiting for the render thread if the performer can't do it anyway
+        if (performer.getStateSize() == 0)
+            return false;
+
+        if (std::this_thread::get_id() == renderThreadID.load() || ! isRendering())
+            return request.apply (performer);
+
+        // (this only serialises the callers - the render thread never touches it)
+        std::lock_guard<decltype(callerLock)> lock (callerLock);
+        pendingRequest = std::addressof (request);
+
+        for (int waited = 0;; ++waited)
+        {
+            if (request.finished)
+                return request.result;
+
+            // If rendering has stopped, or the render thread isn't calling back, take the
+            // request back if it hasn't been picked up yet
+            if (! isRendering() || waited >= maxWaitMilliseconds)
+            {
+                auto expected = std::addressof (request);
+
+                if (pendingRequest.compare_exchange_strong (expected, nullptr))
+                    return isRendering() ? false : request.apply (performer);
+            }
+
+            std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        }
+    }
+};
+
+} // namespace soul
@@ -97,6 +97,7 @@ struct ThreadedVenue  : public soul::Venue
             waitForThreadToFinish();
             shouldStop = false;
             loadMeasurer.reset();
+            isRendering = true;
             renderThread = std::thread ([this] { run(); });
             setState (State::running);
             return true;
@@ -125,6 +126,21 @@ struct ThreadedVenue  : public soul::Venue
 
         EndpointHandle getEndpointHandle (const EndpointID& endpointID) override  { return performer->getEndpointHandle (endpointID); }
 
+        uint64_t getStateSize() override
+        {
+            return performer->getStateSize();
+        }
+
+        bool saveState (void* dest, uint64_t destSize) override
+        {
+            return stateTransfer.saveState (*performer, dest, destSize, [this] { return isRendering.load(); });
+        }
+
+        bool loadState (const void* source, uint64_t sourceSize) override
+        {
+            return stateTransfer.loadState (*performer, source, sourceSize, [this] { return isRendering.load(); });
+        }
+
         void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) override
         {
             performer->setNextInputStreamFrames (handle, frameArray);
@@ -187,26 +203,30 @@ struct ThreadedVenue  : public soul::Venue
 
         bool setInputEndpointServiceCallback (EndpointID endpoint, EndpointServiceFn callback) override
         {
-            if (! containsEndpoint (performer->getInputEndpoints(), endpoint))
-                return false;
-
-            inputCallbacks.push_back ({ performer->getEndpointHandle (endpoint), std::move (callback) });
-            return true;
+            return serviceTable.addInputCallback (*performer, endpoint, std::move (callback));
         }
 
         bool setOutputEndpointServiceCallback (EndpointID endpoint, EndpointServiceFn callback) override
         {
-            if (! containsEndpoint (performer->getOutputEndpoints(), endpoint))
-                return false;
+            return serviceTable.addOutputCallback (*performer, endpoint, std::move (callback));
+        }
 
-            outputCallbacks.push_back ({ performer->getEndpointHandle (endpoint), std::move (callback) });
-            return true;
+        bool setInputBlockServiceCallback (ArrayView<const EndpointID> endpoints, BlockServiceFn callback) override
+        {
+            return serviceTable.addInputBlockCallback (*performer, endpoints, std::move (callback));
+        }
+
+        bool setOutputBlockServiceCallback (ArrayView<const EndpointID> endpoints, BlockServiceFn callback) override
+        {
+            return serviceTable.addOutputBlockCallback (*performer, endpoints, std::move (callback));
         }
 
     private:
         ThreadedVenue& venue;
         std::unique_ptr<Performer> performer;
         std::thread renderThread;
+        PerformerStateTransfer stateTransfer;
+        std::atomic<bool> isRendering { false };
         CPULoadMeasurer loadMeasurer;
         StateChangeCallbackFn stateChangeCallback;
         std::atomic<State> state { State::empty };
@@ -214,13 +234,7 @@ struct ThreadedVenue  : public soul::Venue
         std::atomic<uint64_t> totalFramesRendered { 0 };
         uint32_t blockSize = 0;
 
-        struct EndpointCallback
-        {
-            EndpointHandle endpointHandle;
-            EndpointServiceFn callback;
-        };
-
-        std::vector<EndpointCallback> inputCallbacks, outputCallbacks;
+        EndpointServiceTable serviceTable;
 
         void waitForThreadToFinish()
         {
@@ -255,15 +269,9 @@ struct ThreadedVenue  : public soul::Venue
                 while (! shouldStop.load())
                 {
                     loadMeasurer.startMeasurement();
-                    performer->prepare (blockSize);
-
-                    for (auto& c : inputCallbacks)
-                        c.callback (*this, c.endpointHandle);
-
-                    performer->advance();
 
-                    for (auto& c : outputCallbacks)
-                        c.callback (*this, c.endpointHandle);
+                    stateTransfer.performPendingRequest (*performer);
+                    serviceTable.renderBlock (*this, *performer, blockSize);
 
                     totalFramesRendered += blockSize;
                     loadMeasurer.stopMeasurement();
@@ -278,6 +286,7 @@ struct ThreadedVenue  : public soul::Venue
                 handleError ("Uncaught exception");
             }
 
+            isRendering = false;
             setState (State::linked);
         }
     };
@@ -21,6 +21,8 @@
 namespace soul
 {
 
+struct EndpointEventList;
+
 //==============================================================================
 /**
     Abstract base class for a "venue" which hosts sessions.
@@ -93,6 +95,25 @@ public:
         */
         virtual EndpointHandle getEndpointHandle (const EndpointID&) = 0;
 
+        /** Returns the number of bytes needed to hold a snapshot of the linked program's state.
+            Returns 0 if no program is linked, or if the performer can't save its state.
+        */
+        virtual uint64_t getStateSize() = 0;
+
+        /** Copies the state of the linked program into a flat binary image.
+            If the session is running, the render thread takes the snapshot between two blocks
+            while the caller waits, so the audio thread never blocks. Returns false if the
+            performer can't save its state, or the render thread doesn't pick the request up in time.
+            @see Performer::saveState
+        */
+        virtual bool saveState (void* dest, uint64_t destSize) = 0;
+
+        /** Restores the state of the linked program from an image created by saveState().
+            If the session is running, the new state takes effect from the next block.
+            @see Performer::loadState
+        */
+        virtual bool loadState (const void* source, uint64_t sourceSize) = 0;
+
         /** Pushes a block of samples to an input endpoint.
             This should be called to provide the next block of samples for an input stream.
             This method may only be called during a callback attached to setInputEndpointServiceCallback(),
@@ -161,6 +182,9 @@ public:
             uint32_t xruns;
             double sampleRate;
             uint32_t blockSize;
+
+            /** The number of frames of latency which the venue adds between its inputs and outputs. */
+            uint32_t latencyFrames = 0;
         };
 
         /** Returns the venue's current status. */
@@ -189,6 +213,51 @@ public:
 
         /** Allows client code to get a callback when the amount of data in an endpoint's FIFO changes. */
         virtual bool setOutputEndpointServiceCallback (EndpointID, EndpointServiceFn) = 0;
+
+        //==============================================================================
+        /** An entry in the table of endpoints which is passed to a BlockServiceFn.
+            The venue maps the buffers for each endpoint before invoking the callback, so that
+            a client can service all of its endpoints in one call rather than making a virtual
+            call per endpoint, per frame buffer or per event.
+        */
+        struct ServicedEndpoint
+        {
+            EndpointHandle handle;
+            const EndpointDetails* details = nullptr;
+
+            /** For an input stream, this is an array of frames, owned by the venue, which the callback
+                should fill. It's cleared before each block, and passed to the performer when the
+                callback returns.
+                For an output stream, this holds the frames that the last block rendered.
+                It's empty for other kinds of endpoint.
+            */
+            choc::value::ValueView frames;
+
+            /** For an input event endpoint, the callback should add the events for the coming block to
+                this list, in time order. Each one is delivered at its frame offset, by splitting the
+                block into smaller chunks where necessary.
+                For an output event endpoint, this holds the events that were emitted during the last block.
+                It's null for other kinds of endpoint.
+            */
+            EndpointEventList* events = nullptr;
+        };
+
+        /** A callback function which services a whole table of endpoints once per block.
+            Value inputs may still be updated with setInputValue() from inside this callback.
+        */
+        using BlockServiceFn = std::function<void (Session&, uint32_t numFrames, ArrayView<ServicedEndpoint>)>;
+
+        /** Attaches a callback which is given the chance to fill all of the given input endpoints
+            in a single call before each block is rendered.
+            This can be used alongside (or instead of) setInputEndpointServiceCallback().
+        */
+        virtual bool setInputBlockServiceCallback (ArrayView<const EndpointID>, BlockServiceFn) = 0;
+
+        /** Attaches a callback which is given the output of all of the given endpoints in a single
+            call after each block has been rendered.
+            This can be used alongside (or instead of) setOutputEndpointServiceCallback().
+        */
+        virtual bool setOutputBlockServiceCallback (ArrayView<const EndpointID>, BlockServiceFn) = 0;
     };
 
     //==============================================================================
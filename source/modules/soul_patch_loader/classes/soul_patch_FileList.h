@@ -45,7 +45,7 @@ struct FileList
     VirtualFile::Ptr root;
     std::string manifestName;
     FileState manifest;
-    std::vector<FileState> sourceFiles, filesToWatch;
+    std::vector<FileState> sourceFiles, externalFiles, filesToWatch;
     choc::value::Value manifestJSON;
 
     void reset()
@@ -53,6 +53,7 @@ struct FileList
         manifest = {};
         manifestJSON = choc::value::Value();
         sourceFiles.clear();
+        externalFiles.clear();
         filesToWatch.clear();
     }
 
@@ -62,6 +63,7 @@ struct FileList
         findManifestFile();
         parseManifest();
         findSourceFiles();
+        findExternalFiles();
         findViewFiles();
     }
 
@@ -142,6 +144,42 @@ struct FileList
         appendVector (filesToWatch, files);
     }
 
+    /** Collects any files named in the manifest's externals, so that changes to them are
+        noticed in the same way as changes to the source. Names which can't be found are
+        skipped here, as they'll be reported when the external gets resolved.
+    */
+    void findExternalFiles()
+    {
+        auto externals = getExternalsList();
+
+        if (! externals.isObject())
+            return;
+
+        std::function<void(const choc::value::ValueView&)> addFiles = [&] (const choc::value::ValueView& value)
+        {
+            if (value.isString())
+            {
+                try
+                {
+                    externalFiles.push_back (checkAndCreateFileState (std::string (value.getString())));
+                }
+                catch (const PatchLoadError&) {}
+            }
+            else if (value.isArray())
+            {
+                for (auto i : value)
+                    addFiles (i);
+            }
+            else if (value.isObject())
+            {
+                value.visitObjectMembers ([&] (const std::string&, const choc::value::ValueView& memberValue) { addFiles (memberValue); });
+            }
+        };
+
+        externals.visitObjectMembers ([&] (const std::string&, const choc::value::ValueView& value) { addFiles (value); });
+        appendVector (filesToWatch, externalFiles);
+    }
+
     void findViewFiles()
     {
         appendVector (filesToWatch, getFileListProperty ("view"));
@@ -89,6 +89,9 @@ struct PatchInstanceImpl final  : public RefCountHelper<PatchInstance, PatchInst
         {
             refreshFileList();
 
+            if (auto spawned = spawnFromLinkedPrototype (config, preprocessor, externalDataProvider, consoleHandler))
+                return spawned;
+
             auto patchImpl = new PatchPlayerImpl (fileList, config, performerFactory->createPerformer());
             patch = PatchPlayer::Ptr (patchImpl);
 
@@ -96,7 +99,8 @@ struct PatchInstanceImpl final  : public RefCountHelper<PatchInstance, PatchInst
             settings.sampleRate = config.sampleRate;
             settings.maxBlockSize = config.maxFramesPerBlock;
 
-            patchImpl->compile (settings, cache, preprocessor, externalDataProvider, consoleHandler);
+            patchImpl->compile (settings, cache, &linkedProgramCache, preprocessor, externalDataProvider, consoleHandler);
+            updateLinkedPrototype (*patchImpl, preprocessor, externalDataProvider);
         }
         catch (const PatchLoadError& e)
         {
@@ -115,10 +119,105 @@ struct PatchInstanceImpl final  : public RefCountHelper<PatchInstance, PatchInst
         return patch.incrementAndGetPointer();
     }
 
+    /** When a player has been successfully compiled without any custom preprocessing or
+        external data, later players with the same configuration can share its compiled code
+        rather than building and linking it all over again.
+
+        This doesn't keep a performer of its own: it keeps a list of the performers belonging
+        to the live players that run the code, and spawns new instances from one of those.
+        Each player holds a registration that takes its performer off the list when the player
+        is deleted, and the instance only holds a weak reference, so this is released along with
+        the last player that uses it. It's also dropped if any of the patch's files, including
+        its externals, have changed.
+    */
+    struct LinkedPrototype
+    {
+        PatchPlayerConfiguration config;
+        FileList fileList;
+        std::vector<CompilationMessage> compileMessages;
+
+        std::mutex lock;
+        std::vector<soul::Performer*> performers;
+
+        std::unique_ptr<soul::Performer> createInstance()
+        {
+            std::lock_guard<std::mutex> l (lock);
+
+            for (auto* p : performers)
+                if (auto instance = p->createInstance())
+                    return instance;
+
+            return {};
+        }
+
+        static void addPlayer (const std::shared_ptr<LinkedPrototype>& prototype, PatchPlayerImpl& player)
+        {
+            auto* performer = player.performer.get();
+
+            {
+                std::lock_guard<std::mutex> l (prototype->lock);
+                prototype->performers.push_back (performer);
+            }
+
+            player.linkedPrototype = std::shared_ptr<void> (performer, [prototype] (void* p)
+            {
+                std::lock_guard<std::mutex> l (prototype->lock);
+                removeFirst (prototype->performers, [p] (soul::Performer* q) { return q == p; });
+            });
+        }
+    };
+
+    PatchPlayer* spawnFromLinkedPrototype (const PatchPlayerConfiguration& config,
+                                           SourceFilePreprocessor* preprocessor,
+                                           ExternalDataProvider* externalDataProvider,
+                                           ConsoleMessageHandler* consoleHandler)
+    {
+        auto prototype = linkedPrototype.lock();
+
+        if (prototype == nullptr || preprocessor != nullptr || externalDataProvider != nullptr)
+            return {};
+
+        if (prototype->config != config || prototype->fileList.hasChanged())
+        {
+            linkedPrototype.reset();
+            return {};
+        }
+
+        auto newPerformer = prototype->createInstance();
+
+        if (newPerformer == nullptr)
+            return {};
+
+        auto patchImpl = new PatchPlayerImpl (fileList, config, std::move (newPerformer));
+        PatchPlayer::Ptr patch (patchImpl);
+        LinkedPrototype::addPlayer (prototype, *patchImpl);
+        patchImpl->initialiseFromLinkedPerformer (prototype->compileMessages, consoleHandler);
+        return patch.incrementAndGetPointer();
+    }
+
+    void updateLinkedPrototype (PatchPlayerImpl& player,
+                                SourceFilePreprocessor* preprocessor,
+                                ExternalDataProvider* externalDataProvider)
+    {
+        linkedPrototype.reset();
+
+        if (preprocessor != nullptr || externalDataProvider != nullptr || ! player.isPlayable())
+            return;
+
+        auto prototype = std::make_shared<LinkedPrototype>();
+        prototype->config = player.config;
+        prototype->fileList = player.fileList;
+        prototype->compileMessages = player.compileMessages;
+        LinkedPrototype::addPlayer (prototype, player);
+        linkedPrototype = prototype;
+    }
+
     std::unique_ptr<soul::PerformerFactory> performerFactory;
     const VirtualFile::Ptr root;
     FileList fileList;
     Description::Ptr description;
+    std::weak_ptr<LinkedPrototype> linkedPrototype;
+    soul::Compiler::LinkedProgramCache linkedProgramCache;
 };
 
 } // namespace soul::patch
@@ -33,6 +33,9 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
 
     ~PatchPlayerImpl()
     {
+        // (this must stop other players being spawned from the performer before it's unloaded)
+        linkedPrototype = {};
+
         if (performer != nullptr)
         {
             performer->unload();
@@ -79,19 +82,21 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
 
     soul::Program compileSources (soul::CompileMessageList& messageList,
                                   const BuildSettings& settings,
-                                  SourceFilePreprocessor* preprocessor)
+                                  SourceFilePreprocessor* preprocessor,
+                                  Compiler::LinkedProgramCache* linkedProgramCache,
+                                  LinkerCache* programCache)
     {
         BuildBundle build;
         addSource (build, preprocessor);
         build.settings = settings;
-        auto program = Compiler::build (messageList, build);
+        auto program = Compiler::build (messageList, build, linkedProgramCache, programCache);
 
        #if JUCE_BELA
         {
             auto wrappedBuild = build;
             wrappedBuild.sourceFiles.push_back ({ "BelaWrapper", soul::patch::BelaWrapper::build (program) });
             wrappedBuild.settings.mainProcessor = "BelaWrapper";
-            program = Compiler::build (messageList, wrappedBuild);
+            program = Compiler::build (messageList, wrappedBuild, linkedProgramCache, programCache);
         }
        #endif
 
@@ -101,6 +106,7 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
     void compile (soul::CompileMessageList& messageList,
                   const BuildSettings& settings,
                   CompilerCache* cache,
+                  Compiler::LinkedProgramCache* linkedProgramCache,
                   SourceFilePreprocessor* preprocessor,
                   ExternalDataProvider* externalDataProvider,
                   ConsoleMessageHandler* consoleHandler)
@@ -114,7 +120,17 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
                 throwPatchLoadError (message.getFullDescription() + "\n" + message.getAnnotatedSourceLine());
         };
 
-        auto program = compileSources (messageList, settings, preprocessor);
+        SOUL_LOG_TIME_OF_SCOPE ("load patch");
+
+        // The external audio files get decoded in the background while the code is being compiled.
+        // A host-supplied ExternalDataProvider could replace any of them, so this is only done without one.
+        ExternalAudioFilePreloader preloader;
+
+        if (externalDataProvider == nullptr)
+            preloadExternalFiles (preloader);
+
+        auto linkerCache = CacheConverter::create (cache);
+        auto program = compileSources (messageList, settings, preprocessor, linkedProgramCache, linkerCache.get());
 
         if (program.isEmpty())
             return messageList.addError ("Empty program", {});
@@ -124,20 +140,40 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
 
         createBuses();
         createRenderOperations (consoleHandler);
-        resolveExternalVariables (externalDataProvider);
 
-        if (! performer->link (messageList, settings, CacheConverter::create (cache).get()))
+        {
+            SOUL_LOG_TIME_OF_SCOPE ("resolve externals");
+            resolveExternalVariables (externalDataProvider, &preloader);
+        }
+
+        if (! performer->link (messageList, settings, linkerCache.get()))
             return messageList.addError ("Failed to link", {});
     }
 
+    /** Prepares a player whose performer was spawned from another player's already-linked
+        performer, so only the buses and render operations need to be built.
+    */
+    void initialiseFromLinkedPerformer (const std::vector<CompilationMessage>& messages,
+                                        ConsoleMessageHandler* consoleHandler)
+    {
+        SOUL_ASSERT (performer != nullptr && performer->isLinked());
+
+        createBuses();
+        createRenderOperations (consoleHandler);
+
+        compileMessages = messages;
+        updateCompileMessageStatus();
+    }
+
     void compile (const BuildSettings& settings,
                   CompilerCache* cache,
+                  Compiler::LinkedProgramCache* linkedProgramCache,
                   SourceFilePreprocessor* preprocessor,
                   ExternalDataProvider* externalDataProvider,
                   ConsoleMessageHandler* consoleHandler)
     {
         soul::CompileMessageList messageList;
-        compile (messageList, settings, cache, preprocessor, externalDataProvider, consoleHandler);
+        compile (messageList, settings, cache, linkedProgramCache, preprocessor, externalDataProvider, consoleHandler);
 
         compileMessages.reserve (messageList.messages.size());
 
@@ -167,14 +203,35 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
             anyErrors = anyErrors || m.isError;
     }
 
-    void resolveExternalVariables (ExternalDataProvider* externalDataProvider)
+    /** Starts decoding any audio files listed in the manifest's externals which aren't
+        already loaded.
+    */
+    void preloadExternalFiles (ExternalAudioFilePreloader& preloader)
+    {
+        // (each job gets its own VirtualFile, as the list's ones are polled for changes on this thread)
+        for (auto& f : fileList.externalFiles)
+        {
+            if (! DecodedAudioFileCache::getInstance().isFileInUse (*f.file))
+            {
+                try
+                {
+                    preloader.preload (fileList.checkAndCreateVirtualFile (f.path));
+                }
+                catch (const PatchLoadError&) {} // any errors will be reported when the external gets resolved
+            }
+        }
+    }
+
+    void resolveExternalVariables (ExternalDataProvider* externalDataProvider, ExternalAudioFilePreloader* preloader)
     {
         for (auto& ev : performer->getExternalVariables())
         {
-            auto value = resolveExternalVariable (externalDataProvider, ev);
+            auto value = resolveExternalVariable (externalDataProvider, preloader, ev);
 
-            if (! value.isVoid())
-                performer->setExternalVariable (ev.name.c_str(), value);
+            // The player doesn't keep its own reference, so the decoded data only stays in
+            // the shared cache for as long as a performer is using it in place
+            if (value != nullptr && ! value->isVoid())
+                performer->shareExternalVariable (ev.name.c_str(), std::move (value));
         }
     }
 
@@ -209,11 +266,15 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
         return choc::value::Value (value);
     }
 
-    choc::value::Value resolveExternalVariable (ExternalDataProvider* externalDataProvider, const ExternalVariable& ev)
+    DecodedAudioFileCache::ValuePtr resolveExternalVariable (ExternalDataProvider* externalDataProvider,
+                                                             ExternalAudioFilePreloader* preloader,
+                                                             const ExternalVariable& ev)
     {
+        auto& audioFileCache = DecodedAudioFileCache::getInstance();
+
         if (externalDataProvider != nullptr)
             if (auto file = externalDataProvider->getExternalFile (ev.name.c_str()))
-                return AudioFileToValue::load (VirtualFile::Ptr (file), ev.annotation);
+                return audioFileCache.load (VirtualFile::Ptr (file), ev.annotation);
 
         auto externals = fileList.getExternalsList();
 
@@ -221,14 +282,21 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
         {
             try
             {
-                return replaceStringsWithFileContent (externals[ev.name],
-                                                      [&] (std::string_view s) -> choc::value::Value
-                                                      {
-                                                          if (auto file = fileList.checkAndCreateVirtualFile (std::string (s)))
-                                                              return AudioFileToValue::load (std::move (file), ev.annotation);
-
-                                                          return choc::value::createString (s);
-                                                      });
+                auto external = externals[ev.name];
+
+                // A single file can be shared as-is, but anything else has to be assembled into a new value
+                if (external.isString())
+                    return audioFileCache.load (fileList.checkAndCreateVirtualFile (std::string (external.getString())), ev.annotation, preloader);
+
+                return std::make_shared<const choc::value::Value> (
+                         replaceStringsWithFileContent (external,
+                                                        [&] (std::string_view s) -> choc::value::Value
+                                                        {
+                                                            if (auto file = fileList.checkAndCreateVirtualFile (std::string (s)))
+                                                                return *audioFileCache.load (std::move (file), ev.annotation, preloader);
+
+                                                            return choc::value::createString (s);
+                                                        }));
             }
             catch (const PatchLoadError& error)
             {
@@ -448,6 +516,13 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
     Span<Parameter::Ptr> parameterSpan = {};
 
     PatchPlayerConfiguration config;
+
+    /** If other players can be spawned from this player's linked code, this keeps alive the
+        record that they're spawned from, and takes this player's performer off its list when
+        it's released.
+    */
+    std::shared_ptr<void> linkedPrototype;
+
     std::unique_ptr<soul::Performer> performer;
     AudioMIDIWrapper wrapper;
 
@@ -63,23 +63,58 @@ struct PatchLoadError
 struct AudioFileToValue
 {
     static choc::value::Value load (VirtualFile::Ptr file, const choc::value::ValueView& annotation)
+    {
+        return convert (*decode (std::move (file)), annotation);
+    }
+
+    /** The raw content of an audio file, before any annotation-specific processing. */
+    struct DecodedData
+    {
+        choc::buffer::ChannelArrayBuffer<float> buffer;
+        double sampleRate = 0;
+    };
+
+    using DecodedDataPtr = std::shared_ptr<const DecodedData>;
+
+    /** Reads the file into memory. This is the slow part of loading, and can be done on any thread. */
+    static DecodedDataPtr decode (VirtualFile::Ptr file)
     {
         SOUL_ASSERT (file != nullptr);
         std::string fileName (file->getAbsolutePath()->getCharPointer());
 
         if (auto reader = createAudioFileReader (file))
-            return loadAudioFileAsValue (*reader, fileName, annotation);
+            return readAudioData (*reader, fileName);
 
         throwPatchLoadError ("Failed to read file " + quoteName (fileName));
         return {};
     }
 
+    /** Applies any resampling or channel extraction that the annotation asks for, and converts the result to a Value. */
+    static choc::value::Value convert (const DecodedData& data, const choc::value::ValueView& annotation)
+    {
+        if (data.sampleRate <= 0 || data.buffer.getNumFrames() == 0)
+            return {};
+
+        auto resampleRate     = annotation["resample"];
+        auto channelToExtract = annotation["sourceChannel"];
+
+        if (resampleRate.isVoid() && channelToExtract.isVoid())
+            return convertToObject (data.buffer, data.sampleRate);
+
+        choc::buffer::ChannelArrayBuffer<float> buffer (data.buffer);
+        resampleAudioDataIfNeeded (buffer, data.sampleRate, resampleRate);
+        extractChannelIfNeeded (buffer, channelToExtract);
+        return convertToObject (buffer, data.sampleRate);
+    }
+
 private:
     static constexpr unsigned int maxNumChannels = 8;
     static constexpr uint64_t maxNumFrames = 48000 * 60;
 
-    static choc::value::Value loadAudioFileAsValue (juce::AudioFormatReader& reader, const std::string& fileName, const choc::value::ValueView& annotation)
+    static DecodedDataPtr readAudioData (juce::AudioFormatReader& reader, const std::string& fileName)
     {
+        auto data = std::make_shared<DecodedData>();
+
         if (reader.sampleRate > 0)
         {
             if (reader.numChannels > maxNumChannels)
@@ -91,24 +126,26 @@ private:
             auto numSourceChannels = (uint32_t) reader.numChannels;
             auto numFrames         = (uint32_t) reader.lengthInSamples;
 
-            if (numFrames == 0)
-                return {};
-
-            choc::buffer::ChannelArrayBuffer<float> buffer (numSourceChannels, numFrames);
-            reader.read (buffer.getView().data.channels, (int) numSourceChannels, 0, (int) numFrames);
+            data->sampleRate = reader.sampleRate;
 
-            resampleAudioDataIfNeeded (buffer, reader.sampleRate, annotation["resample"]);
-            extractChannelIfNeeded (buffer, annotation["sourceChannel"]);
+            if (numFrames != 0)
+            {
+                data->buffer = choc::buffer::ChannelArrayBuffer<float> (numSourceChannels, numFrames);
+                reader.read (data->buffer.getView().data.channels, (int) numSourceChannels, 0, (int) numFrames);
+            }
+        }
 
-            auto result = convertAudioDataToObject (buffer, reader.sampleRate);
+        return data;
+    }
 
-            if (result.isVoid())
-                throwPatchLoadError ("Could not load audio file");
+    static choc::value::Value convertToObject (const choc::buffer::ChannelArrayBuffer<float>& buffer, double sampleRate)
+    {
+        auto result = convertAudioDataToObject (buffer, sampleRate);
 
-            return result;
-        }
+        if (result.isVoid())
+            throwPatchLoadError ("Could not load audio file");
 
-        return {};
+        return result;
     }
 
     static void resampleAudioDataIfNeeded (choc::buffer::ChannelArrayBuffer<float>& buffer,
@@ -175,6 +212,244 @@ private:
     }
 };
 
+//==============================================================================
+/** Decodes a set of audio files in parallel on a pool of background threads, so
+    that they're ready by the time they're needed.
+
+    Any errors are held until getDecodedData() is called for the file that failed,
+    at which point they're re-thrown as a PatchLoadError on the caller's thread.
+*/
+struct ExternalAudioFilePreloader
+{
+    ExternalAudioFilePreloader() = default;
+
+    ~ExternalAudioFilePreloader()
+    {
+        // Any jobs that haven't started are dropped, but we have to wait for the ones in progress
+        if (threadPool != nullptr)
+            threadPool->removeAllJobs (true, -1);
+    }
+
+    /** Starts decoding the given file in the background, if it isn't already being done. */
+    void preload (VirtualFile::Ptr file)
+    {
+        SOUL_ASSERT (file != nullptr);
+        auto path = String::Ptr (file->getAbsolutePath()).toString<std::string>();
+
+        if (pendingFiles.find (path) != pendingFiles.end())
+            return;
+
+        auto result = std::make_shared<std::promise<AudioFileToValue::DecodedDataPtr>>();
+        pendingFiles[path] = result->get_future().share();
+
+        if (threadPool == nullptr)
+            threadPool = std::make_unique<juce::ThreadPool> (juce::jmax (1, juce::jmin (maxNumThreads, juce::SystemStats::getNumCpus())));
+
+        threadPool->addJob ([file, result]
+        {
+            try
+            {
+                result->set_value (AudioFileToValue::decode (file));
+            }
+            catch (...)
+            {
+                result->set_exception (std::current_exception());
+            }
+        });
+    }
+
+    /** Returns the decoded content of a file, waiting for it if it's being preloaded,
+        or decoding it on the calling thread if not.
+    */
+    AudioFileToValue::DecodedDataPtr getDecodedData (VirtualFile::Ptr file)
+    {
+        SOUL_ASSERT (file != nullptr);
+        auto found = pendingFiles.find (String::Ptr (file->getAbsolutePath()).toString<std::string>());
+
+        if (found != pendingFiles.end())
+            return found->second.get();
+
+        return AudioFileToValue::decode (std::move (file));
+    }
+
+private:
+    static constexpr int maxNumThreads = 8;
+
+    std::unordered_map<std::string, std::shared_future<AudioFileToValue::DecodedDataPtr>> pendingFiles;
+    std::unique_ptr<juce::ThreadPool> threadPool;
+};
+
+//==============================================================================
+/** A process-wide cache of decoded audio files, so that players which use the same
+    external files can share a single decoded copy rather than each one reading,
+    resampling and holding its own.
+
+    Items are keyed by the file's path and modification time, plus the annotation
+    properties which affect the decoded result. The cache only holds weak references,
+    and the players hand the data straight to their performers, so an item stays alive
+    for as long as a performer is using it in place (see Performer::shareExternalVariable).
+    With a performer that copies its externals, an item is only shared by the players
+    that are being compiled at the same time.
+    Files with an unknown modification time (e.g. remote ones) are never cached.
+*/
+struct DecodedAudioFileCache
+{
+    using ValuePtr = std::shared_ptr<const choc::value::Value>;
+
+    static DecodedAudioFileCache& getInstance()
+    {
+        static DecodedAudioFileCache instance;
+        return instance;
+    }
+
+    /** Returns the decoded content of a file, either by sharing an existing copy or by
+        decoding it (using the preloader if one is supplied).
+    */
+    ValuePtr load (VirtualFile::Ptr file, const choc::value::ValueView& annotation,
+                   ExternalAudioFilePreloader* preloader = nullptr)
+    {
+        SOUL_ASSERT (file != nullptr);
+        auto key = createKey (*file, annotation);
+
+        if (key.empty())
+            return decode (std::move (file), annotation, preloader);
+
+        {
+            std::lock_guard<std::mutex> l (lock);
+
+            if (auto existing = findLiveItem (key))
+            {
+                ++numHits;
+                return existing;
+            }
+        }
+
+        // Decode outside the lock, so that loading other files isn't held up by this one
+        auto decoded = decode (std::move (file), annotation, preloader);
+
+        std::lock_guard<std::mutex> l (lock);
+
+        // (another thread may have decoded the same file in the meantime)
+        if (auto existing = findLiveItem (key))
+            return existing;
+
+        ++numDecodes;
+        removeExpiredItems();
+        items[key] = { decoded, decoded->getRawDataSize() };
+        return decoded;
+    }
+
+    struct Statistics
+    {
+        uint64_t numItems = 0;      /**< The number of decoded files that are currently in use */
+        uint64_t totalBytes = 0;    /**< The total size of all the decoded data currently in use */
+        uint64_t numHits = 0;       /**< Loads which were able to share an existing decoded file */
+        uint64_t numDecodes = 0;    /**< Loads which had to decode the file */
+    };
+
+    /** Returns true if some version of this file is already held by the cache, in which
+        case there's probably no need to preload it.
+    */
+    bool isFileInUse (VirtualFile& file)
+    {
+        auto prefix = createFilePrefix (file);
+
+        if (prefix.empty())
+            return false;
+
+        std::lock_guard<std::mutex> l (lock);
+
+        for (auto& i : items)
+            if (startsWith (i.first, prefix) && ! i.second.value.expired())
+                return true;
+
+        return false;
+    }
+
+    Statistics getStatistics()
+    {
+        std::lock_guard<std::mutex> l (lock);
+        removeExpiredItems();
+
+        Statistics s;
+        s.numItems = items.size();
+        s.numHits = numHits;
+        s.numDecodes = numDecodes;
+
+        for (auto& i : items)
+            s.totalBytes += i.second.size;
+
+        return s;
+    }
+
+private:
+    struct Item
+    {
+        std::weak_ptr<const choc::value::Value> value;
+        size_t size = 0;
+    };
+
+    std::mutex lock;
+    std::unordered_map<std::string, Item> items;
+    uint64_t numHits = 0, numDecodes = 0;
+
+    static ValuePtr decode (VirtualFile::Ptr file, const choc::value::ValueView& annotation,
+                            ExternalAudioFilePreloader* preloader)
+    {
+        auto data = preloader != nullptr ? preloader->getDecodedData (std::move (file))
+                                         : AudioFileToValue::decode (std::move (file));
+
+        return std::make_shared<const choc::value::Value> (AudioFileToValue::convert (*data, annotation));
+    }
+
+    static std::string createFilePrefix (VirtualFile& file)
+    {
+        auto modificationTime = file.getLastModificationTime();
+
+        if (modificationTime <= 0)
+            return {};
+
+        return String::Ptr (file.getAbsolutePath()).toString<std::string>()
+                + "|" + std::to_string (modificationTime) + "|";
+    }
+
+    static std::string createKey (VirtualFile& file, const choc::value::ValueView& annotation)
+    {
+        auto prefix = createFilePrefix (file);
+
+        if (prefix.empty())
+            return {};
+
+        auto resample      = annotation["resample"];
+        auto sourceChannel = annotation["sourceChannel"];
+
+        return prefix
+                + (resample.isVoid()      ? std::string() : std::to_string (resample.getWithDefault<double> (0)))
+                + "|" + (sourceChannel.isVoid() ? std::string() : std::to_string (sourceChannel.getWithDefault<int64_t> (-1)));
+    }
+
+    ValuePtr findLiveItem (const std::string& key)
+    {
+        auto found = items.find (key);
+
+        if (found != items.end())
+            return found->second.value.lock();
+
+        return {};
+    }
+
+    void removeExpiredItems()
+    {
+        for (auto i = items.begin(); i != items.end();)
+        {
+            if (i->second.value.expired())
+                i = items.erase (i);
+            else
+                ++i;
+        }
+    }
+};
+
 //==============================================================================
 /** Wraps a CompilerCache object and presents it as via the LinkerCache interface */
 struct CacheConverter  : public LinkerCache
@@ -27,8 +27,9 @@ class AudioPlayerVenue   : public soul::Venue,
 {
 public:
     AudioPlayerVenue (Requirements r, std::unique_ptr<PerformerFactory> factory)
-        : audioSystem (std::move (r)),
-          performerFactory (std::move (factory))
+        : audioSystem (r),
+          performerFactory (std::move (factory)),
+          renderAheadBlocks ((uint32_t) std::clamp (r.renderAheadBlocks, 0, (int) RenderPipeline::maxBlocksAhead))
     {
         createDeviceEndpoints (audioSystem.getNumInputChannels(),
                                audioSystem.getNumOutputChannels());
@@ -108,6 +109,21 @@ public:
 
         EndpointHandle getEndpointHandle (const EndpointID& endpointID) override  { return performer->getEndpointHandle (endpointID); }
 
+        uint64_t getStateSize() override
+        {
+            return performer->getStateSize();
+        }
+
+        bool saveState (void* dest, uint64_t destSize) override
+        {
+            return stateTransfer.saveState (*performer, dest, destSize, [this] { return isRendering.load(); });
+        }
+
+        bool loadState (const void* source, uint64_t sourceSize) override
+        {
+            return stateTransfer.loadState (*performer, source, sourceSize, [this] { return isRendering.load(); });
+        }
+
         void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) override
         {
             performer->setNextInputStreamFrames (handle, frameArray);
@@ -167,9 +183,18 @@ public:
             if (state == State::linked)
             {
                 SOUL_ASSERT (performer->isLinked());
+                createRenderPipelineIfNeeded();
+                isRendering = true;
 
                 if (venue.startSession (this))
+                {
                     setState (State::running);
+                }
+                else
+                {
+                    renderPipeline.reset();
+                    isRendering = false;
+                }
             }
 
             return isRunning();
@@ -180,6 +205,8 @@ public:
             if (isRunning())
             {
                 venue.stopSession (this);
+                renderPipeline.reset();
+                isRendering = false;
                 setState (State::linked);
                 totalFramesRendered = 0;
             }
@@ -206,6 +233,12 @@ public:
             s.blockSize = venue.audioSystem.getMaxBlockSize();
             s.xruns = performer->getXRuns();
 
+            if (renderPipeline != nullptr)
+            {
+                s.xruns += renderPipeline->getNumUnderruns();
+                s.latencyFrames = renderPipeline->getLatencyFrames();
+            }
+
             auto deviceXruns = venue.audioSystem.getXRunCount();
 
             if (deviceXruns > 0) // < 0 means not known
@@ -231,20 +264,22 @@ public:
 
         bool setInputEndpointServiceCallback (EndpointID endpoint, EndpointServiceFn callback) override
         {
-            if (! containsEndpoint (performer->getInputEndpoints(), endpoint))
-                return false;
-
-            inputCallbacks.push_back ({ performer->getEndpointHandle (endpoint), std::move (callback) });
-            return true;
+            return serviceTable.addInputCallback (*performer, endpoint, std::move (callback));
         }
 
         bool setOutputEndpointServiceCallback (EndpointID endpoint, EndpointServiceFn callback) override
         {
-            if (! containsEndpoint (performer->getOutputEndpoints(), endpoint))
-                return false;
+            return serviceTable.addOutputCallback (*performer, endpoint, std::move (callback));
+        }
 
-            outputCallbacks.push_back ({ performer->getEndpointHandle (endpoint), std::move (callback) });
-            return true;
+        bool setInputBlockServiceCallback (ArrayView<const EndpointID> endpoints, BlockServiceFn callback) override
+        {
+            return serviceTable.addInputBlockCallback (*performer, endpoints, std::move (callback));
+        }
+
+        bool setOutputBlockServiceCallback (ArrayView<const EndpointID> endpoints, BlockServiceFn callback) override
+        {
+            return serviceTable.addOutputBlockCallback (*performer, endpoints, std::move (callback));
         }
 
         void deviceStopped()
@@ -366,47 +401,76 @@ public:
             }
         }
 
-        void processBlock (AudioMIDIWrapper::RenderContext context)
+        void createRenderPipelineIfNeeded()
         {
-            SOUL_ASSERT (maxBlockSize > 0);
-            auto maxFramesPerBlock = std::min (512u, maxBlockSize);
-            context.totalFramesRendered = totalFramesRendered;
-
-            context.iterateInBlocks (maxFramesPerBlock, [&] (RenderContext& rc)
-            {
-                performer->prepare (rc.inputChannels.getNumFrames());
+            renderPipeline.reset();
 
-                for (auto& op : preRenderOperations)
-                    op (rc);
+            if (venue.renderAheadBlocks == 0)
+                return;
 
-                for (auto& c : inputCallbacks)
-                    c.callback (*this, c.endpointHandle);
+            auto deviceBlockSize = venue.audioSystem.getMaxBlockSize();
 
-                performer->advance();
+            if (deviceBlockSize == 0)
+                deviceBlockSize = maxBlockSize;
 
-                for (auto& op : postRenderOperations)
-                    op (rc);
+            renderPipeline = std::make_unique<RenderPipeline> ((uint32_t) venue.audioSystem.getNumInputChannels(),
+                                                               (uint32_t) venue.audioSystem.getNumOutputChannels(),
+                                                               deviceBlockSize, venue.renderAheadBlocks,
+                                                               [this] (RenderContext& rc) { renderBlock (rc); });
+            renderPipeline->start();
+        }
 
-                for (auto& c : outputCallbacks)
-                    c.callback (*this, c.endpointHandle);
-            });
+        void processBlock (AudioMIDIWrapper::RenderContext context)
+        {
+            if (renderPipeline != nullptr)
+                renderPipeline->process (context);
+            else
+                renderBlock (context);
 
             totalFramesRendered += context.outputChannels.getNumFrames();
         }
 
+        void renderBlock (AudioMIDIWrapper::RenderContext& context)
+        {
+            SOUL_ASSERT (maxBlockSize > 0);
+            auto maxFramesPerBlock = std::min (512u, maxBlockSize);
+
+            if (renderPipeline == nullptr)
+                context.totalFramesRendered = totalFramesRendered;
+
+            stateTransfer.performPendingRequest (*performer);
+
+            context.iterateInBlocks (maxFramesPerBlock, [&] (RenderContext& rc)
+            {
+                serviceTable.renderBlock (*this, *performer, rc.inputChannels.getNumFrames(),
+                                          [&] (uint32_t start, uint32_t numFrames)
+                                          {
+                                              auto chunk = rc.getFrameRange (start, numFrames);
+
+                                              for (auto& op : preRenderOperations)
+                                                  op (chunk);
+                                          },
+                                          [&] (uint32_t start, uint32_t numFrames)
+                                          {
+                                              auto chunk = rc.getFrameRange (start, numFrames);
+
+                                              for (auto& op : postRenderOperations)
+                                                  op (chunk);
+
+                                              rc.midiOutCount = chunk.midiOutCount;
+                                          });
+            });
+        }
+
         AudioPlayerVenue& venue;
         std::unique_ptr<Performer> performer;
+        PerformerStateTransfer stateTransfer;
+        std::atomic<bool> isRendering { false };
         uint32_t maxBlockSize = 0;
         std::atomic<uint64_t> totalFramesRendered { 0 };
         StateChangeCallbackFn stateChangeCallback;
 
-        struct EndpointCallback
-        {
-            EndpointHandle endpointHandle;
-            EndpointServiceFn callback;
-        };
-
-        std::vector<EndpointCallback> inputCallbacks, outputCallbacks;
+        EndpointServiceTable serviceTable;
 
         struct Connection
         {
@@ -418,6 +482,7 @@ public:
         std::vector<Connection> connections;
         std::vector<std::function<void(RenderContext&)>> preRenderOperations;
         std::vector<std::function<void(RenderContext&)>> postRenderOperations;
+        std::unique_ptr<RenderPipeline> renderPipeline;
 
         State state = State::empty;
     };
@@ -450,6 +515,7 @@ private:
     //==============================================================================
     AudioMIDISystem audioSystem;
     std::unique_ptr<PerformerFactory> performerFactory;
+    const uint32_t renderAheadBlocks;
 
     std::vector<EndpointInfo> sourceEndpoints, sinkEndpoints;
 
@@ -0,0 +1,366 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul::audioplayer
+{
+
+//==============================================================================
+/**
+    Moves the rendering of a session onto a high-priority worker thread which runs
+    a fixed number of blocks ahead of the audio device.
+
+    The device callback only pushes its input into a FIFO and pulls previously-rendered
+    frames out of another one, so the render function gets to use a whole device period
+    rather than whatever is left after the device's own overhead. The price is an extra
+    blocksAhead * blockSize frames of latency.
+*/
+struct RenderPipeline  : private juce::Thread
+{
+    using RenderContext = AudioMIDIWrapper::RenderContext;
+    using RenderFn = std::function<void(RenderContext&)>;
+
+    static constexpr uint32_t maxBlocksAhead = 3;
+
+    RenderPipeline (uint32_t numInputChannels, uint32_t numOutputChannels,
+                    uint32_t deviceBlockSize, uint32_t numBlocksAhead, RenderFn renderFn)
+        : juce::Thread ("SOUL render pipeline"),
+          blockSize (deviceBlockSize),
+          blocksAhead (std::min (numBlocksAhead, maxBlocksAhead)),
+          fifoSize ((int) ((blocksAhead + 2) * blockSize)),
+          render (std::move (renderFn)),
+          inputFIFO (fifoSize),
+          outputFIFO (fifoSize),
+          inputFrames (numInputChannels, (uint32_t) fifoSize),
+          outputFrames (numOutputChannels, (uint32_t) fifoSize),
+          blockInput (numInputChannels, blockSize),
+          blockOutput (numOutputChannels, blockSize)
+    {
+        SOUL_ASSERT (blockSize > 0 && blocksAhead > 0 && render != nullptr);
+
+        midiFIFO.reset (midiFIFOSize);
+        blockMIDI.reserve (midiFIFOSize);
+        reset();
+    }
+
+    ~RenderPipeline() override
+    {
+        stop();
+    }
+
+    void start()
+    {
+        stop();
+        reset();
+        startThread (juce::Thread::Priority::highest);
+    }
+
+    void stop()
+    {
+        signalThreadShouldExit();
+        wakeSignal.post();
+        stopThread (-1);
+    }
+
+    /** The extra latency that the pipeline adds between input and output.
+        Sessions report this in Venue::Session::Status::latencyFrames.
+    */
+    uint32_t getLatencyFrames() const         { return blocksAhead * blockSize; }
+
+    /** Returns the number of device callbacks which found that the worker thread hadn't
+        finished rendering the frames that they needed, or which couldn't queue their input.
+    */
+    uint32_t getNumUnderruns() const          { return numUnderruns; }
+
+    /** Called by the audio device: queues the incoming frames and MIDI, and fills the
+        output with frames that were rendered earlier. This never blocks or takes a lock:
+        it wakes the worker thread by posting a semaphore.
+    */
+    void process (RenderContext& context)
+    {
+        bool inputQueued = pushInput (context.inputChannels, context.midiIn, context.midiInCount);
+
+        // Only the frames that were queued move the timeline on, so that the MIDI
+        // timestamps stay in step with the input that the worker actually renders
+        if (inputQueued)
+            deviceFramePosition += context.inputChannels.getNumFrames();
+
+        bool outputReady = popOutput (context.outputChannels);
+
+        // (posted after the output has been read, so that the worker sees the space that frees up too)
+        if (inputQueued)
+            wakeSignal.post();
+
+        if (! (inputQueued && outputReady))
+            ++numUnderruns;
+    }
+
+private:
+    //==============================================================================
+    struct TimedMIDIEvent
+    {
+        uint64_t frame;
+        choc::midi::ShortMessage message;
+    };
+
+    //==============================================================================
+    /** A semaphore which the device callback can post without blocking, so that the
+        worker starts rendering as soon as there's new input, rather than when it next
+        happens to look.
+    */
+    struct WakeSignal
+    {
+        WakeSignal()
+        {
+           #if JUCE_WINDOWS
+            semaphore = CreateSemaphoreW (nullptr, 0, std::numeric_limits<LONG>::max(), nullptr);
+           #elif JUCE_MAC || JUCE_IOS
+            semaphore = dispatch_semaphore_create (0);
+           #else
+            sem_init (std::addressof (semaphore), 0, 0);
+           #endif
+        }
+
+        ~WakeSignal()
+        {
+           #if JUCE_WINDOWS
+            CloseHandle (semaphore);
+           #elif JUCE_MAC || JUCE_IOS
+            dispatch_release (semaphore);
+           #else
+            sem_destroy (std::addressof (semaphore));
+           #endif
+        }
+
+        void post() noexcept
+        {
+           #if JUCE_WINDOWS
+            ReleaseSemaphore (semaphore, 1, nullptr);
+           #elif JUCE_MAC || JUCE_IOS
+            dispatch_semaphore_signal (semaphore);
+           #else
+            sem_post (std::addressof (semaphore));
+           #endif
+        }
+
+        /** Returns when post() has been called, or the timeout has passed. */
+        void wait (int milliseconds) noexcept
+        {
+           #if JUCE_WINDOWS
+            WaitForSingleObject (semaphore, (DWORD) milliseconds);
+           #elif JUCE_MAC || JUCE_IOS
+            dispatch_semaphore_wait (semaphore, dispatch_time (DISPATCH_TIME_NOW, (int64_t) milliseconds * 1000000));
+           #else
+            timespec deadline;
+            clock_gettime (CLOCK_REALTIME, std::addressof (deadline));
+            auto nanoseconds = (int64_t) deadline.tv_nsec + (int64_t) milliseconds * 1000000;
+            deadline.tv_sec += (time_t) (nanoseconds / 1000000000);
+            deadline.tv_nsec = (long) (nanoseconds % 1000000000);
+
+            while (sem_timedwait (std::addressof (semaphore), std::addressof (deadline)) != 0 && errno == EINTR)
+            {}
+           #endif
+        }
+
+    private:
+       #if JUCE_WINDOWS
+        HANDLE semaphore;
+       #elif JUCE_MAC || JUCE_IOS
+        dispatch_semaphore_t semaphore;
+       #else
+        sem_t semaphore;
+       #endif
+
+        JUCE_DECLARE_NON_COPYABLE (WakeSignal)
+    };
+
+    static constexpr uint32_t midiFIFOSize = 1024;
+
+    // The device callback posts the wake signal every time it queues some input, so this
+    // timeout only matters if the device stops calling back
+    static constexpr int idleTimeoutMilliseconds = 100;
+
+    const uint32_t blockSize, blocksAhead;
+    const int fifoSize;
+    RenderFn render;
+
+    juce::AbstractFifo inputFIFO, outputFIFO;
+    choc::buffer::ChannelArrayBuffer<float> inputFrames, outputFrames, blockInput, blockOutput;
+    choc::fifo::SingleReaderSingleWriterFIFO<TimedMIDIEvent> midiFIFO;
+    std::vector<MIDIEvent> blockMIDI;
+    std::optional<TimedMIDIEvent> pendingMIDIEvent;
+
+    WakeSignal wakeSignal;
+    uint64_t deviceFramePosition = 0, renderFramePosition = 0;
+    std::atomic<uint32_t> numUnderruns { 0 };
+
+    //==============================================================================
+    void reset()
+    {
+        inputFIFO.reset();
+        outputFIFO.reset();
+        midiFIFO.reset();
+        pendingMIDIEvent.reset();
+        inputFrames.clear();
+        outputFrames.clear();
+        deviceFramePosition = 0;
+        renderFramePosition = 0;
+        numUnderruns = 0;
+
+        // Pre-fill the output with silence, so that the device reads from the block that
+        // was rendered blocksAhead callbacks ago while the worker is busy on the next one
+        int start1, size1, start2, size2;
+        auto latency = (int) getLatencyFrames();
+        outputFIFO.prepareToWrite (latency, start1, size1, start2, size2);
+        outputFIFO.finishedWrite (size1 + size2);
+    }
+
+    template <typename BufferType, typename Fn>
+    static void visitFIFOSections (BufferType& buffer, int start1, int size1, int start2, int size2, Fn&& fn)
+    {
+        if (size1 > 0)
+            fn (buffer.getFrameRange ({ (uint32_t) start1, (uint32_t) (start1 + size1) }), 0u);
+
+        if (size2 > 0)
+            fn (buffer.getFrameRange ({ (uint32_t) start2, (uint32_t) (start2 + size2) }), (uint32_t) size1);
+    }
+
+    bool pushInput (choc::buffer::ChannelArrayView<const float> input, const MIDIEvent* midiIn, uint32_t midiInCount)
+    {
+        auto numFrames = (int) input.getNumFrames();
+
+        if (inputFIFO.getFreeSpace() < numFrames)
+            return false;
+
+        int start1, size1, start2, size2;
+        inputFIFO.prepareToWrite (numFrames, start1, size1, start2, size2);
+
+        visitFIFOSections (inputFrames, start1, size1, start2, size2, [&] (auto dest, uint32_t sourceOffset)
+        {
+            copyIntersectionAndClearOutside (dest, input.getFrameRange ({ sourceOffset, sourceOffset + dest.getNumFrames() }));
+        });
+
+        inputFIFO.finishedWrite (size1 + size2);
+
+        for (uint32_t i = 0; i < midiInCount; ++i)
+            midiFIFO.push ({ deviceFramePosition + midiIn[i].frameIndex, midiIn[i].message });
+
+        return true;
+    }
+
+    bool popOutput (choc::buffer::ChannelArrayView<float> output)
+    {
+        auto numFrames = (int) output.getNumFrames();
+        auto numAvailable = std::min (numFrames, outputFIFO.getNumReady());
+
+        int start1, size1, start2, size2;
+        outputFIFO.prepareToRead (numAvailable, start1, size1, start2, size2);
+
+        visitFIFOSections (outputFrames, start1, size1, start2, size2, [&] (auto source, uint32_t destOffset)
+        {
+            copyIntersectionAndClearOutside (output.getFrameRange ({ destOffset, destOffset + source.getNumFrames() }), source);
+        });
+
+        outputFIFO.finishedRead (size1 + size2);
+
+        if (numAvailable == numFrames)
+            return true;
+
+        output.getFrameRange ({ (uint32_t) numAvailable, (uint32_t) numFrames }).clear();
+        return false;
+    }
+
+    //==============================================================================
+    void run() override
+    {
+        juce::ScopedNoDenormals disableDenormals;
+
+        while (! threadShouldExit())
+            if (! renderNextBlockIfReady())
+                wakeSignal.wait (idleTimeoutMilliseconds);
+    }
+
+    bool renderNextBlockIfReady()
+    {
+        if (inputFIFO.getNumReady() < (int) blockSize || outputFIFO.getFreeSpace() < (int) blockSize)
+            return false;
+
+        int start1, size1, start2, size2;
+
+        inputFIFO.prepareToRead ((int) blockSize, start1, size1, start2, size2);
+
+        visitFIFOSections (inputFrames, start1, size1, start2, size2, [this] (auto source, uint32_t destOffset)
+        {
+            copy (blockInput.getFrameRange ({ destOffset, destOffset + source.getNumFrames() }), source);
+        });
+
+        inputFIFO.finishedRead (size1 + size2);
+
+        collectMIDIForNextBlock();
+        blockOutput.clear();
+
+        RenderContext context { renderFramePosition, blockInput, blockOutput, blockMIDI.data(), nullptr,
+                                0, static_cast<uint32_t> (blockMIDI.size()), 0, 0 };
+        render (context);
+
+        outputFIFO.prepareToWrite ((int) blockSize, start1, size1, start2, size2);
+
+        visitFIFOSections (outputFrames, start1, size1, start2, size2, [this] (auto dest, uint32_t sourceOffset)
+        {
+            copy (dest, blockOutput.getFrameRange ({ sourceOffset, sourceOffset + dest.getNumFrames() }));
+        });
+
+        outputFIFO.finishedWrite (size1 + size2);
+        renderFramePosition += blockSize;
+        return true;
+    }
+
+    void collectMIDIForNextBlock()
+    {
+        blockMIDI.clear();
+        auto blockEnd = renderFramePosition + blockSize;
+
+        for (;;)
+        {
+            if (! pendingMIDIEvent.has_value())
+            {
+                TimedMIDIEvent e;
+
+                if (! midiFIFO.pop (e))
+                    break;
+
+                pendingMIDIEvent = e;
+            }
+
+            if (pendingMIDIEvent->frame >= blockEnd)
+                break;
+
+            auto frame = pendingMIDIEvent->frame > renderFramePosition ? (uint32_t) (pendingMIDIEvent->frame - renderFramePosition) : 0u;
+
+            if (blockMIDI.size() < midiFIFOSize)
+                blockMIDI.push_back ({ frame, pendingMIDIEvent->message });
+
+            pendingMIDIEvent.reset();
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (RenderPipeline)
+};
+
+}
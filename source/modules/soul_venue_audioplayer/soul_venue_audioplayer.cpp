@@ -35,5 +35,20 @@
 #include <soul_core/soul_core.h>
 #include <juce_audio_devices/juce_audio_devices.h>
 
+// (for the semaphore that the render pipeline uses to wake its worker thread)
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX 1
+ #endif
+ #include <windows.h>
+#elif JUCE_MAC || JUCE_IOS
+ #include <dispatch/dispatch.h>
+#else
+ #include <semaphore.h>
+ #include <cerrno>
+ #include <ctime>
+#endif
+
 #include "audio_player/soul_AudioMIDISystem.h"
+#include "audio_player/soul_RenderPipeline.h"
 #include "audio_player/soul_AudioPlayer.cpp"
@@ -51,6 +51,16 @@ namespace soul::audioplayer
         int numInputChannels = 2;
         int numOutputChannels = 2;
 
+        /** If this is greater than zero (up to a maximum of 3), each session renders on a
+            high-priority worker thread which runs this many device blocks ahead of the audio
+            callback, adding that many blocks of latency. The callback then only needs to copy
+            out frames that are already rendered, and any blocks that the worker fails to
+            finish in time are reported as xruns in the session status, which also
+            reports the added latency.
+            Leave it at zero to render synchronously inside the device callback.
+        */
+        int renderAheadBlocks = 0;
+
         /** The caller can provide a lambda here to handle log messages about audio
             and MIDI devices being opened and closed.
         */
@@ -0,0 +1,164 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+    Tests for the default MultiLanePerformer. This is a standalone program, which can be
+    built on its own, e.g.
+
+        c++ -std=c++17 -I source/modules source/tests/soul_MultiLanePerformerTests.cpp -lpthread -ldl
+
+    and returns a non-zero exit code if anything fails.
+*/
+
+#include <soul_core/soul_core.cpp>
+#include "soul_TestPerformer.h"
+
+namespace soul::test
+{
+
+static bool checkLanesRenderIndependently (bool canCreateInstances)
+{
+    constexpr uint32_t numLanes = 4, blockSize = 16, numBlocks = 3;
+    auto context = std::string (canCreateInstances ? "shared lanes: " : "separately linked lanes: ");
+
+    TestPerformerFactory factory (canCreateInstances);
+    auto performer = factory.createMultiLanePerformer (numLanes);
+    CompileMessageList messages;
+
+    if (! expect (performer->getNumLanes() == numLanes, context + "getNumLanes")
+         || ! expect (performer->load (messages, createTestProgram()), context + "load"))
+        return false;
+
+    std::vector<EndpointHandle> ins, eventIns, outs, eventOuts;
+
+    for (uint32_t lane = 0; lane < numLanes; ++lane)
+    {
+        ins.push_back (performer->getLaneEndpointHandle (lane, EndpointID::create ("in")));
+        eventIns.push_back (performer->getLaneEndpointHandle (lane, EndpointID::create ("eventIn")));
+        outs.push_back (performer->getLaneEndpointHandle (lane, EndpointID::create ("out")));
+        eventOuts.push_back (performer->getLaneEndpointHandle (lane, EndpointID::create ("eventOut")));
+    }
+
+    if (! expect (! performer->getLaneEndpointHandle (numLanes, EndpointID::create ("in")), context + "out-of-range lane")
+         || ! expect (performer->getEndpointHandle (EndpointID::create ("in")) == ins.front(), context + "lane 0 handle"))
+        return false;
+
+    BuildSettings settings;
+    settings.maxBlockSize = blockSize;
+
+    if (! expect (performer->link (messages, settings, nullptr), context + "link"))
+        return false;
+
+    // Only lane 0 should come from the factory unless the lanes have to be linked separately
+    if (! expect (factory.numPerformersCreated == (canCreateInstances ? 1 : (int) numLanes), context + "number of performers created"))
+        return false;
+
+    // Give each lane a different state, so that the outputs show which lane produced them
+    std::vector<float> counters;
+
+    for (uint32_t lane = 0; lane < numLanes; ++lane)
+        counters.push_back ((float) (lane * 10));
+
+    if (! expect (performer->getStateSize() == numLanes * sizeof (float), context + "getStateSize")
+         || ! expect (performer->loadState (counters.data(), counters.size() * sizeof (float)), context + "loadState"))
+        return false;
+
+    auto inputFrames = choc::value::Value (choc::value::Type::createArray (choc::value::Type::createFloat32(), blockSize));
+
+    for (uint32_t block = 0; block < numBlocks; ++block)
+    {
+        performer->prepare (blockSize);
+
+        for (uint32_t lane = 0; lane < numLanes; ++lane)
+        {
+            for (uint32_t i = 0; i < blockSize; ++i)
+                inputFrames.getViewReference()[i].set ((float) (lane * 1000 + i));
+
+            performer->setNextInputStreamFrames (ins[lane], inputFrames);
+            performer->addInputEvent (eventIns[lane], choc::value::createInt32 ((int32_t) (lane * 100)));
+        }
+
+        performer->advance();
+
+        for (uint32_t lane = 0; lane < numLanes; ++lane)
+        {
+            auto expectedCounter = counters[lane] + (float) block;
+            auto frames = performer->getOutputStreamFrames (outs[lane]);
+
+            if (! expect (frames.size() == blockSize, context + "output block size"))
+                return false;
+
+            for (uint32_t i = 0; i < blockSize; ++i)
+                if (! expect (frames[i].getFloat32() == (float) (lane * 1000 + i) + expectedCounter,
+                              context + "stream output of lane " + std::to_string (lane)))
+                    return false;
+
+            std::vector<int32_t> events;
+
+            performer->iterateOutputEvents (eventOuts[lane], [&] (uint32_t, const choc::value::ValueView& e) -> bool
+            {
+                events.push_back (e.getInt32());
+                return true;
+            });
+
+            if (! expect (events.size() == 1 && events.front() == (int32_t) (lane * 100) + (int32_t) expectedCounter,
+                          context + "event output of lane " + std::to_string (lane)))
+                return false;
+        }
+    }
+
+    // Each lane's state should have moved on by one for every block
+    std::vector<float> saved (numLanes);
+
+    if (! expect (performer->saveState (saved.data(), saved.size() * sizeof (float)), context + "saveState"))
+        return false;
+
+    for (uint32_t lane = 0; lane < numLanes; ++lane)
+        if (! expect (saved[lane] == counters[lane] + (float) numBlocks, context + "saved state of lane " + std::to_string (lane)))
+            return false;
+
+    // An instance should have the same number of lanes, starting from a fresh state
+    if (canCreateInstances)
+    {
+        auto instance = performer->createInstance();
+
+        if (! expect (instance != nullptr && instance->getStateSize() == performer->getStateSize(), context + "createInstance"))
+            return false;
+
+        std::vector<float> instanceState (numLanes);
+        instance->saveState (instanceState.data(), instanceState.size() * sizeof (float));
+
+        if (! expect (instanceState == std::vector<float> (numLanes, 0.0f), context + "instance state"))
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace soul::test
+
+int main()
+{
+    bool ok = soul::test::checkLanesRenderIndependently (true)
+               && soul::test::checkLanesRenderIndependently (false);
+
+    std::cout << (ok ? "All MultiLanePerformer tests passed" : "MultiLanePerformer tests FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+    Builds each of the example patches at every optimisation level, and checks that the
+    result is valid HEART, that levels 1 and 2 never make a program bigger than the level
+    below them, and that level 3 stays within its growth limit. This is a standalone
+    program, which can be built on its own, e.g.
+
+        c++ -std=c++17 -I source/modules source/tests/soul_OptimisationPipelineTests.cpp -lpthread -ldl
+
+    and returns a non-zero exit code if anything fails.
+*/
+
+#include <soul_core/soul_core.cpp>
+#include "soul_TestPerformer.h"
+#include <fstream>
+#include <sstream>
+
+namespace soul::test
+{
+
+static std::string getExamplePatchFolder()
+{
+    std::string path (__FILE__);
+    return path.substr (0, path.find_last_of ("/\\") + 1) + "../../examples/patches/";
+}
+
+static Program buildAtLevel (const std::vector<std::string>& files, int level, std::string& error)
+{
+    BuildBundle bundle;
+    bundle.settings.optimisationLevel = level;
+    bundle.settings.sampleRate = 44100;
+    bundle.settings.maxBlockSize = 512;
+
+    for (auto& file : files)
+    {
+        std::ifstream in (getExamplePatchFolder() + file);
+
+        if (! in)
+        {
+            error = "couldn't read " + file;
+            return {};
+        }
+
+        std::stringstream content;
+        content << in.rdbuf();
+        bundle.sourceFiles.push_back ({ file, content.str() });
+    }
+
+    CompileMessageList messages;
+    auto program = Compiler::build (messages, bundle);
+
+    if (messages.hasErrors())
+    {
+        error = messages.toString();
+        return {};
+    }
+
+    Program::createFromHEART (messages, CodeLocation::createFromString ("HEART", program.toHEART()));
+
+    if (messages.hasErrors())
+    {
+        error = "HEART round-trip: " + messages.toString();
+        return {};
+    }
+
+    return program;
+}
+
+static bool checkLevelsOnPatch (const std::vector<std::string>& files)
+{
+    std::vector<size_t> statements;
+
+    for (int level = 0; level <= OptimisationPipeline::maxOptimisationLevel; ++level)
+    {
+        auto context = files.front() + " at level " + std::to_string (level);
+        std::string error;
+        auto program = buildAtLevel (files, level, error);
+
+        if (! expect (! program.isEmpty(), context + ": " + error))
+            return false;
+
+        statements.push_back (OptimisationPipeline::ProgramSize::measure (program).statements);
+    }
+
+    for (int level = 1; level <= OptimisationPipeline::defaultOptimisationLevel; ++level)
+        if (! expect (statements[(size_t) level] <= statements[(size_t) level - 1],
+                      files.front() + ": level " + std::to_string (level) + " shouldn't be bigger than the level below it"))
+            return false;
+
+    auto level2 = statements[(size_t) OptimisationPipeline::defaultOptimisationLevel];
+
+    return expect (statements.back() <= level2 + level2 * OptimisationPipeline::maxGrowthPercent / 100,
+                   files.front() + ": level 3 should stay within its growth limit");
+}
+
+} // namespace soul::test
+
+int main()
+{
+    const std::vector<std::vector<std::string>> patches =
+    {
+        { "ClassicRingtone/ClassicRingtone.soul" },
+        { "Delay/Delay.soul" },
+        { "DiodeClipper/DiodeClipper.soul" },
+        { "MinimumViablePiano/MinimumViablePiano.soul" },
+        { "PadSynth/PadSynth.soul" },
+        { "Reverb/Reverb.soul" },
+        { "SOUL909/SOUL909.soul" },
+        { "SineSynth/SineSynth.soul" },
+        { "clarinetMIDI/clarinetMIDI.soul" },
+        { "TX/ElecBass1/ElecBass1.soul",       "TX/ElecBass1/TX81Z.soul" },
+        { "TX/ElectroPiano/ElectroPiano.soul", "TX/ElectroPiano/TX81Z.soul" },
+        { "TX/LatelyBass/LatelyBass.soul",     "TX/LatelyBass/TX81Z.soul" }
+    };
+
+    bool ok = true;
+
+    for (auto& files : patches)
+        ok = soul::test::checkLevelsOnPatch (files) && ok;
+
+    std::cout << (ok ? "All optimisation pipeline tests passed" : "Optimisation pipeline tests FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
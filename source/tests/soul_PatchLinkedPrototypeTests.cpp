@@ -0,0 +1,148 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+
+/*
+    Tests that a PatchInstance's linked prototype is only shared while it's still valid,
+    and is released when the players that use it have gone.
+
+    This needs JUCE, so it's built by the SOULPatchLoaderTests.jucer console app project
+    in this folder, and returns a non-zero exit code if anything fails.
+*/
+
+#include <JuceHeader.h>
+#include "soul_TestPerformer.h"
+
+namespace soul::test
+{
+
+static void writeTestAudioFile (const juce::File& file, float level)
+{
+    file.deleteFile();
+
+    juce::AudioBuffer<float> buffer (1, 64);
+
+    for (int i = 0; i < buffer.getNumSamples(); ++i)
+        buffer.setSample (0, i, level);
+
+    if (auto out = std::unique_ptr<juce::FileOutputStream> (file.createOutputStream()))
+    {
+        juce::WavAudioFormat wav;
+
+        if (auto writer = std::unique_ptr<juce::AudioFormatWriter> (wav.createWriterFor (out.get(), 44100.0, 1, 16, {}, 0)))
+        {
+            out.release(); // (the writer owns the stream now)
+            writer->writeFromAudioSampleBuffer (buffer, 0, buffer.getNumSamples());
+        }
+    }
+}
+
+static bool checkLinkedPrototypeIsRebuiltAndReleased()
+{
+    auto folder = juce::File::createTempFile ("soul_prototype_test");
+    folder.createDirectory();
+
+    auto manifest = folder.getChildFile ("Test.soulpatch");
+    auto source   = folder.getChildFile ("Test.soul");
+    auto sample   = folder.getChildFile ("sample.wav");
+
+    manifest.replaceWithText (R"({ "soulPatchV1": { "ID": "dev.soul.test", "version": "1.0", "name": "Test",
+                                                    "source": "Test.soul", "externals": { "Test::sample": "sample.wav" } } })");
+    source.replaceWithText ("processor Test { output stream float out; void run() { loop { out << 0.0f; advance(); } } }");
+    writeTestAudioFile (sample, 0.5f);
+
+    auto factory = std::make_unique<TestPerformerFactory>();
+    auto& numPerformersCreated = factory->numPerformersCreated;
+    auto instance = patch::PatchInstance::Ptr (patch::createPatchInstance (std::move (factory), manifest.getFullPathName().toRawUTF8()));
+
+    if (! expect (instance != nullptr, "createPatchInstance"))
+        return false;
+
+    patch::PatchPlayerConfiguration config;
+    config.sampleRate = 44100;
+    config.maxFramesPerBlock = 512;
+
+    auto compile = [&]
+    {
+        auto player = patch::PatchPlayer::Ptr (instance->compileNewPlayer (config, nullptr, nullptr, nullptr, nullptr));
+        expect (player != nullptr && player->isPlayable(), "compileNewPlayer");
+        return player;
+    };
+
+    bool ok = [&]
+    {
+        auto first = compile();
+
+        if (! expect (numPerformersCreated == 1, "the first player should be built from scratch"))
+            return false;
+
+        auto second = compile();
+
+        if (! expect (numPerformersCreated == 1, "an unchanged patch should share the linked prototype"))
+            return false;
+
+        // The code stays shared after the player that built it has gone
+        first = {};
+        first = compile();
+
+        if (! expect (numPerformersCreated == 1, "the prototype should outlive the player that built it"))
+            return false;
+
+        // Changing an external file must stop later players from sharing the old prototype
+        writeTestAudioFile (sample, 0.25f);
+        sample.setLastModificationTime (juce::Time::getCurrentTime() + juce::RelativeTime::seconds (10));
+
+        if (! expect (second->needsRebuilding (config), "a player should need rebuilding when an external has changed"))
+            return false;
+
+        auto third = compile();
+
+        if (! expect (numPerformersCreated == 2, "the prototype should be rebuilt when an external has changed"))
+            return false;
+
+        auto fourth = compile();
+
+        if (! expect (numPerformersCreated == 2, "the rebuilt prototype should be shared"))
+            return false;
+
+        // Once all the players have gone, so should the prototype, so the next one is built from scratch
+        first = {};
+        second = {};
+        third = {};
+        fourth = {};
+
+        auto fifth = compile();
+        return expect (numPerformersCreated == 3, "the prototype should be released along with the last player");
+    }();
+
+    instance = {};
+    folder.deleteRecursively();
+    return ok;
+}
+
+} // namespace soul::test
+
+int main()
+{
+    bool ok = soul::test::checkLinkedPrototypeIsRebuiltAndReleased();
+
+    std::cout << (ok ? "All linked prototype tests passed" : "Linked prototype tests FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <iostream>
+
+namespace soul::test
+{
+
+//==============================================================================
+/** Reports a failed check, and returns the condition so that callers can bail out. */
+inline bool expect (bool condition, const std::string& description)
+{
+    if (! condition)
+        std::cerr << "FAILED: " << description << std::endl;
+
+    return condition;
+}
+
+//==============================================================================
+/**
+    A stand-in for a real performer, which lets the venue and performer plumbing be
+    tested without a code generator.
+
+    It doesn't run the program it's given: its single float input stream "in" is copied
+    to the output stream "out" with a per-instance counter added to each frame, and the
+    counter goes up by one after every block. Each event on the int "eventIn" endpoint
+    is echoed on "eventOut" at the same frame offset, with the counter added to it.
+    The counter is the performer's whole state.
+*/
+struct TestPerformer  : public Performer
+{
+    /** If canCreateInstances is false, createInstance() uses the default implementation
+        (i.e. returns nullptr) so that callers have to take their fallback path.
+    */
+    TestPerformer (bool canCreateInstances = true)  : canShare (canCreateInstances)
+    {
+        inputs.push_back ({ EndpointID::create ("in"), "in", EndpointType::stream, { PrimitiveType::float32 }, {} });
+        inputs.push_back ({ EndpointID::create ("eventIn"), "eventIn", EndpointType::event, { PrimitiveType::int32 }, {} });
+        outputs.push_back ({ EndpointID::create ("out"), "out", EndpointType::stream, { PrimitiveType::float32 }, {} });
+        outputs.push_back ({ EndpointID::create ("eventOut"), "eventOut", EndpointType::event, { PrimitiveType::int32 }, {} });
+    }
+
+    enum Handles : uint32_t { inHandle = 1, eventInHandle, outHandle, eventOutHandle };
+
+    bool load (CompileMessageList&, const Program& p) noexcept override     { loaded = ! p.isEmpty(); return loaded; }
+    void unload() noexcept override                                         { loaded = linked = false; }
+
+    ArrayView<const EndpointDetails> getInputEndpoints() noexcept override      { return inputs; }
+    ArrayView<const EndpointDetails> getOutputEndpoints() noexcept override     { return outputs; }
+    ArrayView<const ExternalVariable> getExternalVariables() noexcept override  { return {}; }
+
+    bool setExternalVariable (const char*, const choc::value::ValueView&) noexcept override  { return false; }
+
+    bool link (CompileMessageList&, const BuildSettings& settings, LinkerCache*) noexcept override
+    {
+        if (! loaded)
+            return false;
+
+        blockSize = settings.maxBlockSize;
+        linked = true;
+        return true;
+    }
+
+    bool isLoaded() noexcept override       { return loaded; }
+    bool isLinked() noexcept override       { return linked; }
+    void reset() noexcept override          { counter = 0; }
+
+    std::unique_ptr<Performer> createInstance() noexcept override
+    {
+        if (! (linked && canShare))
+            return {};
+
+        auto instance = std::make_unique<TestPerformer> (canShare);
+        instance->loaded = instance->linked = true;
+        instance->blockSize = blockSize;
+        return instance;
+    }
+
+    uint64_t getStateSize() noexcept override   { return linked ? sizeof (counter) : 0; }
+
+    bool saveState (void* dest, uint64_t destSize) noexcept override
+    {
+        if (destSize < getStateSize())
+            return false;
+
+        std::memcpy (dest, std::addressof (counter), sizeof (counter));
+        return true;
+    }
+
+    bool loadState (const void* source, uint64_t sourceSize) noexcept override
+    {
+        if (sourceSize != getStateSize())
+            return false;
+
+        std::memcpy (std::addressof (counter), source, sizeof (counter));
+        return true;
+    }
+
+    EndpointHandle getEndpointHandle (const EndpointID& endpointID) noexcept override
+    {
+        auto& name = endpointID.toString();
+
+        if (name == "in")        return EndpointHandle::create (inHandle);
+        if (name == "eventIn")   return EndpointHandle::create (eventInHandle);
+        if (name == "out")       return EndpointHandle::create (outHandle);
+        if (name == "eventOut")  return EndpointHandle::create (eventOutHandle);
+
+        return {};
+    }
+
+    void prepare (uint32_t numFramesToBeRendered) noexcept override
+    {
+        numFrames = numFramesToBeRendered;
+        inputFrames.assign (numFrames, 0.0f);
+        inputEvents.clear();
+    }
+
+    void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) noexcept override
+    {
+        if (handle.getRawHandle() == inHandle)
+            for (uint32_t i = 0; i < numFrames && i < frameArray.size(); ++i)
+                inputFrames[i] = frameArray[i].getFloat32();
+    }
+
+    void setSparseInputStreamTarget (EndpointHandle, const choc::value::ValueView&, uint32_t, float) noexcept override {}
+    void setInputValue (EndpointHandle, const choc::value::ValueView&) noexcept override {}
+
+    void addInputEvent (EndpointHandle handle, const choc::value::ValueView& eventData) noexcept override
+    {
+        if (handle.getRawHandle() == eventInHandle)
+            inputEvents.push_back ({ 0, eventData.getInt32() });
+    }
+
+    choc::value::ValueView getOutputStreamFrames (EndpointHandle handle) noexcept override
+    {
+        if (handle.getRawHandle() != outHandle)
+            return {};
+
+        return choc::value::ValueView (choc::value::Type::createArray (choc::value::Type::createFloat32(), numFrames),
+                                       outputFrames.data(), nullptr);
+    }
+
+    choc::value::ValueView getOutputValue (EndpointHandle) noexcept override    { return {}; }
+
+    void iterateOutputEvents (EndpointHandle handle, HandleNextOutputEventFn fn) noexcept override
+    {
+        if (handle.getRawHandle() == eventOutHandle)
+        {
+            for (auto& e : outputEvents)
+            {
+                auto value = choc::value::createInt32 (e.value);
+
+                if (! fn (e.frameOffset, value.getView()))
+                    break;
+            }
+        }
+    }
+
+    void advance() noexcept override
+    {
+        outputFrames.resize (numFrames);
+
+        for (uint32_t i = 0; i < numFrames; ++i)
+            outputFrames[i] = inputFrames[i] + counter;
+
+        outputEvents.clear();
+
+        for (auto& e : inputEvents)
+            outputEvents.push_back ({ e.frameOffset, e.value + (int32_t) counter });
+
+        counter += 1.0f;
+    }
+
+    bool isEndpointActive (const EndpointID&) noexcept override     { return true; }
+    uint32_t getXRuns() noexcept override                           { return 0; }
+    uint32_t getBlockSize() noexcept override                       { return blockSize; }
+    bool hasError() noexcept override                               { return false; }
+    const char* getError() noexcept override                        { return nullptr; }
+
+    struct Event
+    {
+        uint32_t frameOffset;
+        int32_t value;
+    };
+
+    std::vector<EndpointDetails> inputs, outputs;
+    std::vector<float> inputFrames, outputFrames;
+    std::vector<Event> inputEvents, outputEvents;
+    float counter = 0;
+    uint32_t numFrames = 0, blockSize = 0;
+    bool loaded = false, linked = false;
+    const bool canShare;
+};
+
+//==============================================================================
+struct TestPerformerFactory  : public PerformerFactory
+{
+    TestPerformerFactory (bool canCreateInstances = true)  : canShare (canCreateInstances) {}
+
+    std::unique_ptr<Performer> createPerformer() override
+    {
+        ++numPerformersCreated;
+        return std::make_unique<TestPerformer> (canShare);
+    }
+
+    const bool canShare;
+    int numPerformersCreated = 0;
+};
+
+//==============================================================================
+/** Builds a trivial program, as the venues and performers refuse to load an empty one. */
+inline Program createTestProgram()
+{
+    CompileMessageList messages;
+    BuildBundle bundle;
+    bundle.settings.sampleRate = 44100;
+    bundle.settings.maxBlockSize = 512;
+    bundle.sourceFiles.push_back ({ "test.soul", "processor Test { output stream float out; void run() { loop { out << 0.0f; advance(); } } }" });
+
+    auto program = Compiler::build (messages, bundle);
+    expect (! program.isEmpty(), "building the test program: " + messages.toString());
+    return program;
+}
+
+} // namespace soul::test